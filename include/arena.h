@@ -0,0 +1,97 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Handle 0 is reserved so a zeroed slot means "no record"
+#define ARENA_NULL 0u
+
+struct Epoch;
+
+/*
+ * Fixed-size record pool carved out of large slabs.
+ * Records are addressed by 32-bit handles instead of pointers: the high bits
+ * pick the slab, the low `slab_shift` bits pick the record inside it.
+ * Slabs never move once allocated, so a pointer obtained from
+ * slab_pool_get() stays valid until the whole pool is released. A grown
+ * directory is published with a release store and the old one retired
+ * through `epoch`, so readers may resolve handles while the pool grows.
+ */
+typedef struct {
+  size_t elem_size;     // bytes per record
+  uint32_t slab_shift;  // log2(records per slab)
+  uint32_t next_handle; // next record to hand out
+  uint32_t free_list;   // recycled records, linked through their first word
+  char **slabs;         // slab directory
+  uint32_t slab_count;
+  uint32_t slab_capacity;
+  bool borrowed; // slabs point into memory the pool does not own (a mapping)
+  struct Epoch *epoch; // retires old directories, NULL frees them at once
+} slab_pool_t;
+
+int slab_pool_init(slab_pool_t *pool, size_t elem_size, uint32_t slab_shift);
+uint32_t slab_shift_for(size_t elem_size, size_t slab_bytes);
+uint32_t slab_pool_alloc(slab_pool_t *pool);
+void slab_pool_free(slab_pool_t *pool, uint32_t handle);
+void slab_pool_release(slab_pool_t *pool);
+void slab_pool_reset(slab_pool_t *pool);
+size_t slab_pool_bytes(const slab_pool_t *pool);
+int slab_pool_write(const slab_pool_t *pool, FILE *fp);
+int slab_pool_attach(slab_pool_t *pool, void *image, size_t elem_size,
+                     uint32_t slab_shift, uint32_t count, bool copy);
+
+// Records in use including the reserved slot 0 (0 while no slab exists)
+static inline uint32_t slab_pool_count(const slab_pool_t *pool) {
+  return pool->slab_count ? pool->next_handle : 0;
+}
+
+// Resolve a handle into a pointer (no bounds checking on the hot path)
+static inline void *slab_pool_get(const slab_pool_t *pool, uint32_t handle) {
+  uint32_t mask = (1u << pool->slab_shift) - 1;
+  char **slabs = __atomic_load_n(&pool->slabs, __ATOMIC_ACQUIRE);
+  return slabs[handle >> pool->slab_shift] +
+         (size_t)(handle & mask) * pool->elem_size;
+}
+
+/*
+ * Variable-size byte arena for posting blocks. Space is handed out in
+ * 8-byte units from 1 MB slabs; the handle is the unit index, so a block
+ * never straddles two slabs and 32 bits address up to 32 GB.
+ */
+#define BYTE_ARENA_UNIT 8
+#define BYTE_ARENA_SLAB_SHIFT 17
+
+typedef struct {
+  char **slabs;
+  uint32_t slab_count;
+  uint32_t slab_capacity;
+  uint32_t next_unit; // next free unit (global, so it doubles as the handle)
+  bool borrowed;
+  struct Epoch *epoch; // as in slab_pool_t
+} byte_arena_t;
+
+void byte_arena_init(byte_arena_t *arena);
+uint32_t byte_arena_alloc(byte_arena_t *arena, size_t bytes);
+void byte_arena_release(byte_arena_t *arena);
+void byte_arena_reset(byte_arena_t *arena);
+size_t byte_arena_bytes(const byte_arena_t *arena);
+int byte_arena_write(const byte_arena_t *arena, FILE *fp);
+int byte_arena_attach(byte_arena_t *arena, void *image, uint32_t units,
+                      bool copy);
+
+static inline uint32_t byte_arena_units(const byte_arena_t *arena) {
+  return arena->slab_count ? arena->next_unit : 0;
+}
+
+static inline void *byte_arena_get(const byte_arena_t *arena,
+                                   uint32_t handle) {
+  uint32_t mask = (1u << BYTE_ARENA_SLAB_SHIFT) - 1;
+  char **slabs = __atomic_load_n(&arena->slabs, __ATOMIC_ACQUIRE);
+  return slabs[handle >> BYTE_ARENA_SLAB_SHIFT] +
+         (size_t)(handle & mask) * BYTE_ARENA_UNIT;
+}
+
+#endif // !ARENA_H
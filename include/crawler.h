@@ -2,7 +2,29 @@
 #define CRAWLER_H
 #include "toolkit_core.h"
 
+// Files handed to the engine and the callback at a time
+#define CRAWL_DEFAULT_BATCH 256
+
+// Queued directories that keep their descriptor open; the rest are
+// reopened by path when a worker gets to them
+#define CRAWL_MAX_OPEN_DIRS 256
+
+// Receives `count` new paths; paths[i] was registered as first_doc_id + i
+typedef void (*crawl_batch_fn)(const char *const *paths, int count,
+                               int first_doc_id, void *user_data);
+
+typedef struct {
+  int workers;                    // <= 0: one per online CPU
+  const char *const *include_ext; // NULL terminated, NULL means {"pdf"}
+  const char *const *exclude_ext; // NULL terminated, may be NULL
+  int batch_size;                 // <= 0: CRAWL_DEFAULT_BATCH
+  crawl_batch_fn on_batch;        // may be NULL
+  void *user_data;
+} crawl_options_t;
+
 int crawl_directory(const char *path, search_engine_t *engine,
                     void (*callback)(const char *));
+int crawl_directory_parallel(const char *path, search_engine_t *engine,
+                             const crawl_options_t *options);
 
 #endif // !CRAWLER_H
@@ -0,0 +1,18 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli, reflected polynomial 0x82F63B78), the checksum
+ * of index file sections. The SSE4.2 crc32 instruction computes it when
+ * the build targets it, slicing-by-8 tables otherwise. Chained calls
+ * checksum data that arrives in pieces:
+ *   crc32c(crc32c(0, a, n), b, m) == crc32c(0, a ++ b, n + m)
+ */
+#define CRC32C_POLY 0x82F63B78u
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t n);
+
+#endif // !CRC32C_H
@@ -0,0 +1,65 @@
+#ifndef DOC_TABLE_H
+#define DOC_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Paths per front-coded block: random access decodes at most this many
+#define DOC_TABLE_BLOCK 16
+// Longest path the table takes, its NUL included (PATH_MAX on Linux)
+#define DOC_TABLE_MAX_PATH 4096
+
+/*
+ * Document paths front-coded in one byte arena. Path i is entry
+ * i % DOC_TABLE_BLOCK of block i / DOC_TABLE_BLOCK; the first entry of a
+ * block is stored whole (varint length, bytes), the others as the varint
+ * length they share with the path before them, the varint length of the
+ * rest, and the rest. Paths under one directory cost little more than
+ * their file names.
+ */
+typedef struct {
+  uint8_t *bytes;  // blocks back to back
+  uint64_t size;
+  uint64_t capacity;
+  uint64_t *blocks; // start of each block in bytes
+  uint64_t block_capacity;
+  int count;
+  bool mapped; // bytes and blocks point into a read-only file mapping
+
+  // Appends front-code against the previous path
+  char *last;
+  size_t last_len;
+} doc_table_t;
+
+// Section layout: this header, uint64 blocks[block_count], then bytes[size]
+typedef struct {
+  uint64_t count;
+  uint32_t block_paths; // DOC_TABLE_BLOCK when written
+  uint32_t reserved;
+  uint64_t block_count;
+  uint64_t size;
+} doc_table_header_t;
+
+// Sequential decoding, one entry at a time
+typedef struct {
+  const doc_table_t *table;
+  int next;
+  const uint8_t *pos;
+  char path[DOC_TABLE_MAX_PATH];
+  size_t len;
+} doc_table_iter_t;
+
+int doc_table_append(doc_table_t *table, const char *path);
+int doc_table_reserve(doc_table_t *table, int extra);
+long doc_table_get(const doc_table_t *table, int id, char *out,
+                   size_t out_size);
+void doc_table_iter(const doc_table_t *table, doc_table_iter_t *it);
+const char *doc_table_next(doc_table_iter_t *it);
+int doc_table_write(const doc_table_t *table, FILE *fp);
+int doc_table_open(doc_table_t *table, const void *image, size_t length,
+                   bool copy);
+void doc_table_free(doc_table_t *table);
+
+#endif // !DOC_TABLE_H
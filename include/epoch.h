@@ -0,0 +1,57 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Readers that can be pinned at once; more wait for a free slot
+#define EPOCH_SLOTS 64
+
+// Retired items collected before the writer tries to reclaim them
+#define EPOCH_RECLAIM_BATCH 64
+
+// Gives a retired item back: free() it, return a record to its pool, ...
+typedef void (*epoch_release_fn)(void *owner, uintptr_t item);
+
+typedef struct {
+  epoch_release_fn release;
+  void *owner;
+  uintptr_t item;
+  uint64_t epoch; // global epoch when it was unlinked
+} epoch_retired_t;
+
+// One reader's pin on its own cache line: 0 while free
+typedef struct {
+  uint64_t epoch;
+  char pad[64 - sizeof(uint64_t)];
+} epoch_slot_t;
+
+/*
+ * Epoch-based reclamation for one writer and many readers. A reader pins
+ * the current epoch for the length of a query; the writer unlinks memory
+ * with release stores, retires it, and only releases it once every pinned
+ * reader entered after the epoch it was retired in. Readers never block
+ * the writer and never take a lock.
+ */
+typedef struct Epoch {
+  epoch_slot_t slots[EPOCH_SLOTS];
+  uint64_t global;
+
+  // Writer only
+  epoch_retired_t *retired;
+  size_t retired_count;
+  size_t retired_capacity;
+} epoch_t;
+
+epoch_t *epoch_create(void);
+int epoch_enter(epoch_t *epoch);
+void epoch_exit(epoch_t *epoch, int slot);
+void epoch_retire(epoch_t *epoch, epoch_release_fn release, void *owner,
+                  uintptr_t item);
+void epoch_reclaim(epoch_t *epoch);
+void epoch_synchronize(epoch_t *epoch);
+void epoch_drain(epoch_t *epoch);
+void epoch_free(epoch_t *epoch);
+void epoch_release_memory(void *owner, uintptr_t item);
+
+#endif // !EPOCH_H
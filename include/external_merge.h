@@ -0,0 +1,31 @@
+#ifndef EXTERNAL_MERGE_H
+#define EXTERNAL_MERGE_H
+
+#include "index_structure.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Blocks are copied to the postings file through a buffer this large
+#define EXTERNAL_MERGE_BUFFER (1u << 20)
+
+/*
+ * The postings section of a merged index as it is written: a byte arena
+ * image (see arena.h) laid out block by block in a temporary file, with
+ * handles given out exactly as byte_arena_alloc() would. A block is held
+ * back until the next one of its list has a handle to link to.
+ */
+typedef struct {
+  FILE *fp;
+  uint32_t next_unit; // handle of the next block
+  uint32_t units;     // units in the file so far
+  uint32_t pending;   // handle of the block held back, ARENA_NULL if none
+  uint8_t block[POSTING_BLOCK_MAX];
+  bool failed;
+} external_postings_t;
+
+typedef struct SearchEngine search_engine_t;
+
+int external_merge_write(search_engine_t *engine, const char *filepath);
+
+#endif // !EXTERNAL_MERGE_H
@@ -0,0 +1,92 @@
+#ifndef IMPACTS_H
+#define IMPACTS_H
+
+#include "postings.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Documents summarized by one impact block: smaller blocks give tighter
+// bounds and more skip points, for a table of ~20 bytes per block
+#define IMPACT_BLOCK_DOCS 16
+
+/*
+ * Score upper bounds for block-max WAND. Every posting list is cut into
+ * runs of IMPACT_BLOCK_DOCS documents, and each run keeps the highest
+ * BM25 weight (bm25_weight(), no idf) any of its documents reaches.
+ * Weights depend on the average document length, so the table records
+ * the one it was built with and is stale once that moves. Each run also
+ * keeps where its first posting sits in the list's chain, so a cursor
+ * that skips runs lands there without decoding the postings between.
+ */
+typedef struct {
+  uint32_t last_doc; // last document of the run
+  float max_weight;  // rounded up, so it never undercuts a real score
+} impact_block_t;
+
+/*
+ * File layout (the impacts section): this header, uint32 first[list_count
+ * + 1] (the blocks of list handle h are first[h]..first[h + 1]), uint32
+ * postings[list_count] (each list's count when it was summarized), float
+ * list_max[list_count], impact_block_t[block_count], then
+ * posting_skip_t[block_count]. Sections written before the skip entries
+ * end after the blocks, and are still read, without them.
+ */
+typedef struct {
+  double avgdl;
+  uint32_t block_docs; // as built; any size reads back
+  uint32_t list_count; // list handles covered, the reserved 0 included
+  uint64_t block_count;
+} impact_header_t;
+
+typedef struct ImpactIndex {
+  impact_header_t header;
+  const struct Trie *trie; // whose list handles key the table
+  const uint32_t *first;
+  const uint32_t *postings;
+  const float *list_max;
+  const impact_block_t *blocks;
+  const posting_skip_t *skips; // NULL for sections written without them
+  void *owned; // the arrays above in one allocation, NULL when mapped
+} impact_index_t;
+
+typedef struct SearchEngine search_engine_t;
+struct Trie;
+
+impact_index_t *impact_build(const search_engine_t *engine,
+                             const struct Trie *trie, double avgdl);
+impact_index_t *impact_open(const void *image, size_t length, bool copy);
+bool impact_usable(const impact_index_t *impacts,
+                   const search_engine_t *engine);
+bool impact_covers(const impact_index_t *impacts,
+                   const search_engine_t *engine);
+int impact_write(const impact_index_t *impacts, FILE *fp);
+void impact_free(impact_index_t *impacts);
+
+/*
+ * Blocks of `list` (handle `handle`), NULL when the table does not cover
+ * it or postings were added since; the list's overall bound goes to *max.
+ */
+static inline const impact_block_t *
+impact_list(const impact_index_t *impacts, uint32_t handle,
+            const posting_list_t *list, uint32_t *count, float *max) {
+  if (handle >= impacts->header.list_count ||
+      impacts->postings[handle] != posting_list_count(list))
+    return NULL;
+  uint32_t from = impacts->first[handle], to = impacts->first[handle + 1];
+  if (from > to || to > impacts->header.block_count)
+    return NULL;
+  *count = to - from;
+  *max = impacts->list_max[handle];
+  return impacts->blocks + from;
+}
+
+// Skip entries for the blocks impact_list() returned, NULL if none
+static inline const posting_skip_t *
+impact_list_skips(const impact_index_t *impacts, uint32_t handle) {
+  return impacts->skips != NULL ? impacts->skips + impacts->first[handle]
+                                : NULL;
+}
+
+#endif // !IMPACTS_H
@@ -0,0 +1,120 @@
+#ifndef INDEX_FILE_H
+#define INDEX_FILE_H
+
+#include "impacts.h"
+#include "index_structure.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define INDEX_MAGIC 0xD0C0C0DE
+#define INDEX_VERSION_TREE 1 // one record per trie character, read only
+#define INDEX_VERSION_FLAT 2 // section based, mmap-able
+#define INDEX_VERSION_POSITIONS 3 // version 2 with token positions in postings
+#define INDEX_VERSION_TERM_COUNTS 4 // version 3 with per-node subtree counts
+#define INDEX_VERSION_DOC_TABLE 5 // version 4 with front-coded document paths
+#define INDEX_VERSION_CHECKSUMS 6 // version 5, checksums after the header
+
+// Index files are written through a user-space buffer this large
+#define INDEX_WRITE_BUFFER (1u << 20)
+
+// Every section starts on a cache line
+#define INDEX_SECTION_ALIGN 64
+#define INDEX_MAX_SECTIONS 16
+
+typedef enum {
+  INDEX_SECTION_DOCMAP = 0, // doc_table_t image (version 5), before that
+                            // uint64 offsets[doc_count + 1] + path bytes
+  INDEX_SECTION_NODE4,
+  INDEX_SECTION_NODE16,
+  INDEX_SECTION_NODE48,
+  INDEX_SECTION_NODE256,
+  INDEX_SECTION_LISTS,     // posting_list_t records
+  INDEX_SECTION_POSTINGS,  // posting block bytes
+  INDEX_SECTION_DOCMETA,   // index_docmeta_header_t + doc_meta_t[doc_count]
+  INDEX_SECTION_IMPACTS,   // impact_header_t + arrays, empty when not built
+  INDEX_SECTION_CHECKSUMS, // index_checksums_t, last in the file
+  INDEX_SECTION_COUNT,
+} index_section_id_t;
+
+// Files written before the docmeta section stop here and still load
+#define INDEX_SECTION_REQUIRED INDEX_SECTION_DOCMETA
+
+typedef struct {
+  uint64_t deleted_count; // tombstones, so opening never scans the records
+  uint64_t total_length;  // engine->total_length (0 in older files)
+  uint64_t length_docs;   // engine->length_docs
+  uint64_t first_doc;     // id of the first document, 0 but in segments
+} index_docmeta_header_t;
+
+typedef struct {
+  uint64_t offset;     // from the start of the file
+  uint64_t length;     // bytes
+  uint32_t elem_size;  // record size (unit size for raw sections)
+  uint32_t slab_shift; // log2(records per slab) the handles were built with
+  uint64_t count;      // records, units or documents
+} index_section_t;
+
+/*
+ * Version 2 layout: this header, then each section at its offset.
+ * Sections are the arena images of the trie, so handles stored inside
+ * nodes and lists resolve against the mapping without any fix-ups.
+ * Values are in host byte order.
+ */
+typedef struct {
+  uint32_t magic; // same first 6 bytes as version 1
+  uint16_t version;
+  uint16_t section_count;
+  uint32_t root; // root node handle
+  int32_t doc_count;
+  uint64_t file_size;
+  index_section_t sections[INDEX_MAX_SECTIONS];
+} index_file_header_t;
+
+/*
+ * The checksums section: CRC32C (crc32c.h) of every other section's
+ * bytes, and of the header followed by sections[]. It is written in
+ * every layout version, and older readers skip it as a section they do
+ * not know. Version 6 files, written before it, keep the same record
+ * right after the header instead. Files without either load unchecked.
+ */
+typedef struct {
+  uint32_t sections[INDEX_MAX_SECTIONS];
+  uint32_t header;
+  uint32_t reserved;
+} index_checksums_t;
+
+/*
+ * An index file being saved: written to <path>.tmp through a large
+ * buffer, then synced and renamed over <path> by index_output_commit(),
+ * so a crash leaves either the old file or the new one.
+ */
+typedef struct {
+  FILE *fp; // open for update, so sections can be read back
+  char *temp;
+  char *buffer;
+} index_output_t;
+
+// A postings section laid out ahead of time in a file of its own, as
+// byte_arena_write() would have written it (see index_file_write_merged())
+typedef struct {
+  FILE *fp;
+  uint32_t units; // arena units in the file, unit 0 included
+} index_postings_t;
+
+typedef struct SearchEngine search_engine_t;
+
+int index_file_write(search_engine_t *engine, FILE *fp);
+int index_file_write_segment(search_engine_t *engine, int first_doc,
+                             FILE *fp);
+int index_file_write_merged(search_engine_t *engine,
+                            const index_postings_t *postings, FILE *fp);
+int index_file_write_impacts(FILE *fp, const impact_index_t *impacts);
+int index_output_open(index_output_t *out, const char *filepath);
+int index_output_commit(index_output_t *out, const char *filepath,
+                        int result);
+search_engine_t *index_file_open(const char *filepath, bool copy);
+search_engine_t *index_file_open_segment(const char *filepath, bool copy,
+                                         int first_doc);
+int index_file_verify(const void *base, size_t size);
+
+#endif // !INDEX_FILE_H
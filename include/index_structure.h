@@ -1,17 +1,45 @@
 #ifndef INDEX_STRUCTURE_H
 #define INDEX_STRUCTURE_H
 
+#include "arena.h"
+#include "epoch.h"
+#include "postings.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
-#define ALPHABET_SIZE 128
+// Edges are raw bytes, so any UTF-8 sequence can be stored
+#define ALPHABET_SIZE 256
 
-typedef struct WordOccurence {
-  int doc_id;
-  int page_num;
-  long byte_offset;
-  struct WordOccurence *next;
-} word_occurrence_t;
+// Target slab size for node pools (records per slab depends on node type)
+// and records per slab (log2) for the posting list headers
+#define TRIE_NODE_SLAB_BYTES (256 * 1024)
+#define TRIE_LIST_SLAB_SHIFT 12
+
+// Longest key the v1 loader, trie_merge() and prefix walks will rebuild
+#define TRIE_MAX_KEY 1024
+
+// node->terms stops counting here
+#define TRIE_TERMS_SATURATED UINT16_MAX
+
+// Bytes of a compressed single-child chain kept inline in a node.
+// Longer chains are split over several nodes (pessimistic path compression).
+#define TRIE_MAX_PREFIX 10
+
+/*
+ * Adaptive radix tree node types. The type lives in the top two bits of a
+ * node handle, the remaining 30 bits index that type's slab pool.
+ */
+typedef enum {
+  TRIE_NODE4 = 0,
+  TRIE_NODE16 = 1,
+  TRIE_NODE48 = 2,
+  TRIE_NODE256 = 3,
+} trie_node_type_t;
+
+#define TRIE_NODE_TYPES 4
+#define TRIE_TYPE_SHIFT 30
+#define TRIE_INDEX_MASK ((1u << TRIE_TYPE_SHIFT) - 1)
 
 typedef struct {
   int doc_id;
@@ -19,26 +47,143 @@ typedef struct {
   long byte_offset;
 } occurrence_transfer_t;
 
+// Header shared by every node type
 typedef struct TrieNode {
-  struct TrieNode *children[ALPHABET_SIZE];
+  uint16_t num_children;
+  uint8_t prefix_len; // compressed path bytes in front of this node
   bool isEndOfWord;
-  word_occurrence_t *occurrences;
-  int char_index;
+  uint8_t prefix[TRIE_MAX_PREFIX];
+  uint16_t terms;    // words in this subtree, saturating (see term_counts)
+  uint32_t postings; // handle of this word's posting list
 } trie_node_t;
 
-trie_node_t *create_node(void);
-word_occurrence_t *create_occurrence(int doc_id, int page_num,
-                                     long byte_offset);
-void add_occurence_to_node(trie_node_t *node, int doc_id, int page_num,
-                           long byte_offset);
-void relink_occurence(trie_node_t *node, int doc_id, int page_num,
-                      long byte_offset);
-void trie_insert(trie_node_t *root, const char *word, int doc_id, int page_num,
+// Up to 4 children, keys kept sorted
+typedef struct {
+  trie_node_t header;
+  uint8_t keys[4];
+  uint32_t children[4];
+} trie_node4_t;
+
+// Up to 16 children, keys kept sorted and compared 16 at a time
+typedef struct {
+  trie_node_t header;
+  uint8_t keys[16];
+  uint32_t children[16];
+} trie_node16_t;
+
+// Up to 48 children, child_index maps a byte to slot + 1 (0 = empty)
+typedef struct {
+  trie_node_t header;
+  uint8_t child_index[256];
+  uint32_t children[48];
+} trie_node48_t;
+
+// Direct lookup table for dense nodes
+typedef struct {
+  trie_node_t header;
+  uint32_t children[256];
+} trie_node256_t;
+
+/*
+ * The index owns the arenas every node and posting is carved from.
+ * One writer may insert while any number of readers search, each between
+ * trie_read_begin() and trie_read_end(). The writer never rewrites a
+ * published Node4, Node16 or compressed path: it fills in a copy,
+ * publishes it with a release store and retires the original through
+ * `epoch`. Readers load child slots, the root and postings handles with
+ * acquire loads.
+ */
+typedef struct Trie {
+  slab_pool_t nodes[TRIE_NODE_TYPES]; // one pool per node type
+  slab_pool_t lists;                  // posting_list_t headers
+  byte_arena_t postings;              // encoded posting blocks
+  uint32_t root;                      // see trie_root()
+  uint64_t generation; // bumped as changes get published, keys cached results
+  int visible_docs;    // readers stop at postings of this document
+  epoch_t *epoch;
+  bool read_only;   // arenas are borrowed from a read-only mapping
+  bool positional;  // postings carry token positions (not in old files)
+  bool term_counts; // node->terms is maintained (not in old mapped files)
+} trie_t;
+
+// One arena as laid out in a flat index file
+typedef struct {
+  void *base;
+  uint32_t elem_size;
+  uint32_t slab_shift;
+  uint32_t count; // records (units for the posting bytes)
+} trie_arena_image_t;
+
+typedef struct {
+  trie_arena_image_t nodes[TRIE_NODE_TYPES];
+  trie_arena_image_t lists;
+  trie_arena_image_t postings;
+  uint32_t root;
+  bool positional;
+  bool term_counts;
+} trie_image_t;
+
+static inline trie_node_type_t trie_node_type(uint32_t handle) {
+  return (trie_node_type_t)(handle >> TRIE_TYPE_SHIFT);
+}
+
+static inline trie_node_t *trie_node(const trie_t *trie, uint32_t handle) {
+  return (trie_node_t *)slab_pool_get(&trie->nodes[trie_node_type(handle)],
+                                      handle & TRIE_INDEX_MASK);
+}
+
+static inline posting_list_t *trie_posting_list(const trie_t *trie,
+                                                uint32_t handle) {
+  return (posting_list_t *)slab_pool_get(&trie->lists, handle);
+}
+
+static inline uint32_t trie_root(const trie_t *trie) {
+  return __atomic_load_n(&trie->root, __ATOMIC_ACQUIRE);
+}
+
+// Posting list of the word a node ends, ARENA_NULL if it ends none
+static inline uint32_t trie_node_postings(const trie_node_t *node) {
+  return __atomic_load_n(&node->postings, __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t trie_generation(const trie_t *trie) {
+  return __atomic_load_n(&trie->generation, __ATOMIC_ACQUIRE);
+}
+
+trie_t *trie_create(void);
+trie_t *trie_open_image(const trie_image_t *image, bool copy);
+uint32_t create_node(trie_t *trie, trie_node_type_t type);
+void add_occurence_to_node(trie_t *trie, uint32_t node, int doc_id,
+                           int page_num, long byte_offset, int position);
+void trie_insert(trie_t *trie, const char *word, int doc_id, int page_num,
                  long byte_offset);
-word_occurrence_t *trie_search(trie_node_t *root, const char *word);
-void trie_free(trie_node_t *node);
+void trie_insert_at(trie_t *trie, const char *word, int doc_id, int page_num,
+                    long byte_offset, int position);
+uint32_t trie_insert_key(trie_t *trie, const unsigned char *key, size_t len);
+uint32_t trie_lookup(const trie_t *trie, const char *word);
+posting_list_t *trie_search(trie_t *trie, const char *word);
+void trie_postings_iter(const trie_t *trie, const posting_list_t *list,
+                        posting_iter_t *it);
+uint32_t trie_find_child(const trie_t *trie, uint32_t node, unsigned char c);
+int trie_node_children(const trie_t *trie, uint32_t node, unsigned char *keys,
+                       uint32_t *children);
+void trie_read_begin(const trie_t *trie);
+void trie_read_snapshot(const trie_t *trie);
+void trie_read_end(const trie_t *trie);
+void trie_publish(trie_t *trie, int visible_docs);
+void trie_hide_from(trie_t *trie, int first_doc);
+void trie_touch(trie_t *trie);
+void trie_adopt_epoch(trie_t *trie, trie_t *from);
+void trie_freeze(trie_t *trie);
+void trie_free(trie_t *trie);
+int trie_reset(trie_t *trie);
+int trie_merge(trie_t *dst, const trie_t *src);
+int trie_merge_remap(trie_t *dst, const trie_t *src, const int *remap);
 int trie_children_count(trie_node_t *node);
-int trie_node_serialize(trie_node_t *node, int char_index, FILE *fp);
-trie_node_t *trie_node_deserialize(FILE *fp);
+uint32_t trie_find_prefix(const trie_t *trie, const unsigned char *prefix,
+                          size_t len, unsigned char *key, size_t *key_len);
+long trie_subtree_terms(const trie_t *trie, uint32_t node);
+size_t trie_memory_bytes(const trie_t *trie);
+trie_t *trie_deserialize(FILE *fp);
 
 #endif // !INDEX_STRUCTURE_H
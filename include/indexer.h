@@ -0,0 +1,20 @@
+#ifndef INDEXER_H
+#define INDEXER_H
+
+#include "toolkit_core.h"
+
+// Upper bound on documents a worker indexes into one local trie
+#define INDEXER_MAX_BATCH 64
+
+// Called on the calling thread, in doc id order, once a document is merged
+typedef void (*index_progress_fn)(int done, int total, const char *path,
+                                  void *user_data);
+
+int engine_set_memory_budget(search_engine_t *engine, size_t bytes,
+                             const char *temp_dir);
+int engine_index_parallel(search_engine_t *engine, int workers,
+                          index_progress_fn progress, void *user_data);
+int engine_index_from(search_engine_t *engine, int first_doc, int workers,
+                      index_progress_fn progress, void *user_data);
+
+#endif // !INDEXER_H
@@ -0,0 +1,30 @@
+#ifndef KEY_SET_H
+#define KEY_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One side of a set is this many times larger: gallop instead of merging
+#define KEY_GALLOP_RATIO 16
+
+/*
+ * Sorted arrays of unique 64-bit keys, the currency of boolean queries
+ * (a document id, or a document id and page packed together).
+ */
+static inline uint64_t key_pack(int doc_id, int page_num) {
+  return ((uint64_t)(uint32_t)doc_id << 32) | (uint32_t)page_num;
+}
+
+static inline int key_doc(uint64_t key) { return (int)(key >> 32); }
+static inline int key_page(uint64_t key) { return (int)(uint32_t)key; }
+
+size_t key_gallop(const uint64_t *keys, size_t count, size_t from,
+                  uint64_t key);
+size_t key_intersect(const uint64_t *a, size_t na, const uint64_t *b,
+                     size_t nb, uint64_t *out);
+size_t key_union(const uint64_t *a, size_t na, const uint64_t *b, size_t nb,
+                 uint64_t *out);
+size_t key_difference(const uint64_t *a, size_t na, const uint64_t *b,
+                      size_t nb, uint64_t *out);
+
+#endif // !KEY_SET_H
@@ -0,0 +1,39 @@
+#ifndef LEVENSHTEIN_H
+#define LEVENSHTEIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest edit distance an automaton is built for
+#define LEV_MAX_DISTANCE 2
+// Longest query word, in characters (one bit each, plus the start bit)
+#define LEV_MAX_CHARS 63
+
+/*
+ * Levenshtein automaton for one query word, simulated bit-parallel: row d
+ * has bit i set when the first i query characters can be turned into the
+ * input seen so far with d edits. Input is fed a byte at a time, so it
+ * can follow a byte trie; UTF-8 sequences count as one character.
+ */
+typedef struct {
+  int distance;
+  int length; // query characters
+  uint64_t mask;
+  uint64_t ascii[128]; // bit i + 1 set where query character i is c
+  unsigned int chars[LEV_MAX_CHARS];
+} lev_automaton_t;
+
+typedef struct {
+  uint64_t rows[LEV_MAX_DISTANCE + 1];
+  unsigned int partial; // code point of an unfinished UTF-8 sequence
+  int pending;          // continuation bytes it still needs
+} lev_state_t;
+
+int lev_init(lev_automaton_t *a, const char *word, size_t len,
+             int distance);
+void lev_start(const lev_automaton_t *a, lev_state_t *s);
+bool lev_step(const lev_automaton_t *a, lev_state_t *s, unsigned char byte);
+int lev_distance(const lev_automaton_t *a, const lev_state_t *s);
+
+#endif // !LEVENSHTEIN_H
@@ -0,0 +1,24 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Small LZ77 block codec in the spirit of LZ4: a block is a run of
+ * sequences, each a token byte (literal count high nibble, match length
+ * minus 4 low nibble; 15 means "more length bytes follow"), the literals,
+ * then a 2-byte little endian back offset and the extra match length.
+ * The last sequence carries literals only.
+ */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+// Worst case output size for `n` input bytes
+static inline size_t lz_bound(size_t n) { return n + n / 255 + 16; }
+
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size);
+
+#endif // !LZ_H
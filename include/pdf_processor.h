@@ -5,11 +5,16 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "index_structure.h"
+#include "text_store.h"
+
 // Forward declare engine
 typedef struct SearchEngine search_engine_t;
 
 void index_pdf_content(search_engine_t *engine, int doc_id,
                        const char *filepath);
+long index_pdf_into(trie_t *trie, text_store_t *texts, int doc_id,
+                    const char *filepath);
 // PDF page structure
 typedef struct {
   int page_number;
@@ -101,6 +106,21 @@ int pdf_unlock(PDF *pdf, const char *password);
 bool pdf_is_encrypted(PDF *pdf);
 
 char *get_snippet(const char *filepath, int page_num, long byte_offset);
+char *snippet_from_text(const char *page_text, size_t page_len,
+                        long byte_offset);
 void free_snippet(char *snippet);
 
+// Snippets for many hits, packed into one allocation
+typedef struct {
+  char *text;       // every snippet, each NUL terminated
+  size_t text_size; // bytes in text
+  int64_t *offsets; // per hit: start of its snippet in text, -1 if none
+  int count;        // hits
+} snippet_batch_t;
+
+snippet_batch_t *get_snippets(search_engine_t *engine,
+                              const occurrence_transfer_t *hits, int count,
+                              int workers);
+void free_snippet_batch(snippet_batch_t *batch);
+
 #endif // !PDF_PROCESSOR_H
@@ -0,0 +1,123 @@
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include "arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Posting blocks start small and double up to this size (bytes, header incl.)
+#define POSTING_BLOCK_MIN 32
+#define POSTING_BLOCK_MAX 4096
+
+typedef struct {
+  int doc_id;
+  int page_num;
+  long byte_offset;
+  int position; // token ordinal on the page, -1 if the list has none
+} posting_t;
+
+// A list's tail keeps the byte offset and position of its last posting in
+// one word, 40 + 24 bits
+#define POSTING_OFFSET_BITS 40
+#define POSTING_MAX_OFFSET ((1L << POSTING_OFFSET_BITS) - 1)
+#define POSTING_MAX_POSITION ((1 << (64 - POSTING_OFFSET_BITS)) - 1)
+
+/*
+ * The highest posting of a list, the base for the next delta. Same 16
+ * bytes as the {int, int, long} it replaces, so lists from files without
+ * positions read back with their offsets intact and position 0.
+ */
+typedef struct {
+  int32_t doc_id;
+  int32_t page_num;
+  uint64_t packed; // byte offset | position << POSTING_OFFSET_BITS
+} posting_tail_t;
+
+/*
+ * Every posting block starts with this header. The first posting in a block
+ * is encoded against a zero base so a block can be decoded on its own.
+ * Appends write the bytes first and then publish `used` (and a new block
+ * through `next`) with release stores, so a reader never decodes a
+ * half-written posting.
+ */
+typedef struct {
+  uint32_t next;     // handle of the next block, ARENA_NULL at the end
+  uint16_t capacity; // payload bytes
+  uint16_t used;     // payload bytes written so far
+} posting_block_t;
+
+/*
+ * Postings of one term, ordered by (doc_id, page_num, byte_offset) and
+ * stored as delta + varint encoded bytes in a chain of arena blocks:
+ *   doc delta, then page and offset absolute when the doc changes,
+ *   otherwise page delta, then offset absolute when the page changes,
+ *   otherwise offset delta.
+ * Positional lists (index files from version 3) fold the page change
+ * into the first varint instead: (doc delta << 1 | new page), then the
+ * page (absolute for a new doc, else a delta, only when it changes),
+ * then the offset and the token position, absolute on a new page and
+ * deltas otherwise. Once a list is shared, `head` never changes and
+ * readers load the counts through posting_list_count() and
+ * posting_list_docs().
+ */
+typedef struct {
+  uint32_t count;      // postings in the list
+  uint32_t doc_count;  // distinct documents
+  uint32_t head;       // first block
+  uint32_t tail;       // block that receives appends
+  posting_tail_t last; // highest posting, the base for the next delta
+} posting_list_t;
+
+// posting_list_append(): the posting sorts before the end of the list
+#define POSTING_UNSORTED 1
+
+/*
+ * Where the first posting of a document sits in a chain, so an iterator
+ * can resume there without decoding what comes before (see
+ * posting_iter_jump()). Such a posting only depends on the previous
+ * document id, or on nothing at the start of a block.
+ */
+typedef struct {
+  uint32_t block;   // posting block handle
+  uint32_t offset;  // bytes into the block's payload
+  int32_t base_doc; // document the posting's delta is taken from
+} posting_skip_t;
+
+// Streaming decoder over a posting list
+typedef struct {
+  const byte_arena_t *arena;
+  uint32_t block;   // next block to enter
+  uint32_t entered; // block being read, ARENA_NULL before the first
+  const uint8_t *pos;
+  const uint8_t *end;
+  bool positional;
+  int doc_limit; // the list ends before this document (INT_MAX: no limit)
+  bool exhausted; // past the last posting: `current` is stale
+  posting_t current;
+} posting_iter_t;
+
+static inline uint32_t posting_list_count(const posting_list_t *list) {
+  return __atomic_load_n(&list->count, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t posting_list_docs(const posting_list_t *list) {
+  return __atomic_load_n(&list->doc_count, __ATOMIC_RELAXED);
+}
+
+int posting_compare(const posting_t *a, const posting_t *b);
+int posting_list_append(byte_arena_t *arena, posting_list_t *list,
+                        const posting_t *p, bool positional);
+int posting_list_insert(byte_arena_t *arena, posting_list_t *dst,
+                        const posting_list_t *src, const posting_t *p,
+                        bool positional);
+void posting_iter_init(posting_iter_t *it, const byte_arena_t *arena,
+                       const posting_list_t *list, bool positional);
+bool posting_iter_next(posting_iter_t *it);
+bool posting_iter_seek(posting_iter_t *it, int doc_id, int page_num);
+void posting_iter_mark(const posting_iter_t *it, posting_skip_t *at);
+void posting_iter_jump(posting_iter_t *it, const posting_skip_t *at);
+
+size_t varint_encode(uint64_t value, uint8_t *out);
+const uint8_t *varint_decode(const uint8_t *in, uint64_t *value);
+
+#endif // !POSTINGS_H
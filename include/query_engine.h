@@ -2,13 +2,114 @@
 #define QUERY_ENGINE_H
 
 #include "index_structure.h"
+#include <stdint.h>
 
 typedef struct SearchEngine search_engine_t;
 
+// Terms this many times longer than the running candidate set are probed
+// with seeks rather than decoded in full
+#define QUERY_SEEK_RATIO 64
+
+// Words a prefix or wildcard query expands to unless told otherwise
+#define QUERY_MAX_EXPANSIONS 256
+
+// One indexed word within the edit distance of a fuzzy query
+typedef struct {
+  char *term;
+  int distance; // edits away from the query word
+  int count;    // postings of the word
+} fuzzy_term_t;
+
+// BM25 term frequency saturation and document length normalization
+#define BM25_K1 1.2
+#define BM25_B 0.75
+// BM25 without the idf: how much `tf` occurrences in a document with
+// length factor `norm` (bm25_length_norm()) are worth
+static inline double bm25_weight(int tf, double norm) {
+  return tf * (BM25_K1 + 1.0) / (tf + norm);
+}
+
+// Results a ranked query keeps unless told otherwise
+#define QUERY_DEFAULT_K 10
+
+// One document of a ranked query
+typedef struct {
+  int doc_id;
+  int page_num;     // first query word in the document
+  long byte_offset;
+  double score;
+} scored_result_t;
+
+// Results of many queries packed into one allocation
+typedef struct {
+  occurrence_transfer_t *results; // every query's hits, back to back
+  int64_t *offsets;               // per query: its first hit in results
+  int *counts;                    // per query: its hits
+  int64_t total;                  // hits in results
+  int count;                      // queries
+} query_batch_t;
+
+// Queries a batch worker claims at a time
+#define QUERY_BATCH_CHUNK 64
+
+// Granularity at which boolean query terms must co-occur
+typedef enum {
+  QUERY_SCOPE_DOCUMENT = 0,
+  QUERY_SCOPE_PAGE = 1,
+} query_scope_t;
+
 occurrence_transfer_t *get_search_results(search_engine_t *engine,
                                           const char *word, int *found_count);
 
-int *get_doc_ids_from_search(word_occurrence_t *list, int *out_count);
+occurrence_transfer_t *search_boolean(search_engine_t *engine,
+                                      const char *const *must, int must_count,
+                                      const char *const *should,
+                                      int should_count,
+                                      const char *const *must_not,
+                                      int not_count, int scope,
+                                      int *found_count);
+
+occurrence_transfer_t *search_phrase(search_engine_t *engine,
+                                     const char *phrase, int *found_count);
+occurrence_transfer_t *search_near(search_engine_t *engine,
+                                   const char *const *words, int count,
+                                   int distance, int *found_count);
+
+occurrence_transfer_t *search_prefix(search_engine_t *engine,
+                                     const char *pattern, int max_terms,
+                                     int max_results, int *found_count);
+long count_prefix_terms(search_engine_t *engine, const char *prefix);
+
+fuzzy_term_t *search_fuzzy_terms(search_engine_t *engine, const char *word,
+                                 int max_distance, int max_terms,
+                                 int *found_count);
+void free_fuzzy_terms(fuzzy_term_t *terms, int count);
+occurrence_transfer_t *search_fuzzy(search_engine_t *engine,
+                                    const char *word, int max_distance,
+                                    int max_terms, int max_results,
+                                    int *found_count);
+
+double bm25_average_length(const search_engine_t *engine);
+double bm25_length_norm(const search_engine_t *engine, int doc_id,
+                        double avgdl);
+scored_result_t *search_ranked(search_engine_t *engine, const char *query,
+                               int k, int *found_count);
+scored_result_t *search_ranked_exhaustive(search_engine_t *engine,
+                                          const char *query, int k,
+                                          int *found_count);
+
+query_batch_t *search_batch(search_engine_t *engine,
+                            const char *const *queries, int count,
+                            int max_results, int workers);
+void free_query_batch(query_batch_t *batch);
+
+const occurrence_transfer_t *search_cached(search_engine_t *engine,
+                                           const char *query,
+                                           int *found_count);
+void release_results(const occurrence_transfer_t *results);
+
+int *get_doc_ids_from_search(trie_t *trie, posting_list_t *list,
+                             int *out_count);
 void free_results(int *results);
 
 #endif // !QUERY_ENGINE_H
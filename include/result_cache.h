@@ -0,0 +1,70 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "index_structure.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Memory budget of a result cache unless told otherwise
+#define RESULT_CACHE_DEFAULT_BYTES (32u << 20)
+
+/*
+ * The hits of one query, shared by the cache and every caller holding
+ * them. Never modified once built; the last release frees it.
+ */
+typedef struct {
+  uint32_t refs;
+  int count;
+  size_t bytes; // charged against the budget, key and bookkeeping included
+  occurrence_transfer_t hits[];
+} result_buffer_t;
+
+typedef struct ResultEntry {
+  struct ResultEntry *next;  // hash chain
+  struct ResultEntry *newer; // LRU order, towards the most recent
+  struct ResultEntry *older;
+  uint64_t hash;
+  uint64_t generation; // of the index the hits were taken from
+  result_buffer_t *buffer;
+  char key[]; // normalized query
+} result_entry_t;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;    // lookups with no entry, or a stale one
+  uint64_t evictions; // entries dropped to stay within the budget
+  uint64_t entries;
+  uint64_t bytes;
+  uint64_t budget;
+} result_cache_stats_t;
+
+/*
+ * Least recently used hits of whole queries, keyed by the normalized
+ * query and the index generation (trie_t.generation) they were taken at,
+ * so an entry goes stale as soon as the index changes and simply ages
+ * out. Safe to use from several threads.
+ */
+typedef struct ResultCache {
+  pthread_mutex_t lock;
+  result_entry_t **buckets;
+  uint32_t bucket_mask;
+  result_entry_t *newest;
+  result_entry_t *oldest;
+  result_cache_stats_t stats;
+} result_cache_t;
+
+result_buffer_t *result_buffer_create(const occurrence_transfer_t *hits,
+                                      int count, size_t key_len);
+void result_buffer_release(result_buffer_t *buffer);
+
+result_cache_t *result_cache_create(size_t budget);
+void result_cache_set_budget(result_cache_t *cache, size_t budget);
+result_buffer_t *result_cache_get(result_cache_t *cache, const char *key,
+                                  uint64_t generation);
+void result_cache_put(result_cache_t *cache, const char *key,
+                      uint64_t generation, result_buffer_t *buffer);
+void result_cache_stats(result_cache_t *cache, result_cache_stats_t *stats);
+void result_cache_free(result_cache_t *cache);
+
+#endif // !RESULT_CACHE_H
@@ -0,0 +1,143 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include "toolkit_core.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SEGMENT_MANIFEST_MAGIC 0x4D474553 // "SEGM"
+#define SEGMENT_MANIFEST_VERSION 1
+
+// Segment files sit next to the manifest: <manifest path>.seg<id>
+#define SEGMENT_SUFFIX ".seg"
+
+// Runs spilled by a memory-budgeted build without a manifest of its own
+// go to a fresh directory under the budget's (see segments_spill())
+#define SEGMENT_SPILL_TEMPLATE "pdfsearch-XXXXXX"
+#define SEGMENT_SPILL_MANIFEST "runs"
+
+// Segments smaller than this share the lowest merge tier; each tier up
+// holds segments SEGMENT_TIER_FACTOR times larger, and that many adjacent
+// segments of one tier are merged into one of the next
+#define SEGMENT_TIER_BYTES (1u << 20)
+#define SEGMENT_TIER_FACTOR 4
+
+// Sealed segments keep their score bounds (impacts.h) until the average
+// document length outgrows the one they were built with by this much
+#define SEGMENT_IMPACT_HEADROOM 1.25
+
+/*
+ * Manifest layout: this header, segment_record_t[segment_count] in doc
+ * order, then uint32 ids of the documents tombstoned since their segment
+ * was written [deleted_count]. Values are in host byte order.
+ */
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t segment_count;
+  int32_t doc_count; // documents in the segments
+  uint64_t next_id;  // id the next segment file gets
+  uint64_t deleted_count;
+} segment_manifest_t;
+
+typedef struct {
+  uint64_t id;
+  uint64_t bytes; // size of the segment file
+  int32_t first_doc;
+  int32_t doc_count;
+} segment_record_t;
+
+// One immutable part of the index, documents first_doc.. in a file
+typedef struct {
+  trie_t *index;           // frozen (trie_freeze()), global doc ids
+  impact_index_t *impacts; // swapped when refreshed, read with acquire
+  doc_table_t docs;        // its own paths, so merges never read the engine
+  int first_doc;
+  int doc_count;
+  uint64_t id;
+  uint64_t bytes;
+  void *mapping; // set when opened without copy
+  size_t mapping_size;
+} segment_t;
+
+// What a query fans out over: the segments in doc order, then `live`
+typedef struct {
+  trie_t *live; // the engine's index, documents after the last segment
+  int count;
+  segment_t *items[];
+} segment_list_t;
+
+/*
+ * Segmented index, LSM style. New documents go into the engine's live
+ * trie; engine_flush() seals it into a segment file written once and
+ * never again, so saving costs the new documents only. Segments are
+ * combined by size tier on a merge thread (or engine_merge_segments()),
+ * and the manifest, rewritten atomically, says which files make up the
+ * index. Every trie shares the live trie's epoch: a query pins it once
+ * and reads one published list (segment_view_begin()).
+ */
+typedef struct SegmentSet {
+  segment_list_t *list; // published with release stores
+  epoch_t *epoch;       // the live trie's, handed on as it is replaced
+  char *path;           // the manifest
+  char *spill_dir; // temporary directory of spilled runs, gone on free/flush
+  uint64_t next_id;
+  int sealed_docs; // documents held by segments
+
+  // Segment files to unlink once a manifest without them is written
+  uint64_t *dead;
+  int dead_count;
+  int dead_capacity;
+
+  pthread_mutex_t lock;    // list swaps and manifest writes
+  pthread_mutex_t merging; // held through a merge; tombstones wait on it
+
+  // Background merging, see engine_set_background_merge()
+  pthread_cond_t wake;
+  pthread_t merger;
+  bool running;
+  bool stop;
+  bool pending; // a flush happened since the merger last looked
+} segment_set_t;
+
+// Every source of one query, pinned between begin and end
+typedef struct {
+  const search_engine_t *engine;
+  const segment_list_t *list; // NULL for a monolithic engine
+  trie_t *live;
+  int slot;
+} segment_view_t;
+
+void segment_view_begin(const search_engine_t *engine, segment_view_t *view);
+void segment_view_end(segment_view_t *view);
+const impact_index_t *segment_view_impacts(const segment_view_t *view,
+                                           int source);
+
+// Sources in doc order; the live trie is the last one
+static inline int segment_view_count(const segment_view_t *view) {
+  return view->list != NULL ? view->list->count + 1 : 1;
+}
+
+static inline trie_t *segment_view_trie(const segment_view_t *view,
+                                        int source) {
+  if (view->list == NULL || source == view->list->count)
+    return view->live;
+  return view->list->items[source]->index;
+}
+
+int engine_flush(search_engine_t *engine, const char *path);
+int engine_merge_segments(search_engine_t *engine);
+int engine_set_background_merge(search_engine_t *engine, bool enabled);
+int engine_segment_count(search_engine_t *engine);
+
+search_engine_t *segments_open(const char *path, bool copy);
+int segments_spill(search_engine_t *engine, int end);
+void segments_pause_merges(search_engine_t *engine);
+void segments_resume_merges(search_engine_t *engine);
+int segments_reset(search_engine_t *engine, trie_t *trie);
+int segments_verify(search_engine_t *engine);
+void segments_free(search_engine_t *engine);
+
+#endif // !SEGMENTS_H
@@ -0,0 +1,103 @@
+#ifndef TEXT_STORE_H
+#define TEXT_STORE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TEXT_STORE_MAGIC 0x54585453 // "STXT"
+#define TEXT_STORE_VERSION 1
+
+// Side-car file next to an index: <index path> + TEXT_STORE_SUFFIX
+#define TEXT_STORE_SUFFIX ".text"
+
+// One compressed page
+typedef struct {
+  uint64_t offset;     // into the data section (or the spill file)
+  uint32_t compressed; // bytes stored
+  uint32_t raw;        // bytes of text once decoded
+} text_page_t;
+
+/*
+ * File layout: this header, uint32 doc_first[doc_count + 1] (page index
+ * of each document's first page), text_page_t[page_count], then the
+ * compressed pages. Page p of document d is entry doc_first[d] + p.
+ * Values are in host byte order.
+ */
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t doc_count;
+  uint32_t page_count;
+  uint64_t pages_offset;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t file_size;
+} text_store_header_t;
+
+// Pages of one document, compressed by the thread that extracted them
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  text_page_t *pages; // offsets relative to data
+  uint32_t count;
+  uint32_t page_capacity;
+} text_doc_t;
+
+// Where a document's pages live
+typedef enum {
+  TEXT_SOURCE_NONE = 0,
+  TEXT_SOURCE_BASE,  // the mapped side-car file
+  TEXT_SOURCE_SPILL, // added since, kept in the spill file
+} text_source_t;
+
+typedef struct {
+  uint32_t first; // page index in the source's table
+  uint32_t count;
+  uint32_t source;
+} text_doc_ref_t;
+
+/*
+ * Page texts by (doc_id, page). A store opened from a side-car answers
+ * straight from the read-only mapping. Documents added afterwards are
+ * spilled to an unlinked temporary file, and an overlay table (created on
+ * the first change) says which source holds each document.
+ */
+typedef struct TextStore {
+  void *mapping;
+  size_t mapping_size;
+  const text_store_header_t *header;
+  const uint32_t *base_first;
+  const text_page_t *base_pages;
+  const uint8_t *base_data;
+
+  text_doc_ref_t *docs; // overlay, NULL while the base is used as is
+  uint32_t doc_count;
+  uint32_t doc_capacity;
+  text_page_t *pages; // spilled pages
+  uint32_t page_count;
+  uint32_t page_capacity;
+  int spill_fd;
+  uint64_t spill_size;
+
+  pthread_mutex_t lock; // writers only
+} text_store_t;
+
+int text_doc_add_page(text_doc_t *doc, const char *text, size_t len);
+void text_doc_release(text_doc_t *doc);
+
+text_store_t *text_store_create(void);
+text_store_t *text_store_open(const char *path);
+void text_store_free(text_store_t *store);
+int text_store_put(text_store_t *store, int doc_id, const text_doc_t *doc);
+bool text_store_has(const text_store_t *store, int doc_id);
+char *text_store_get_page(const text_store_t *store, int doc_id, int page,
+                          size_t *len);
+int text_store_remap(text_store_t *store, const int *remap, int old_count);
+int text_store_write(const text_store_t *store, const char *path,
+                     int doc_count);
+
+#endif // !TEXT_STORE_H
@@ -0,0 +1,20 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stddef.h>
+
+// Longer runs (hashes, base64, layout garbage) are dropped, not cut short
+#define TOKEN_MAX_BYTES 128
+
+/*
+ * Receives each word, case folded and NUL terminated. `byte_offset` is
+ * where the word starts in the original text. The buffer is reused for
+ * the next token.
+ */
+typedef void (*token_fn)(const char *token, size_t len, long byte_offset,
+                         void *user_data);
+
+size_t tokenize(const char *text, size_t len, token_fn emit, void *user_data);
+size_t utf8_fold(unsigned int cp, char *out);
+
+#endif // !TOKENIZER_H
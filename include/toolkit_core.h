@@ -1,20 +1,117 @@
 #ifndef TOOLKIT_CORE_H
 #define TOOLKIT_CORE_H
 
+#include "doc_table.h"
+#include "impacts.h"
 #include "index_structure.h"
+#include "result_cache.h"
+#include "text_store.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// doc_meta_t.flags
+#define DOC_META_KNOWN 0x1 // the fingerprint below was taken
+#define DOC_DELETED 0x2    // tombstone: hidden from results until compaction
+
+// Fingerprint of a document as it was when it was indexed
+typedef struct {
+  int64_t mtime_ns;
+  uint64_t size;
+  uint64_t hash; // content hash, see doc_fingerprint()
+  uint32_t flags;
+  uint32_t length; // words indexed, the BM25 document length (0: unknown)
+} doc_meta_t;
 
 typedef struct SearchEngine {
-  trie_node_t *index_root;
-  char **document_map;
+  trie_t *index; // owns the node/occurrence arena
+  doc_table_t docs; // paths by doc id, see engine_get_document_path()
   int doc_count;
-  int doc_capacity;
+
+  // Per-document fingerprints; ids at or past doc_meta_capacity are unknown
+  doc_meta_t *doc_meta;
+  int doc_meta_capacity;
+  int deleted_count;
+
+  // Words indexed over the live documents of known length, the collection
+  // side of BM25 length normalization (see engine_count_lengths())
+  uint64_t total_length;
+  int length_docs;
+
+  // Block-max score bounds for top-k pruning, NULL until built
+  impact_index_t *impacts;
+
+  // Sealed segments and their manifest, NULL while the index is one trie
+  // (see segments.h); `index` is then the live trie behind them
+  struct SegmentSet *segments;
+
+  // Live trie cap while indexing, 0 for none, and where the runs it
+  // spills go (see engine_set_memory_budget())
+  size_t memory_budget;
+  char *temp_dir;
+
+  // Compressed page texts for snippets, saved next to the index file
+  text_store_t *texts;
+
+  // Hits of recent queries, NULL until engine_set_cache_budget()
+  result_cache_t *cache;
+
+  // Set when a version 2 file is served straight from a read-only mapping
+  void *mapping;
+  size_t mapping_size;
 } search_engine_t;
 
 search_engine_t *engine_create();
 void engine_free(search_engine_t *engine);
 void engine_index_all(search_engine_t *engine);
 const char *engine_get_document_path(search_engine_t *engine, int doc_id);
+int engine_add_document(search_engine_t *engine, const char *path);
+int engine_reserve_documents(search_engine_t *engine, int extra);
+doc_meta_t *engine_doc_meta(search_engine_t *engine, int doc_id);
+int engine_reserve_meta(search_engine_t *engine);
+void engine_count_lengths(search_engine_t *engine);
+void engine_update_ranking(search_engine_t *engine);
+int engine_set_cache_budget(search_engine_t *engine, size_t bytes);
+void engine_cache_stats(search_engine_t *engine, result_cache_stats_t *stats);
+
+/*
+ * A document's fingerprint for a query, NULL past doc_meta_capacity.
+ * Indexing may grow the array meanwhile: the capacity is published after
+ * the array that holds it, so it is loaded first.
+ */
+static inline const doc_meta_t *engine_meta_snapshot(
+    const search_engine_t *engine, int doc_id) {
+  int capacity = __atomic_load_n(&engine->doc_meta_capacity, __ATOMIC_ACQUIRE);
+  if (doc_id < 0 || doc_id >= capacity)
+    return NULL;
+  return __atomic_load_n(&engine->doc_meta, __ATOMIC_ACQUIRE) + doc_id;
+}
+
+// Cheap enough for every posting a query returns
+static inline bool engine_doc_deleted(const search_engine_t *engine,
+                                      int doc_id) {
+  if (engine->deleted_count == 0)
+    return false;
+  const doc_meta_t *meta = engine_meta_snapshot(engine, doc_id);
+  return meta != NULL && (meta->flags & DOC_DELETED);
+}
+
+// Every document path in one blob, for callers that resolve many ids
+typedef struct {
+  char *paths;         // in doc id order, each NUL terminated
+  uint64_t *offsets;   // [count + 1]; path i starts at offsets[i], and
+                       // offsets[i] == offsets[i + 1] when it has none
+  uint64_t paths_size; // bytes in paths
+  int count;           // documents
+} doc_path_table_t;
+
+doc_path_table_t *engine_export_paths(search_engine_t *engine);
+void free_doc_path_table(doc_path_table_t *table);
+
 int engine_serialize(search_engine_t *engine, char *filepath);
 search_engine_t *engine_deserialize(char *filepath);
+search_engine_t *engine_open_mapped(char *filepath);
+int engine_verify(search_engine_t *engine);
+char *engine_get_snippet(search_engine_t *engine, int doc_id, int page_num,
+                         long byte_offset);
 
 #endif // !TOOLKIT_CORE_H
@@ -0,0 +1,22 @@
+#ifndef UPDATER_H
+#define UPDATER_H
+
+#include "crawler.h"
+#include "indexer.h"
+
+// What an incremental update did to the engine
+typedef struct {
+  int added;     // new files, indexed under fresh ids
+  int modified;  // content changed: old id tombstoned, reindexed as new
+  int deleted;   // file is gone: id tombstoned
+  int unchanged; // fingerprint matched, nothing re-extracted
+} update_stats_t;
+
+int doc_fingerprint(const char *path, doc_meta_t *meta);
+int engine_update_directory(search_engine_t *engine, const char *path,
+                            const crawl_options_t *options,
+                            index_progress_fn progress, void *user_data,
+                            update_stats_t *stats);
+int engine_compact(search_engine_t *engine);
+
+#endif // !UPDATER_H
@@ -16,7 +16,7 @@ def highlight_text(text: str, query: str) -> str:
     return pattern.sub(lambda m: f"\033[38;5;33m{m.group(0)}\033[0m", text)
 
 
-def interactive_search(engine: SearchEngine):
+def interactive_search(engine: SearchEngine, top_k: int = 10):
     """Interactive search loop"""
     print("\n" + "=" * 60)
     print("Interactive Search Mode")
@@ -34,7 +34,7 @@ def interactive_search(engine: SearchEngine):
                 continue
 
             # Search
-            results = engine.search(query)
+            results = engine.search(query, top_k)
 
             if not results:
                 print("No results found.")
@@ -44,13 +44,16 @@ def interactive_search(engine: SearchEngine):
                 f"Found {len(results)} occurrence{'s' if len(results) != 1 else ''}:\n"
             )
 
+            # One pass over the PDFs for every snippet
+            snippets = engine.get_snippets(results)
+
             # Display results
-            for i, result in enumerate(results, 1):
+            for i, (result, snippet) in enumerate(zip(results, snippets), 1):
                 filename = os.path.basename(result.doc_path)
-                print(f"{i}. {filename} - Page {result.page_num + 1}")
+                score = f" (score {result.score:.2f})" if result.score else ""
+                print(f"{i}. {filename} - Page {result.page_num + 1}{score}")
 
-                # Get and display snippet
-                snippet = engine.get_snippet(result)
+                # Display snippet
                 if snippet:
                     highlighted = highlight_text(snippet, query)
                     print(f"    ...{highlighted}...")
@@ -76,6 +79,42 @@ def main():
     parser.add_argument(
         "--reindex", action="store_true", help="Force reindexing even if index exists"
     )
+    parser.add_argument(
+        "--update",
+        action="store_true",
+        help="Refresh the existing index: only new or changed PDFs are indexed",
+    )
+    parser.add_argument(
+        "--compact",
+        action="store_true",
+        help="With --update, drop deleted documents from the index for good",
+    )
+    parser.add_argument(
+        "--segmented",
+        action="store_true",
+        help="Save newly indexed PDFs as a new index segment instead of "
+        "rewriting the whole index, merging small segments as they pile up",
+    )
+    parser.add_argument(
+        "--memory-budget",
+        type=int,
+        default=0,
+        metavar="MB",
+        help="Keep at most MB megabytes of index in memory while indexing, "
+        "spilling the rest to temporary run files (default: no limit)",
+    )
+    parser.add_argument(
+        "--verify",
+        action="store_true",
+        help="Check every checksum of the loaded index before searching",
+    )
+    parser.add_argument(
+        "--top",
+        type=int,
+        default=10,
+        help="Rank plain word queries and show the best N documents "
+        "(0 lists every occurrence, default: 10)",
+    )
     parser.add_argument(
         "--data-dir",
         type=str,
@@ -92,8 +131,28 @@ def main():
         print(f"Error: {e}")
         return 1
 
-    # Load existing index or create a new one
-    needs_indexing = args.reindex or not engine.load()
+    # Incremental refresh needs a writable engine
+    if args.update and not args.reindex:
+        if not args.directory or not os.path.isdir(args.directory):
+            print("Error: --update needs the directory that was indexed")
+            return 1
+        if not engine.load(read_only=False):
+            engine.create_new()
+        engine.set_memory_budget(args.memory_budget << 20)
+        if engine.update_directory(args.directory) is None:
+            print("Update failed!")
+            return 1
+        if args.compact:
+            engine.compact()
+        if not engine.save(segmented=args.segmented):
+            print("Saving the index failed!")
+            return 1
+        if args.segmented:
+            engine.merge_segments()
+        needs_indexing = False
+    else:
+        # Load existing index or create a new one
+        needs_indexing = args.reindex or not engine.load()
 
     if needs_indexing:
         if not args.directory:
@@ -106,6 +165,7 @@ def main():
 
         if args.reindex:
             engine.create_new()
+        engine.set_memory_budget(args.memory_budget << 20)
 
         # Index directory
         if not engine.index_directory(args.directory):
@@ -113,11 +173,17 @@ def main():
             return 1
 
         # Save the index
-        engine.save()
+        if not engine.save(segmented=args.segmented):
+            print("Saving the index failed!")
+            return 1
+
+    if args.verify and engine.is_indexed() and not engine.verify():
+        print("Error: the index is damaged, rebuild it with --reindex")
+        return 1
 
     # Start interactive search
     if engine.is_indexed():
-        interactive_search(engine)
+        interactive_search(engine, args.top)
     else:
         print("No index available. Please specify a directory to index.")
         return 1
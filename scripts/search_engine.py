@@ -4,8 +4,10 @@ Handles all C library interactions and state management
 """
 
 import os
+import re
 import ctypes
-from typing import List, Optional
+import weakref
+from typing import Iterator, List, Optional, Sequence, Tuple, Union
 
 
 class RawOccurence(ctypes.Structure):
@@ -16,38 +18,283 @@ class RawOccurence(ctypes.Structure):
     ]
 
 
+class ScoredOccurence(ctypes.Structure):
+    _fields_ = [
+        ("doc_id", ctypes.c_int),
+        ("page_num", ctypes.c_int),
+        ("byte_offset", ctypes.c_long),
+        ("score", ctypes.c_double),
+    ]
+
+
+class FuzzyTerm(ctypes.Structure):
+    _fields_ = [
+        ("term", ctypes.c_char_p),
+        ("distance", ctypes.c_int),
+        ("count", ctypes.c_int),
+    ]
+
+
+class SnippetBatch(ctypes.Structure):
+    _fields_ = [
+        ("text", ctypes.POINTER(ctypes.c_char)),
+        ("text_size", ctypes.c_size_t),
+        ("offsets", ctypes.POINTER(ctypes.c_int64)),
+        ("count", ctypes.c_int),
+    ]
+
+
+class QueryBatch(ctypes.Structure):
+    _fields_ = [
+        ("results", ctypes.POINTER(RawOccurence)),
+        ("offsets", ctypes.POINTER(ctypes.c_int64)),
+        ("counts", ctypes.POINTER(ctypes.c_int)),
+        ("total", ctypes.c_int64),
+        ("count", ctypes.c_int),
+    ]
+
+
+class DocPathTable(ctypes.Structure):
+    _fields_ = [
+        ("paths", ctypes.POINTER(ctypes.c_char)),
+        ("offsets", ctypes.POINTER(ctypes.c_uint64)),
+        ("paths_size", ctypes.c_uint64),
+        ("count", ctypes.c_int),
+    ]
+
+
+# Called as (paths, count, first_doc_id, user_data) for each crawled batch
+CRAWL_BATCH_TYPE = ctypes.CFUNCTYPE(
+    None,
+    ctypes.POINTER(ctypes.c_char_p),
+    ctypes.c_int,
+    ctypes.c_int,
+    ctypes.c_void_p,
+)
+
+
+class CrawlOptions(ctypes.Structure):
+    _fields_ = [
+        ("workers", ctypes.c_int),
+        ("include_ext", ctypes.POINTER(ctypes.c_char_p)),
+        ("exclude_ext", ctypes.POINTER(ctypes.c_char_p)),
+        ("batch_size", ctypes.c_int),
+        ("on_batch", CRAWL_BATCH_TYPE),
+        ("user_data", ctypes.c_void_p),
+    ]
+
+
+class CacheStats(ctypes.Structure):
+    _fields_ = [
+        ("hits", ctypes.c_uint64),
+        ("misses", ctypes.c_uint64),
+        ("evictions", ctypes.c_uint64),
+        ("entries", ctypes.c_uint64),
+        ("bytes", ctypes.c_uint64),
+        ("budget", ctypes.c_uint64),
+    ]
+
+
+class UpdateStats(ctypes.Structure):
+    _fields_ = [
+        ("added", ctypes.c_int),
+        ("modified", ctypes.c_int),
+        ("deleted", ctypes.c_int),
+        ("unchanged", ctypes.c_int),
+    ]
+
+
+def _c_string_list(items: Optional[List[str]]):
+    """NULL terminated char ** for the crawler's extension filters"""
+    if items is None:
+        return None
+    array = (ctypes.c_char_p * (len(items) + 1))()
+    for i, item in enumerate(items):
+        array[i] = item.encode("utf-8")
+    array[len(items)] = None
+    return array
+
+
+# "word NEAR/k word"
+NEAR_PATTERN = re.compile(r"(\S+)\s+NEAR/(\d+)\s+(\S+)")
+# "word~" (one edit) or "word~2"
+FUZZY_PATTERN = re.compile(r"(\S+)~([12])?")
+
+
+def parse_boolean_query(query: str):
+    """
+    Splits a query into (all_of, any_of, none_of) word lists. Words are
+    ANDed by default; NOT excludes the next word, and words joined by OR
+    become alternatives: "neural network NOT biology", "cat OR dog".
+    """
+    all_of, any_of, none_of = [], [], []
+    words = query.split()
+    i = 0
+    while i < len(words):
+        word = words[i]
+        if word == "NOT" and i + 1 < len(words):
+            none_of.append(words[i + 1])
+            i += 2
+            continue
+        if word in ("AND", "OR", "NOT"):
+            i += 1
+            continue
+        joined = (i > 0 and words[i - 1] == "OR") or (
+            i + 1 < len(words) and words[i + 1] == "OR"
+        )
+        (any_of if joined else all_of).append(word)
+        i += 1
+    return all_of, any_of, none_of
+
+
+def is_plain_query(query: str) -> bool:
+    """True for bare words: no quotes, operators, NEAR, wildcards or ~"""
+    if any(c in query for c in '"*?~'):
+        return False
+    return not any(
+        word in ("AND", "OR", "NOT") or word.startswith("NEAR/")
+        for word in query.split()
+    )
+
+
 class SearchResult:
     """Represents a single search result occurrence"""
 
     def __init__(
-        self, doc_id: int, page_num: int, byte_offset: int, doc_path: str = ""
+        self,
+        doc_id: int,
+        page_num: int,
+        byte_offset: int,
+        doc_path: str = "",
+        score: Optional[float] = None,
     ):
         self.doc_id = doc_id
         self.page_num = page_num
         self.byte_offset = byte_offset
         self.doc_path = doc_path
+        self.score = score  # BM25 score for ranked queries
 
     def __repr__(self):
+        if self.score is not None:
+            return f"SearchResult(doc={self.doc_id}, page={self.page_num}, offset={self.byte_offset}, score={self.score:.3f})"
         return f"SearchResult(doc={self.doc_id}, page={self.page_num}, offset={self.byte_offset})"
 
 
+class PathTable:
+    """
+    Every document path, taken from C in one call: a blob of NUL
+    terminated paths plus their offsets. Paths are decoded on first use.
+    """
+
+    def __init__(self, blob: bytes, offsets: memoryview):
+        self._blob = blob
+        self._offsets = offsets
+        self._decoded = {}
+
+    def __len__(self):
+        return len(self._offsets) - 1
+
+    def path(self, doc_id: int) -> str:
+        path = self._decoded.get(doc_id)
+        if path is None:
+            if not 0 <= doc_id < len(self):
+                return ""
+            start, end = self._offsets[doc_id], self._offsets[doc_id + 1]
+            path = self._blob[start : max(start, end - 1)].decode("utf-8")
+            self._decoded[doc_id] = path
+        return path
+
+
+class ResultSet(Sequence):
+    """
+    Search results left in the array the C search returned. The array is
+    exposed as-is through `buffer` (a memoryview of doc_id, page_num,
+    byte_offset[, score] records) and freed once neither the set nor a
+    view of it is alive; SearchResults are only built for the items that
+    are accessed.
+    """
+
+    def __init__(self, array, paths: Optional[PathTable]):
+        self._array = array
+        self._record = array._type_
+        self._paths = paths
+
+    @classmethod
+    def take(
+        cls, lib, results_ptr, count: int, record, paths: PathTable, release=None
+    ):
+        """
+        Adopts a C result array, handed to release (free_results() unless
+        told otherwise) when done
+        """
+        if count <= 0:
+            return cls((record * 0)(), paths)
+        array = ctypes.cast(results_ptr, ctypes.POINTER(record * count)).contents
+        # Tied to the array, so views taken from `buffer` keep it alive
+        weakref.finalize(
+            array,
+            release or lib.free_results,
+            ctypes.cast(results_ptr, ctypes.POINTER(RawOccurence)),
+        )
+        return cls(array, paths)
+
+    @property
+    def buffer(self) -> memoryview:
+        """The C records, without a copy"""
+        return memoryview(self._array)
+
+    def __len__(self) -> int:
+        return len(self._array)
+
+    def __getitem__(
+        self, index: Union[int, slice]
+    ) -> Union[SearchResult, List[SearchResult]]:
+        if isinstance(index, slice):
+            return [self[i] for i in range(*index.indices(len(self)))]
+        occ = self._array[index]
+        score = occ.score if self._record is ScoredOccurence else None
+        return SearchResult(
+            occ.doc_id,
+            occ.page_num,
+            occ.byte_offset,
+            self._paths.path(occ.doc_id),
+            score,
+        )
+
+    def __iter__(self) -> Iterator[SearchResult]:
+        for i in range(len(self)):
+            yield self[i]
+
+    def __repr__(self):
+        return f"ResultSet({len(self)} results)"
+
+
 class SearchEngine:
     """
     High-level interface to the C search engine library.
     Manages index creation, persistence, and querying.
     """
 
-    def __init__(self, data_dir: str = "data", lib_path: str = "lib/libengine.so"):
+    def __init__(
+        self,
+        data_dir: str = "data",
+        lib_path: str = "lib/libengine.so",
+        cache_bytes: int = 32 << 20,
+    ):
         """
         Initialize the search engine.
         Args:
             data_dir: Directory to store index files
             lib_path: Path to the compiled C library
+            cache_bytes: Memory budget for the results of repeated word
+                and phrase queries (0 disables the cache)
         """
 
         # Engine state
         self.engine = None
+        self.cache_bytes = cache_bytes
         self._is_indexed = False
+        self._paths = None  # PathTable, dropped whenever documents change
 
         # Setup paths
         self.data_dir = data_dir
@@ -81,6 +328,12 @@ class SearchEngine:
         self.lib.engine_deserialize.argtypes = [ctypes.c_char_p]
         self.lib.engine_deserialize.restype = ctypes.c_void_p
 
+        self.lib.engine_open_mapped.argtypes = [ctypes.c_char_p]
+        self.lib.engine_open_mapped.restype = ctypes.c_void_p
+
+        self.lib.engine_verify.argtypes = [ctypes.c_void_p]
+        self.lib.engine_verify.restype = ctypes.c_int
+
         # Indexing
         CALLBACK_TYPE = ctypes.CFUNCTYPE(None, ctypes.c_char_p)
         self.lib.crawl_directory.argtypes = [
@@ -89,9 +342,61 @@ class SearchEngine:
             CALLBACK_TYPE,
         ]
         self.lib.crawl_directory.restype = ctypes.c_int
+        self.lib.crawl_directory_parallel.argtypes = [
+            ctypes.c_char_p,
+            ctypes.c_void_p,
+            ctypes.POINTER(CrawlOptions),
+        ]
+        self.lib.crawl_directory_parallel.restype = ctypes.c_int
         self.lib.engine_index_all.argtypes = [ctypes.c_void_p]
         self.lib.engine_index_all.restype = None
 
+        # Called as (done, total, path, user_data) in doc id order
+        PROGRESS_TYPE = ctypes.CFUNCTYPE(
+            None, ctypes.c_int, ctypes.c_int, ctypes.c_char_p, ctypes.c_void_p
+        )
+        self.lib.engine_index_parallel.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_int,
+            PROGRESS_TYPE,
+            ctypes.c_void_p,
+        ]
+        self.lib.engine_index_parallel.restype = ctypes.c_int
+
+        # Incremental updates
+        self.lib.engine_update_directory.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_char_p,
+            ctypes.POINTER(CrawlOptions),
+            PROGRESS_TYPE,
+            ctypes.c_void_p,
+            ctypes.POINTER(UpdateStats),
+        ]
+        self.lib.engine_update_directory.restype = ctypes.c_int
+        self.lib.engine_compact.argtypes = [ctypes.c_void_p]
+        self.lib.engine_compact.restype = ctypes.c_int
+
+        # Segmented index
+        self.lib.engine_flush.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+        self.lib.engine_flush.restype = ctypes.c_int
+        self.lib.engine_merge_segments.argtypes = [ctypes.c_void_p]
+        self.lib.engine_merge_segments.restype = ctypes.c_int
+        self.lib.engine_set_background_merge.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_bool,
+        ]
+        self.lib.engine_set_background_merge.restype = ctypes.c_int
+        self.lib.engine_segment_count.argtypes = [ctypes.c_void_p]
+        self.lib.engine_segment_count.restype = ctypes.c_int
+
+        # Bounded-memory indexing
+        self.lib.engine_set_memory_budget.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_size_t,
+            ctypes.c_char_p,
+        ]
+        self.lib.engine_set_memory_budget.restype = ctypes.c_int
+
         # Search
         self.lib.get_search_results.argtypes = [
             ctypes.c_void_p,
@@ -100,12 +405,118 @@ class SearchEngine:
         ]
         self.lib.get_search_results.restype = ctypes.POINTER(RawOccurence)
 
+        self.lib.search_boolean.argtypes = [
+            ctypes.c_void_p,
+            ctypes.POINTER(ctypes.c_char_p),
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_char_p),
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_char_p),
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.lib.search_boolean.restype = ctypes.POINTER(RawOccurence)
+
+        self.lib.search_phrase.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_char_p,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.lib.search_phrase.restype = ctypes.POINTER(RawOccurence)
+
+        self.lib.search_near.argtypes = [
+            ctypes.c_void_p,
+            ctypes.POINTER(ctypes.c_char_p),
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.lib.search_near.restype = ctypes.POINTER(RawOccurence)
+
+        self.lib.search_prefix.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_char_p,
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.lib.search_prefix.restype = ctypes.POINTER(RawOccurence)
+        self.lib.count_prefix_terms.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+        self.lib.count_prefix_terms.restype = ctypes.c_long
+
+        self.lib.search_fuzzy_terms.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_char_p,
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.lib.search_fuzzy_terms.restype = ctypes.POINTER(FuzzyTerm)
+        self.lib.free_fuzzy_terms.argtypes = [
+            ctypes.POINTER(FuzzyTerm),
+            ctypes.c_int,
+        ]
+        self.lib.free_fuzzy_terms.restype = None
+        self.lib.search_fuzzy.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_char_p,
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.lib.search_fuzzy.restype = ctypes.POINTER(RawOccurence)
+
+        self.lib.search_ranked.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_char_p,
+            ctypes.c_int,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.lib.search_ranked.restype = ctypes.POINTER(ScoredOccurence)
+
+        self.lib.search_batch.argtypes = [
+            ctypes.c_void_p,
+            ctypes.POINTER(ctypes.c_char_p),
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.c_int,
+        ]
+        self.lib.search_batch.restype = ctypes.POINTER(QueryBatch)
+        self.lib.free_query_batch.argtypes = [ctypes.POINTER(QueryBatch)]
+        self.lib.free_query_batch.restype = None
+
         self.lib.free_results.argtypes = [ctypes.POINTER(RawOccurence)]
         self.lib.free_results.restype = None
 
+        # Result cache
+        self.lib.search_cached.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_char_p,
+            ctypes.POINTER(ctypes.c_int),
+        ]
+        self.lib.search_cached.restype = ctypes.POINTER(RawOccurence)
+        self.lib.release_results.argtypes = [ctypes.POINTER(RawOccurence)]
+        self.lib.release_results.restype = None
+        self.lib.engine_set_cache_budget.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_size_t,
+        ]
+        self.lib.engine_set_cache_budget.restype = ctypes.c_int
+        self.lib.engine_cache_stats.argtypes = [
+            ctypes.c_void_p,
+            ctypes.POINTER(CacheStats),
+        ]
+        self.lib.engine_cache_stats.restype = None
+
         # Document info
         self.lib.engine_get_document_path.argtypes = [ctypes.c_void_p, ctypes.c_int]
         self.lib.engine_get_document_path.restype = ctypes.c_char_p
+        self.lib.engine_export_paths.argtypes = [ctypes.c_void_p]
+        self.lib.engine_export_paths.restype = ctypes.POINTER(DocPathTable)
+        self.lib.free_doc_path_table.argtypes = [ctypes.POINTER(DocPathTable)]
+        self.lib.free_doc_path_table.restype = None
 
         # Snippets
         self.lib.get_snippet.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_long]
@@ -114,8 +525,27 @@ class SearchEngine:
         self.lib.free_snippet.argtypes = [ctypes.POINTER(ctypes.c_char)]
         self.lib.free_snippet.restype = None
 
-        # Store callback type for later use
+        self.lib.engine_get_snippet.argtypes = [
+            ctypes.c_void_p,
+            ctypes.c_int,
+            ctypes.c_int,
+            ctypes.c_long,
+        ]
+        self.lib.engine_get_snippet.restype = ctypes.POINTER(ctypes.c_char)
+
+        self.lib.get_snippets.argtypes = [
+            ctypes.c_void_p,
+            ctypes.POINTER(RawOccurence),
+            ctypes.c_int,
+            ctypes.c_int,
+        ]
+        self.lib.get_snippets.restype = ctypes.POINTER(SnippetBatch)
+        self.lib.free_snippet_batch.argtypes = [ctypes.POINTER(SnippetBatch)]
+        self.lib.free_snippet_batch.restype = None
+
+        # Store callback types for later use
         self.CALLBACK_TYPE = ctypes.CFUNCTYPE(None, ctypes.c_char_p)
+        self.PROGRESS_TYPE = PROGRESS_TYPE
 
     def create_new(self) -> bool:
         """Create a new empty search engine"""
@@ -124,12 +554,21 @@ class SearchEngine:
 
         self.engine = self.lib.engine_create()
         self._is_indexed = False
+        self._paths = None
+        if self.engine:
+            self.lib.engine_set_cache_budget(self.engine, self.cache_bytes)
         return self.engine is not None
 
-    def load(self) -> bool:
+    def load(self, read_only: bool = True) -> bool:
         """
         Load index from disk
 
+        Args:
+            read_only: Map the index file and search it in place (instant
+                startup, shared page cache; verify() checks what is not
+                checked on load). Pass False to get an engine that can
+                keep indexing, checked whole as it is read.
+
         Returns:
             True if loaded successfully, False otherwise
         """
@@ -137,20 +576,41 @@ class SearchEngine:
             return False
 
         print(f"[Engine] Loading index from {self.index_path}...")
-        self.engine = self.lib.engine_deserialize(self.index_path.encode("utf-8"))
+        self._paths = None
+        path = self.index_path.encode("utf-8")
+        if read_only:
+            self.engine = self.lib.engine_open_mapped(path)
+        else:
+            self.engine = self.lib.engine_deserialize(path)
 
         if self.engine:
             print("[Engine] Index loaded successfully")
+            self.lib.engine_set_cache_budget(self.engine, self.cache_bytes)
             self._is_indexed = True
             return True
         else:
             print("[Engine] Failed to load index")
             return False
 
-    def save(self) -> bool:
+    def verify(self) -> bool:
+        """
+        Check every checksum of the loaded index. A read-only load only
+        checks the header, paths and fingerprints, so startup does not
+        read the whole file; this reads it once.
+        """
+        if not self.engine:
+            return False
+        return self.lib.engine_verify(self.engine) == 0
+
+    def save(self, segmented: bool = False) -> bool:
         """
         Save index to disk.
 
+        Args:
+            segmented: Write the documents added since the last save as a
+                new segment next to a manifest instead of rewriting the
+                whole file. Once segmented, every save works that way.
+
         Returns:
             True if saved successfully, False otherwise
         """
@@ -159,22 +619,39 @@ class SearchEngine:
             return False
 
         print(f"[Engine] Saving index to {self.index_path}...")
-        result = self.lib.engine_serialize(self.engine, self.index_path.encode("utf-8"))
+        path = self.index_path.encode("utf-8")
+        if segmented:
+            result = self.lib.engine_flush(self.engine, path)
+        else:
+            result = self.lib.engine_serialize(self.engine, path)
 
         if result == 0:
             print("[Engine] Index saved successfully")
             return True
         else:
-            print("[Engine] Failed ot save index")
+            print("[Engine] Failed to save index")
             return False
 
-    def index_directory(self, directory: str, callback=None) -> bool:
+    def index_directory(
+        self,
+        directory: str,
+        callback=None,
+        workers: int = 0,
+        progress=None,
+        include_ext: Optional[List[str]] = None,
+        exclude_ext: Optional[List[str]] = None,
+    ) -> bool:
         """
         Index all PDFs in a directory
 
         Args:
             directory: Path to directory containing PDFs
             callback: Optional Python function to call for each PDF found
+            workers: Crawling and indexing threads, 0 for one per CPU
+            progress: Optional function(done, total, path) called as each
+                document lands in the index
+            include_ext: Extensions to pick up (default: ["pdf"])
+            exclude_ext: Extensions to skip even if included
 
         Returns:
             True if indexing succeeded, False otherwise
@@ -187,12 +664,25 @@ class SearchEngine:
             path_str = path_bytes.decode("utf-8")
             print(f"[Engine] Found PDF: {path_str}")
 
-        c_callback = self.CALLBACK_TYPE(callback or default_callback)
+        found = callback or default_callback
+
+        # One call per batch; the crawler serializes them
+        def on_batch(paths, count, _first_doc_id, _user_data):
+            for i in range(count):
+                found(paths[i])
+
+        include = _c_string_list(include_ext)
+        exclude = _c_string_list(exclude_ext)
+        options = CrawlOptions()
+        options.workers = workers
+        options.include_ext = include
+        options.exclude_ext = exclude
+        options.on_batch = CRAWL_BATCH_TYPE(on_batch)
 
         # Crawl and collect PDFs
         print(f"[Engine] Crawling directory: {directory}")
-        result = self.lib.crawl_directory(
-            directory.encode("utf-8"), self.engine, c_callback
+        result = self.lib.crawl_directory_parallel(
+            directory.encode("utf-8"), self.engine, ctypes.byref(options)
         )
 
         if result != 0:
@@ -200,55 +690,392 @@ class SearchEngine:
             return False
 
         # Index all found PDFs
+        def default_progress(done, total, path_bytes, _user_data):
+            print(f"[Engine] Indexed [{done}/{total}]: {path_bytes.decode('utf-8')}")
+
+        def user_progress(done, total, path_bytes, _user_data):
+            progress(done, total, path_bytes.decode("utf-8"))
+
+        c_progress = self.PROGRESS_TYPE(
+            user_progress if progress else default_progress
+        )
+
         print("[Engine] Starting indexing...")
-        self.lib.engine_index_all(self.engine)
+        self._paths = None
+        if self.lib.engine_index_parallel(self.engine, workers, c_progress, None) != 0:
+            print("[Engine] Indexing failed")
+            return False
         print("[Engine] Indexing complete!")
 
         self._is_indexed = True
         return True
 
-    def search(self, query: str) -> List[SearchResult]:
+    def update_directory(
+        self, directory: str, workers: int = 0, progress=None
+    ) -> Optional[UpdateStats]:
+        """
+        Bring a loaded index up to date with a directory: unchanged files
+        are skipped, new and modified ones are indexed, deleted ones are
+        hidden from results until compact() runs.
+
+        Args:
+            directory: Path that was indexed before
+            workers: Crawling and indexing threads, 0 for one per CPU
+            progress: Optional function(done, total, path) per indexed file
+
+        Returns:
+            UpdateStats on success, None on failure
+        """
+        if not self.engine:
+            self.create_new()
+
+        def default_progress(done, total, path_bytes, _user_data):
+            print(f"[Engine] Indexed [{done}/{total}]: {path_bytes.decode('utf-8')}")
+
+        def user_progress(done, total, path_bytes, _user_data):
+            progress(done, total, path_bytes.decode("utf-8"))
+
+        c_progress = self.PROGRESS_TYPE(
+            user_progress if progress else default_progress
+        )
+        options = CrawlOptions()
+        options.workers = workers
+        stats = UpdateStats()
+
+        print(f"[Engine] Updating from directory: {directory}")
+        self._paths = None
+        result = self.lib.engine_update_directory(
+            self.engine,
+            directory.encode("utf-8"),
+            ctypes.byref(options),
+            c_progress,
+            None,
+            ctypes.byref(stats),
+        )
+        if result != 0:
+            print("[Engine] Update failed")
+            return None
+        print(
+            f"[Engine] {stats.added} added, {stats.modified} modified, "
+            f"{stats.deleted} deleted, {stats.unchanged} unchanged"
+        )
+
+        self._is_indexed = True
+        return stats
+
+    def compact(self) -> bool:
+        """Drop deleted and replaced documents from the index for good"""
+        if not self.engine:
+            return False
+        self._paths = None
+        return self.lib.engine_compact(self.engine) == 0
+
+    def merge_segments(self) -> int:
+        """Merge segments of one size tier now; the merges done, -1 on error"""
+        if not self.engine:
+            return -1
+        return self.lib.engine_merge_segments(self.engine)
+
+    def set_background_merge(self, enabled: bool) -> bool:
+        """Merge segments on a background thread after every segmented save"""
+        if not self.engine:
+            return False
+        return self.lib.engine_set_background_merge(self.engine, enabled) == 0
+
+    def set_memory_budget(self, nbytes: int, temp_dir: Optional[str] = None) -> bool:
+        """
+        Cap the in-memory index at nbytes while indexing (0 lifts the cap).
+        Past it, what was indexed so far is spilled as a sorted run file
+        under temp_dir (default: $TMPDIR or /tmp); save() merges the runs
+        into one index file, save(segmented=True) keeps them as segments.
+        """
+        if not self.engine:
+            return False
+        path = temp_dir.encode("utf-8") if temp_dir else None
+        return self.lib.engine_set_memory_budget(self.engine, nbytes, path) == 0
+
+    def segment_count(self) -> int:
+        """Segments the index is made of, 0 when it is one file"""
+        if not self.engine:
+            return 0
+        return self.lib.engine_segment_count(self.engine)
+
+    def search(self, query: str, top_k: int = 0) -> Sequence[SearchResult]:
         """
-        Search for a word in the index.
+        Search for a word in the index. With top_k > 0, plain words (no
+        operators or wildcards) go through search_ranked and come back as
+        the best top_k documents. A "quoted phrase" goes through
+        search_phrase, "word NEAR/k word" through search_near, a single
+        word with * or ? wildcards through search_prefix, "word~" or
+        "word~2" through search_fuzzy, and queries
+        with several words or the AND / OR / NOT operators through
+        search_boolean (see parse_boolean_query).
 
         Args:
             query: Word to search for
         Returns:
-            List of SearchResult objects
+            A ResultSet over the C results (SearchResults built on access)
         """
         if not self.engine or not self._is_indexed:
             return []
 
         # Clean and prepare query
         clean_query = query.lower().strip()
+        if top_k > 0 and is_plain_query(query):
+            return self.search_ranked(query, top_k)
+        if len(clean_query) > 1 and clean_query[0] == clean_query[-1] == '"':
+            return self.search_phrase(clean_query[1:-1])
+        near = NEAR_PATTERN.fullmatch(query.strip())
+        if near:
+            return self.search_near(
+                [near.group(1), near.group(3)], int(near.group(2))
+            )
+        fuzzy = FUZZY_PATTERN.fullmatch(clean_query)
+        if fuzzy:
+            return self.search_fuzzy(fuzzy.group(1), int(fuzzy.group(2) or 1))
+        if len(clean_query.split()) > 1:
+            all_of, any_of, none_of = parse_boolean_query(query)
+            return self.search_boolean(all_of, any_of, none_of)
+        if "*" in clean_query or "?" in clean_query:
+            return self.search_prefix(clean_query)
         count = ctypes.c_int()
 
-        # Get results from C
-        results_ptr = self.lib.get_search_results(
+        # Get results from C, shared with its cache
+        results_ptr = self.lib.search_cached(
             self.engine, clean_query.encode("utf-8"), ctypes.byref(count)
         )
+        return ResultSet.take(
+            self.lib,
+            results_ptr,
+            count.value,
+            RawOccurence,
+            self._path_table(),
+            self.lib.release_results,
+        )
+
+    def cache_stats(self) -> dict:
+        """Hits, misses, evictions, entries, bytes and budget of the cache"""
+        stats = CacheStats()
+        if self.engine:
+            self.lib.engine_cache_stats(self.engine, ctypes.byref(stats))
+        return {name: getattr(stats, name) for name, _ in CacheStats._fields_}
+
+    def search_boolean(
+        self,
+        all_of: List[str] = (),
+        any_of: List[str] = (),
+        none_of: List[str] = (),
+        per_page: bool = False,
+    ) -> Sequence[SearchResult]:
+        """
+        Boolean search evaluated in C: every word of all_of, at least one of
+        any_of (if given) and none of none_of, in the same document, or the
+        same page with per_page. One result per document (or page).
+        """
+        if not self.engine or not self._is_indexed:
+            return []
+
+        def words(items):
+            array = (ctypes.c_char_p * max(len(items), 1))()
+            for i, item in enumerate(items):
+                array[i] = item.encode("utf-8")
+            return array, len(items)
+
+        must, must_count = words(list(all_of))
+        should, should_count = words(list(any_of))
+        must_not, not_count = words(list(none_of))
+        count = ctypes.c_int()
+        results_ptr = self.lib.search_boolean(
+            self.engine,
+            must,
+            must_count,
+            should,
+            should_count,
+            must_not,
+            not_count,
+            1 if per_page else 0,
+            ctypes.byref(count),
+        )
+
+        return self._take_results(results_ptr, count.value)
+
+    def search_phrase(self, phrase: str) -> Sequence[SearchResult]:
+        """
+        Every place where the words of `phrase` appear in order on a page.
+        Needs an index built with token positions; older ones return [].
+        """
+        if not self.engine or not self._is_indexed:
+            return []
+        count = ctypes.c_int()
+        results_ptr = self.lib.search_phrase(
+            self.engine, phrase.encode("utf-8"), ctypes.byref(count)
+        )
+        return self._take_results(results_ptr, count.value)
+
+    def search_near(self, words: List[str], distance: int) -> Sequence[SearchResult]:
+        """
+        NEAR/distance: all words on one page, in any order, with at most
+        `distance` other words between them.
+        """
+        if not self.engine or not self._is_indexed:
+            return []
+        array = (ctypes.c_char_p * max(len(words), 1))()
+        for i, word in enumerate(words):
+            array[i] = word.encode("utf-8")
+        count = ctypes.c_int()
+        results_ptr = self.lib.search_near(
+            self.engine, array, len(words), distance, ctypes.byref(count)
+        )
+        return self._take_results(results_ptr, count.value)
+
+    def search_prefix(
+        self, pattern: str, max_terms: int = 0, max_results: int = 0
+    ) -> Sequence[SearchResult]:
+        """
+        Wildcard search: "optim*" matches every word starting with optim,
+        "colo?r" one character in place of the ?. The pattern must start
+        with a literal. At most max_terms matching words are merged (0 for
+        the C default) and at most max_results hits returned (0: all).
+        """
+        if not self.engine or not self._is_indexed:
+            return []
+        count = ctypes.c_int()
+        results_ptr = self.lib.search_prefix(
+            self.engine,
+            pattern.encode("utf-8"),
+            max_terms,
+            max_results,
+            ctypes.byref(count),
+        )
+        return self._take_results(results_ptr, count.value)
+
+    def count_prefix_terms(self, prefix: str) -> int:
+        """How many indexed words start with prefix (capped at 65535)"""
+        if not self.engine or not self._is_indexed:
+            return 0
+        return self.lib.count_prefix_terms(self.engine, prefix.encode("utf-8"))
 
-        # Parse results
-        results = []
+    def search_fuzzy_terms(
+        self, word: str, max_distance: int = 1, max_terms: int = 0
+    ) -> List[Tuple[str, int, int]]:
+        """
+        Indexed words within max_distance edits (1 or 2) of word, as
+        (term, distance, postings) tuples, closest and most frequent first.
+        """
+        if not self.engine or not self._is_indexed:
+            return []
+        count = ctypes.c_int()
+        terms_ptr = self.lib.search_fuzzy_terms(
+            self.engine,
+            word.encode("utf-8"),
+            max_distance,
+            max_terms,
+            ctypes.byref(count),
+        )
+        terms = [
+            (t.term.decode("utf-8"), t.distance, t.count)
+            for t in terms_ptr[: count.value]
+        ]
         if count.value > 0:
-            occurrences = ctypes.cast(results_ptr, ctypes.POINTER(RawOccurence))
-            for i in range(count.value):
-                occ = occurrences[i]
-                doc_id = occ.doc_id
-                page_num = occ.page_num
-                byte_offset = occ.byte_offset
+            self.lib.free_fuzzy_terms(terms_ptr, count.value)
+        return terms
+
+    def search_fuzzy(
+        self,
+        word: str,
+        max_distance: int = 1,
+        max_terms: int = 0,
+        max_results: int = 0,
+    ) -> Sequence[SearchResult]:
+        """Occurrences of every word search_fuzzy_terms would return"""
+        if not self.engine or not self._is_indexed:
+            return []
+        count = ctypes.c_int()
+        results_ptr = self.lib.search_fuzzy(
+            self.engine,
+            word.encode("utf-8"),
+            max_distance,
+            max_terms,
+            max_results,
+            ctypes.byref(count),
+        )
+        return self._take_results(results_ptr, count.value)
+
+    def search_ranked(self, query: str, k: int = 10) -> Sequence[SearchResult]:
+        """
+        BM25 ranking of the documents holding any word of query; returns
+        the best k, best first, each at its first query word.
+        """
+        if not self.engine or not self._is_indexed:
+            return []
+        count = ctypes.c_int()
+        results_ptr = self.lib.search_ranked(
+            self.engine, query.encode("utf-8"), k, ctypes.byref(count)
+        )
+        return ResultSet.take(
+            self.lib, results_ptr, count.value, ScoredOccurence, self._path_table()
+        )
+
+    def search_batch(
+        self, queries: Sequence[str], max_results: int = 0, workers: int = 0
+    ) -> List[ResultSet]:
+        """
+        Many lookups in one call, spread over `workers` threads (0 for one
+        per CPU): a query that is one word lists its occurrences, several
+        words are matched as a phrase. At most max_results hits per query
+        (0: all). Returns one ResultSet per query, all viewing a single
+        packed C buffer.
+        """
+        if not self.engine or not self._is_indexed:
+            return [ResultSet((RawOccurence * 0)(), None) for _ in queries]
+        array = (ctypes.c_char_p * len(queries))(
+            *(query.encode("utf-8") for query in queries)
+        )
+        batch_ptr = self.lib.search_batch(
+            self.engine, array, len(queries), max_results, workers
+        )
+        if not batch_ptr:
+            raise MemoryError("search_batch failed")
 
-                # Get document path
-                doc_path = self.lib.engine_get_document_path(
-                    self.engine, doc_id
-                ).decode("utf-8")
-                result = SearchResult(doc_id, page_num, byte_offset, doc_path)
-                results.append(result)
+        batch = batch_ptr.contents
+        packed = (RawOccurence * batch.total).from_address(
+            ctypes.addressof(batch.results.contents)
+        )
+        weakref.finalize(packed, self.lib.free_query_batch, batch_ptr)
+        paths = self._path_table()
+        size = ctypes.sizeof(RawOccurence)
+        return [
+            ResultSet(
+                (RawOccurence * batch.counts[q]).from_buffer(
+                    packed, batch.offsets[q] * size
+                ),
+                paths,
+            )
+            for q in range(batch.count)
+        ]
 
-            # Free C memory
-            self.lib.free_results(results_ptr)
+    def _path_table(self) -> PathTable:
+        """Every document path, exported from C once per index state"""
+        if self._paths is None:
+            table_ptr = self.lib.engine_export_paths(self.engine)
+            if not table_ptr:
+                raise MemoryError("engine_export_paths failed")
+            try:
+                table = table_ptr.contents
+                blob = ctypes.string_at(table.paths, table.paths_size)
+                offsets = memoryview(
+                    ctypes.string_at(table.offsets, 8 * (table.count + 1))
+                ).cast("Q")
+            finally:
+                self.lib.free_doc_path_table(table_ptr)
+            self._paths = PathTable(blob, offsets)
+        return self._paths
 
-        return results
+    def _take_results(self, results_ptr, count: int) -> ResultSet:
+        """Wraps a C occurrence array, which the ResultSet then owns"""
+        return ResultSet.take(
+            self.lib, results_ptr, count, RawOccurence, self._path_table()
+        )
 
     def get_snippet(self, result: SearchResult) -> Optional[str]:
         """
@@ -260,9 +1087,15 @@ class SearchEngine:
         Returns:
             Text snippet or None if failed
         """
-        raw_snippet_ptr = self.lib.get_snippet(
-            result.doc_path.encode("utf-8"), result.page_num, result.byte_offset
-        )
+        # Served from the saved page texts when possible, else the PDF
+        if self.engine:
+            raw_snippet_ptr = self.lib.engine_get_snippet(
+                self.engine, result.doc_id, result.page_num, result.byte_offset
+            )
+        else:
+            raw_snippet_ptr = self.lib.get_snippet(
+                result.doc_path.encode("utf-8"), result.page_num, result.byte_offset
+            )
 
         if not raw_snippet_ptr:
             return None
@@ -275,6 +1108,54 @@ class SearchEngine:
             # Always free C memory
             self.lib.free_snippet(raw_snippet_ptr)
 
+    def get_snippets(
+        self, results: Sequence[SearchResult], workers: int = 0
+    ) -> List[Optional[str]]:
+        """
+        Get snippets for many results at once. Each PDF is opened once and
+        each page extracted once, however many results point into it.
+
+        Args:
+            results: SearchResult objects from search()
+            workers: Threads to spread the documents over, 0 for one per CPU
+
+        Returns:
+            One snippet (or None if failed) per result, in the same order
+        """
+        if not self.engine or not results:
+            return [None] * len(results)
+
+        # Unranked result sets are passed back to C as they are
+        if isinstance(results, ResultSet) and results._record is RawOccurence:
+            hits = results._array
+        else:
+            hits = (RawOccurence * len(results))()
+            for i, result in enumerate(results):
+                hits[i].doc_id = result.doc_id
+                hits[i].page_num = result.page_num
+                hits[i].byte_offset = result.byte_offset
+
+        batch_ptr = self.lib.get_snippets(self.engine, hits, len(results), workers)
+        if not batch_ptr:
+            return [None] * len(results)
+
+        try:
+            batch = batch_ptr.contents
+            text = ctypes.string_at(batch.text, batch.text_size)
+            snippets: List[Optional[str]] = []
+            for i in range(batch.count):
+                start = batch.offsets[i]
+                if start < 0:
+                    snippets.append(None)
+                    continue
+                end = text.index(b"\0", start)
+                snippet = text[start:end].decode("utf-8", errors="ignore")
+                snippets.append(snippet.replace("\n", " "))
+            return snippets
+        finally:
+            # Always free C memory
+            self.lib.free_snippet_batch(batch_ptr)
+
     def is_indexed(self) -> bool:
         """Check if engine has been indexed"""
         return self._is_indexed
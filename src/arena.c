@@ -0,0 +1,312 @@
+#include "arena.h"
+#include "epoch.h"
+#include <stdlib.h>
+#include <string.h>
+
+int slab_pool_init(slab_pool_t *pool, size_t elem_size, uint32_t slab_shift) {
+  pool->elem_size = elem_size;
+  pool->slab_shift = slab_shift;
+  pool->next_handle = 1; // Skip ARENA_NULL
+  pool->free_list = ARENA_NULL;
+  pool->slab_count = 0;
+  pool->slab_capacity = 0;
+  pool->slabs = NULL;
+  pool->borrowed = false;
+  pool->epoch = NULL;
+  return 0;
+}
+
+// Largest power-of-two record count that keeps a slab within slab_bytes
+uint32_t slab_shift_for(size_t elem_size, size_t slab_bytes) {
+  uint32_t shift = 0;
+  while (((size_t)2 << shift) * elem_size <= slab_bytes && shift < 24)
+    shift++;
+  return shift;
+}
+
+/*
+ * Grow a slab directory so it can hold `slabs` entries. The `used` ones
+ * move into a new array published with a release store; readers may still
+ * hold the old array, so it is retired rather than freed.
+ */
+static int reserve_directory(char ***directory, uint32_t *capacity,
+                             uint32_t used, uint32_t slabs,
+                             struct Epoch *epoch) {
+  if (slabs <= *capacity)
+    return 0;
+  uint32_t new_capacity = *capacity ? *capacity : 8;
+  while (new_capacity < slabs)
+    new_capacity *= 2;
+  char **temp = calloc(new_capacity, sizeof(char *));
+  if (temp == NULL)
+    return -1;
+  char **old = *directory;
+  if (used > 0)
+    memcpy(temp, old, sizeof(char *) * used);
+  __atomic_store_n(directory, temp, __ATOMIC_RELEASE);
+  *capacity = new_capacity;
+  if (old != NULL)
+    epoch_retire(epoch, epoch_release_memory, NULL, (uintptr_t)old);
+  return 0;
+}
+
+// Append one more slab to the pool
+static int slab_pool_grow(slab_pool_t *pool) {
+  if (reserve_directory(&pool->slabs, &pool->slab_capacity, pool->slab_count,
+                        pool->slab_count + 1, pool->epoch) != 0) {
+    return -1;
+  }
+
+  // Zeroed memory so fresh records start out with NULL handles
+  char *slab = calloc((size_t)1 << pool->slab_shift, pool->elem_size);
+  if (slab == NULL) {
+    return -1;
+  }
+  pool->slabs[pool->slab_count++] = slab;
+  return 0;
+}
+
+uint32_t slab_pool_alloc(slab_pool_t *pool) {
+  // Reuse a recycled record first (and hand it out zeroed like a fresh one)
+  if (pool->free_list != ARENA_NULL) {
+    uint32_t handle = pool->free_list;
+    void *record = slab_pool_get(pool, handle);
+    memcpy(&pool->free_list, record, sizeof(uint32_t));
+    memset(record, 0, pool->elem_size);
+    return handle;
+  }
+
+  uint32_t handle = pool->next_handle;
+  if (handle == UINT32_MAX) {
+    return ARENA_NULL; // Handle space exhausted
+  }
+
+  if ((handle >> pool->slab_shift) >= pool->slab_count) {
+    if (slab_pool_grow(pool) != 0) {
+      return ARENA_NULL;
+    }
+  }
+  pool->next_handle++;
+  return handle;
+}
+
+// Give a record back to the pool so the next alloc can reuse it
+void slab_pool_free(slab_pool_t *pool, uint32_t handle) {
+  if (handle == ARENA_NULL)
+    return;
+  memcpy(slab_pool_get(pool, handle), &pool->free_list, sizeof(uint32_t));
+  pool->free_list = handle;
+}
+
+// Frees every slab at once: O(slabs), not O(records)
+void slab_pool_release(slab_pool_t *pool) {
+  for (uint32_t i = 0; i < pool->slab_count && !pool->borrowed; i++) {
+    free(pool->slabs[i]);
+  }
+  free(pool->slabs);
+  pool->slabs = NULL;
+  pool->slab_count = 0;
+  pool->slab_capacity = 0;
+  pool->next_handle = 1;
+  pool->free_list = ARENA_NULL;
+  pool->borrowed = false;
+}
+
+/*
+ * Forget every record but keep the slabs for the next round of allocations.
+ * Records handed out so far are zeroed again, so alloc keeps its contract.
+ */
+void slab_pool_reset(slab_pool_t *pool) {
+  size_t per_slab = (size_t)1 << pool->slab_shift;
+  size_t remaining = slab_pool_count(pool);
+  for (uint32_t i = 0; i < pool->slab_count && remaining > 0; i++) {
+    size_t records = remaining < per_slab ? remaining : per_slab;
+    memset(pool->slabs[i], 0, records * pool->elem_size);
+    remaining -= records;
+  }
+  pool->next_handle = 1;
+  pool->free_list = ARENA_NULL;
+}
+
+size_t slab_pool_bytes(const slab_pool_t *pool) {
+  return (size_t)pool->slab_count * ((size_t)1 << pool->slab_shift) *
+             pool->elem_size +
+         sizeof(char *) * pool->slab_capacity;
+}
+
+/*
+ * Writes records [0, next_handle) back to back, one fwrite per slab.
+ * Record i lands at byte i * elem_size, so the image can be attached again.
+ */
+int slab_pool_write(const slab_pool_t *pool, FILE *fp) {
+  size_t per_slab = (size_t)1 << pool->slab_shift;
+  size_t remaining = slab_pool_count(pool);
+  for (uint32_t i = 0; i < pool->slab_count && remaining > 0; i++) {
+    size_t records = remaining < per_slab ? remaining : per_slab;
+    if (fwrite(pool->slabs[i], pool->elem_size, records, fp) != records)
+      return -1;
+    remaining -= records;
+  }
+  return remaining == 0 ? 0 : -1;
+}
+
+/*
+ * Rebuild a pool over `count` records written by slab_pool_write().
+ * With copy the records move into owned slabs and the pool stays writable;
+ * without it the directory points straight into the image (zero-copy).
+ */
+int slab_pool_attach(slab_pool_t *pool, void *image, size_t elem_size,
+                     uint32_t slab_shift, uint32_t count, bool copy) {
+  slab_pool_init(pool, elem_size, slab_shift);
+  if (count == 0)
+    return 0;
+
+  size_t per_slab = (size_t)1 << slab_shift;
+  uint32_t slabs = (uint32_t)((count + per_slab - 1) / per_slab);
+  if (reserve_directory(&pool->slabs, &pool->slab_capacity, 0, slabs,
+                        NULL) != 0)
+    return -1;
+
+  char *src = image;
+  for (uint32_t i = 0; i < slabs; i++) {
+    if (copy) {
+      size_t records = count - i * per_slab;
+      if (records > per_slab)
+        records = per_slab;
+      pool->slabs[i] = calloc(per_slab, elem_size);
+      if (pool->slabs[i] == NULL)
+        return -1;
+      pool->slab_count++;
+      memcpy(pool->slabs[i], src, records * elem_size);
+    } else {
+      pool->slabs[i] = src;
+      pool->slab_count++;
+    }
+    src += per_slab * elem_size;
+  }
+  pool->borrowed = !copy;
+  pool->next_handle = count;
+  return 0;
+}
+
+void byte_arena_init(byte_arena_t *arena) {
+  arena->slabs = NULL;
+  arena->slab_count = 0;
+  arena->slab_capacity = 0;
+  arena->next_unit = 1; // Skip ARENA_NULL
+  arena->borrowed = false;
+  arena->epoch = NULL;
+}
+
+// Returns a zeroed, 8-byte aligned region of at least `bytes` bytes
+uint32_t byte_arena_alloc(byte_arena_t *arena, size_t bytes) {
+  uint32_t slab_units = 1u << BYTE_ARENA_SLAB_SHIFT;
+  uint32_t units = (uint32_t)((bytes + BYTE_ARENA_UNIT - 1) / BYTE_ARENA_UNIT);
+  if (units == 0 || units > slab_units) {
+    return ARENA_NULL;
+  }
+
+  uint32_t offset = arena->next_unit & (slab_units - 1);
+  uint32_t slab = arena->next_unit >> BYTE_ARENA_SLAB_SHIFT;
+
+  // Skip the tail of the current slab if the region does not fit in it
+  if (slab < arena->slab_count && offset + units > slab_units) {
+    slab++;
+    offset = 0;
+  }
+
+  if (((uint64_t)slab << BYTE_ARENA_SLAB_SHIFT) + offset + units >=
+      UINT32_MAX) {
+    return ARENA_NULL; // Handle space exhausted
+  }
+
+  if (slab >= arena->slab_count) {
+    if (reserve_directory(&arena->slabs, &arena->slab_capacity,
+                          arena->slab_count, arena->slab_count + 1,
+                          arena->epoch) != 0) {
+      return ARENA_NULL;
+    }
+    char *memory = calloc(slab_units, BYTE_ARENA_UNIT);
+    if (memory == NULL) {
+      return ARENA_NULL;
+    }
+    arena->slabs[arena->slab_count++] = memory;
+  }
+
+  uint32_t handle = (slab << BYTE_ARENA_SLAB_SHIFT) | offset;
+  arena->next_unit = handle + units;
+  return handle;
+}
+
+void byte_arena_release(byte_arena_t *arena) {
+  for (uint32_t i = 0; i < arena->slab_count && !arena->borrowed; i++) {
+    free(arena->slabs[i]);
+  }
+  free(arena->slabs);
+  byte_arena_init(arena);
+}
+
+// Like slab_pool_reset(): drop every block, keep (and re-zero) the slabs
+void byte_arena_reset(byte_arena_t *arena) {
+  size_t slab_units = (size_t)1 << BYTE_ARENA_SLAB_SHIFT;
+  size_t remaining = byte_arena_units(arena);
+  for (uint32_t i = 0; i < arena->slab_count && remaining > 0; i++) {
+    size_t units = remaining < slab_units ? remaining : slab_units;
+    memset(arena->slabs[i], 0, units * BYTE_ARENA_UNIT);
+    remaining -= units;
+  }
+  arena->next_unit = 1;
+}
+
+size_t byte_arena_bytes(const byte_arena_t *arena) {
+  return (size_t)arena->slab_count * ((size_t)1 << BYTE_ARENA_SLAB_SHIFT) *
+             BYTE_ARENA_UNIT +
+         sizeof(char *) * arena->slab_capacity;
+}
+
+// Writes units [0, next_unit) back to back, like slab_pool_write()
+int byte_arena_write(const byte_arena_t *arena, FILE *fp) {
+  size_t per_slab = (size_t)1 << BYTE_ARENA_SLAB_SHIFT;
+  size_t remaining = byte_arena_units(arena);
+  for (uint32_t i = 0; i < arena->slab_count && remaining > 0; i++) {
+    size_t units = remaining < per_slab ? remaining : per_slab;
+    if (fwrite(arena->slabs[i], BYTE_ARENA_UNIT, units, fp) != units)
+      return -1;
+    remaining -= units;
+  }
+  return remaining == 0 ? 0 : -1;
+}
+
+int byte_arena_attach(byte_arena_t *arena, void *image, uint32_t units,
+                      bool copy) {
+  byte_arena_init(arena);
+  if (units == 0)
+    return 0;
+
+  size_t per_slab = (size_t)1 << BYTE_ARENA_SLAB_SHIFT;
+  uint32_t slabs = (uint32_t)((units + per_slab - 1) / per_slab);
+  if (reserve_directory(&arena->slabs, &arena->slab_capacity, 0, slabs,
+                        NULL) != 0)
+    return -1;
+
+  char *src = image;
+  for (uint32_t i = 0; i < slabs; i++) {
+    if (copy) {
+      size_t count = units - i * per_slab;
+      if (count > per_slab)
+        count = per_slab;
+      arena->slabs[i] = calloc(per_slab, BYTE_ARENA_UNIT);
+      if (arena->slabs[i] == NULL)
+        return -1;
+      arena->slab_count++;
+      memcpy(arena->slabs[i], src, count * BYTE_ARENA_UNIT);
+    } else {
+      arena->slabs[i] = src;
+      arena->slab_count++;
+    }
+    src += per_slab * BYTE_ARENA_UNIT;
+  }
+  arena->borrowed = !copy;
+  arena->next_unit = units;
+  return 0;
+}
@@ -1,10 +1,16 @@
 #include "crawler.h"
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h> // for PATH_MAX
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 int crawl_directory(const char *path, search_engine_t *engine,
                     void (*callback)(const char *)) {
@@ -15,6 +21,12 @@ int crawl_directory(const char *path, search_engine_t *engine,
 
   char full_path[PATH_MAX];
 
+  // A mapped engine is read-only: its document table cannot grow
+  if (engine->mapping != NULL) {
+    fprintf(stderr, "Cannot crawl into a read-only mapped engine\n");
+    return -1;
+  }
+
   dir = opendir(path);
 
   if (dir == NULL) {
@@ -61,21 +73,12 @@ int crawl_directory(const char *path, search_engine_t *engine,
         } else if ((size_t)result >= sizeof(full_path)) {
           printf("Output truncated (%d chars)", result);
         }
-        if (engine->doc_count >= engine->doc_capacity) {
-          engine->doc_capacity *= 2;
-          char **temp_map = realloc(engine->document_map,
-                                    sizeof(char *) * engine->doc_capacity);
-          if (temp_map != NULL) {
-            engine->document_map = temp_map;
-          } else {
-            // Handle error: memory realloc failed
-            perror("realloc failed");
-            return -1;
-          }
+        if (engine_add_document(engine, full_path) < 0) {
+          // Handle error: memory realloc failed
+          perror("realloc failed");
+          closedir(dir);
+          return -1;
         }
-        engine->document_map[engine->doc_count] = strdup(full_path);
-        // int doc_id = engine->doc_count;
-        engine->doc_count++;
         callback(full_path); // Call the python function
       }
     }
@@ -86,3 +89,405 @@ int crawl_directory(const char *path, search_engine_t *engine,
 
   return 0;
 }
+
+/*
+ * Parallel crawl. Every worker owns a deque of directories still to scan:
+ * it pushes and pops at the back (depth first, so few descriptors stay
+ * open) and steals from the front of the others when its own runs dry.
+ * Directories are opened with openat() relative to their parent and read
+ * through fdopendir(), so no path is resolved twice. Files that pass the
+ * extension filters collect in a per-worker batch that is registered in
+ * the document table with one capacity check per batch.
+ */
+typedef struct CrawlDir {
+  int fd;      // open descriptor, or -1 to reopen by path
+  size_t len;  // path length, never counting a trailing '/'
+  char path[]; // NUL terminated
+} crawl_dir_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  crawl_dir_t **items; // ring buffer
+  int head;
+  int count;
+  int capacity;
+} crawl_deque_t;
+
+typedef struct {
+  char **paths;
+  int count;
+} crawl_batch_t;
+
+typedef struct {
+  search_engine_t *engine;
+  const char *const *include_ext;
+  const char *const *exclude_ext;
+  int batch_size;
+  crawl_batch_fn on_batch;
+  void *user_data;
+
+  int workers;
+  crawl_deque_t *deques;
+
+  int queued;    // directories sitting in a deque (atomic)
+  int pending;   // directories queued or being scanned (atomic)
+  int open_dirs; // queued directories holding a descriptor (atomic)
+  int sleeping;  // workers waiting for work (atomic)
+  pthread_mutex_t idle_lock;
+  pthread_cond_t work;
+
+  pthread_mutex_t register_lock; // document table and on_batch
+  bool failed;
+} crawl_job_t;
+
+typedef struct {
+  crawl_job_t *job;
+  int self;
+  crawl_batch_t batch;
+} crawl_worker_t;
+
+static const char *const default_include_ext[] = {"pdf", NULL};
+
+static bool ext_listed(const char *ext, const char *const *list) {
+  for (; list != NULL && *list != NULL; list++) {
+    if (strcasecmp(ext, *list) == 0)
+      return true;
+  }
+  return false;
+}
+
+static bool crawl_wants(const crawl_job_t *job, const char *name) {
+  // Skip names without an extension, and names that are only one (".pdf")
+  const char *dot = strrchr(name, '.');
+  if (dot == NULL || dot == name)
+    return false;
+  if (ext_listed(dot + 1, job->exclude_ext))
+    return false;
+  return ext_listed(dot + 1, job->include_ext);
+}
+
+// Joins dir and name; `name_len` is strlen(name)
+static char *join_path(const crawl_dir_t *dir, const char *name,
+                       size_t name_len, char *out) {
+  memcpy(out, dir->path, dir->len);
+  out[dir->len] = '/';
+  memcpy(out + dir->len + 1, name, name_len + 1);
+  return out;
+}
+
+static int deque_push(crawl_deque_t *deque, crawl_dir_t *dir) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity) {
+    int new_capacity = deque->capacity ? deque->capacity * 2 : 64;
+    crawl_dir_t **temp = malloc(sizeof(crawl_dir_t *) * new_capacity);
+    if (temp == NULL) {
+      pthread_mutex_unlock(&deque->lock);
+      return -1;
+    }
+    // Unroll the ring so the oldest entry sits at index 0
+    for (int i = 0; i < deque->count; i++) {
+      temp[i] = deque->items[(deque->head + i) % deque->capacity];
+    }
+    free(deque->items);
+    deque->items = temp;
+    deque->head = 0;
+    deque->capacity = new_capacity;
+  }
+  deque->items[(deque->head + deque->count) % deque->capacity] = dir;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+  return 0;
+}
+
+// The owner takes the newest entry, thieves the oldest
+static crawl_dir_t *deque_take(crawl_deque_t *deque, bool newest) {
+  crawl_dir_t *dir = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count > 0) {
+    if (newest) {
+      dir = deque->items[(deque->head + deque->count - 1) % deque->capacity];
+    } else {
+      dir = deque->items[deque->head];
+      deque->head = (deque->head + 1) % deque->capacity;
+    }
+    deque->count--;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return dir;
+}
+
+static void crawl_push(crawl_job_t *job, int self, crawl_dir_t *dir) {
+  __atomic_add_fetch(&job->pending, 1, __ATOMIC_SEQ_CST);
+  if (deque_push(&job->deques[self], dir) != 0) {
+    if (dir->fd >= 0) {
+      close(dir->fd);
+      __atomic_sub_fetch(&job->open_dirs, 1, __ATOMIC_SEQ_CST);
+    }
+    free(dir);
+    __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&job->pending, 1, __ATOMIC_SEQ_CST);
+    return;
+  }
+  __atomic_add_fetch(&job->queued, 1, __ATOMIC_SEQ_CST);
+
+  // Sleepers register before they look at `queued`, so none is missed
+  if (__atomic_load_n(&job->sleeping, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&job->idle_lock);
+    pthread_cond_signal(&job->work);
+    pthread_mutex_unlock(&job->idle_lock);
+  }
+}
+
+static crawl_dir_t *crawl_take(crawl_job_t *job, int self) {
+  crawl_dir_t *dir = deque_take(&job->deques[self], true);
+  for (int i = 1; dir == NULL && i < job->workers; i++) {
+    dir = deque_take(&job->deques[(self + i) % job->workers], false);
+  }
+  if (dir != NULL)
+    __atomic_sub_fetch(&job->queued, 1, __ATOMIC_SEQ_CST);
+  return dir;
+}
+
+// Appends a batch to the document table and hands it to the callback
+static void crawl_flush(crawl_job_t *job, crawl_batch_t *batch) {
+  if (batch->count == 0)
+    return;
+  search_engine_t *engine = job->engine;
+
+  pthread_mutex_lock(&job->register_lock);
+  int first = engine->doc_count;
+  bool failed = engine_reserve_documents(engine, batch->count) != 0;
+  for (int i = 0; !failed && i < batch->count; i++) {
+    failed = engine_add_document(engine, batch->paths[i]) < 0;
+  }
+  if (failed) {
+    perror("realloc failed");
+    __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+  } else if (job->on_batch != NULL) {
+    job->on_batch((const char *const *)batch->paths, batch->count, first,
+                  job->user_data);
+  }
+  pthread_mutex_unlock(&job->register_lock);
+  for (int i = 0; i < batch->count; i++) {
+    free(batch->paths[i]);
+  }
+  batch->count = 0;
+}
+
+static int crawl_open(crawl_dir_t *dir) {
+  if (dir->fd >= 0)
+    return dir->fd;
+  return open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static void crawl_scan(crawl_job_t *job, int self, crawl_dir_t *dir,
+                       crawl_batch_t *batch) {
+  bool held = dir->fd >= 0;
+  int fd = crawl_open(dir);
+  DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+  if (held)
+    __atomic_sub_fetch(&job->open_dirs, 1, __ATOMIC_SEQ_CST);
+  if (d == NULL) {
+    fprintf(stderr, "Could not open the directory %s: %s\n", dir->path,
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    free(dir);
+    return;
+  }
+
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    const char *name = de->d_name;
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+
+    // Some filesystems leave d_type unset; ask the inode without following
+    // symlinks, the sequential crawler skips those too
+    unsigned char type = de->d_type;
+    if (type == DT_UNKNOWN) {
+      struct stat st;
+      if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        continue;
+      type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG
+                                                                : DT_UNKNOWN;
+    }
+
+    if (type == DT_DIR) {
+      size_t name_len = strlen(name);
+      crawl_dir_t *child =
+          malloc(sizeof(crawl_dir_t) + dir->len + name_len + 2);
+      if (child == NULL) {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        continue;
+      }
+      join_path(dir, name, name_len, child->path);
+      child->len = dir->len + 1 + name_len;
+      child->fd = -1;
+      if (__atomic_add_fetch(&job->open_dirs, 1, __ATOMIC_SEQ_CST) <=
+          CRAWL_MAX_OPEN_DIRS) {
+        child->fd = openat(dirfd(d), name,
+                           O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      }
+      if (child->fd < 0)
+        __atomic_sub_fetch(&job->open_dirs, 1, __ATOMIC_SEQ_CST);
+      crawl_push(job, self, child);
+    } else if (type == DT_REG && crawl_wants(job, name)) {
+      size_t name_len = strlen(name);
+      char *full_path = malloc(dir->len + name_len + 2);
+      if (full_path == NULL) {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        continue;
+      }
+      batch->paths[batch->count++] = join_path(dir, name, name_len, full_path);
+      if (batch->count == job->batch_size)
+        crawl_flush(job, batch);
+    }
+  }
+
+  closedir(d);
+  free(dir);
+}
+
+static void *crawl_worker(void *arg) {
+  crawl_worker_t *worker = arg;
+  crawl_job_t *job = worker->job;
+
+  for (;;) {
+    crawl_dir_t *dir = crawl_take(job, worker->self);
+    if (dir != NULL) {
+      crawl_scan(job, worker->self, dir, &worker->batch);
+      if (__atomic_sub_fetch(&job->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&job->idle_lock);
+        pthread_cond_broadcast(&job->work);
+        pthread_mutex_unlock(&job->idle_lock);
+      }
+      continue;
+    }
+
+    // Nothing to steal: sleep until a push, or stop once nothing is pending
+    pthread_mutex_lock(&job->idle_lock);
+    __atomic_add_fetch(&job->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&job->queued, __ATOMIC_SEQ_CST) == 0 &&
+           __atomic_load_n(&job->pending, __ATOMIC_SEQ_CST) > 0) {
+      pthread_cond_wait(&job->work, &job->idle_lock);
+    }
+    __atomic_sub_fetch(&job->sleeping, 1, __ATOMIC_SEQ_CST);
+    bool done = __atomic_load_n(&job->pending, __ATOMIC_SEQ_CST) == 0;
+    pthread_mutex_unlock(&job->idle_lock);
+    if (done)
+      break;
+  }
+
+  crawl_flush(job, &worker->batch);
+  return NULL;
+}
+
+/*
+ * Crawls `path` with `options->workers` threads (the calling thread is one
+ * of them) and appends every matching file to the engine's document table.
+ * Doc ids follow discovery order, which depends on scheduling; each batch
+ * gets a consecutive range. `options` may be NULL for the defaults.
+ * Returns 0 on success, -1 if the root cannot be opened, the engine is
+ * read-only or memory ran out (files found so far stay registered).
+ */
+int crawl_directory_parallel(const char *path, search_engine_t *engine,
+                             const crawl_options_t *options) {
+  if (engine->mapping != NULL) {
+    fprintf(stderr, "Cannot crawl into a read-only mapped engine\n");
+    return -1;
+  }
+  crawl_options_t defaults = {0};
+  if (options == NULL)
+    options = &defaults;
+
+  crawl_job_t job = {0};
+  job.engine = engine;
+  job.include_ext =
+      options->include_ext ? options->include_ext : default_include_ext;
+  job.exclude_ext = options->exclude_ext;
+  job.batch_size =
+      options->batch_size > 0 ? options->batch_size : CRAWL_DEFAULT_BATCH;
+  job.on_batch = options->on_batch;
+  job.user_data = options->user_data;
+  job.workers = options->workers;
+  if (job.workers <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    job.workers = cpus > 0 ? (int)cpus : 1;
+  }
+
+  // 1. The root: open it as given, keep the path without trailing slashes
+  size_t len = strlen(path);
+  while (len > 0 && path[len - 1] == '/')
+    len--;
+  crawl_dir_t *root = malloc(sizeof(crawl_dir_t) + len + 1);
+  if (root == NULL)
+    return -1;
+  memcpy(root->path, path, len);
+  root->path[len] = '\0';
+  root->len = len;
+  root->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root->fd < 0) {
+    perror("Could not open the directory");
+    free(root);
+    return -1;
+  }
+  job.open_dirs = 1;
+
+  job.deques = calloc(job.workers, sizeof(crawl_deque_t));
+  crawl_worker_t *workers = calloc(job.workers, sizeof(crawl_worker_t));
+  pthread_t *threads = calloc(job.workers, sizeof(pthread_t));
+  bool ready = job.deques != NULL && workers != NULL && threads != NULL;
+  for (int i = 0; ready && i < job.workers; i++) {
+    workers[i].batch.paths = malloc(sizeof(char *) * job.batch_size);
+    ready = workers[i].batch.paths != NULL;
+  }
+  if (!ready) {
+    close(root->fd);
+    free(root);
+    for (int i = 0; workers != NULL && i < job.workers; i++) {
+      free(workers[i].batch.paths);
+    }
+    free(job.deques);
+    free(workers);
+    free(threads);
+    return -1;
+  }
+  for (int i = 0; i < job.workers; i++) {
+    pthread_mutex_init(&job.deques[i].lock, NULL);
+    workers[i].job = &job;
+    workers[i].self = i;
+  }
+  pthread_mutex_init(&job.idle_lock, NULL);
+  pthread_cond_init(&job.work, NULL);
+  pthread_mutex_init(&job.register_lock, NULL);
+  crawl_push(&job, 0, root);
+
+  // 2. Helpers steal from the calling thread, which starts at the root.
+  // Deques of threads that failed to start simply stay empty.
+  int started = 1;
+  while (started < job.workers &&
+         pthread_create(&threads[started], NULL, crawl_worker,
+                        &workers[started]) == 0) {
+    started++;
+  }
+  crawl_worker(&workers[0]);
+  for (int i = 1; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // 3. Every deque is empty once nothing is pending
+  for (int i = 0; i < job.workers; i++) {
+    pthread_mutex_destroy(&job.deques[i].lock);
+    free(job.deques[i].items);
+    free(workers[i].batch.paths);
+  }
+  pthread_cond_destroy(&job.work);
+  pthread_mutex_destroy(&job.idle_lock);
+  pthread_mutex_destroy(&job.register_lock);
+  free(job.deques);
+  free(threads);
+  free(workers);
+  return job.failed ? -1 : 0;
+}
@@ -0,0 +1,56 @@
+#include "crc32c.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__SSE4_2__)
+#include <immintrin.h>
+#else
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+// table[k][b]: the CRC of byte b followed by k zero bytes
+static void build_table(void) {
+  for (uint32_t b = 0; b < 256; b++) {
+    uint32_t crc = b;
+    for (int i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+    table[0][b] = crc;
+  }
+  for (uint32_t b = 0; b < 256; b++) {
+    for (int k = 1; k < 8; k++)
+      table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+  }
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t n) {
+  const uint8_t *p = data;
+  crc = ~crc;
+#if defined(__SSE4_2__)
+  // Eight bytes per instruction, the tail one at a time
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc = (uint32_t)_mm_crc32_u64(crc, word);
+  }
+  for (; n > 0; n--)
+    crc = _mm_crc32_u8(crc, *p++);
+#else
+  pthread_once(&table_once, build_table);
+
+  // Eight bytes per step, each through its own table (little endian)
+  for (; n >= 8; n -= 8, p += 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, sizeof(lo));
+    memcpy(&hi, p + 4, sizeof(hi));
+    lo ^= crc;
+    crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+          table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+          table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+          table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+  }
+  for (; n > 0; n--)
+    crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+#endif
+  return ~crc;
+}
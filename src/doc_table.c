@@ -0,0 +1,255 @@
+#include "doc_table.h"
+#include "postings.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Two varint lengths below DOC_TABLE_MAX_PATH take two bytes each
+#define ENTRY_HEADER_BYTES 4
+
+static uint64_t block_count(int count) {
+  return ((uint64_t)count + DOC_TABLE_BLOCK - 1) / DOC_TABLE_BLOCK;
+}
+
+// varint_decode() that stops at `end`; NULL if the value runs past it
+static const uint8_t *read_varint(const uint8_t *in, const uint8_t *end,
+                                  uint64_t *value) {
+  uint64_t v = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    uint8_t byte = *in++;
+    v |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *value = v;
+      return in;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Decodes one entry over path[0..*len), the path before it. Returns the
+ * position after the entry, NULL if it is malformed or would not fit in
+ * `room` bytes with its NUL.
+ */
+static const uint8_t *decode_entry(const uint8_t *pos, const uint8_t *end,
+                                   bool first, char *path, size_t *len,
+                                   size_t room) {
+  uint64_t shared = 0, rest;
+  if (!first && (pos = read_varint(pos, end, &shared)) == NULL)
+    return NULL;
+  if ((pos = read_varint(pos, end, &rest)) == NULL || shared > *len ||
+      rest > (uint64_t)(end - pos) || shared + rest >= room)
+    return NULL;
+  memcpy(path + shared, pos, rest);
+  *len = shared + rest;
+  path[*len] = '\0';
+  return pos + rest;
+}
+
+// Bounds of block b, NULL if the block index points outside the bytes
+static const uint8_t *block_bounds(const doc_table_t *table, uint64_t b,
+                                   const uint8_t **end) {
+  uint64_t start = table->blocks[b];
+  uint64_t stop =
+      b + 1 < block_count(table->count) ? table->blocks[b + 1] : table->size;
+  if (start > stop || stop > table->size)
+    return NULL;
+  *end = table->bytes + stop;
+  return table->bytes + start;
+}
+
+static int grow_bytes(doc_table_t *table, uint64_t extra) {
+  if (table->size + extra <= table->capacity)
+    return 0;
+  uint64_t capacity = table->capacity ? table->capacity * 2 : 4096;
+  while (capacity < table->size + extra)
+    capacity *= 2;
+  uint8_t *temp = realloc(table->bytes, capacity);
+  if (temp == NULL)
+    return -1;
+  table->bytes = temp;
+  table->capacity = capacity;
+  return 0;
+}
+
+/*
+ * Room for `extra` more paths in the block index; the bytes grow on
+ * demand, doubling. Returns -1 if out of memory or mapped.
+ */
+int doc_table_reserve(doc_table_t *table, int extra) {
+  if (table->mapped)
+    return -1;
+  uint64_t needed = block_count(table->count + extra);
+  if (needed <= table->block_capacity)
+    return 0;
+  uint64_t capacity = table->block_capacity ? table->block_capacity * 2 : 64;
+  while (capacity < needed)
+    capacity *= 2;
+  uint64_t *temp = realloc(table->blocks, sizeof(uint64_t) * capacity);
+  if (temp == NULL)
+    return -1;
+  table->blocks = temp;
+  table->block_capacity = capacity;
+  return 0;
+}
+
+// Adds `path` as id table->count. Returns -1 if out of memory, mapped or
+// the path is DOC_TABLE_MAX_PATH bytes or longer.
+int doc_table_append(doc_table_t *table, const char *path) {
+  size_t len = strlen(path);
+  if (table->mapped || len >= DOC_TABLE_MAX_PATH ||
+      doc_table_reserve(table, 1) != 0 ||
+      grow_bytes(table, len + ENTRY_HEADER_BYTES) != 0)
+    return -1;
+  if (table->last == NULL &&
+      (table->last = malloc(DOC_TABLE_MAX_PATH)) == NULL)
+    return -1;
+
+  // 1. Whole at a block start, else against the previous path
+  uint8_t *out = table->bytes + table->size;
+  size_t shared = 0;
+  if (table->count % DOC_TABLE_BLOCK == 0) {
+    table->blocks[table->count / DOC_TABLE_BLOCK] = table->size;
+  } else {
+    while (shared < len && shared < table->last_len &&
+           path[shared] == table->last[shared])
+      shared++;
+    out += varint_encode(shared, out);
+  }
+  out += varint_encode(len - shared, out);
+  memcpy(out, path + shared, len - shared);
+  table->size = (uint64_t)(out - table->bytes) + (len - shared);
+
+  // 2. The base for the next one
+  memcpy(table->last, path, len + 1);
+  table->last_len = len;
+  table->count++;
+  return 0;
+}
+
+/*
+ * Decodes path `id` into out (DOC_TABLE_MAX_PATH bytes always suffice),
+ * walking only its own block. Returns its length, -1 for a bad id or a
+ * damaged table.
+ */
+long doc_table_get(const doc_table_t *table, int id, char *out,
+                   size_t out_size) {
+  if (id < 0 || id >= table->count)
+    return -1;
+  const uint8_t *end;
+  const uint8_t *pos = block_bounds(table, id / DOC_TABLE_BLOCK, &end);
+  size_t len = 0;
+  for (int i = 0; pos != NULL && i <= id % DOC_TABLE_BLOCK; i++)
+    pos = decode_entry(pos, end, i == 0, out, &len, out_size);
+  return pos != NULL ? (long)len : -1;
+}
+
+void doc_table_iter(const doc_table_t *table, doc_table_iter_t *it) {
+  it->table = table;
+  it->next = 0;
+  it->pos = NULL;
+  it->len = 0;
+}
+
+// The next path in id order, NULL past the last one or on damage
+const char *doc_table_next(doc_table_iter_t *it) {
+  const doc_table_t *table = it->table;
+  if (it->next >= table->count)
+    return NULL;
+  bool first = it->next % DOC_TABLE_BLOCK == 0;
+  const uint8_t *end;
+  if (first)
+    it->pos = block_bounds(table, it->next / DOC_TABLE_BLOCK, &end);
+  else
+    block_bounds(table, it->next / DOC_TABLE_BLOCK, &end);
+  if (it->pos == NULL)
+    return NULL;
+  it->pos = decode_entry(it->pos, end, first, it->path, &it->len,
+                         sizeof(it->path));
+  if (it->pos == NULL)
+    return NULL;
+  it->next++;
+  return it->path;
+}
+
+// The whole table as one section: header, block index, bytes
+int doc_table_write(const doc_table_t *table, FILE *fp) {
+  doc_table_header_t header = {0};
+  header.count = (uint64_t)table->count;
+  header.block_paths = DOC_TABLE_BLOCK;
+  header.block_count = block_count(table->count);
+  header.size = table->size;
+  if (fwrite(&header, sizeof(header), 1, fp) != 1)
+    return -1;
+  if (header.block_count > 0 &&
+      fwrite(table->blocks, sizeof(uint64_t), header.block_count, fp) !=
+          header.block_count)
+    return -1;
+  if (table->size > 0 &&
+      fwrite(table->bytes, 1, table->size, fp) != table->size)
+    return -1;
+  return 0;
+}
+
+/*
+ * Loads a section written by doc_table_write(). Without copy the table
+ * reads straight from `image`, which must outlive it, and refuses
+ * appends. Returns -1 if the section does not hold what it claims.
+ */
+int doc_table_open(doc_table_t *table, const void *image, size_t length,
+                   bool copy) {
+  memset(table, 0, sizeof(doc_table_t));
+  doc_table_header_t header;
+  if (length < sizeof(header))
+    return -1;
+  memcpy(&header, image, sizeof(header));
+  uint64_t room = length - sizeof(header);
+  if (header.block_paths != DOC_TABLE_BLOCK || header.count > INT32_MAX ||
+      header.block_count != block_count((int)header.count) ||
+      header.block_count > room / sizeof(uint64_t) ||
+      header.size > room - sizeof(uint64_t) * header.block_count)
+    return -1;
+
+  const uint64_t *blocks =
+      (const uint64_t *)((const char *)image + sizeof(header));
+  const uint8_t *bytes = (const uint8_t *)(blocks + header.block_count);
+  table->count = (int)header.count;
+  table->size = header.size;
+  if (!copy) {
+    table->blocks = (uint64_t *)blocks; // never written through
+    table->bytes = (uint8_t *)bytes;
+    table->mapped = true;
+    return 0;
+  }
+
+  // An owned copy keeps taking appends, front-coded against its last path
+  table->blocks = malloc(sizeof(uint64_t) *
+                         (header.block_count ? header.block_count : 1));
+  table->bytes = malloc(header.size ? header.size : 1);
+  table->last = malloc(DOC_TABLE_MAX_PATH);
+  if (table->blocks == NULL || table->bytes == NULL || table->last == NULL) {
+    doc_table_free(table);
+    return -1;
+  }
+  memcpy(table->blocks, blocks, sizeof(uint64_t) * header.block_count);
+  memcpy(table->bytes, bytes, header.size);
+  table->block_capacity = header.block_count;
+  table->capacity = header.size;
+  long len = 0;
+  if (table->count > 0 &&
+      (len = doc_table_get(table, table->count - 1, table->last,
+                           DOC_TABLE_MAX_PATH)) < 0) {
+    doc_table_free(table);
+    return -1;
+  }
+  table->last_len = (size_t)len;
+  return 0;
+}
+
+void doc_table_free(doc_table_t *table) {
+  if (!table->mapped) {
+    free(table->bytes);
+    free(table->blocks);
+  }
+  free(table->last);
+  memset(table, 0, sizeof(doc_table_t));
+}
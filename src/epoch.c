@@ -0,0 +1,155 @@
+#include "epoch.h"
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+epoch_t *epoch_create(void) {
+  void *memory = NULL;
+  if (posix_memalign(&memory, sizeof(epoch_slot_t), sizeof(epoch_t)) != 0)
+    return NULL;
+  epoch_t *epoch = memory;
+  memset(epoch, 0, sizeof(epoch_t));
+  epoch->global = 1; // a pinned slot is never 0
+  return epoch;
+}
+
+// Slot a thread tries first, so readers on different threads rarely meet
+static __thread int slot_hint = -1;
+static int next_hint;
+
+/*
+ * Pins the current epoch for the calling thread and returns the slot to
+ * hand to epoch_exit(). Everything the reader reaches from now on stays
+ * allocated until it exits. Waits only when every slot is taken.
+ */
+int epoch_enter(epoch_t *epoch) {
+  if (slot_hint < 0)
+    slot_hint = __atomic_fetch_add(&next_hint, 1, __ATOMIC_RELAXED) %
+                EPOCH_SLOTS;
+  for (;;) {
+    uint64_t now = __atomic_load_n(&epoch->global, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < EPOCH_SLOTS; i++) {
+      int slot = (slot_hint + i) % EPOCH_SLOTS;
+      uint64_t expected = 0;
+      if (__atomic_compare_exchange_n(&epoch->slots[slot].epoch, &expected,
+                                      now, false, __ATOMIC_SEQ_CST,
+                                      __ATOMIC_RELAXED)) {
+        // Pairs with the fence in epoch_reclaim(): either the writer sees
+        // this pin, or this reader sees everything unlinked before it
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        return slot;
+      }
+    }
+    sched_yield();
+  }
+}
+
+void epoch_exit(epoch_t *epoch, int slot) {
+  __atomic_store_n(&epoch->slots[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Hands an item the writer has just unlinked over for release once no
+ * reader can still hold it. Without an epoch (a trie nobody reads
+ * concurrently) it is released at once. Writer only.
+ */
+void epoch_retire(epoch_t *epoch, epoch_release_fn release, void *owner,
+                  uintptr_t item) {
+  if (epoch == NULL) {
+    release(owner, item);
+    return;
+  }
+  if (epoch->retired_count == epoch->retired_capacity) {
+    size_t capacity = epoch->retired_capacity
+                          ? epoch->retired_capacity * 2
+                          : EPOCH_RECLAIM_BATCH * 2;
+    epoch_retired_t *temp =
+        realloc(epoch->retired, sizeof(epoch_retired_t) * capacity);
+    if (temp == NULL)
+      return; // Leaked rather than released too early
+    epoch->retired = temp;
+    epoch->retired_capacity = capacity;
+  }
+  epoch_retired_t *r = &epoch->retired[epoch->retired_count++];
+  r->release = release;
+  r->owner = owner;
+  r->item = item;
+  r->epoch = __atomic_load_n(&epoch->global, __ATOMIC_RELAXED);
+  if (epoch->retired_count % EPOCH_RECLAIM_BATCH == 0)
+    epoch_reclaim(epoch);
+}
+
+/*
+ * Starts a new epoch and releases what was retired before the oldest
+ * pinned reader entered. Items a reader may still hold stay queued.
+ * Writer only.
+ */
+void epoch_reclaim(epoch_t *epoch) {
+  if (epoch == NULL)
+    return;
+  __atomic_add_fetch(&epoch->global, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  uint64_t oldest = UINT64_MAX;
+  for (int i = 0; i < EPOCH_SLOTS; i++) {
+    uint64_t pinned =
+        __atomic_load_n(&epoch->slots[i].epoch, __ATOMIC_ACQUIRE);
+    if (pinned != 0 && pinned < oldest)
+      oldest = pinned;
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < epoch->retired_count; i++) {
+    epoch_retired_t *r = &epoch->retired[i];
+    if (r->epoch < oldest)
+      r->release(r->owner, r->item);
+    else
+      epoch->retired[kept++] = *r;
+  }
+  epoch->retired_count = kept;
+}
+
+/*
+ * Waits until every reader that was pinned when the call started has
+ * exited; readers entering meanwhile are not waited for. Writer only.
+ */
+void epoch_synchronize(epoch_t *epoch) {
+  if (epoch == NULL)
+    return;
+  uint64_t now = __atomic_add_fetch(&epoch->global, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (int i = 0; i < EPOCH_SLOTS; i++) {
+    for (;;) {
+      uint64_t pinned =
+          __atomic_load_n(&epoch->slots[i].epoch, __ATOMIC_ACQUIRE);
+      if (pinned == 0 || pinned >= now)
+        break;
+      sched_yield();
+    }
+  }
+}
+
+// Releases everything retired; only once no reader can be pinned
+void epoch_drain(epoch_t *epoch) {
+  if (epoch == NULL)
+    return;
+  for (size_t i = 0; i < epoch->retired_count; i++) {
+    epoch_retired_t *r = &epoch->retired[i];
+    r->release(r->owner, r->item);
+  }
+  epoch->retired_count = 0;
+}
+
+void epoch_free(epoch_t *epoch) {
+  if (epoch == NULL)
+    return;
+  epoch_drain(epoch);
+  free(epoch->retired);
+  free(epoch);
+}
+
+// epoch_release_fn for plain heap memory
+void epoch_release_memory(void *owner, uintptr_t item) {
+  (void)owner;
+  free((void *)item);
+}
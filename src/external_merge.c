@@ -0,0 +1,243 @@
+#include "external_merge.h"
+#include "index_file.h"
+#include "query_engine.h"
+#include "segments.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * External k-way merge of the runs a memory budget spilled (see
+ * engine_set_memory_budget()). Runs hold consecutive documents and every
+ * posting block decodes on its own (postings.h), so a word's merged list
+ * is its blocks from each run chained in run order: nothing is decoded
+ * or encoded again. Only the merged dictionary, nodes and list records
+ * for the vocabulary, is built in memory; the blocks stream through a
+ * temporary file into the postings section.
+ */
+typedef struct Merge {
+  const segment_view_t *view;
+  trie_t *out; // the merged dictionary
+  external_postings_t *postings;
+  unsigned char key[TRIE_MAX_KEY + 1];
+  int (*visit)(struct Merge *m, const trie_t *trie, uint32_t list,
+               size_t len);
+} merge_t;
+
+// Where byte_arena_alloc() would put a block of `bytes`, ARENA_NULL if
+// the handles run out
+static uint32_t postings_alloc(external_postings_t *postings, size_t bytes) {
+  uint32_t slab_units = 1u << BYTE_ARENA_SLAB_SHIFT;
+  uint32_t units = (uint32_t)((bytes + BYTE_ARENA_UNIT - 1) / BYTE_ARENA_UNIT);
+  uint32_t offset = postings->next_unit & (slab_units - 1);
+  uint64_t handle = postings->next_unit;
+  if (offset > 0 && offset + units > slab_units)
+    handle += slab_units - offset; // a block never straddles two slabs
+  if (handle + units >= UINT32_MAX) {
+    postings->failed = true;
+    return ARENA_NULL;
+  }
+  postings->next_unit = (uint32_t)(handle + units);
+  return (uint32_t)handle;
+}
+
+// Writes the block held back, its successor now known, at its handle
+static void postings_flush(external_postings_t *postings, uint32_t next) {
+  static const char zeros[BYTE_ARENA_UNIT] = {0};
+  if (postings->pending == ARENA_NULL)
+    return;
+  posting_block_t *block = (posting_block_t *)postings->block;
+  block->next = next;
+  size_t bytes = sizeof(posting_block_t) + block->used;
+  uint32_t units = (uint32_t)((bytes + BYTE_ARENA_UNIT - 1) / BYTE_ARENA_UNIT);
+  memset(postings->block + bytes, 0, units * BYTE_ARENA_UNIT - bytes);
+  for (; postings->units < postings->pending; postings->units++) {
+    if (fwrite(zeros, 1, BYTE_ARENA_UNIT, postings->fp) != BYTE_ARENA_UNIT)
+      postings->failed = true;
+  }
+  if (fwrite(postings->block, BYTE_ARENA_UNIT, units, postings->fp) != units)
+    postings->failed = true;
+  postings->units += units;
+  postings->pending = ARENA_NULL;
+}
+
+// Chains a copy of every non-empty block of `list` onto `dst`
+static void postings_copy(external_postings_t *postings, const trie_t *src,
+                          const posting_list_t *list, posting_list_t *dst) {
+  uint32_t handle = list->head;
+  while (handle != ARENA_NULL && !postings->failed) {
+    const posting_block_t *block = byte_arena_get(&src->postings, handle);
+    handle = block->next;
+    if (block->used == 0)
+      continue;
+    size_t bytes = sizeof(posting_block_t) + block->used;
+    uint32_t at = postings_alloc(postings, bytes);
+    if (at == ARENA_NULL)
+      return;
+    if (postings->pending != ARENA_NULL)
+      postings_flush(postings, at);
+    else
+      dst->head = at;
+    memcpy(postings->block, block, bytes);
+    ((posting_block_t *)postings->block)->capacity = block->used;
+    postings->pending = at;
+    dst->tail = at;
+  }
+}
+
+// Calls m->visit for every word of `trie` under `node`, in byte order
+static int walk(merge_t *m, const trie_t *trie, uint32_t node, size_t depth) {
+  trie_node_t *n = trie_node(trie, node);
+  if (depth + n->prefix_len >= TRIE_MAX_KEY)
+    return 0;
+  memcpy(m->key + depth, n->prefix, n->prefix_len);
+  depth += n->prefix_len;
+  uint32_t list = trie_node_postings(n);
+  if (n->isEndOfWord && list != ARENA_NULL &&
+      m->visit(m, trie, list, depth) != 0)
+    return -1;
+
+  unsigned char keys[ALPHABET_SIZE];
+  uint32_t children[ALPHABET_SIZE];
+  int count = trie_node_children(trie, node, keys, children);
+  for (int i = 0; i < count; i++) {
+    m->key[depth] = keys[i];
+    if (walk(m, trie, children[i], depth + 1) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Pass 1: the word joins the merged dictionary with an empty list
+static int add_word(merge_t *m, const trie_t *trie, uint32_t list,
+                    size_t len) {
+  if (posting_list_count(trie_posting_list(trie, list)) == 0)
+    return 0;
+  uint32_t node = trie_insert_key(m->out, m->key, len);
+  if (node == ARENA_NULL)
+    return -1;
+  trie_node_t *n = trie_node(m->out, node);
+  if (n->postings != ARENA_NULL)
+    return 0;
+  uint32_t handle = slab_pool_alloc(&m->out->lists);
+  if (handle == ARENA_NULL)
+    return -1;
+  memset(trie_posting_list(m->out, handle), 0, sizeof(posting_list_t));
+  n->postings = handle;
+  return 0;
+}
+
+// Pass 2: the word's blocks from every run, in run order
+static int merge_word(merge_t *m, const trie_t *trie, uint32_t list,
+                      size_t len) {
+  posting_list_t *dst = trie_posting_list(trie, list);
+  m->key[len] = '\0';
+  for (int s = 0; s < segment_view_count(m->view); s++) {
+    const trie_t *src = segment_view_trie(m->view, s);
+    uint32_t handle = trie_lookup(src, (const char *)m->key);
+    if (handle == ARENA_NULL)
+      continue;
+    const posting_list_t *from = trie_posting_list(src, handle);
+    uint32_t count = posting_list_count(from);
+    if (count == 0)
+      continue;
+    if (dst->count + count < dst->count)
+      return -1;
+    postings_copy(m->postings, src, from, dst);
+    dst->count += count;
+    dst->doc_count += posting_list_docs(from);
+    dst->last = from->last;
+  }
+  postings_flush(m->postings, ARENA_NULL);
+  return m->postings->failed ? -1 : 0;
+}
+
+// Bounds are built from the file just written, list by list off the
+// mapping, and filled into its empty impacts section
+static int add_impacts(index_output_t *out) {
+  search_engine_t *mapped =
+      fflush(out->fp) == 0 ? index_file_open(out->temp, false) : NULL;
+  if (mapped == NULL)
+    return -1;
+  impact_index_t *impacts =
+      impact_build(mapped, mapped->index, bm25_average_length(mapped));
+  int result = impacts != NULL ? index_file_write_impacts(out->fp, impacts)
+                               : 0;
+  impact_free(impacts);
+  engine_free(mapped);
+  return result;
+}
+
+/*
+ * Writes the index of a memory-budgeted build to `filepath`: every
+ * spilled run and the live trie merged into one file, the same postings
+ * a build without a budget writes. Memory stays within the merged
+ * dictionary and a block buffer. Returns 0 on success, -1 on error.
+ */
+int external_merge_write(search_engine_t *engine, const char *filepath) {
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  external_postings_t *postings = calloc(1, sizeof(external_postings_t));
+  char *buffer = malloc(EXTERNAL_MERGE_BUFFER);
+  trie_t *out = trie_create();
+  merge_t m = {&view, out, postings, {0}, add_word};
+  search_engine_t shell = {0};
+  index_output_t file;
+  bool opened = false;
+  char temp[PATH_MAX];
+  int result = -1;
+  if (postings == NULL || buffer == NULL || out == NULL)
+    goto done;
+  out->positional = engine->index->positional;
+
+  // 1. The postings file, gone from the directory as soon as it is open
+  snprintf(temp, sizeof(temp), "%s/postings", engine->segments->spill_dir);
+  postings->fp = fopen(temp, "w+b");
+  if (postings->fp == NULL) {
+    perror("Error creating the merge file");
+    goto done;
+  }
+  unlink(temp);
+  setvbuf(postings->fp, buffer, _IOFBF, EXTERNAL_MERGE_BUFFER);
+  postings->next_unit = 1; // 0 is ARENA_NULL
+
+  // 2. Every word of every run, then each one's blocks
+  for (int s = 0; s < segment_view_count(&view); s++) {
+    const trie_t *src = segment_view_trie(&view, s);
+    if (walk(&m, src, src->root, 0) != 0)
+      goto done;
+  }
+  m.visit = merge_word;
+  if (walk(&m, out, out->root, 0) != 0 || fflush(postings->fp) != 0)
+    goto done;
+
+  // 3. The file, through a shell over the merged dictionary
+  shell.index = out;
+  shell.docs = engine->docs;
+  shell.doc_count = engine->doc_count;
+  shell.doc_meta = engine->doc_meta;
+  shell.doc_meta_capacity = engine->doc_meta_capacity;
+  shell.deleted_count = engine->deleted_count;
+  shell.total_length = engine->total_length;
+  shell.length_docs = engine->length_docs;
+  index_postings_t section = {postings->fp, postings->units};
+  if (index_output_open(&file, filepath) != 0)
+    goto done;
+  opened = true;
+  result = index_file_write_merged(&shell, &section, file.fp);
+
+done:
+  segment_view_end(&view);
+  if (postings != NULL && postings->fp != NULL)
+    fclose(postings->fp);
+  free(buffer);
+  free(postings);
+  trie_free(out);
+
+  // 4. Score bounds, which need every run's postings in one list, then
+  // the file takes the old one's place
+  if (result == 0)
+    result = add_impacts(&file);
+  return opened ? index_output_commit(&file, filepath, result) : result;
+}
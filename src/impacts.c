@@ -0,0 +1,245 @@
+#include "impacts.h"
+#include "query_engine.h"
+#include "toolkit_core.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes of the arrays that follow the header
+static size_t payload_bytes(const impact_header_t *h, bool skips) {
+  return sizeof(uint32_t) * ((size_t)h->list_count * 2 + 1) +
+         sizeof(float) * (size_t)h->list_count +
+         sizeof(impact_block_t) * (size_t)h->block_count +
+         (skips ? sizeof(posting_skip_t) * (size_t)h->block_count : 0);
+}
+
+static void point_arrays(impact_index_t *impacts, const void *payload,
+                         bool skips) {
+  const uint32_t *first = payload;
+  impacts->first = first;
+  impacts->postings = first + impacts->header.list_count + 1;
+  impacts->list_max =
+      (const float *)(impacts->postings + impacts->header.list_count);
+  impacts->blocks = (const impact_block_t *)(impacts->list_max +
+                                             impacts->header.list_count);
+  impacts->skips =
+      skips ? (const posting_skip_t *)(impacts->blocks +
+                                       impacts->header.block_count)
+            : NULL;
+}
+
+// Smallest float >= x
+static float round_up(double x) {
+  float f = (float)x;
+  return (double)f < x ? nextafterf(f, INFINITY) : f;
+}
+
+typedef struct {
+  impact_block_t *blocks;
+  posting_skip_t *skips;
+  uint64_t count;
+  uint64_t capacity;
+} block_list_t;
+
+static int add_block(block_list_t *out, uint32_t last_doc, double weight,
+                     const posting_skip_t *start) {
+  if (out->count == out->capacity) {
+    uint64_t capacity = out->capacity ? out->capacity * 2 : 1024;
+    impact_block_t *blocks =
+        realloc(out->blocks, sizeof(impact_block_t) * capacity);
+    if (blocks == NULL)
+      return -1;
+    out->blocks = blocks;
+    posting_skip_t *skips =
+        realloc(out->skips, sizeof(posting_skip_t) * capacity);
+    if (skips == NULL)
+      return -1;
+    out->skips = skips;
+    out->capacity = capacity;
+  }
+  out->blocks[out->count].last_doc = last_doc;
+  out->blocks[out->count].max_weight = round_up(weight);
+  out->skips[out->count] = *start;
+  out->count++;
+  return 0;
+}
+
+// One pass over a list: a block per IMPACT_BLOCK_DOCS documents
+static int build_list(const search_engine_t *engine, const trie_t *trie,
+                      const posting_list_t *list, double avgdl,
+                      block_list_t *out, double *list_max) {
+  posting_iter_t it;
+  posting_skip_t at, start; // where the next posting and the block start
+  trie_postings_iter(trie, list, &it);
+  posting_iter_mark(&it, &at);
+  bool more = posting_iter_next(&it);
+  double block_max = 0.0;
+  int docs = 0;
+  *list_max = 0.0;
+  while (more) {
+    int doc_id = it.current.doc_id;
+    int tf = 0;
+    if (docs == 0)
+      start = at;
+    while (more && it.current.doc_id == doc_id) {
+      tf++;
+      posting_iter_mark(&it, &at);
+      more = posting_iter_next(&it);
+    }
+    double weight =
+        bm25_weight(tf, bm25_length_norm(engine, doc_id, avgdl));
+    if (weight > block_max)
+      block_max = weight;
+    if (++docs == IMPACT_BLOCK_DOCS || !more) {
+      if (add_block(out, (uint32_t)doc_id, block_max, &start) != 0)
+        return -1;
+      if (block_max > *list_max)
+        *list_max = block_max;
+      block_max = 0.0;
+      docs = 0;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Decodes every posting list of `trie` once to collect its block bounds,
+ * weighting with average document length `avgdl`. Run after the trie or
+ * the document lengths change; NULL if out of memory.
+ */
+impact_index_t *impact_build(const search_engine_t *engine,
+                             const trie_t *trie, double avgdl) {
+  uint32_t lists = slab_pool_count(&trie->lists);
+  uint32_t *first = malloc(sizeof(uint32_t) * ((size_t)lists * 2 + 1));
+  uint32_t *postings = first + lists + 1;
+  float *list_max = malloc(sizeof(float) * (lists ? lists : 1));
+  block_list_t blocks = {0};
+  impact_index_t *impacts = calloc(1, sizeof(impact_index_t));
+  if (first == NULL || list_max == NULL || impacts == NULL)
+    goto fail;
+
+  for (uint32_t h = 0; h < lists; h++) {
+    first[h] = (uint32_t)blocks.count;
+    postings[h] = 0;
+    list_max[h] = 0.0f;
+    if (h == ARENA_NULL)
+      continue;
+    const posting_list_t *list = trie_posting_list(trie, h);
+    double max;
+    postings[h] = list->count;
+    if (build_list(engine, trie, list, avgdl, &blocks, &max) != 0 ||
+        blocks.count > UINT32_MAX)
+      goto fail;
+    list_max[h] = round_up(max);
+  }
+  first[lists] = (uint32_t)blocks.count;
+
+  // One allocation laid out like the file section
+  impacts->trie = trie;
+  impacts->header.avgdl = avgdl;
+  impacts->header.block_docs = IMPACT_BLOCK_DOCS;
+  impacts->header.list_count = lists;
+  impacts->header.block_count = blocks.count;
+  impacts->owned = malloc(payload_bytes(&impacts->header, true));
+  if (impacts->owned == NULL)
+    goto fail;
+  char *p = impacts->owned;
+  memcpy(p, first, sizeof(uint32_t) * ((size_t)lists * 2 + 1));
+  p += sizeof(uint32_t) * ((size_t)lists * 2 + 1);
+  if (lists > 0)
+    memcpy(p, list_max, sizeof(float) * lists);
+  p += sizeof(float) * lists;
+  if (blocks.count > 0) {
+    memcpy(p, blocks.blocks, sizeof(impact_block_t) * blocks.count);
+    p += sizeof(impact_block_t) * blocks.count;
+    memcpy(p, blocks.skips, sizeof(posting_skip_t) * blocks.count);
+  }
+  point_arrays(impacts, impacts->owned, true);
+  free(first);
+  free(list_max);
+  free(blocks.blocks);
+  free(blocks.skips);
+  return impacts;
+
+fail:
+  free(first);
+  free(list_max);
+  free(blocks.blocks);
+  free(blocks.skips);
+  free(impacts);
+  return NULL;
+}
+
+/*
+ * Attaches the impacts section of an index file, with its skip entries
+ * when the section is long enough to hold them. Without copy the table
+ * points into `image`, which must outlive it. NULL when the section is
+ * empty or does not hold what its header claims.
+ */
+impact_index_t *impact_open(const void *image, size_t length, bool copy) {
+  if (length < sizeof(impact_header_t))
+    return NULL;
+  impact_index_t *impacts = calloc(1, sizeof(impact_index_t));
+  if (impacts == NULL)
+    return NULL;
+  memcpy(&impacts->header, image, sizeof(impact_header_t));
+  const impact_header_t *h = &impacts->header;
+  bool skips = payload_bytes(h, true) <= length - sizeof(impact_header_t);
+  if (h->block_docs == 0 || h->list_count == 0 ||
+      h->block_count > UINT32_MAX ||
+      payload_bytes(h, skips) > length - sizeof(impact_header_t)) {
+    free(impacts);
+    return NULL;
+  }
+  const char *payload = (const char *)image + sizeof(impact_header_t);
+  if (copy) {
+    impacts->owned = malloc(payload_bytes(h, skips));
+    if (impacts->owned == NULL) {
+      free(impacts);
+      return NULL;
+    }
+    memcpy(impacts->owned, payload, payload_bytes(h, skips));
+    payload = impacts->owned;
+  }
+  point_arrays(impacts, payload, skips);
+  return impacts;
+}
+
+/*
+ * Whether the bounds can be trusted at all: they were computed with the
+ * current average document length. Lists changed since are caught one
+ * by one in impact_list().
+ */
+bool impact_usable(const impact_index_t *impacts,
+                   const search_engine_t *engine) {
+  return impacts != NULL &&
+         impacts->header.avgdl == bm25_average_length(engine);
+}
+
+/*
+ * impact_usable() for documents whose lengths never change (sealed
+ * segments): a weight only grows with avgdl (see bm25_length_norm()), so
+ * bounds built with a larger one still hold, just looser.
+ */
+bool impact_covers(const impact_index_t *impacts,
+                   const search_engine_t *engine) {
+  if (impacts == NULL)
+    return false;
+  double avgdl = bm25_average_length(engine);
+  return impacts->header.avgdl == avgdl ||
+         (avgdl > 0.0 && avgdl <= impacts->header.avgdl);
+}
+
+int impact_write(const impact_index_t *impacts, FILE *fp) {
+  if (fwrite(&impacts->header, sizeof(impact_header_t), 1, fp) != 1)
+    return -1;
+  size_t bytes = payload_bytes(&impacts->header, impacts->skips != NULL);
+  return fwrite(impacts->first, 1, bytes, fp) == bytes ? 0 : -1;
+}
+
+void impact_free(impact_index_t *impacts) {
+  if (impacts == NULL)
+    return;
+  free(impacts->owned);
+  free(impacts);
+}
@@ -0,0 +1,634 @@
+#include "index_file.h"
+#include "crc32c.h"
+#include "toolkit_core.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Zero-pad the file up to the next section boundary
+static int pad_to_alignment(FILE *fp) {
+  static const char zeros[INDEX_SECTION_ALIGN] = {0};
+  long pos = ftell(fp);
+  if (pos < 0)
+    return -1;
+  size_t pad = (INDEX_SECTION_ALIGN - pos % INDEX_SECTION_ALIGN) %
+               INDEX_SECTION_ALIGN;
+  return fwrite(zeros, 1, pad, fp) == pad ? 0 : -1;
+}
+
+static int begin_section(FILE *fp, index_section_t *section) {
+  if (pad_to_alignment(fp) != 0)
+    return -1;
+  section->offset = (uint64_t)ftell(fp);
+  return 0;
+}
+
+static void end_section(FILE *fp, index_section_t *section) {
+  section->length = (uint64_t)ftell(fp) - section->offset;
+}
+
+static int write_docmap(search_engine_t *engine, FILE *fp, int version,
+                        index_section_t *section) {
+  section->elem_size = 1;
+  section->count = (uint64_t)engine->doc_count;
+  if (version >= INDEX_VERSION_DOC_TABLE)
+    return doc_table_write(&engine->docs, fp);
+
+  // Older layouts: offsets first so a reader can jump straight to any path
+  doc_table_iter_t it;
+  doc_table_iter(&engine->docs, &it);
+  uint64_t offset = 0;
+  for (int i = 0; i <= engine->doc_count; i++) {
+    if (fwrite(&offset, sizeof(uint64_t), 1, fp) != 1)
+      return -1;
+    if (i < engine->doc_count) {
+      if (doc_table_next(&it) == NULL)
+        return -1;
+      offset += it.len + 1;
+    }
+  }
+
+  // Then the paths, NUL terminated so they can be handed out in place
+  doc_table_iter(&engine->docs, &it);
+  for (int i = 0; i < engine->doc_count; i++) {
+    const char *path = doc_table_next(&it);
+    if (path == NULL || fwrite(path, 1, it.len + 1, fp) != it.len + 1)
+      return -1;
+  }
+  return 0;
+}
+
+static int write_docmeta(search_engine_t *engine, int first_doc, FILE *fp,
+                         index_section_t *section) {
+  index_docmeta_header_t header = {0};
+  header.first_doc = (uint64_t)first_doc;
+  header.deleted_count = (uint64_t)engine->deleted_count;
+  header.total_length = engine->total_length;
+  header.length_docs = (uint64_t)engine->length_docs;
+  if (fwrite(&header, sizeof(header), 1, fp) != 1)
+    return -1;
+
+  // Ids without a slot yet are written as unknown
+  int known = engine->doc_meta_capacity < engine->doc_count
+                  ? engine->doc_meta_capacity
+                  : engine->doc_count;
+  if (known > 0 && fwrite(engine->doc_meta, sizeof(doc_meta_t), known, fp) !=
+                       (size_t)known)
+    return -1;
+  doc_meta_t unknown = {0};
+  for (int i = known; i < engine->doc_count; i++) {
+    if (fwrite(&unknown, sizeof(doc_meta_t), 1, fp) != 1)
+      return -1;
+  }
+  section->elem_size = sizeof(doc_meta_t);
+  section->count = (uint64_t)engine->doc_count;
+  return 0;
+}
+
+static uint32_t header_checksum(const index_file_header_t *header,
+                                const index_checksums_t *sums) {
+  uint32_t crc = crc32c(0, header, sizeof(*header));
+  return crc32c(crc, sums->sections, sizeof(sums->sections));
+}
+
+// CRC32C of `length` bytes at `offset`, read back through the descriptor
+static int checksum_range(FILE *fp, uint64_t offset, uint64_t length,
+                          uint32_t *crc) {
+  char buffer[1 << 16];
+  uint32_t sum = 0;
+  while (length > 0) {
+    size_t chunk = length < sizeof(buffer) ? (size_t)length : sizeof(buffer);
+    ssize_t got = pread(fileno(fp), buffer, chunk, (off_t)offset);
+    if (got <= 0)
+      return -1;
+    sum = crc32c(sum, buffer, (size_t)got);
+    offset += (uint64_t)got;
+    length -= (uint64_t)got;
+  }
+  *crc = sum;
+  return 0;
+}
+
+// Checksums of sections first.. as they are in the file, then the header's
+static int checksum_file(FILE *fp, const index_file_header_t *header,
+                         index_checksums_t *sums, int first) {
+  if (fflush(fp) != 0)
+    return -1;
+  for (int i = first; i < INDEX_SECTION_CHECKSUMS; i++) {
+    const index_section_t *s = &header->sections[i];
+    if (checksum_range(fp, s->offset, s->length, &sums->sections[i]) != 0)
+      return -1;
+  }
+  sums->header = header_checksum(header, sums);
+  return 0;
+}
+
+/*
+ * Ends a file whose other sections are written: the checksums section,
+ * summing sections first.. (those before are in `sums` already), then
+ * the header again at the start.
+ */
+static int finish_file(FILE *fp, index_file_header_t *header,
+                       index_checksums_t *sums, int first) {
+  index_section_t *section = &header->sections[INDEX_SECTION_CHECKSUMS];
+  section->elem_size = sizeof(*sums);
+  section->count = 1;
+  if (begin_section(fp, section) != 0)
+    return -1;
+  section->length = sizeof(*sums);
+  header->file_size = section->offset + section->length;
+  if (checksum_file(fp, header, sums, first) != 0 ||
+      fwrite(sums, sizeof(*sums), 1, fp) != 1 ||
+      fseek(fp, 0, SEEK_SET) != 0 ||
+      fwrite(header, sizeof(*header), 1, fp) != 1)
+    return -1;
+  return fseek(fp, 0, SEEK_END);
+}
+
+static void describe_pool(index_section_t *section, const slab_pool_t *pool) {
+  section->elem_size = (uint32_t)pool->elem_size;
+  section->slab_shift = pool->slab_shift;
+  section->count = slab_pool_count(pool);
+}
+
+// The postings section from where index_file_write_merged() put it
+static int copy_postings(const index_postings_t *postings, FILE *fp) {
+  char buffer[1 << 16];
+  uint64_t left = (uint64_t)postings->units * BYTE_ARENA_UNIT;
+  if (fseek(postings->fp, 0, SEEK_SET) != 0)
+    return -1;
+  while (left > 0) {
+    size_t chunk = left < sizeof(buffer) ? (size_t)left : sizeof(buffer);
+    if (fread(buffer, 1, chunk, postings->fp) != chunk ||
+        fwrite(buffer, 1, chunk, fp) != chunk)
+      return -1;
+    left -= chunk;
+  }
+  return 0;
+}
+
+// Writes the version 2 layout (numbered 3 when the postings carry token
+// positions, 5 when the nodes also carry subtree term counts and the paths
+// are front-coded), checksummed whichever the version, the postings from
+// `postings` unless NULL; `fp` must be open for update and positioned at
+// the file start
+static int write_file(search_engine_t *engine, int first_doc,
+                      const index_postings_t *postings, FILE *fp) {
+  trie_t *trie = engine->index;
+  index_file_header_t header;
+  index_checksums_t sums;
+  memset(&header, 0, sizeof(header));
+  memset(&sums, 0, sizeof(sums));
+  header.magic = INDEX_MAGIC;
+  header.version = !trie->positional ? INDEX_VERSION_FLAT
+                   : trie->term_counts ? INDEX_VERSION_DOC_TABLE
+                                       : INDEX_VERSION_POSITIONS;
+  header.section_count = INDEX_SECTION_COUNT;
+  header.root = trie->root;
+  header.doc_count = engine->doc_count;
+
+  // 1. Reserve room for the header, rewritten once offsets are known
+  if (fwrite(&header, sizeof(header), 1, fp) != 1)
+    return -1;
+
+  // 2. Document map
+  index_section_t *section = &header.sections[INDEX_SECTION_DOCMAP];
+  if (begin_section(fp, section) != 0 ||
+      write_docmap(engine, fp, header.version, section) != 0)
+    return -1;
+  end_section(fp, section);
+
+  // 3. Dictionary: one section per node type
+  for (int t = 0; t < TRIE_NODE_TYPES; t++) {
+    section = &header.sections[INDEX_SECTION_NODE4 + t];
+    describe_pool(section, &trie->nodes[t]);
+    if (begin_section(fp, section) != 0 ||
+        slab_pool_write(&trie->nodes[t], fp) != 0)
+      return -1;
+    end_section(fp, section);
+  }
+
+  // 4. Postings: list headers, then the encoded blocks
+  section = &header.sections[INDEX_SECTION_LISTS];
+  describe_pool(section, &trie->lists);
+  if (begin_section(fp, section) != 0 || slab_pool_write(&trie->lists, fp) != 0)
+    return -1;
+  end_section(fp, section);
+
+  section = &header.sections[INDEX_SECTION_POSTINGS];
+  section->elem_size = BYTE_ARENA_UNIT;
+  section->slab_shift = BYTE_ARENA_SLAB_SHIFT;
+  section->count = postings != NULL ? postings->units
+                                    : byte_arena_units(&trie->postings);
+  if (begin_section(fp, section) != 0 ||
+      (postings != NULL ? copy_postings(postings, fp)
+                        : byte_arena_write(&trie->postings, fp)) != 0)
+    return -1;
+  end_section(fp, section);
+
+  // 5. Document fingerprints and tombstones
+  section = &header.sections[INDEX_SECTION_DOCMETA];
+  if (begin_section(fp, section) != 0 ||
+      write_docmeta(engine, first_doc, fp, section) != 0)
+    return -1;
+  end_section(fp, section);
+
+  // 6. Block-max score bounds
+  section = &header.sections[INDEX_SECTION_IMPACTS];
+  section->elem_size = 1;
+  if (begin_section(fp, section) != 0 ||
+      (engine->impacts != NULL && impact_write(engine->impacts, fp) != 0))
+    return -1;
+  end_section(fp, section);
+
+  // 7. Checksum the sections as written, then go back and fill in the
+  // header
+  return finish_file(fp, &header, &sums, 0);
+}
+
+int index_file_write(search_engine_t *engine, FILE *fp) {
+  return write_file(engine, 0, NULL, fp);
+}
+
+/*
+ * One segment of a segmented index (see segments.h): documents
+ * first_doc.. of the collection, whose postings keep their global ids.
+ * `engine` is a view holding only those documents' paths and metadata.
+ */
+int index_file_write_segment(search_engine_t *engine, int first_doc,
+                             FILE *fp) {
+  return write_file(engine, first_doc, NULL, fp);
+}
+
+/*
+ * The index of an external merge (see external_merge.h): the dictionary
+ * of `engine` with lists whose handles point into `postings`, whose
+ * blocks are copied in as the postings section. The engine's trie holds
+ * no postings of its own.
+ */
+int index_file_write_merged(search_engine_t *engine,
+                            const index_postings_t *postings, FILE *fp) {
+  return write_file(engine, 0, postings, fp);
+}
+
+/*
+ * Fills in the impacts section of a file just written without bounds
+ * (still open for update in `fp`), for bounds built from the file
+ * itself. Returns 0 on success, -1 on error.
+ */
+int index_file_write_impacts(FILE *fp, const impact_index_t *impacts) {
+  // 1. The empty section must be right before the checksums, which end
+  // the file
+  index_file_header_t header;
+  index_checksums_t sums;
+  index_section_t *section = &header.sections[INDEX_SECTION_IMPACTS];
+  const index_section_t *last = &header.sections[INDEX_SECTION_CHECKSUMS];
+  if (fseek(fp, 0, SEEK_SET) != 0 ||
+      fread(&header, sizeof(header), 1, fp) != 1 ||
+      header.magic != INDEX_MAGIC ||
+      header.section_count != INDEX_SECTION_COUNT || section->length != 0 ||
+      section->offset != last->offset ||
+      last->offset + last->length != header.file_size ||
+      fseek(fp, (long)last->offset, SEEK_SET) != 0 ||
+      fread(&sums, sizeof(sums), 1, fp) != 1)
+    return -1;
+  if (fseek(fp, (long)section->offset, SEEK_SET) != 0 ||
+      impact_write(impacts, fp) != 0)
+    return -1;
+
+  // 2. Then the checksums after it and the header again
+  end_section(fp, section);
+  return finish_file(fp, &header, &sums, INDEX_SECTION_IMPACTS);
+}
+
+/*
+ * Starts saving an index file: `out` writes to <filepath>.tmp through
+ * an INDEX_WRITE_BUFFER buffer. Returns -1 if it cannot be created.
+ */
+int index_output_open(index_output_t *out, const char *filepath) {
+  size_t len = strlen(filepath) + sizeof(".tmp");
+  out->fp = NULL;
+  out->temp = malloc(len);
+  out->buffer = malloc(INDEX_WRITE_BUFFER);
+  if (out->temp != NULL && out->buffer != NULL) {
+    snprintf(out->temp, len, "%s.tmp", filepath);
+    out->fp = fopen(out->temp, "w+b");
+  }
+  if (out->fp == NULL) {
+    perror("Error opening file");
+    free(out->temp);
+    free(out->buffer);
+    return -1;
+  }
+  setvbuf(out->fp, out->buffer, _IOFBF, INDEX_WRITE_BUFFER);
+  return 0;
+}
+
+// Makes a rename into the directory of `filepath` durable
+static void sync_directory(const char *filepath) {
+  const char *slash = strrchr(filepath, '/');
+  char dir[PATH_MAX];
+  if (slash == NULL)
+    snprintf(dir, sizeof(dir), ".");
+  else
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - filepath + 1),
+             filepath);
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+/*
+ * Ends a save. With `result` 0 the file is flushed, synced to disk and
+ * renamed over `filepath`, so a crash at any point leaves the old file
+ * or the whole new one; otherwise it is removed. Returns 0 once the new
+ * file is in place.
+ */
+int index_output_commit(index_output_t *out, const char *filepath,
+                        int result) {
+  if (result == 0 && (fflush(out->fp) != 0 || fsync(fileno(out->fp)) != 0))
+    result = -1;
+  if (fclose(out->fp) != 0)
+    result = -1;
+  if (result == 0 && rename(out->temp, filepath) != 0)
+    result = -1;
+  if (result == 0)
+    sync_directory(filepath);
+  else
+    unlink(out->temp);
+  free(out->temp);
+  free(out->buffer);
+  return result;
+}
+
+// Sections must sit inside the file and hold what the header claims
+static int validate_header(const index_file_header_t *header, size_t size) {
+  if (size < sizeof(index_file_header_t) || header->magic != INDEX_MAGIC ||
+      header->version < INDEX_VERSION_FLAT ||
+      header->version > INDEX_VERSION_CHECKSUMS ||
+      header->section_count < INDEX_SECTION_REQUIRED ||
+      header->section_count > INDEX_MAX_SECTIONS ||
+      header->file_size != size || header->doc_count < 0) {
+    return -1;
+  }
+  size_t start = sizeof(index_file_header_t);
+  if (header->version == INDEX_VERSION_CHECKSUMS) {
+    start += sizeof(index_checksums_t);
+    if (size < start)
+      return -1;
+  }
+  for (int i = 0; i < header->section_count; i++) {
+    const index_section_t *s = &header->sections[i];
+    if (s->offset % INDEX_SECTION_ALIGN != 0 || s->offset > size ||
+        s->length > size - s->offset ||
+        (s->length > 0 && s->offset < start)) {
+      return -1;
+    }
+    if (s->elem_size != 0 && s->count > s->length / s->elem_size)
+      return -1;
+    if (s->slab_shift > 24 || s->count > UINT32_MAX)
+      return -1;
+  }
+
+  const index_section_t *docmap = &header->sections[INDEX_SECTION_DOCMAP];
+  uint64_t docmap_min = header->version >= INDEX_VERSION_DOC_TABLE
+                            ? sizeof(doc_table_header_t)
+                            : sizeof(uint64_t) * (docmap->count + 1);
+  if (docmap->count != (uint64_t)header->doc_count ||
+      docmap->length < docmap_min) {
+    return -1;
+  }
+
+  if (header->section_count > INDEX_SECTION_DOCMETA) {
+    const index_section_t *meta = &header->sections[INDEX_SECTION_DOCMETA];
+    if (meta->elem_size != sizeof(doc_meta_t) ||
+        meta->count != (uint64_t)header->doc_count ||
+        meta->length < sizeof(index_docmeta_header_t) +
+                           sizeof(doc_meta_t) * meta->count) {
+      return -1;
+    }
+  }
+  if (header->section_count > INDEX_SECTION_CHECKSUMS &&
+      header->sections[INDEX_SECTION_CHECKSUMS].length <
+          sizeof(index_checksums_t))
+    return -1;
+  return 0;
+}
+
+// The checksums a file carries, NULL if it was written without them
+static const index_checksums_t *
+file_checksums(const char *base, const index_file_header_t *header) {
+  if (header->version == INDEX_VERSION_CHECKSUMS)
+    return (const index_checksums_t *)(header + 1);
+  if (header->section_count > INDEX_SECTION_CHECKSUMS)
+    return (const index_checksums_t *)(
+        base + header->sections[INDEX_SECTION_CHECKSUMS].offset);
+  return NULL;
+}
+
+// Sections checked on a mapped open: the paths and the fingerprints,
+// read up front; index_file_verify() checks the rest
+static const uint32_t mapped_checks =
+    1u << INDEX_SECTION_DOCMAP | 1u << INDEX_SECTION_DOCMETA;
+
+/*
+ * The header's checksum and those of the sections in the `sections`
+ * mask (bit i for section i) against the mapped bytes. Files without
+ * checksums pass.
+ */
+static int verify_checksums(const char *base,
+                            const index_file_header_t *header,
+                            uint32_t sections) {
+  const index_checksums_t *sums = file_checksums(base, header);
+  if (sums == NULL)
+    return 0;
+  if (header_checksum(header, sums) != sums->header)
+    return -1;
+  for (int i = 0; i < header->section_count; i++) {
+    const index_section_t *s = &header->sections[i];
+    if (i != INDEX_SECTION_CHECKSUMS && (sections & (1u << i)) &&
+        crc32c(0, base + s->offset, s->length) != sums->sections[i])
+      return -1;
+  }
+  return 0;
+}
+
+static void image_from_section(trie_arena_image_t *image, char *base,
+                               const index_section_t *section) {
+  image->base = base + section->offset;
+  image->elem_size = section->elem_size;
+  image->slab_shift = section->slab_shift;
+  image->count = (uint32_t)section->count;
+}
+
+// Files before version 5 store plain NUL-terminated paths; they are
+// front-coded into an owned table on open, whichever mode is asked for
+static int read_legacy_docmap(search_engine_t *engine, const char *base,
+                              const index_section_t *docmap) {
+  const uint64_t *offsets = (const uint64_t *)(base + docmap->offset);
+  const char *paths = (const char *)(offsets + docmap->count + 1);
+  uint64_t path_bytes =
+      docmap->length - sizeof(uint64_t) * (docmap->count + 1);
+  if (doc_table_reserve(&engine->docs, (int)docmap->count) != 0)
+    return -1;
+  for (uint64_t i = 0; i < docmap->count; i++) {
+    uint64_t start = offsets[i], end = offsets[i + 1];
+    if (start >= end || end > path_bytes || paths[end - 1] != '\0' ||
+        doc_table_append(&engine->docs, paths + start) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Files must start at `first_doc`: a segment is no whole index
+static search_engine_t *open_file(const char *filepath, bool copy,
+                                  int first_doc) {
+  int fd = open(filepath, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(index_file_header_t)) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = (size_t)st.st_size;
+  char *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // The mapping keeps the file alive
+  if (base == MAP_FAILED)
+    return NULL;
+
+  const index_file_header_t *header = (const index_file_header_t *)base;
+  search_engine_t *engine = NULL;
+  if (validate_header(header, size) != 0 ||
+      verify_checksums(base, header,
+                       copy ? UINT32_MAX : mapped_checks) != 0)
+    goto fail;
+
+  engine = calloc(1, sizeof(search_engine_t));
+  if (engine == NULL)
+    goto fail;
+
+  // 1. Dictionary and postings
+  trie_image_t image;
+  for (int t = 0; t < TRIE_NODE_TYPES; t++) {
+    image_from_section(&image.nodes[t], base,
+                       &header->sections[INDEX_SECTION_NODE4 + t]);
+  }
+  image_from_section(&image.lists, base,
+                     &header->sections[INDEX_SECTION_LISTS]);
+  image_from_section(&image.postings, base,
+                     &header->sections[INDEX_SECTION_POSTINGS]);
+  image.root = header->root;
+  image.positional = header->version >= INDEX_VERSION_POSITIONS;
+  image.term_counts = header->version >= INDEX_VERSION_TERM_COUNTS;
+  engine->index = trie_open_image(&image, copy);
+  if (engine->index == NULL)
+    goto fail;
+
+  // 2. Document map
+  const index_section_t *docmap = &header->sections[INDEX_SECTION_DOCMAP];
+  if (header->version >= INDEX_VERSION_DOC_TABLE) {
+    if (doc_table_open(&engine->docs, base + docmap->offset, docmap->length,
+                       copy) != 0 ||
+        engine->docs.count != header->doc_count)
+      goto fail;
+  } else if (read_legacy_docmap(engine, base, docmap) != 0) {
+    goto fail;
+  }
+  engine->doc_count = header->doc_count;
+
+  // 3. Fingerprints (absent in older files: every document is unknown)
+  const index_docmeta_header_t *meta_header = NULL;
+  const doc_meta_t *meta = NULL;
+  if (header->section_count > INDEX_SECTION_DOCMETA) {
+    meta_header = (const index_docmeta_header_t *)(
+        base + header->sections[INDEX_SECTION_DOCMETA].offset);
+    meta = (const doc_meta_t *)(meta_header + 1);
+  }
+  if ((meta_header != NULL ? meta_header->first_doc : 0) !=
+      (uint64_t)first_doc)
+    goto fail;
+
+  // 4. Score bounds (absent in older files: ranking scores exhaustively)
+  if (header->section_count > INDEX_SECTION_IMPACTS) {
+    const index_section_t *impacts = &header->sections[INDEX_SECTION_IMPACTS];
+    engine->impacts =
+        impact_open(base + impacts->offset, impacts->length, copy);
+    if (engine->impacts != NULL)
+      engine->impacts->trie = engine->index;
+  }
+
+  if (!copy) {
+    engine->mapping = base;
+    engine->mapping_size = size;
+    if (meta != NULL) {
+      engine->doc_meta = (doc_meta_t *)meta; // never written through
+      engine->doc_meta_capacity = engine->doc_count;
+      engine->deleted_count = (int)meta_header->deleted_count;
+      engine->total_length = meta_header->total_length;
+      engine->length_docs = (int)meta_header->length_docs;
+    }
+    return engine;
+  }
+
+  if (meta != NULL && engine->doc_count > 0) {
+    if (engine_reserve_meta(engine) != 0)
+      goto fail;
+    memcpy(engine->doc_meta, meta, sizeof(doc_meta_t) * engine->doc_count);
+    engine->deleted_count = (int)meta_header->deleted_count;
+    engine->total_length = meta_header->total_length;
+    engine->length_docs = (int)meta_header->length_docs;
+  }
+  munmap(base, size);
+  return engine;
+
+fail:
+  if (engine != NULL) {
+    engine->mapping = NULL; // unmapped below
+    engine_free(engine);
+  }
+  munmap(base, size);
+  return NULL;
+}
+
+/*
+ * Opens a version 2 file. Without copy the engine answers queries straight
+ * from a read-only shared mapping, so startup does no per-node work and
+ * several processes share the page cache. With copy everything is moved
+ * into owned arenas (still a handful of memcpy calls) and the engine can
+ * keep indexing. Checksums are checked in one sequential pass first: all
+ * of them with copy, only the header's, the paths' and the fingerprints'
+ * without, so opening stays independent of the index size (see
+ * index_file_verify() for the rest). Returns NULL for anything that is
+ * not a valid v2 file, and for a file whose checked checksums do not
+ * match.
+ */
+search_engine_t *index_file_open(const char *filepath, bool copy) {
+  return open_file(filepath, copy, 0);
+}
+
+// A file index_file_write_segment() wrote for documents first_doc..
+search_engine_t *index_file_open_segment(const char *filepath, bool copy,
+                                         int first_doc) {
+  return open_file(filepath, copy, first_doc);
+}
+
+/*
+ * Checks every checksum of a file mapped at `base`, which a mapped open
+ * leaves to this call, reading it whole. Returns 0 if they match (or it
+ * has none), -1 if not.
+ */
+int index_file_verify(const void *base, size_t size) {
+  const index_file_header_t *header = base;
+  if (validate_header(header, size) != 0 ||
+      verify_checksums(base, header, UINT32_MAX) != 0)
+    return -1;
+  return 0;
+}
@@ -1,242 +1,941 @@
 #include "index_structure.h"
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const size_t node_sizes[TRIE_NODE_TYPES] = {
+    sizeof(trie_node4_t),
+    sizeof(trie_node16_t),
+    sizeof(trie_node48_t),
+    sizeof(trie_node256_t),
+};
+
+// Points the trie and its arenas at `epoch` (NULL: nothing is retired)
+static void use_epoch(trie_t *trie, epoch_t *epoch) {
+  trie->epoch = epoch;
+  for (int t = 0; t < TRIE_NODE_TYPES; t++) {
+    trie->nodes[t].epoch = epoch;
+  }
+  trie->lists.epoch = epoch;
+  trie->postings.epoch = epoch;
+}
 
-// Creates a new Trie node
-trie_node_t *create_node(void) {
-  trie_node_t *new_node = (trie_node_t *)malloc(sizeof(trie_node_t));
+// Lets the arenas retire what readers may still hold through the epoch
+static int attach_epoch(trie_t *trie) {
+  epoch_t *epoch = epoch_create();
+  if (epoch == NULL)
+    return -1;
+  use_epoch(trie, epoch);
+  return 0;
+}
 
-  if (new_node == NULL) {
+// Creates an empty index with its own node and posting arenas
+trie_t *trie_create(void) {
+  trie_t *trie = malloc(sizeof(trie_t));
+  if (trie == NULL) {
     return NULL;
   }
-  new_node->isEndOfWord = false;
-  for (int i = 0; i < ALPHABET_SIZE; i++) {
-    new_node->children[i] = NULL;
+  for (int t = 0; t < TRIE_NODE_TYPES; t++) {
+    slab_pool_init(&trie->nodes[t], node_sizes[t],
+                   slab_shift_for(node_sizes[t], TRIE_NODE_SLAB_BYTES));
+  }
+  slab_pool_init(&trie->lists, sizeof(posting_list_t), TRIE_LIST_SLAB_SHIFT);
+  byte_arena_init(&trie->postings);
+  trie->generation = 0;
+  trie->visible_docs = INT_MAX;
+  if (attach_epoch(trie) != 0) {
+    free(trie);
+    return NULL;
   }
-  new_node->occurrences = NULL;
-  new_node->char_index = -1;
-  return new_node;
+  trie->read_only = false;
+  trie->positional = true;
+  trie->term_counts = true;
+  trie->root = create_node(trie, TRIE_NODE4);
+  if (trie->root == ARENA_NULL) {
+    trie_free(trie);
+    return NULL;
+  }
+  return trie;
 }
 
-void trie_insert(trie_node_t *root, const char *word, int doc_id, int page_num,
-                 long byte_offset) {
+// Fills node->terms bottom up; returns the (saturated) count of `node`
+static uint32_t count_terms(trie_t *trie, uint32_t node) {
+  unsigned char keys[ALPHABET_SIZE];
+  uint32_t children[ALPHABET_SIZE];
+  int count = trie_node_children(trie, node, keys, children);
+  trie_node_t *n = trie_node(trie, node);
+  uint32_t terms = n->isEndOfWord ? 1 : 0;
+  for (int i = 0; i < count; i++)
+    terms += count_terms(trie, children[i]);
+  if (terms > TRIE_TERMS_SATURATED)
+    terms = TRIE_TERMS_SATURATED;
+  trie_node(trie, node)->terms = (uint16_t)terms;
+  return terms;
+}
 
-#ifdef DEBUG_MODE
-  printf("[DEBUG INSERT] word='%s' doc=%d page=%d offset=%ld\n", word, doc_id,
-         page_num, byte_offset);
-#endif /* ifdef DEBUG_MODE                                                     \
-        */
-  trie_node_t *current = root;
-  while (*word != '\0') {
-    unsigned char c = *word;
-    // Calculate index for the character
-    int idx = c;
-    if (current->children[idx] == NULL) {
-      current->children[idx] = create_node();
-    }
-    current = current->children[idx];
-    word++;
+/*
+ * Rebuild a trie over the arenas of a flat index file. With copy the
+ * records move into owned slabs and the trie can keep growing; without it
+ * the trie reads straight from the image and refuses inserts.
+ */
+trie_t *trie_open_image(const trie_image_t *image, bool copy) {
+  trie_t *trie = calloc(1, sizeof(trie_t));
+  if (trie == NULL) {
+    return NULL;
+  }
+
+  int failed = 0;
+  for (int t = 0; t < TRIE_NODE_TYPES; t++) {
+    const trie_arena_image_t *a = &image->nodes[t];
+    failed |= a->elem_size != node_sizes[t];
+    failed |= slab_pool_attach(&trie->nodes[t], a->base, a->elem_size,
+                               a->slab_shift, a->count, copy);
+  }
+  failed |= image->lists.elem_size != sizeof(posting_list_t);
+  failed |= slab_pool_attach(&trie->lists, image->lists.base,
+                             image->lists.elem_size, image->lists.slab_shift,
+                             image->lists.count, copy);
+  failed |= image->postings.slab_shift != BYTE_ARENA_SLAB_SHIFT;
+  failed |= byte_arena_attach(&trie->postings, image->postings.base,
+                              image->postings.count, copy);
+
+  // The root must name a record that exists
+  uint32_t root_index = image->root & TRIE_INDEX_MASK;
+  failed |= root_index == ARENA_NULL ||
+            root_index >= image->nodes[trie_node_type(image->root)].count;
+  if (failed) {
+    trie_free(trie);
+    return NULL;
+  }
+  if (attach_epoch(trie) != 0) {
+    trie_free(trie);
+    return NULL;
+  }
+  trie->root = image->root;
+  trie->visible_docs = INT_MAX;
+  trie->read_only = !copy;
+  trie->positional = image->positional;
+  trie->term_counts = image->term_counts;
+  if (copy && !trie->term_counts) { // Older file: count once, then maintain
+    count_terms(trie, trie->root);
+    trie->term_counts = true;
   }
-  current->isEndOfWord = true;
-  add_occurence_to_node(current, doc_id, page_num, byte_offset);
+  return trie;
 }
 
-void trie_free(trie_node_t *node) {
-  if (node == NULL)
-    return;
+// Creates a new Trie node of the given type and returns its tagged handle
+uint32_t create_node(trie_t *trie, trie_node_type_t type) {
+  uint32_t index = slab_pool_alloc(&trie->nodes[type]);
+
+  if (index == ARENA_NULL || index > TRIE_INDEX_MASK) {
+    return ARENA_NULL;
+  }
+  // Records come zeroed: no children, no prefix, no postings
+  return ((uint32_t)type << TRIE_TYPE_SHIFT) | index;
+}
+
+// epoch_release_fn: the node goes back to its pool
+static void release_node(void *owner, uintptr_t item) {
+  trie_t *trie = owner;
+  uint32_t node = (uint32_t)item;
+  slab_pool_free(&trie->nodes[trie_node_type(node)], node & TRIE_INDEX_MASK);
+}
 
-  // Tell all 128 potential alphabet children to free themselves
-  for (int i = 0; i < ALPHABET_SIZE; i++) {
-    if (node->children[i] != NULL) {
-      trie_free(node->children[i]);
+static void release_list(void *owner, uintptr_t item) {
+  trie_t *trie = owner;
+  slab_pool_free(&trie->lists, (uint32_t)item);
+}
+
+// Points a slot readers may be loading (a child or the root) elsewhere
+static void publish(uint32_t *ref, uint32_t node) {
+  __atomic_store_n(ref, node, __ATOMIC_RELEASE);
+}
+
+// Returns the slot holding the child for byte c, or NULL if there is none
+static uint32_t *find_child_ref(const trie_t *trie, uint32_t node,
+                                unsigned char c) {
+  trie_node_t *n = trie_node(trie, node);
+  switch (trie_node_type(node)) {
+  case TRIE_NODE4: {
+    trie_node4_t *n4 = (trie_node4_t *)n;
+    for (int i = 0; i < n->num_children; i++) {
+      if (n4->keys[i] == c)
+        return &n4->children[i];
+    }
+    return NULL;
+  }
+  case TRIE_NODE16: {
+    trie_node16_t *n16 = (trie_node16_t *)n;
+#ifdef __SSE2__
+    // Compare the key against all 16 slots in one instruction
+    __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)c),
+                                 _mm_loadu_si128((const __m128i *)n16->keys));
+    unsigned mask = (unsigned)_mm_movemask_epi8(cmp) &
+                    ((1u << n->num_children) - 1);
+    if (mask != 0)
+      return &n16->children[__builtin_ctz(mask)];
+#else
+    for (int i = 0; i < n->num_children; i++) {
+      if (n16->keys[i] == c)
+        return &n16->children[i];
     }
+#endif
+    return NULL;
+  }
+  case TRIE_NODE48: {
+    trie_node48_t *n48 = (trie_node48_t *)n;
+    uint8_t slot = __atomic_load_n(&n48->child_index[c], __ATOMIC_ACQUIRE);
+    return slot ? &n48->children[slot - 1] : NULL;
   }
+  case TRIE_NODE256: {
+    trie_node256_t *n256 = (trie_node256_t *)n;
+    return __atomic_load_n(&n256->children[c], __ATOMIC_ACQUIRE) != ARENA_NULL
+               ? &n256->children[c]
+               : NULL;
+  }
+  }
+  return NULL;
+}
+
+uint32_t trie_find_child(const trie_t *trie, uint32_t node, unsigned char c) {
+  uint32_t *ref = find_child_ref(trie, node, c);
+  return ref ? __atomic_load_n(ref, __ATOMIC_ACQUIRE) : ARENA_NULL;
+}
 
-  // Free the linked list of occurrences for this word
-  word_occurrence_t *curr_occur = node->occurrences;
-  while (curr_occur != NULL) {
-    word_occurrence_t *next = curr_occur->next;
-    free(curr_occur);
-    curr_occur = next;
+// Same type, same contents: the copy a published node is changed in
+static uint32_t copy_node(trie_t *trie, uint32_t node) {
+  trie_node_type_t type = trie_node_type(node);
+  uint32_t copy = create_node(trie, type);
+  if (copy == ARENA_NULL)
+    return ARENA_NULL;
+  memcpy(trie_node(trie, copy), trie_node(trie, node), node_sizes[type]);
+  return copy;
+}
+
+// Copy a full node into the next bigger type. Returns the new handle.
+static uint32_t grow_node(trie_t *trie, uint32_t node) {
+  trie_node_type_t type = trie_node_type(node);
+  uint32_t bigger = create_node(trie, (trie_node_type_t)(type + 1));
+  if (bigger == ARENA_NULL)
+    return ARENA_NULL;
+
+  trie_node_t *old = trie_node(trie, node);
+  trie_node_t *grown = trie_node(trie, bigger);
+  *grown = *old; // header: prefix, end marker, postings, child count
+
+  switch (type) {
+  case TRIE_NODE4: {
+    trie_node4_t *from = (trie_node4_t *)old;
+    trie_node16_t *to = (trie_node16_t *)grown;
+    memcpy(to->keys, from->keys, old->num_children);
+    memcpy(to->children, from->children, sizeof(uint32_t) * old->num_children);
+    break;
   }
+  case TRIE_NODE16: {
+    trie_node16_t *from = (trie_node16_t *)old;
+    trie_node48_t *to = (trie_node48_t *)grown;
+    for (int i = 0; i < old->num_children; i++) {
+      to->children[i] = from->children[i];
+      to->child_index[from->keys[i]] = i + 1;
+    }
+    break;
+  }
+  case TRIE_NODE48: {
+    trie_node48_t *from = (trie_node48_t *)old;
+    trie_node256_t *to = (trie_node256_t *)grown;
+    for (int c = 0; c < 256; c++) {
+      if (from->child_index[c])
+        to->children[c] = from->children[from->child_index[c] - 1];
+    }
+    break;
+  }
+  case TRIE_NODE256:
+    break; // Never full
+  }
+  return bigger;
+}
 
-  // Finally free the node itself
-  free(node);
+// Sorted insert into the key/child arrays of a Node4 or Node16
+static void insert_sorted(uint8_t *keys, uint32_t *children, int count,
+                          unsigned char c, uint32_t child) {
+  int pos = 0;
+  while (pos < count && keys[pos] < c)
+    pos++;
+  memmove(keys + pos + 1, keys + pos, count - pos);
+  memmove(children + pos + 1, children + pos, sizeof(uint32_t) * (count - pos));
+  keys[pos] = c;
+  children[pos] = child;
 }
 
-word_occurrence_t *create_occurrence(int doc_id, int page_num,
-                                     long byte_offset) {
-  word_occurrence_t *new_occurrence =
-      (word_occurrence_t *)malloc(sizeof(word_occurrence_t));
+// Adds the edge to a node readers cannot see yet, or to a Node48/256
+static void insert_child(trie_t *trie, uint32_t node, unsigned char c,
+                         uint32_t child) {
+  trie_node_t *n = trie_node(trie, node);
+  switch (trie_node_type(node)) {
+  case TRIE_NODE4: {
+    trie_node4_t *n4 = (trie_node4_t *)n;
+    insert_sorted(n4->keys, n4->children, n->num_children, c, child);
+    break;
+  }
+  case TRIE_NODE16: {
+    trie_node16_t *n16 = (trie_node16_t *)n;
+    insert_sorted(n16->keys, n16->children, n->num_children, c, child);
+    break;
+  }
+  case TRIE_NODE48: {
+    // Nodes never lose children, so the slots in use are 0..num_children-1
+    // and the new one is filled before the index byte points at it
+    trie_node48_t *n48 = (trie_node48_t *)n;
+    n48->children[n->num_children] = child;
+    __atomic_store_n(&n48->child_index[c], (uint8_t)(n->num_children + 1),
+                     __ATOMIC_RELEASE);
+    break;
+  }
+  case TRIE_NODE256: {
+    trie_node256_t *n256 = (trie_node256_t *)n;
+    publish(&n256->children[c], child);
+    break;
+  }
+  }
+  n->num_children++;
+}
 
-  if (new_occurrence == NULL) {
-    return NULL;
+/*
+ * Attach `child` under byte c. `ref` is the slot that points at `node`
+ * (in the parent or trie->root). Node48 and Node256 take the edge in
+ * place. A Node4 or Node16, sorted and read without locks, gets a copy
+ * (the next bigger type when full) that replaces it in *ref, and the
+ * original is retired.
+ */
+static int add_child(trie_t *trie, uint32_t *ref, uint32_t node,
+                     unsigned char c, uint32_t child) {
+  static const int capacity[TRIE_NODE_TYPES] = {4, 16, 48, 256};
+  trie_node_type_t type = trie_node_type(node);
+  trie_node_t *n = trie_node(trie, node);
+
+  if (type >= TRIE_NODE48 && n->num_children < capacity[type]) {
+    insert_child(trie, node, c, child);
+    return 0;
   }
+  uint32_t copy = n->num_children == capacity[type] ? grow_node(trie, node)
+                                                    : copy_node(trie, node);
+  if (copy == ARENA_NULL)
+    return -1;
+  insert_child(trie, copy, c, child);
+  publish(ref, copy);
+  epoch_retire(trie->epoch, release_node, trie, node);
+  return 0;
+}
 
-  new_occurrence->doc_id = doc_id;
-  new_occurrence->page_num = page_num;
-  new_occurrence->byte_offset = byte_offset;
-  new_occurrence->next = NULL;
+/*
+ * Build the chain of nodes that spells `key` below a new edge.
+ * Returns the top of the chain and stores the last node in *leaf.
+ */
+static uint32_t create_chain(trie_t *trie, const unsigned char *key,
+                             size_t len, uint32_t *leaf) {
+  uint32_t top = create_node(trie, TRIE_NODE4);
+  if (top == ARENA_NULL)
+    return ARENA_NULL;
+
+  uint32_t current = top;
+  for (;;) {
+    trie_node_t *n = trie_node(trie, current);
+    size_t take = len < TRIE_MAX_PREFIX ? len : TRIE_MAX_PREFIX;
+    memcpy(n->prefix, key, take);
+    n->prefix_len = (uint8_t)take;
+    key += take;
+    len -= take;
+    if (len == 0)
+      break;
+
+    // Prefix is full: continue the chain through a single-child node
+    uint32_t next = create_node(trie, TRIE_NODE4);
+    if (next == ARENA_NULL)
+      return ARENA_NULL;
+    trie_node4_t *n4 = (trie_node4_t *)trie_node(trie, current);
+    n4->keys[0] = *key;
+    n4->children[0] = next;
+    n4->header.num_children = 1;
+    key++;
+    len--;
+    current = next;
+  }
+  *leaf = current;
+  return top;
+}
 
-  return new_occurrence;
+// Adds a just inserted word to the term count of every node on its path
+static void count_new_word(trie_t *trie, const unsigned char *key,
+                           size_t len) {
+  uint32_t node = trie->root;
+  for (;;) {
+    trie_node_t *n = trie_node(trie, node);
+    if (n->terms < TRIE_TERMS_SATURATED)
+      __atomic_store_n(&n->terms, n->terms + 1, __ATOMIC_RELAXED);
+    key += n->prefix_len;
+    len -= n->prefix_len;
+    if (len == 0)
+      return;
+    node = trie_find_child(trie, node, key[0]);
+    key++;
+    len--;
+  }
 }
 
-// For serialization to prevent duplicates
-void add_occurence_to_node(trie_node_t *node, int doc_id, int page_num,
-                           long byte_offset) {
-  // Check if the list is not empty
-  if (node->occurrences != NULL) {
-    // Look at the very first item (the most recent one added) [We are
-    // prepending]
-    if (node->occurrences->doc_id == doc_id &&
-        node->occurrences->page_num == page_num &&
-        node->occurrences->byte_offset == byte_offset) {
-      return; // We have already recorded this word for this page. Skip!
+/*
+ * Walk down to the node spelling key[0..len), creating and splitting nodes
+ * as needed. The node is marked as the end of a word and its handle returned.
+ */
+uint32_t trie_insert_key(trie_t *trie, const unsigned char *key, size_t len) {
+  if (trie->read_only)
+    return ARENA_NULL;
+  const unsigned char *word = key;
+  size_t word_len = len;
+  uint32_t *ref = &trie->root;
+
+  for (;;) {
+    uint32_t node = *ref;
+    trie_node_t *n = trie_node(trie, node);
+
+    // 1. Match the compressed path stored in this node
+    size_t p = 0;
+    while (p < n->prefix_len && p < len && key[p] == n->prefix[p])
+      p++;
+
+    // 2. Mismatch inside the path: split it with a new parent over a
+    // copy of the node that keeps the rest of the path
+    if (p < n->prefix_len) {
+      uint32_t parent = create_node(trie, TRIE_NODE4);
+      uint32_t rest = copy_node(trie, node);
+      if (parent == ARENA_NULL || rest == ARENA_NULL)
+        return ARENA_NULL;
+      trie_node_t *pn = trie_node(trie, parent);
+      trie_node_t *rn = trie_node(trie, rest);
+      memcpy(pn->prefix, n->prefix, p);
+      pn->prefix_len = (uint8_t)p;
+
+      unsigned char split = n->prefix[p];
+      memmove(rn->prefix, n->prefix + p + 1, n->prefix_len - p - 1);
+      rn->prefix_len = (uint8_t)(n->prefix_len - p - 1);
+
+      trie_node4_t *pn4 = (trie_node4_t *)pn;
+      pn4->keys[0] = split;
+      pn4->children[0] = rest;
+      pn->num_children = 1;
+      pn->terms = n->terms;
+      publish(ref, parent);
+      epoch_retire(trie->epoch, release_node, trie, node);
+      node = parent;
+      n = pn;
+    }
+    key += p;
+    len -= p;
+
+    // 3. The whole key is consumed: this node ends the word
+    if (len == 0) {
+      if (!n->isEndOfWord) {
+        n->isEndOfWord = true;
+        count_new_word(trie, word, word_len);
+      }
+      return node;
+    }
+
+    // 4. Follow the edge for the next byte if it exists
+    uint32_t *child_ref = find_child_ref(trie, node, key[0]);
+    if (child_ref != NULL) {
+      ref = child_ref;
+      key++;
+      len--;
+      continue;
     }
+
+    // 5. Otherwise hang the rest of the key below a new edge
+    uint32_t leaf = ARENA_NULL;
+    uint32_t chain = create_chain(trie, key + 1, len - 1, &leaf);
+    if (chain == ARENA_NULL)
+      return ARENA_NULL;
+    trie_node(trie, leaf)->isEndOfWord = true;
+    if (add_child(trie, ref, node, key[0], chain) != 0)
+      return ARENA_NULL;
+    count_new_word(trie, word, word_len);
+    return leaf;
   }
+}
+
+void trie_insert(trie_t *trie, const char *word, int doc_id, int page_num,
+                 long byte_offset) {
+  trie_insert_at(trie, word, doc_id, page_num, byte_offset, 0);
+}
+
+/*
+ * Like trie_insert(), recording the word's token position on the page.
+ * The generation is left alone: the writer bumps it once a batch is
+ * visible (trie_publish(), trie_touch()), not per token.
+ */
+void trie_insert_at(trie_t *trie, const char *word, int doc_id, int page_num,
+                    long byte_offset, int position) {
 
-  // Otherwise proceed with the process
-  word_occurrence_t *new_occ = create_occurrence(doc_id, page_num, byte_offset);
-  if (new_occ == NULL)
+#ifdef DEBUG_MODE
+  printf("[DEBUG INSERT] word='%s' doc=%d page=%d offset=%ld pos=%d\n", word,
+         doc_id, page_num, byte_offset, position);
+#endif /* ifdef DEBUG_MODE                                                     \
+        */
+  uint32_t node =
+      trie_insert_key(trie, (const unsigned char *)word, strlen(word));
+  if (node == ARENA_NULL)
     return;
-  new_occ->next = node->occurrences;
-  node->occurrences = new_occ;
+  add_occurence_to_node(trie, node, doc_id, page_num, byte_offset, position);
 }
 
-// For deserialization because there's no dulicates
-// Stop checking if occurrences are equal or anything like that
+// The thread's pinned trie, see trie_read_begin()
+static __thread struct {
+  const trie_t *trie;
+  int depth;
+  int slot;
+  int doc_limit;
+} reader;
 
-void relink_occurence(trie_node_t *node, int doc_id, int page_num,
-                      long byte_offset) {
-  word_occurrence_t *new_occ = create_occurrence(doc_id, page_num, byte_offset);
-  if (new_occ == NULL)
+/*
+ * Pins the trie for the calling thread until the matching trie_read_end():
+ * nothing the thread can reach is released meanwhile, and its posting
+ * iterators stop at the documents published when it was pinned, so a
+ * query sees one snapshot. Calls nest; a thread reads one trie at a time
+ * (nested calls for another trie do not pin it).
+ */
+void trie_read_begin(const trie_t *trie) {
+  if (reader.depth++ > 0)
     return;
+  reader.trie = trie;
+  reader.slot = trie->epoch != NULL ? epoch_enter(trie->epoch) : -1;
+  reader.doc_limit = __atomic_load_n(&trie->visible_docs, __ATOMIC_ACQUIRE);
+}
 
-  // Just prepend - no checking is needed
-  new_occ->next = node->occurrences;
-  node->occurrences = new_occ;
+/*
+ * trie_read_begin() for a reader that pinned the trie's epoch itself
+ * (several tries sharing one, see trie_adopt_epoch()): only the documents
+ * published so far are taken for its iterators.
+ */
+void trie_read_snapshot(const trie_t *trie) {
+  if (reader.depth++ > 0)
+    return;
+  reader.trie = trie;
+  reader.slot = -1;
+  reader.doc_limit = __atomic_load_n(&trie->visible_docs, __ATOMIC_ACQUIRE);
 }
 
-word_occurrence_t *trie_search(trie_node_t *root, const char *word) {
-  trie_node_t *current = root;
-  while (*word != '\0') {
-    unsigned char c = *word;
-    int idx = c;
-    if (current->children[idx] == NULL) {
-      return NULL;
-    }
-    current = current->children[idx];
-    word++;
+void trie_read_end(const trie_t *trie) {
+  if (reader.depth == 0 || --reader.depth > 0)
+    return;
+  if (reader.slot >= 0)
+    epoch_exit(trie->epoch, reader.slot);
+  reader.trie = NULL;
+}
+
+/*
+ * Shows the postings of documents below `visible_docs` (INT_MAX: all of
+ * them) to reads that start from now on, and releases what no reader can
+ * hold any more. Writer only.
+ */
+void trie_publish(trie_t *trie, int visible_docs) {
+  __atomic_store_n(&trie->visible_docs, visible_docs, __ATOMIC_RELEASE);
+  trie_touch(trie);
+  epoch_reclaim(trie->epoch);
+}
+
+/*
+ * Hides documents from `first_doc` on until trie_publish() shows them, and
+ * waits for reads that started before and would not stop there.
+ */
+void trie_hide_from(trie_t *trie, int first_doc) {
+  __atomic_store_n(&trie->visible_docs, first_doc, __ATOMIC_RELEASE);
+  epoch_synchronize(trie->epoch);
+}
+
+// Bumps the generation so cached results of older ones go stale
+void trie_touch(trie_t *trie) {
+  __atomic_add_fetch(&trie->generation, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Hands the epoch of `from` over to `trie`, dropping the one `trie` had,
+ * so readers pinned through `from` also cover what `trie` retires. `from`
+ * is left frozen (see trie_freeze()); nothing it retired may be pending.
+ */
+void trie_adopt_epoch(trie_t *trie, trie_t *from) {
+  epoch_free(trie->epoch);
+  use_epoch(trie, from->epoch);
+  use_epoch(from, NULL);
+}
+
+/*
+ * Ends writing: what the trie retired is released and its epoch dropped,
+ * so it is read without pins from now on and lives as long as its owner
+ * keeps it. No reader may still hold anything it retired.
+ */
+void trie_freeze(trie_t *trie) {
+  epoch_free(trie->epoch);
+  use_epoch(trie, NULL);
+}
+
+// Nodes and postings live in the arena, so teardown is one free per slab
+void trie_free(trie_t *trie) {
+  if (trie == NULL)
+    return;
+
+  epoch_free(trie->epoch); // hands retired records back first
+  for (int t = 0; t < TRIE_NODE_TYPES; t++) {
+    slab_pool_release(&trie->nodes[t]);
   }
-  if (current->isEndOfWord == true) {
-    return current->occurrences;
+  slab_pool_release(&trie->lists);
+  byte_arena_release(&trie->postings);
+  free(trie);
+}
+
+// Empties the trie but keeps its slabs, so a worker can reuse it per batch
+int trie_reset(trie_t *trie) {
+  if (trie->read_only)
+    return -1;
+  epoch_drain(trie->epoch);
+  for (int t = 0; t < TRIE_NODE_TYPES; t++) {
+    slab_pool_reset(&trie->nodes[t]);
   }
-  return NULL;
+  slab_pool_reset(&trie->lists);
+  byte_arena_reset(&trie->postings);
+  trie_touch(trie);
+  trie->root = create_node(trie, TRIE_NODE4);
+  return trie->root == ARENA_NULL ? -1 : 0;
 }
 
-// Count the number of non NULL children in the trie node
-int trie_children_count(trie_node_t *node) {
-  int counter = 0;
-  for (int i = 0; i < ALPHABET_SIZE; i++) {
-    if (node->children[i] != NULL) {
-      counter++;
+/*
+ * Depth-first walk over `src`; `key` holds the bytes spelled so far.
+ * Children are visited in byte order, but any order gives the same result
+ * since every word only touches its own posting list in `dst`.
+ */
+static int trie_merge_node(trie_t *dst, const trie_t *src, uint32_t node,
+                           unsigned char *key, size_t depth,
+                           const int *remap) {
+  trie_node_t *n = trie_node(src, node);
+  if (depth + n->prefix_len >= TRIE_MAX_KEY)
+    return -1;
+  memcpy(key + depth, n->prefix, n->prefix_len);
+  depth += n->prefix_len;
+
+  // 1. Append this word's postings, they sort after everything in dst.
+  // The key is only created once a posting survives the remap.
+  if (n->isEndOfWord && n->postings != ARENA_NULL) {
+    uint32_t target = ARENA_NULL;
+    posting_iter_t it;
+    trie_postings_iter(src, trie_posting_list(src, n->postings), &it);
+    while (posting_iter_next(&it)) {
+      int doc_id = remap ? remap[it.current.doc_id] : it.current.doc_id;
+      if (doc_id < 0)
+        continue;
+      if (target == ARENA_NULL) {
+        target = trie_insert_key(dst, key, depth);
+        if (target == ARENA_NULL)
+          return -1;
+      }
+      add_occurence_to_node(dst, target, doc_id, it.current.page_num,
+                            it.current.byte_offset, it.current.position);
     }
   }
-  return counter;
+
+  // 2. Recurse into the children
+  unsigned char keys[ALPHABET_SIZE];
+  uint32_t children[ALPHABET_SIZE];
+  int count = trie_node_children(src, node, keys, children);
+  for (int i = 0; i < count; i++) {
+    key[depth] = keys[i];
+    if (trie_merge_node(dst, src, children[i], key, depth + 1, remap) != 0)
+      return -1;
+  }
+  return 0;
 }
 
-/* Visits every node and writes its data
- * Writes directly to the file pointer (FILE *fp)
- * This file pointer was opened in the engine_serialize (toolkit_core)
+/*
+ * Adds every word and posting of `src` to `dst`. Cheapest when the
+ * documents in `src` come after those already in `dst`: each posting then
+ * takes the sorted append path.
  */
-int trie_node_serialize(trie_node_t *node, int char_index, FILE *fp) {
-  if (node == NULL)
-    return -1;
+int trie_merge(trie_t *dst, const trie_t *src) {
+  return trie_merge_remap(dst, src, NULL);
+}
 
-  fwrite(&char_index, sizeof(int), 1, fp);
-  fwrite(&node->isEndOfWord, sizeof(bool), 1, fp);
+/*
+ * Like trie_merge(), with doc ids rewritten through remap[old] (-1 drops
+ * the posting, NULL keeps ids as they are). remap must be increasing over
+ * the ids it keeps so postings stay sorted.
+ */
+int trie_merge_remap(trie_t *dst, const trie_t *src, const int *remap) {
+  unsigned char key[TRIE_MAX_KEY];
+  trie_touch(dst);
+  return trie_merge_node(dst, src, src->root, key, 0, remap);
+}
 
-  int child_count = trie_children_count(node);
-  fwrite(&child_count, sizeof(int), 1, fp);
+/*
+ * Appends to the word's posting list; repeated postings are skipped.
+ * A word's first list is published once it holds the posting, and one
+ * that lands before the end is spliced into a copy of the list that
+ * replaces it.
+ */
+void add_occurence_to_node(trie_t *trie, uint32_t node, int doc_id,
+                           int page_num, long byte_offset, int position) {
+  trie_node_t *n = trie_node(trie, node);
+  posting_t p = {doc_id, page_num, byte_offset, position};
+  uint32_t list = n->postings;
+  if (list != ARENA_NULL &&
+      posting_list_append(&trie->postings, trie_posting_list(trie, list),
+                          &p, trie->positional) != POSTING_UNSORTED)
+    return;
 
-  // If this node is the end of the word
-  int occurs = 0;
-  if (node->isEndOfWord) {
-    // Count the occurrences
-    word_occurrence_t *curr = node->occurrences;
-    while (curr != NULL) {
-      occurs++;
-      curr = curr->next;
-    }
+  uint32_t fresh = slab_pool_alloc(&trie->lists);
+  if (fresh == ARENA_NULL)
+    return;
+  posting_list_t *dst = trie_posting_list(trie, fresh);
+  int rc = list == ARENA_NULL
+               ? posting_list_append(&trie->postings, dst, &p,
+                                     trie->positional)
+               : posting_list_insert(&trie->postings, dst,
+                                     trie_posting_list(trie, list), &p,
+                                     trie->positional);
+  if (rc != 0 || dst->count == 0) {
+    slab_pool_free(&trie->lists, fresh); // never published
+    return;
   }
+  __atomic_store_n(&n->postings, fresh, __ATOMIC_RELEASE);
+  if (list != ARENA_NULL)
+    epoch_retire(trie->epoch, release_list, trie, list);
+}
 
-  fwrite(&occurs, sizeof(int), 1, fp);
-  word_occurrence_t *curr = node->occurrences;
-  if (occurs > 0) {
-    while (curr != NULL) {
-      fwrite(&curr->doc_id, sizeof(int), 1, fp);
-      fwrite(&curr->page_num, sizeof(int), 1, fp);
-      fwrite(&curr->byte_offset, sizeof(long), 1, fp);
-      curr = curr->next;
+// Posting list handle of `word`, ARENA_NULL when it is not indexed
+uint32_t trie_lookup(const trie_t *trie, const char *word) {
+  const unsigned char *key = (const unsigned char *)word;
+  uint32_t current = trie_root(trie);
+  for (;;) {
+    trie_node_t *node = trie_node(trie, current);
+
+    // The compressed path has to match byte for byte
+    for (int i = 0; i < node->prefix_len; i++) {
+      if (key[i] != node->prefix[i])
+        return ARENA_NULL;
     }
-  }
+    key += node->prefix_len;
+
+    if (*key == '\0')
+      return trie_node_postings(node);
 
-  // Serialize children
-  for (int i = 0; i < ALPHABET_SIZE; i++) {
-    if (node->children[i] != NULL) {
-      trie_node_serialize(node->children[i], i, fp);
+    current = trie_find_child(trie, current, *key);
+    if (current == ARENA_NULL) {
+      return ARENA_NULL;
     }
+    key++;
   }
+}
 
-  return 0;
+posting_list_t *trie_search(trie_t *trie, const char *word) {
+  uint32_t handle = trie_lookup(trie, word);
+  return handle != ARENA_NULL ? trie_posting_list(trie, handle) : NULL;
 }
 
 /*
- * Visits the binary data in a file (FILE *fp)
- * Reads its data and store it into a respective variable
+ * Finds the topmost node whose subtree holds exactly the words starting
+ * with prefix[0..len). The prefix may end inside that node's compressed
+ * path; `key` (TRIE_MAX_KEY bytes) receives everything spelled down to
+ * and including the node's path, its length in *key_len. Returns
+ * ARENA_NULL when no word has the prefix.
  */
-trie_node_t *trie_node_deserialize(FILE *fp) {
-  // 1. Read the nodes char index
-  int char_index;
-  fread(&char_index, sizeof(int), 1, fp);
+uint32_t trie_find_prefix(const trie_t *trie, const unsigned char *prefix,
+                          size_t len, unsigned char *key, size_t *key_len) {
+  uint32_t current = trie_root(trie);
+  size_t depth = 0, matched = 0;
+  for (;;) {
+    trie_node_t *node = trie_node(trie, current);
+    if (depth + node->prefix_len >= TRIE_MAX_KEY)
+      return ARENA_NULL;
+    for (int i = 0; i < node->prefix_len; i++) {
+      if (matched < len && prefix[matched++] != node->prefix[i])
+        return ARENA_NULL;
+      key[depth++] = node->prefix[i];
+    }
+    if (matched == len) {
+      *key_len = depth;
+      return current;
+    }
+    current = trie_find_child(trie, current, prefix[matched]);
+    if (current == ARENA_NULL)
+      return ARENA_NULL;
+    key[depth++] = prefix[matched++];
+  }
+}
 
-  // 2. Allocate a new trie node
-  trie_node_t *node = create_node();
-  if (node == NULL) // If it fails
-    return NULL;
+// Words in the subtree of `node`, or -1 when the trie has no counts
+long trie_subtree_terms(const trie_t *trie, uint32_t node) {
+  return trie->term_counts
+             ? __atomic_load_n(&trie_node(trie, node)->terms, __ATOMIC_RELAXED)
+             : -1;
+}
+
+/*
+ * Start a streaming decode over one of this trie's posting lists, up to
+ * the documents published when the calling thread pinned the trie.
+ */
+void trie_postings_iter(const trie_t *trie, const posting_list_t *list,
+                        posting_iter_t *it) {
+  posting_iter_init(it, &trie->postings, list, trie->positional);
+  if (reader.depth > 0 && reader.trie == trie)
+    it->doc_limit = reader.doc_limit;
+}
 
-  node->char_index = char_index;
-  // 3. Read isEndOfWord
-  fread(&node->isEndOfWord, sizeof(bool), 1, fp);
+/*
+ * Copies the edges of a node in ascending byte order.
+ * `keys` and `children` must have room for ALPHABET_SIZE entries.
+ */
+int trie_node_children(const trie_t *trie, uint32_t node, unsigned char *keys,
+                       uint32_t *children) {
+  trie_node_t *n = trie_node(trie, node);
+  int count = 0;
+  switch (trie_node_type(node)) {
+  case TRIE_NODE4:
+  case TRIE_NODE16: {
+    // Keys are fixed once published, a slot may be pointed at a copy
+    const uint8_t *from = trie_node_type(node) == TRIE_NODE4
+                              ? ((trie_node4_t *)n)->keys
+                              : ((trie_node16_t *)n)->keys;
+    uint32_t *slots = trie_node_type(node) == TRIE_NODE4
+                          ? ((trie_node4_t *)n)->children
+                          : ((trie_node16_t *)n)->children;
+    count = n->num_children;
+    memcpy(keys, from, count);
+    for (int i = 0; i < count; i++)
+      children[i] = __atomic_load_n(&slots[i], __ATOMIC_ACQUIRE);
+    break;
+  }
+  case TRIE_NODE48: {
+    trie_node48_t *n48 = (trie_node48_t *)n;
+    for (int c = 0; c < 256; c++) {
+      uint8_t slot = __atomic_load_n(&n48->child_index[c], __ATOMIC_ACQUIRE);
+      if (slot) {
+        keys[count] = (unsigned char)c;
+        children[count++] =
+            __atomic_load_n(&n48->children[slot - 1], __ATOMIC_ACQUIRE);
+      }
+    }
+    break;
+  }
+  case TRIE_NODE256: {
+    trie_node256_t *n256 = (trie_node256_t *)n;
+    for (int c = 0; c < 256; c++) {
+      uint32_t child =
+          __atomic_load_n(&n256->children[c], __ATOMIC_ACQUIRE);
+      if (child != ARENA_NULL) {
+        keys[count] = (unsigned char)c;
+        children[count++] = child;
+      }
+    }
+    break;
+  }
+  }
+  return count;
+}
 
-  // 4. Read number of children
-  int child_count;
-  fread(&child_count, sizeof(int), 1, fp);
+// Count the number of non NULL children in the trie node
+int trie_children_count(trie_node_t *node) { return node->num_children; }
+
+// Bytes reserved by the node and posting arenas
+size_t trie_memory_bytes(const trie_t *trie) {
+  size_t total =
+      slab_pool_bytes(&trie->lists) + byte_arena_bytes(&trie->postings);
+  for (int t = 0; t < TRIE_NODE_TYPES; t++) {
+    total += slab_pool_bytes(&trie->nodes[t]);
+  }
+  return total;
+}
 
-  // 5. Read number of occurrences
-  int occurs;
-  fread(&occurs, sizeof(int), 1, fp);
+static int posting_sort_compare(const void *a, const void *b) {
+  return posting_compare(a, b);
+}
 
-  // 6. Rebuild the occurrences list
-  if (occurs > 0) {
+/*
+ * Visits the binary data in a version 1 file (FILE *fp), which holds one
+ * record per character: char index, end marker, child count, occurrences.
+ * Reads its data and store it into a respective variable
+ *
+ * `key` holds the characters on the path so far; every record that ends a
+ * word is re-inserted under that key so paths get compressed again.
+ */
+static int trie_node_deserialize(trie_t *trie, FILE *fp, unsigned char *key,
+                                 size_t depth) {
+  // 1. Read the nodes char index
+  int char_index;
+  bool isEndOfWord;
+  int child_count, occurs;
+  if (fread(&char_index, sizeof(int), 1, fp) != 1 ||
+      fread(&isEndOfWord, sizeof(bool), 1, fp) != 1 ||
+      fread(&child_count, sizeof(int), 1, fp) != 1 ||
+      fread(&occurs, sizeof(int), 1, fp) != 1) {
+    return -1;
+  }
+  if (char_index < 0 || char_index >= ALPHABET_SIZE || depth >= TRIE_MAX_KEY)
+    return -1;
+  key[depth++] = (unsigned char)char_index;
+
+  // 2. Rebuild the posting list. Older files stored occurrences newest
+  // first, so sort them before appending.
+  if (isEndOfWord || occurs > 0) {
+    uint32_t node = trie_insert_key(trie, key, depth);
+    if (node == ARENA_NULL || occurs < 0)
+      return -1;
+    posting_t *postings = malloc(sizeof(posting_t) * (occurs + 1));
+    if (postings == NULL)
+      return -1;
+    for (int i = 0; i < occurs; i++) {
+      if (fread(&postings[i].doc_id, sizeof(int), 1, fp) != 1 ||
+          fread(&postings[i].page_num, sizeof(int), 1, fp) != 1 ||
+          fread(&postings[i].byte_offset, sizeof(long), 1, fp) != 1) {
+        free(postings);
+        return -1;
+      }
+    }
+    qsort(postings, occurs, sizeof(posting_t), posting_sort_compare);
     for (int i = 0; i < occurs; i++) {
-      int doc_id, page_num;
-      fread(&doc_id, sizeof(int), 1, fp);
-      fread(&page_num, sizeof(int), 1, fp);
-      long byte_offset;
-      fread(&byte_offset, sizeof(long), 1, fp);
-      relink_occurence(node, doc_id, page_num, byte_offset);
+      add_occurence_to_node(trie, node, postings[i].doc_id,
+                            postings[i].page_num, postings[i].byte_offset, -1);
     }
+    free(postings);
   }
 
-  // 7. Deserialize children
+  // 3. Deserialize children
   for (int i = 0; i < child_count; i++) {
-    trie_node_t *child = trie_node_deserialize(fp);
-    if (child != NULL) {
-      node->children[child->char_index] = child;
-    }
+    if (trie_node_deserialize(trie, fp, key, depth) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+trie_t *trie_deserialize(FILE *fp) {
+  bool isEndOfWord;
+  int root_children_num;
+  if (fread(&isEndOfWord, sizeof(bool), 1, fp) != 1 ||
+      fread(&root_children_num, sizeof(int), 1, fp) != 1) {
+    return NULL;
   }
 
-  return node;
+  trie_t *trie = trie_create();
+  if (trie == NULL)
+    return NULL;
+  trie->positional = false; // version 1 files never had positions
+
+  unsigned char key[TRIE_MAX_KEY];
+  for (int i = 0; i < root_children_num; i++) {
+    if (trie_node_deserialize(trie, fp, key, 0) != 0) {
+      trie_free(trie);
+      return NULL;
+    }
+  }
+  return trie;
 }
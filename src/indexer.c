@@ -0,0 +1,294 @@
+#include "indexer.h"
+#include "pdf_processor.h"
+#include "segments.h"
+#include "updater.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Parallel indexing. Documents are cut into batches of consecutive doc ids.
+ * Workers claim batches in order, extract them into a thread-local trie
+ * and park the result; the calling thread merges the parked tries strictly
+ * in batch order. The merged index is therefore identical to a sequential
+ * run whatever the worker count, and every merged posting takes the sorted
+ * append path. Merged tries go back on a spare list for the next batch.
+ *
+ * Queries may run meanwhile: documents from first_doc on stay hidden
+ * until their batch is merged (one document at a time when sequential),
+ * so every query sees whole documents only.
+ */
+typedef struct {
+  search_engine_t *engine;
+  int first_doc; // documents before this one are already indexed
+  int batch_size;
+  int batch_count;
+  int window; // batches allowed in flight ahead of the merge
+
+  pthread_mutex_t lock;
+  pthread_cond_t ready; // a batch finished (the merging thread waits)
+  pthread_cond_t room;  // the merge moved on (workers wait)
+
+  int next_batch; // next batch to claim
+  int merged;     // batches merged so far
+  bool stop;
+  bool *finished; // per batch: worker is done with it
+  trie_t **tries; // per batch: the local trie, NULL if indexing failed
+  trie_t **spares;
+  int spare_count;
+} index_job_t;
+
+// Fingerprint first, so an edit during extraction shows up as a change
+static void index_document(search_engine_t *engine, trie_t *trie,
+                           int doc_id) {
+  doc_meta_t *meta = &engine->doc_meta[doc_id];
+  char path[DOC_TABLE_MAX_PATH];
+  if (doc_table_get(&engine->docs, doc_id, path, sizeof(path)) < 0)
+    return;
+  doc_fingerprint(path, meta);
+  long words = index_pdf_into(trie, engine->texts, doc_id, path);
+  meta->length = words > (long)UINT32_MAX ? UINT32_MAX : (uint32_t)words;
+}
+
+static void index_batch(index_job_t *job, int batch, trie_t *trie) {
+  int first = job->first_doc + batch * job->batch_size;
+  int last = first + job->batch_size;
+  if (last > job->engine->doc_count)
+    last = job->engine->doc_count;
+  for (int doc_id = first; doc_id < last; doc_id++) {
+    index_document(job->engine, trie, doc_id);
+  }
+}
+
+static void *index_worker(void *arg) {
+  index_job_t *job = arg;
+
+  pthread_mutex_lock(&job->lock);
+  for (;;) {
+    // 1. Claim the next batch once the merge has room for it
+    while (!job->stop && job->next_batch < job->batch_count &&
+           job->next_batch >= job->merged + job->window) {
+      pthread_cond_wait(&job->room, &job->lock);
+    }
+    if (job->stop || job->next_batch >= job->batch_count)
+      break;
+    int batch = job->next_batch++;
+    trie_t *trie =
+        job->spare_count > 0 ? job->spares[--job->spare_count] : NULL;
+    pthread_mutex_unlock(&job->lock);
+
+    // 2. Extract without holding the lock
+    if (trie == NULL) {
+      trie = trie_create();
+    } else if (trie_reset(trie) != 0) {
+      trie_free(trie);
+      trie = NULL;
+    }
+    if (trie != NULL)
+      index_batch(job, batch, trie);
+
+    // 3. Park the result for the merging thread
+    pthread_mutex_lock(&job->lock);
+    job->tries[batch] = trie;
+    job->finished[batch] = true;
+    pthread_cond_signal(&job->ready);
+  }
+  pthread_mutex_unlock(&job->lock);
+  return NULL;
+}
+
+static void report_batch(index_job_t *job, int batch,
+                         index_progress_fn progress, void *user_data) {
+  int first = job->first_doc + batch * job->batch_size;
+  int last = first + job->batch_size;
+  if (last > job->engine->doc_count)
+    last = job->engine->doc_count;
+  for (int doc_id = first; doc_id < last; doc_id++) {
+    progress(doc_id - job->first_doc + 1,
+             job->engine->doc_count - job->first_doc,
+             engine_get_document_path(job->engine, doc_id), user_data);
+  }
+}
+
+// Whether the live trie outgrew the budget (engine_set_memory_budget())
+static bool over_budget(const search_engine_t *engine) {
+  return engine->memory_budget > 0 &&
+         trie_memory_bytes(engine->index) >= engine->memory_budget;
+}
+
+static int index_sequential(search_engine_t *engine, int first_doc,
+                            index_progress_fn progress, void *user_data) {
+  for (int i = first_doc; i < engine->doc_count; i++) {
+    index_document(engine, engine->index, i);
+    trie_publish(engine->index, i + 1);
+    if (over_budget(engine) && segments_spill(engine, i + 1) != 0)
+      return -1;
+    if (progress != NULL)
+      progress(i - first_doc + 1, engine->doc_count - first_doc,
+               engine_get_document_path(engine, i), user_data);
+  }
+  return 0;
+}
+
+/*
+ * Caps the live trie at `bytes` while indexing (0 lifts the cap). Past
+ * it, the documents indexed so far are spilled as a sorted run file and
+ * only its read-only mapping is kept (segments_spill()): next to the
+ * manifest of a segmented engine, else under `temp_dir` (NULL: $TMPDIR,
+ * then /tmp). Queries keep seeing every document, and engine_serialize()
+ * merges the runs into one index file without loading them (a first
+ * engine_flush() keeps them as segments). Parked worker tries are not
+ * counted. Returns -1 if out of memory.
+ */
+int engine_set_memory_budget(search_engine_t *engine, size_t bytes,
+                             const char *temp_dir) {
+  char *copy = NULL;
+  if (temp_dir != NULL) {
+    size_t len = strlen(temp_dir) + 1;
+    copy = malloc(len);
+    if (copy == NULL)
+      return -1;
+    memcpy(copy, temp_dir, len);
+  }
+  free(engine->temp_dir);
+  engine->temp_dir = copy;
+  engine->memory_budget = bytes;
+  return 0;
+}
+
+/*
+ * Indexes every document in the table with `workers` threads
+ * (<= 0 picks one per online CPU). Returns 0 on success, -1 if the engine
+ * is read-only or a batch could not be indexed or merged.
+ */
+int engine_index_parallel(search_engine_t *engine, int workers,
+                          index_progress_fn progress, void *user_data) {
+  return engine_index_from(engine, 0, workers, progress, user_data);
+}
+
+/*
+ * Same as engine_index_parallel() for documents first_doc..doc_count-1
+ * only, the ones appended since the last run. Their ids sort after every
+ * posting already in the index, so merges stay on the append path.
+ * Progress counts from 1 to the number of new documents. Documents in
+ * sealed segments (see engine_flush()) cannot be indexed again.
+ */
+int engine_index_from(search_engine_t *engine, int first_doc, int workers,
+                      index_progress_fn progress, void *user_data) {
+  if (engine->mapping != NULL || engine->index->read_only) {
+    fprintf(stderr, "Cannot index into a read-only mapped engine\n");
+    return -1;
+  }
+  int sealed = engine->segments != NULL ? engine->segments->sealed_docs : 0;
+  if (first_doc < sealed || first_doc > engine->doc_count ||
+      engine_reserve_meta(engine) != 0)
+    return -1;
+  trie_hide_from(engine->index, first_doc);
+  int docs = engine->doc_count - first_doc;
+  if (workers <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (int)cpus : 1;
+  }
+  if (workers > docs)
+    workers = docs;
+  if (workers <= 1) {
+    int result = index_sequential(engine, first_doc, progress, user_data);
+    engine_update_ranking(engine);
+    trie_publish(engine->index, INT_MAX);
+    return result;
+  }
+
+  // 1. Batches: a few per worker for balance, capped to bound local tries
+  index_job_t job = {0};
+  job.engine = engine;
+  job.first_doc = first_doc;
+  job.batch_size = docs / (workers * 8);
+  if (job.batch_size < 1)
+    job.batch_size = 1;
+  if (job.batch_size > INDEXER_MAX_BATCH)
+    job.batch_size = INDEXER_MAX_BATCH;
+  job.batch_count = (docs + job.batch_size - 1) / job.batch_size;
+  job.window = workers * 2;
+  job.finished = calloc(job.batch_count, sizeof(bool));
+  job.tries = calloc(job.batch_count, sizeof(trie_t *));
+  job.spares = calloc(job.window, sizeof(trie_t *));
+  pthread_t *threads = calloc(workers, sizeof(pthread_t));
+  if (job.finished == NULL || job.tries == NULL || job.spares == NULL ||
+      threads == NULL) {
+    free(job.finished);
+    free(job.tries);
+    free(job.spares);
+    free(threads);
+    return -1;
+  }
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.ready, NULL);
+  pthread_cond_init(&job.room, NULL);
+
+  // 2. Start the workers
+  int started = 0;
+  while (started < workers &&
+         pthread_create(&threads[started], NULL, index_worker, &job) == 0) {
+    started++;
+  }
+
+  // 3. Merge in batch order on this thread
+  int result = started > 0 ? 0 : -1;
+  for (int batch = 0; batch < job.batch_count && result == 0; batch++) {
+    pthread_mutex_lock(&job.lock);
+    while (!job.finished[batch])
+      pthread_cond_wait(&job.ready, &job.lock);
+    trie_t *trie = job.tries[batch];
+    job.tries[batch] = NULL;
+    pthread_mutex_unlock(&job.lock);
+
+    if (trie == NULL || trie_merge(engine->index, trie) != 0) {
+      trie_free(trie);
+      result = -1;
+      break;
+    }
+    int merged_docs = job.first_doc + (batch + 1) * job.batch_size;
+    if (merged_docs > engine->doc_count)
+      merged_docs = engine->doc_count;
+    trie_publish(engine->index, merged_docs);
+    if (over_budget(engine) && segments_spill(engine, merged_docs) != 0)
+      result = -1;
+    if (progress != NULL)
+      report_batch(&job, batch, progress, user_data);
+
+    pthread_mutex_lock(&job.lock);
+    job.spares[job.spare_count++] = trie;
+    job.merged++;
+    pthread_cond_broadcast(&job.room);
+    pthread_mutex_unlock(&job.lock);
+  }
+
+  // 4. Stop and join the workers, then drop every local trie
+  pthread_mutex_lock(&job.lock);
+  job.stop = true;
+  pthread_cond_broadcast(&job.room);
+  pthread_mutex_unlock(&job.lock);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  for (int i = 0; i < job.batch_count; i++) {
+    trie_free(job.tries[i]);
+  }
+  for (int i = 0; i < job.spare_count; i++) {
+    trie_free(job.spares[i]);
+  }
+
+  pthread_cond_destroy(&job.room);
+  pthread_cond_destroy(&job.ready);
+  pthread_mutex_destroy(&job.lock);
+  free(job.finished);
+  free(job.tries);
+  free(job.spares);
+  free(threads);
+  engine_update_ranking(engine);
+  trie_publish(engine->index, INT_MAX);
+  return result;
+}
@@ -0,0 +1,163 @@
+#include "key_set.h"
+#include <stdbool.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * First index >= from whose key is >= `key`, or count. Probes 1, 2, 4...
+ * slots ahead, then binary searches the last step, so a walk over a long
+ * array costs log of the distance covered rather than the distance.
+ */
+size_t key_gallop(const uint64_t *keys, size_t count, size_t from,
+                  uint64_t key) {
+  if (from >= count || keys[from] >= key)
+    return from;
+  size_t lo = from; // keys[lo] < key
+  size_t step = 1;
+  while (lo + step < count && keys[lo + step] < key) {
+    lo += step;
+    step <<= 1;
+  }
+  size_t hi = lo + step < count ? lo + step : count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (keys[mid] < key)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return hi;
+}
+
+// Each key of the small side is galloped to in the large one
+static size_t intersect_gallop(const uint64_t *small, size_t ns,
+                               const uint64_t *large, size_t nl,
+                               uint64_t *out) {
+  size_t n = 0, j = 0;
+  for (size_t i = 0; i < ns && j < nl; i++) {
+    j = key_gallop(large, nl, j, small[i]);
+    if (j < nl && large[j] == small[i])
+      out[n++] = small[i];
+  }
+  return n;
+}
+
+/*
+ * Block merge for lists of similar size: a block of a is compared with
+ * every rotation of a block of b in a few vector compares, and whichever
+ * block ends lower moves on. Keys are unique, so each key of a matches at
+ * most once. SSE2 has no 64-bit compare: equal 32-bit halves are ANDed.
+ */
+static size_t intersect_merge(const uint64_t *a, size_t na, const uint64_t *b,
+                              size_t nb, uint64_t *out) {
+  size_t i = 0, j = 0, n = 0;
+#if defined(__AVX2__)
+  while (i + 4 <= na && j + 4 <= nb) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+    __m256i eq = _mm256_cmpeq_epi64(va, vb);
+    eq = _mm256_or_si256(
+        eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39)));
+    eq = _mm256_or_si256(
+        eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4E)));
+    eq = _mm256_or_si256(
+        eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93)));
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    for (int k = 0; k < 4; k++) {
+      if (mask & (1 << k))
+        out[n++] = a[i + k];
+    }
+    uint64_t amax = a[i + 3], bmax = b[j + 3];
+    i += amax <= bmax ? 4 : 0;
+    j += bmax <= amax ? 4 : 0;
+  }
+#elif defined(__SSE2__)
+  while (i + 2 <= na && j + 2 <= nb) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+    __m128i vr = _mm_shuffle_epi32(vb, 0x4E); // swap the two keys
+    __m128i eq = _mm_cmpeq_epi32(va, vb);
+    eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, 0xB1));
+    __m128i er = _mm_cmpeq_epi32(va, vr);
+    er = _mm_and_si128(er, _mm_shuffle_epi32(er, 0xB1));
+    int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_or_si128(eq, er)));
+    if (mask & 1)
+      out[n++] = a[i];
+    if (mask & 2)
+      out[n++] = a[i + 1];
+    uint64_t amax = a[i + 1], bmax = b[j + 1];
+    i += amax <= bmax ? 2 : 0;
+    j += bmax <= amax ? 2 : 0;
+  }
+#endif
+  while (i < na && j < nb) {
+    if (a[i] < b[j]) {
+      i++;
+    } else if (a[i] > b[j]) {
+      j++;
+    } else {
+      out[n++] = a[i];
+      i++, j++;
+    }
+  }
+  return n;
+}
+
+// Keys in both. `out` needs room for the smaller input and must not alias.
+size_t key_intersect(const uint64_t *a, size_t na, const uint64_t *b,
+                     size_t nb, uint64_t *out) {
+  if (na == 0 || nb == 0)
+    return 0;
+  if (na * KEY_GALLOP_RATIO < nb)
+    return intersect_gallop(a, na, b, nb, out);
+  if (nb * KEY_GALLOP_RATIO < na) {
+    size_t n = 0, i = 0;
+    for (size_t j = 0; j < nb && i < na; j++) {
+      i = key_gallop(a, na, i, b[j]);
+      if (i < na && a[i] == b[j])
+        out[n++] = b[j];
+    }
+    return n;
+  }
+  return intersect_merge(a, na, b, nb, out);
+}
+
+// Keys in either. `out` needs room for na + nb and must not alias.
+size_t key_union(const uint64_t *a, size_t na, const uint64_t *b, size_t nb,
+                 uint64_t *out) {
+  size_t i = 0, j = 0, n = 0;
+  while (i < na && j < nb) {
+    if (a[i] < b[j]) {
+      out[n++] = a[i++];
+    } else if (a[i] > b[j]) {
+      out[n++] = b[j++];
+    } else {
+      out[n++] = a[i++];
+      j++;
+    }
+  }
+  while (i < na)
+    out[n++] = a[i++];
+  while (j < nb)
+    out[n++] = b[j++];
+  return n;
+}
+
+// Keys of a that are not in b. `out` may be `a` itself.
+size_t key_difference(const uint64_t *a, size_t na, const uint64_t *b,
+                      size_t nb, uint64_t *out) {
+  bool gallop = na * KEY_GALLOP_RATIO < nb;
+  size_t n = 0, j = 0;
+  for (size_t i = 0; i < na; i++) {
+    if (gallop) {
+      j = key_gallop(b, nb, j, a[i]);
+    } else {
+      while (j < nb && b[j] < a[i])
+        j++;
+    }
+    if (j >= nb || b[j] != a[i])
+      out[n++] = a[i];
+  }
+  return n;
+}
@@ -0,0 +1,108 @@
+#include "levenshtein.h"
+#include <string.h>
+
+// Continuation bytes that follow a UTF-8 lead byte (0 for ASCII and
+// stray continuation bytes, which then stand for themselves)
+static int utf8_follow(unsigned char c) {
+  return c < 0xC0 ? 0 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+}
+
+/*
+ * Builds the automaton for word[0..len) (already case folded) within
+ * `distance` edits, clamped to LEV_MAX_DISTANCE. Returns -1 when the word
+ * is longer than LEV_MAX_CHARS characters.
+ */
+int lev_init(lev_automaton_t *a, const char *word, size_t len,
+             int distance) {
+  memset(a, 0, sizeof(lev_automaton_t));
+  a->distance = distance < 0                  ? 0
+                : distance > LEV_MAX_DISTANCE ? LEV_MAX_DISTANCE
+                                              : distance;
+  const unsigned char *p = (const unsigned char *)word;
+  size_t i = 0;
+  while (i < len) {
+    if (a->length == LEV_MAX_CHARS)
+      return -1;
+    unsigned int c = p[i++];
+    int follow = utf8_follow((unsigned char)c);
+    if (follow > 0)
+      c &= 0x3F >> follow;
+    for (; follow > 0 && i < len && (p[i] & 0xC0) == 0x80; follow--)
+      c = c << 6 | (p[i++] & 0x3F);
+    if (c < 128)
+      a->ascii[c] |= 1ULL << (a->length + 1);
+    a->chars[a->length++] = c;
+  }
+  a->mask = a->length == 63 ? ~0ULL : (2ULL << a->length) - 1;
+  return 0;
+}
+
+// Nothing consumed yet: d edits can delete the first d query characters
+void lev_start(const lev_automaton_t *a, lev_state_t *s) {
+  s->rows[0] = 1;
+  for (int d = 1; d <= a->distance; d++)
+    s->rows[d] = (s->rows[d - 1] | s->rows[d - 1] << 1) & a->mask;
+  s->partial = 0;
+  s->pending = 0;
+}
+
+static uint64_t char_mask(const lev_automaton_t *a, unsigned int c) {
+  if (c < 128)
+    return a->ascii[c];
+  uint64_t m = 0;
+  for (int i = 0; i < a->length; i++) {
+    if (a->chars[i] == c)
+      m |= 1ULL << (i + 1);
+  }
+  return m;
+}
+
+/*
+ * Feeds one input byte. Returns false once no row is alive: no word with
+ * the input so far as a prefix is within the distance, so a trie walk can
+ * drop the whole subtree.
+ */
+bool lev_step(const lev_automaton_t *a, lev_state_t *s, unsigned char byte) {
+  // 1. Assemble the character
+  unsigned int c = byte;
+  if (s->pending > 0 && (byte & 0xC0) == 0x80) {
+    s->partial = s->partial << 6 | (byte & 0x3F);
+    if (--s->pending > 0)
+      return true;
+    c = s->partial;
+  } else {
+    s->pending = utf8_follow(byte);
+    if (s->pending > 0) {
+      s->partial = byte & (0x3F >> s->pending);
+      return true;
+    }
+  }
+
+  // 2. Match, insert, substitute, then close over deletions
+  uint64_t match = char_mask(a, c);
+  uint64_t prev = s->rows[0];
+  uint64_t next = (prev << 1) & match;
+  uint64_t alive = next;
+  s->rows[0] = next;
+  for (int d = 1; d <= a->distance; d++) {
+    uint64_t row = s->rows[d];
+    uint64_t lower = next;
+    next = (((row << 1) & match) | prev | prev << 1 | lower << 1) & a->mask;
+    prev = row;
+    s->rows[d] = next;
+    alive |= next;
+  }
+  return alive != 0;
+}
+
+// Edits between the query and the input so far, or -1 when over the limit
+int lev_distance(const lev_automaton_t *a, const lev_state_t *s) {
+  if (s->pending > 0)
+    return -1;
+  uint64_t accept = 1ULL << a->length;
+  for (int d = 0; d <= a->distance; d++) {
+    if (s->rows[d] & accept)
+      return d;
+  }
+  return -1;
+}
@@ -0,0 +1,129 @@
+#include "lz.h"
+#include <string.h>
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 15 in the nibble, then 255s and a final byte below 255
+static uint8_t *put_length(uint8_t *op, size_t len) {
+  for (len -= 15; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals,
+                             size_t lit_len, size_t offset, size_t match_len) {
+  uint8_t *token = op++;
+  *token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+  if (lit_len >= 15)
+    op = put_length(op, lit_len);
+  memcpy(op, literals, lit_len);
+  op += lit_len;
+  if (match_len == 0)
+    return op; // Final literals
+
+  *op++ = (uint8_t)offset;
+  *op++ = (uint8_t)(offset >> 8);
+  size_t m = match_len - LZ_MIN_MATCH;
+  *token |= (uint8_t)(m < 15 ? m : 15);
+  if (m >= 15)
+    op = put_length(op, m);
+  return op;
+}
+
+/*
+ * Compresses n bytes into dst. Returns the compressed size, or 0 if it
+ * would exceed cap (lz_bound(n) is always enough).
+ */
+size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+  if (cap < lz_bound(n))
+    return 0;
+
+  // Last position a match was seen for each 4-byte hash, + 1 (0 = none)
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  uint8_t *op = dst;
+  size_t anchor = 0;
+  size_t ip = 0;
+  while (ip + LZ_MIN_MATCH <= n) {
+    uint32_t seq = read32(src + ip);
+    uint32_t h = lz_hash(seq);
+    size_t ref = table[h];
+    table[h] = (uint32_t)ip + 1;
+    if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET ||
+        read32(src + ref - 1) != seq) {
+      ip++;
+      continue;
+    }
+    ref--;
+
+    size_t len = LZ_MIN_MATCH;
+    while (ip + len < n && src[ref + len] == src[ip + len])
+      len++;
+    op = put_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+    ip += len;
+    anchor = ip;
+  }
+  op = put_sequence(op, src + anchor, n - anchor, 0, 0);
+  return (size_t)(op - dst);
+}
+
+static int get_length(const uint8_t **ip, const uint8_t *end, size_t *len) {
+  uint8_t b;
+  do {
+    if (*ip >= end)
+      return -1;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+/*
+ * Decodes a block of n bytes that must expand to exactly `size` bytes.
+ * Returns 0 on success, -1 for a corrupt block (never writes past dst).
+ */
+int lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t size) {
+  const uint8_t *ip = src;
+  const uint8_t *end = src + n;
+  size_t op = 0;
+  while (ip < end) {
+    uint8_t token = *ip++;
+
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && get_length(&ip, end, &lit_len) != 0)
+      return -1;
+    if (lit_len > (size_t)(end - ip) || lit_len > size - op)
+      return -1;
+    memcpy(dst + op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == end)
+      break; // Final literals
+
+    if (end - ip < 2)
+      return -1;
+    size_t offset = ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15 && get_length(&ip, end, &match_len) != 0)
+      return -1;
+    match_len += LZ_MIN_MATCH;
+    if (offset == 0 || offset > op || match_len > size - op)
+      return -1;
+
+    // Byte by byte: the match may overlap what it is copying
+    for (size_t i = 0; i < match_len; i++, op++)
+      dst[op] = dst[op - offset];
+  }
+  return op == size ? 0 : -1;
+}
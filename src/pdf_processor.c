@@ -2,12 +2,15 @@
 #include "glib-object.h"
 #include "poppler-document.h"
 #include "poppler-page.h"
+#include "tokenizer.h"
 #include "toolkit_core.h"
-#include <ctype.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <poppler.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 // Initialization functions
 
@@ -72,6 +75,38 @@ void pdf_free(PDF *pdf) {
 
 void index_pdf_content(search_engine_t *engine, int doc_id,
                        const char *filepath) {
+  long words = index_pdf_into(engine->index, engine->texts, doc_id, filepath);
+  trie_touch(engine->index); // once per document, cached results go stale
+  doc_meta_t *meta = engine_doc_meta(engine, doc_id);
+  if (meta != NULL)
+    meta->length = words > (long)UINT32_MAX ? UINT32_MAX : (uint32_t)words;
+}
+
+// Per-page state for the tokenizer callback
+typedef struct {
+  trie_t *trie;
+  int doc_id;
+  int page;
+  int position; // ordinal of the next token on the page
+} page_tokens_t;
+
+static void insert_token(const char *token, size_t len, long byte_offset,
+                         void *user_data) {
+  (void)len;
+  page_tokens_t *ctx = user_data;
+  trie_insert_at(ctx->trie, token, ctx->doc_id, ctx->page, byte_offset,
+                 ctx->position++);
+}
+
+/*
+ * Extracts every page of `filepath` and inserts its words into `trie`.
+ * With `texts` the page texts are also compressed into the page-text
+ * store so snippets never have to reopen the PDF. Touches nothing else
+ * (the store locks itself), so indexing workers can call it concurrently
+ * on their own tries. Returns the number of words inserted.
+ */
+long index_pdf_into(trie_t *trie, text_store_t *texts, int doc_id,
+                    const char *filepath) {
 #ifdef DEBUG_MODE
   printf("[DEBUG PDF] Opening: %s\n", filepath);
 #endif /* ifdef DEBUG_MODE                                                     \
@@ -95,7 +130,7 @@ void index_pdf_content(search_engine_t *engine, int doc_id,
 #endif /* ifdef DEBUG_MODE */
       g_error_free(error);
     }
-    return;
+    return 0;
   }
 #ifdef DEBUG_MODE
   printf("[DEBUG PDF] URI: %s\n", uri); // ADD THIS
@@ -115,7 +150,7 @@ void index_pdf_content(search_engine_t *engine, int doc_id,
 #endif
     }
     g_error_free(error);
-    return; // ADD THIS - you were missing it!
+    return 0; // ADD THIS - you were missing it!
   }
 
   int num_pages = poppler_document_get_n_pages(doc);
@@ -124,94 +159,392 @@ void index_pdf_content(search_engine_t *engine, int doc_id,
   printf("[DEBUG PDF] Successfully opened, pages: %d\n",
          poppler_document_get_n_pages(doc));
 #endif
+  text_doc_t stored = {0};
+  bool store_ok = texts != NULL;
+  long words = 0;
   for (int i = 0; i < num_pages; i++) {
     PopplerPage *page = poppler_document_get_page(doc, i);
-    if (!page)
+    if (!page) {
+      // Keep page numbers aligned in the store
+      store_ok = store_ok && text_doc_add_page(&stored, "", 0) == 0;
       continue;
+    }
 
     char *page_text = poppler_page_get_text(page);
+    if (store_ok) {
+      const char *text = page_text ? page_text : "";
+      store_ok = text_doc_add_page(&stored, text, strlen(text)) == 0;
+    }
     if (page_text) {
-      char word[100];
-      int w_idx = 0;         // Separate index for our small word buffer
-      long start_offset = 0; // To track the beginning of a word
-
-      for (size_t j = 0; j < strlen(page_text); j++) {
-        char c = page_text[j];
-        if (isalnum(c)) {
-          if (w_idx == 0) {   // start of the word
-            start_offset = j; // Record the current index
-          }
-          if (w_idx < 99) {
-            word[w_idx++] = tolower(c);
-          }
-        } else {
-          // We hit a space or punctuation
-          if (w_idx > 0) {      // We have letters
-            word[w_idx] = '\0'; // Terminate the string
-            trie_insert(engine->index_root, word, doc_id, i, start_offset);
-            w_idx = 0; // Reset for the next word
-          }
-        }
-      }
-
-      // Final word on the page
-      if (w_idx > 0) {
-        word[w_idx] = '\0'; // Terminate the string
-        trie_insert(engine->index_root, word, doc_id, i, start_offset);
-      }
+      page_tokens_t ctx = {trie, doc_id, i, 0};
+      words += (long)tokenize(page_text, strlen(page_text), insert_token,
+                              &ctx);
       g_free(page_text);
     }
     g_object_unref(page);
   }
   g_object_unref(doc);
+
+  // A half-stored document would serve wrong pages, so it is all or nothing
+  if (store_ok)
+    text_store_put(texts, doc_id, &stored);
+  text_doc_release(&stored);
+  return words;
 }
 
-char *get_snippet(const char *filepath, int page_num, long byte_offset) {
+/*
+ * Finds the window of roughly 30 bytes on each side of byte_offset,
+ * widened to the nearest whitespace. Returns its start, length in *len.
+ */
+static size_t snippet_bounds(const char *page_text, size_t page_len,
+                             long byte_offset, size_t *len) {
+  long start = (byte_offset > 30) ? (byte_offset - 30) : 0;
+  long end = (byte_offset + 30 < (long)page_len) ? (byte_offset + 30)
+                                                 : (long)page_len;
+  if (start > end) // Offset past the end of the page
+    start = end;
+
+  // Snap START backward to the nearest space
+  while (start > 0 && page_text[start] != ' ' && page_text[start] != '\n') {
+    start--;
+  }
+
+  // Snap END forward to the nearest space
+  while (end < (long)page_len && page_text[end] != ' ' &&
+         page_text[end] != '\n') {
+    end++;
+  }
+
+  *len = (size_t)(end - start);
+  return (size_t)start;
+}
+
+static PopplerDocument *open_document(const char *filepath) {
+  // Crawled paths may be relative, URIs may not
+  char *abs_path = g_canonicalize_filename(filepath, NULL);
   GError *error = NULL;
-  gchar *uri = g_filename_to_uri(filepath, NULL, &error);
+  gchar *uri = g_filename_to_uri(abs_path, NULL, &error);
+  g_free(abs_path);
+  if (uri == NULL) {
+    if (error)
+      g_error_free(error);
+    return NULL;
+  }
 
-  if (uri) {
-    PopplerDocument *doc = poppler_document_new_from_file(uri, NULL, &error);
-    if (doc == NULL) {
-      g_warning("Failed to open document: %s", error->message);
+  PopplerDocument *doc = poppler_document_new_from_file(uri, NULL, &error);
+  g_free(uri);
+  if (doc == NULL) {
+    g_warning("Failed to open document: %s", error ? error->message : "");
+    if (error)
       g_error_free(error);
-    } else {
-      PopplerPage *page = poppler_document_get_page(doc, page_num);
-      char *page_text = poppler_page_get_text(page);
-      if (page_text) {
-        size_t page_len = strlen(page_text);
-        long start = (byte_offset > 30) ? (byte_offset - 30) : 0;
-        long end = (byte_offset + 30 < (long)page_len) ? (byte_offset + 30)
-                                                       : (long)page_len;
-
-        // Snap START backward to the nearest space
-        while (start > 0 && page_text[start] != ' ' &&
-               page_text[start] != '\n') {
-          start--;
-        }
-
-        // Snap END forward to the nearest space
-        while (end < (long)page_len && page_text[end] != ' ' &&
-               page_text[end] != '\n') {
-          end++;
-        }
-
-        size_t length_to_copy = end - start;
-        char *result = malloc(length_to_copy + 1);
-
-        // Prevent from going before the beginning of text (index 0)
-        strncpy(result, page_text + start, length_to_copy);
-        result[length_to_copy] = '\0';
-        g_free(page_text);
-        g_object_unref(page);
-        g_object_unref(doc);
-        g_free(uri);
-
-        return result;
-      }
+  }
+  return doc;
+}
+
+static char *page_text_of(PopplerDocument *doc, int page_num) {
+  if (page_num < 0 || page_num >= poppler_document_get_n_pages(doc))
+    return NULL;
+  PopplerPage *page = poppler_document_get_page(doc, page_num);
+  if (page == NULL)
+    return NULL;
+  char *text = poppler_page_get_text(page);
+  g_object_unref(page);
+  return text;
+}
+
+// The snippet around byte_offset as a fresh string (free_snippet() it)
+char *snippet_from_text(const char *page_text, size_t page_len,
+                        long byte_offset) {
+  size_t length_to_copy;
+  size_t start =
+      snippet_bounds(page_text, page_len, byte_offset, &length_to_copy);
+  char *result = malloc(length_to_copy + 1);
+  if (result != NULL) {
+    memcpy(result, page_text + start, length_to_copy);
+    result[length_to_copy] = '\0';
+  }
+  return result;
+}
+
+char *get_snippet(const char *filepath, int page_num, long byte_offset) {
+  PopplerDocument *doc = open_document(filepath);
+  if (doc == NULL)
+    return NULL;
+
+  char *result = NULL;
+  char *page_text = page_text_of(doc, page_num);
+  if (page_text) {
+    result = snippet_from_text(page_text, strlen(page_text), byte_offset);
+    g_free(page_text);
+  }
+  g_object_unref(doc);
+  return result;
+}
+
+void free_snippet(char *snippet) { free(snippet); }
+
+/*
+ * Batch snippets. Hits are sorted by (doc, page) through an index array,
+ * so each document is opened once and each page extracted once however
+ * many hits land on it (pages in the page-text store skip Poppler
+ * entirely). Workers claim whole documents and append their
+ * snippets to a private buffer; the buffers are stitched together at the
+ * end and the per-hit offsets shifted accordingly. Poppler documents are
+ * never shared between threads.
+ */
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+} snippet_buffer_t;
+
+typedef struct {
+  search_engine_t *engine;
+  const occurrence_transfer_t *hits;
+  const int *order;     // hit indices sorted by (doc_id, page_num)
+  const int *doc_first; // per document group: first position in order
+  int doc_groups;
+  int next_group; // next group to claim (atomic)
+
+  int64_t *offsets; // per hit: offset into its worker's buffer, -1 if none
+  int *owner;       // per hit: the worker that produced it
+} snippet_job_t;
+
+typedef struct {
+  snippet_job_t *job;
+  int self;
+  snippet_buffer_t buffer;
+} snippet_worker_t;
+
+static int buffer_append(snippet_buffer_t *buffer, const char *text,
+                         size_t len) {
+  if (buffer->size + len + 1 > buffer->capacity) {
+    size_t new_capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+    while (new_capacity < buffer->size + len + 1)
+      new_capacity *= 2;
+    char *temp = realloc(buffer->data, new_capacity);
+    if (temp == NULL)
+      return -1;
+    buffer->data = temp;
+    buffer->capacity = new_capacity;
+  }
+  memcpy(buffer->data + buffer->size, text, len);
+  buffer->data[buffer->size + len] = '\0';
+  buffer->size += len + 1;
+  return 0;
+}
+
+static int compare_hits(const occurrence_transfer_t *hits, int a, int b) {
+  if (hits[a].doc_id != hits[b].doc_id)
+    return hits[a].doc_id < hits[b].doc_id ? -1 : 1;
+  if (hits[a].page_num != hits[b].page_num)
+    return hits[a].page_num < hits[b].page_num ? -1 : 1;
+  return a < b ? -1 : a > b;
+}
+
+// qsort has no context argument, so sort the index array by hand
+static void sort_hits(const occurrence_transfer_t *hits, int *order,
+                      int count) {
+  if (count < 2)
+    return;
+  int pivot = order[count / 2];
+  int i = 0, j = count - 1;
+  while (i <= j) {
+    while (compare_hits(hits, order[i], pivot) < 0)
+      i++;
+    while (compare_hits(hits, order[j], pivot) > 0)
+      j--;
+    if (i <= j) {
+      int tmp = order[i];
+      order[i++] = order[j];
+      order[j--] = tmp;
     }
   }
+  sort_hits(hits, order, j + 1);
+  sort_hits(hits, order + i, count - i);
+}
+
+// Page text from the store, else from the PDF (opened on first need)
+static char *snippet_page(snippet_job_t *job, int doc_id, int page_num,
+                          PopplerDocument **doc, bool *tried) {
+  char *text = text_store_get_page(job->engine->texts, doc_id, page_num, NULL);
+  if (text != NULL)
+    return text;
+  if (!*tried) {
+    const char *path = engine_get_document_path(job->engine, doc_id);
+    *doc = path ? open_document(path) : NULL;
+    *tried = true;
+  }
+  if (*doc == NULL)
+    return NULL;
+  // Hand out malloc'd memory either way
+  char *page_text = page_text_of(*doc, page_num);
+  text = page_text ? strdup(page_text) : NULL;
+  g_free(page_text);
+  return text;
+}
+
+static void snippet_document(snippet_worker_t *worker, int group) {
+  snippet_job_t *job = worker->job;
+  int first = job->doc_first[group];
+  int last = job->doc_first[group + 1];
+  int doc_id = job->hits[job->order[first]].doc_id;
+  PopplerDocument *doc = NULL;
+  bool tried = false;
+
+  char *page_text = NULL;
+  size_t page_len = 0;
+  int page_num = -1;
+  for (int k = first; k < last; k++) {
+    int hit = job->order[k];
+    if (k == first || job->hits[hit].page_num != page_num) {
+      free(page_text);
+      page_num = job->hits[hit].page_num;
+      page_text = snippet_page(job, doc_id, page_num, &doc, &tried);
+      page_len = page_text ? strlen(page_text) : 0;
+    }
+    if (page_text == NULL)
+      continue;
+
+    size_t len;
+    size_t start =
+        snippet_bounds(page_text, page_len, job->hits[hit].byte_offset, &len);
+    size_t offset = worker->buffer.size;
+    if (buffer_append(&worker->buffer, page_text + start, len) != 0)
+      break;
+    job->offsets[hit] = (int64_t)offset;
+    job->owner[hit] = worker->self;
+  }
+  free(page_text);
+  if (doc != NULL)
+    g_object_unref(doc);
+}
+
+static void *snippet_worker(void *arg) {
+  snippet_worker_t *worker = arg;
+  snippet_job_t *job = worker->job;
+  for (;;) {
+    int group = __atomic_fetch_add(&job->next_group, 1, __ATOMIC_RELAXED);
+    if (group >= job->doc_groups)
+      break;
+    snippet_document(worker, group);
+  }
   return NULL;
 }
 
-void free_snippet(char *snippet) { free(snippet); }
+/*
+ * Snippets for `count` hits in one call. Result i starts at
+ * text + offsets[i] (NUL terminated) or has offset -1 if its document or
+ * page could not be read. `workers` <= 0 picks one per online CPU; at most
+ * one worker per distinct document is started. Free with
+ * free_snippet_batch(). Returns NULL if out of memory.
+ */
+snippet_batch_t *get_snippets(search_engine_t *engine,
+                              const occurrence_transfer_t *hits, int count,
+                              int workers) {
+  snippet_batch_t *batch = calloc(1, sizeof(snippet_batch_t));
+  if (batch == NULL)
+    return NULL;
+  batch->count = count > 0 ? count : 0;
+  batch->offsets = malloc(sizeof(int64_t) * (batch->count + 1));
+  int *order = malloc(sizeof(int) * (batch->count + 1));
+  int *doc_first = malloc(sizeof(int) * (batch->count + 1));
+  int *owner = calloc(batch->count + 1, sizeof(int));
+  if (batch->offsets == NULL || order == NULL || doc_first == NULL ||
+      owner == NULL) {
+    free(order);
+    free(doc_first);
+    free(owner);
+    free_snippet_batch(batch);
+    return NULL;
+  }
+
+  // 1. Group the hits by document, then page
+  for (int i = 0; i < batch->count; i++) {
+    order[i] = i;
+    batch->offsets[i] = -1;
+  }
+  sort_hits(hits, order, batch->count);
+  snippet_job_t job = {0};
+  job.engine = engine;
+  job.hits = hits;
+  job.order = order;
+  job.doc_first = doc_first;
+  job.offsets = batch->offsets;
+  job.owner = owner;
+  for (int k = 0; k < batch->count; k++) {
+    if (k == 0 || hits[order[k]].doc_id != hits[order[k - 1]].doc_id)
+      doc_first[job.doc_groups++] = k;
+  }
+  doc_first[job.doc_groups] = batch->count;
+
+  // 2. One document per task
+  if (workers <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (int)cpus : 1;
+  }
+  if (workers > job.doc_groups)
+    workers = job.doc_groups > 0 ? job.doc_groups : 1;
+  snippet_worker_t *pool = calloc(workers, sizeof(snippet_worker_t));
+  pthread_t *threads = calloc(workers, sizeof(pthread_t));
+  if (pool != NULL && threads != NULL) {
+    for (int i = 0; i < workers; i++) {
+      pool[i].job = &job;
+      pool[i].self = i;
+    }
+    int started = 1;
+    while (started < workers && pthread_create(&threads[started], NULL,
+                                               snippet_worker,
+                                               &pool[started]) == 0) {
+      started++;
+    }
+    snippet_worker(&pool[0]);
+    for (int i = 1; i < started; i++) {
+      pthread_join(threads[i], NULL);
+    }
+
+    // 3. Stitch the worker buffers together and rebase the offsets
+    size_t total = 0;
+    size_t *base = malloc(sizeof(size_t) * workers);
+    for (int i = 0; base != NULL && i < workers; i++) {
+      base[i] = total;
+      total += pool[i].buffer.size;
+    }
+    batch->text = base ? malloc(total > 0 ? total : 1) : NULL;
+    if (batch->text != NULL) {
+      for (int i = 0; i < workers; i++) {
+        if (pool[i].buffer.size > 0)
+          memcpy(batch->text + base[i], pool[i].buffer.data,
+                 pool[i].buffer.size);
+      }
+      batch->text_size = total;
+      for (int i = 0; i < batch->count; i++) {
+        if (batch->offsets[i] >= 0)
+          batch->offsets[i] += (int64_t)base[owner[i]];
+      }
+    }
+    free(base);
+    for (int i = 0; i < workers; i++) {
+      free(pool[i].buffer.data);
+    }
+  }
+  free(pool);
+  free(threads);
+  free(order);
+  free(doc_first);
+  free(owner);
+
+  if (batch->text == NULL) {
+    free_snippet_batch(batch);
+    return NULL;
+  }
+  return batch;
+}
+
+void free_snippet_batch(snippet_batch_t *batch) {
+  if (batch == NULL)
+    return;
+  free(batch->text);
+  free(batch->offsets);
+  free(batch);
+}
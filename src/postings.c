@@ -0,0 +1,402 @@
+#include "postings.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Worst case for one posting: 5 + 5 + 10 + 5 varint bytes
+#define POSTING_MAX_BYTES 25
+
+// 7 bits per byte, high bit set while more bytes follow
+size_t varint_encode(uint64_t value, uint8_t *out) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+const uint8_t *varint_decode(const uint8_t *in, uint64_t *value) {
+  uint64_t result = 0;
+  int shift = 0;
+  while (*in & 0x80) {
+    result |= (uint64_t)(*in++ & 0x7F) << shift;
+    shift += 7;
+  }
+  result |= (uint64_t)(*in++) << shift;
+  *value = result;
+  return in;
+}
+
+int posting_compare(const posting_t *a, const posting_t *b) {
+  if (a->doc_id != b->doc_id)
+    return a->doc_id < b->doc_id ? -1 : 1;
+  if (a->page_num != b->page_num)
+    return a->page_num < b->page_num ? -1 : 1;
+  if (a->byte_offset != b->byte_offset)
+    return a->byte_offset < b->byte_offset ? -1 : 1;
+  return 0;
+}
+
+// Encode `p` against `base` (a zeroed base gives the absolute form)
+static size_t posting_encode(const posting_t *base, const posting_t *p,
+                             bool positional, uint8_t *out) {
+  if (positional) {
+    // (doc delta << 1 | new page), so a posting on the same page as the
+    // previous one spends a single byte on where it is
+    bool new_doc = p->doc_id != base->doc_id;
+    bool new_page = new_doc || p->page_num != base->page_num;
+    size_t n = varint_encode(
+        (uint64_t)(p->doc_id - base->doc_id) << 1 | new_page, out);
+    if (new_doc) {
+      n += varint_encode((uint64_t)p->page_num, out + n);
+    } else if (new_page) {
+      n += varint_encode((uint64_t)(p->page_num - base->page_num), out + n);
+    }
+    if (new_page) {
+      n += varint_encode((uint64_t)p->byte_offset, out + n);
+      n += varint_encode((uint64_t)p->position, out + n);
+    } else {
+      n += varint_encode((uint64_t)(p->byte_offset - base->byte_offset),
+                         out + n);
+      n += varint_encode((uint64_t)(p->position - base->position), out + n);
+    }
+    return n;
+  }
+
+  size_t n = varint_encode((uint64_t)(p->doc_id - base->doc_id), out);
+  if (p->doc_id != base->doc_id) {
+    n += varint_encode((uint64_t)p->page_num, out + n);
+    n += varint_encode((uint64_t)p->byte_offset, out + n);
+  } else {
+    n += varint_encode((uint64_t)(p->page_num - base->page_num), out + n);
+    if (p->page_num != base->page_num) {
+      n += varint_encode((uint64_t)p->byte_offset, out + n);
+    } else {
+      n += varint_encode((uint64_t)(p->byte_offset - base->byte_offset),
+                         out + n);
+    }
+  }
+  return n;
+}
+
+static const uint8_t *posting_decode(const uint8_t *in, posting_t *p,
+                                     bool positional) {
+  uint64_t doc_delta, page, offset, position;
+  if (positional) {
+    uint64_t tag;
+    in = varint_decode(in, &tag);
+    doc_delta = tag >> 1;
+    if (doc_delta != 0) {
+      p->doc_id += (int)doc_delta;
+      in = varint_decode(in, &page);
+      p->page_num = (int)page;
+    } else if (tag & 1) {
+      in = varint_decode(in, &page);
+      p->page_num += (int)page;
+    }
+    in = varint_decode(in, &offset);
+    in = varint_decode(in, &position);
+    if (tag & 1) {
+      p->byte_offset = (long)offset;
+      p->position = (int)position;
+    } else {
+      p->byte_offset += (long)offset;
+      p->position += (int)position;
+    }
+    return in;
+  }
+
+  in = varint_decode(in, &doc_delta);
+  if (doc_delta != 0) {
+    p->doc_id += (int)doc_delta;
+    in = varint_decode(in, &page);
+    in = varint_decode(in, &offset);
+    p->page_num = (int)page;
+    p->byte_offset = (long)offset;
+  } else {
+    in = varint_decode(in, &page);
+    if (page != 0) {
+      p->page_num += (int)page;
+      in = varint_decode(in, &offset);
+      p->byte_offset = (long)offset;
+    } else {
+      in = varint_decode(in, &offset);
+      p->byte_offset += (long)offset;
+    }
+  }
+  p->position = -1;
+  return in;
+}
+
+static posting_t tail_posting(const posting_tail_t *tail) {
+  posting_t p = {tail->doc_id, tail->page_num,
+                 (long)(tail->packed & POSTING_MAX_OFFSET),
+                 (int)(tail->packed >> POSTING_OFFSET_BITS)};
+  return p;
+}
+
+// Chain a fresh block after the tail, twice the size of the previous one
+static posting_block_t *posting_new_block(byte_arena_t *arena,
+                                          posting_list_t *list) {
+  size_t size = POSTING_BLOCK_MIN;
+  if (list->tail != ARENA_NULL) {
+    posting_block_t *tail = byte_arena_get(arena, list->tail);
+    size = (sizeof(posting_block_t) + tail->capacity) * 2;
+    if (size > POSTING_BLOCK_MAX)
+      size = POSTING_BLOCK_MAX;
+  }
+
+  uint32_t handle = byte_arena_alloc(arena, size);
+  if (handle == ARENA_NULL)
+    return NULL;
+
+  posting_block_t *block = byte_arena_get(arena, handle);
+  block->capacity = (uint16_t)(size - sizeof(posting_block_t));
+  block->used = 0;
+  block->next = ARENA_NULL;
+
+  if (list->tail != ARENA_NULL) {
+    posting_block_t *tail = byte_arena_get(arena, list->tail);
+    __atomic_store_n(&tail->next, handle, __ATOMIC_RELEASE);
+  } else {
+    list->head = handle;
+  }
+  list->tail = handle;
+  return block;
+}
+
+static int posting_append_sorted(byte_arena_t *arena, posting_list_t *list,
+                                 const posting_t *p, bool positional) {
+  uint8_t buf[POSTING_MAX_BYTES];
+  posting_block_t *block =
+      list->tail ? byte_arena_get(arena, list->tail) : NULL;
+
+  size_t n = 0;
+  if (block != NULL) {
+    posting_t last = tail_posting(&list->last);
+    n = posting_encode(&last, p, positional, buf);
+  }
+  if (block == NULL || block->used + n > block->capacity) {
+    // New blocks restart from a zero base
+    block = posting_new_block(arena, list);
+    if (block == NULL)
+      return -1;
+    posting_t zero = {0, 0, 0, 0};
+    n = posting_encode(&zero, p, positional, buf);
+  }
+
+  memcpy((uint8_t *)(block + 1) + block->used, buf, n);
+  __atomic_store_n(&block->used, (uint16_t)(block->used + n),
+                   __ATOMIC_RELEASE);
+
+  if (list->count == 0 || p->doc_id != list->last.doc_id)
+    __atomic_store_n(&list->doc_count, list->doc_count + 1,
+                     __ATOMIC_RELAXED);
+  __atomic_store_n(&list->count, list->count + 1, __ATOMIC_RELAXED);
+  list->last.doc_id = p->doc_id;
+  list->last.page_num = p->page_num;
+  list->last.packed = (uint64_t)p->byte_offset |
+                      (uint64_t)p->position << POSTING_OFFSET_BITS;
+  return 0;
+}
+
+// Clamps the position; offsets past POSTING_MAX_OFFSET are refused
+static int posting_check(posting_t *p) {
+  if (p->byte_offset < 0 || p->byte_offset > POSTING_MAX_OFFSET)
+    return -1;
+  if (p->position < 0)
+    p->position = 0;
+  if (p->position > POSTING_MAX_POSITION)
+    p->position = POSTING_MAX_POSITION;
+  return 0;
+}
+
+/*
+ * Slow path for a posting that lands before the end of the list: decode
+ * `src`, splice the posting in and re-encode everything into the zeroed
+ * list `dst` (left empty if `src` already has it). `src` stays as it is
+ * for readers still walking it; its blocks stay in the arena until the
+ * index is freed. Indexing appends in document order, so this only runs
+ * for callers that insert out of order.
+ */
+int posting_list_insert(byte_arena_t *arena, posting_list_t *dst,
+                        const posting_list_t *src, const posting_t *posting,
+                        bool positional) {
+  posting_t p = *posting;
+  if (posting_check(&p) != 0)
+    return -1;
+  posting_t *all = malloc(sizeof(posting_t) * (src->count + 1));
+  if (all == NULL)
+    return -1;
+
+  posting_iter_t it;
+  posting_iter_init(&it, arena, src, positional);
+  uint32_t count = 0;
+  bool inserted = false;
+  while (posting_iter_next(&it)) {
+    if (!inserted) {
+      int cmp = posting_compare(&p, &it.current);
+      if (cmp == 0) { // Already recorded, dst stays empty
+        free(all);
+        return 0;
+      }
+      if (cmp < 0) {
+        all[count++] = p;
+        inserted = true;
+      }
+    }
+    all[count++] = it.current;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (posting_append_sorted(arena, dst, &all[i], positional) != 0) {
+      free(all);
+      return -1;
+    }
+  }
+  free(all);
+  return 0;
+}
+
+/*
+ * Adds a posting. With `positional` the list stores p->position too,
+ * clamped to [0, POSTING_MAX_POSITION]; every append to one list must
+ * agree on it. Offsets past POSTING_MAX_OFFSET are refused. A posting
+ * that sorts before the end of the list is not added: the call returns
+ * POSTING_UNSORTED and the caller rebuilds with posting_list_insert().
+ */
+int posting_list_append(byte_arena_t *arena, posting_list_t *list,
+                        const posting_t *posting, bool positional) {
+  posting_t p = *posting;
+  if (posting_check(&p) != 0)
+    return -1;
+  if (list->count > 0) {
+    posting_t last = tail_posting(&list->last);
+    int cmp = posting_compare(&p, &last);
+    if (cmp == 0)
+      return 0; // We have already recorded this word at this spot. Skip!
+    if (cmp < 0)
+      return POSTING_UNSORTED;
+  }
+  return posting_append_sorted(arena, list, &p, positional);
+}
+
+void posting_iter_init(posting_iter_t *it, const byte_arena_t *arena,
+                       const posting_list_t *list, bool positional) {
+  it->arena = arena;
+  it->positional = positional;
+  it->block = list ? list->head : ARENA_NULL;
+  it->entered = ARENA_NULL;
+  it->pos = NULL;
+  it->end = NULL;
+  it->doc_limit = INT_MAX;
+  it->exhausted = false;
+  memset(&it->current, 0, sizeof(posting_t));
+}
+
+// Enters a block: only the bytes published so far are read
+static void iter_enter(posting_iter_t *it, uint32_t handle) {
+  const posting_block_t *block = byte_arena_get(it->arena, handle);
+  it->entered = handle;
+  it->pos = (const uint8_t *)(block + 1);
+  it->end = it->pos + __atomic_load_n(&block->used, __ATOMIC_ACQUIRE);
+  it->block = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE);
+  memset(&it->current, 0, sizeof(posting_t));
+}
+
+/*
+ * Decodes the next posting into it->current. Returns false at the end,
+ * or at the first posting of it->doc_limit or later.
+ */
+bool posting_iter_next(posting_iter_t *it) {
+  while (it->pos == it->end) {
+    if (it->block == ARENA_NULL) {
+      it->exhausted = true;
+      return false;
+    }
+    iter_enter(it, it->block);
+  }
+  it->pos = posting_decode(it->pos, &it->current, it->positional);
+  if (it->current.doc_id >= it->doc_limit) {
+    it->pos = it->end; // and stay at the end
+    it->block = ARENA_NULL;
+    it->exhausted = true;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Moves to the first posting at or after (doc_id, page_num) and returns
+ * false if there is none. The current posting counts, so repeated seeks
+ * to the same target stay put. Blocks restart from a zero base, so the
+ * first posting of the next block can be read on its own: while it is
+ * still at or before the target, the rest of the current block is
+ * skipped without being decoded. Once the list is exhausted every seek
+ * fails, whatever the target.
+ */
+bool posting_iter_seek(posting_iter_t *it, int doc_id, int page_num) {
+  posting_t target = {doc_id, page_num, 0, 0};
+  if (it->exhausted || it->current.doc_id >= it->doc_limit)
+    return false;
+  if (it->pos != NULL && posting_compare(&it->current, &target) >= 0)
+    return true;
+
+  while (it->block != ARENA_NULL) {
+    const posting_block_t *next = byte_arena_get(it->arena, it->block);
+    if (__atomic_load_n(&next->used, __ATOMIC_ACQUIRE) == 0)
+      break;
+    posting_t first = {0, 0, 0, 0};
+    posting_decode((const uint8_t *)(next + 1), &first, it->positional);
+    if (posting_compare(&first, &target) > 0 || first.doc_id >= it->doc_limit)
+      break;
+    iter_enter(it, it->block);
+  }
+
+  while (posting_iter_next(it)) {
+    if (posting_compare(&it->current, &target) >= 0)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Where the posting posting_iter_next() decodes next starts. Only valid
+ * as a jump target when that posting is the first of its document.
+ */
+void posting_iter_mark(const posting_iter_t *it, posting_skip_t *at) {
+  if (it->pos == it->end) { // the next block, from a zero base
+    at->block = it->block;
+    at->offset = 0;
+    at->base_doc = 0;
+    return;
+  }
+  const posting_block_t *block = byte_arena_get(it->arena, it->entered);
+  at->block = it->entered;
+  at->offset = (uint32_t)(it->pos - (const uint8_t *)(block + 1));
+  at->base_doc = it->current.doc_id;
+}
+
+/*
+ * Moves to the posting marked at `at`, which must not be behind the
+ * current one: the next posting_iter_next() decodes it. Nothing before
+ * it is read. An offset past the published bytes leaves the iterator at
+ * the end of that block.
+ */
+void posting_iter_jump(posting_iter_t *it, const posting_skip_t *at) {
+  if (it->exhausted)
+    return;
+  if (at->block == ARENA_NULL) {
+    it->pos = it->end;
+    it->block = ARENA_NULL;
+    return;
+  }
+  iter_enter(it, at->block);
+  if (at->offset <= (size_t)(it->end - it->pos))
+    it->pos += at->offset;
+  else
+    it->pos = it->end;
+  it->current.doc_id = at->base_doc;
+}
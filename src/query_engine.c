@@ -1,26 +1,106 @@
 #include "query_engine.h"
 #include "index_structure.h"
+#include "key_set.h"
+#include "levenshtein.h"
+#include "result_cache.h"
+#include "segments.h"
+#include "tokenizer.h"
 #include "toolkit_core.h"
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-int *get_doc_ids_from_search(word_occurrence_t *list, int *out_count) {
-  // Count how many results we have
-  int count = 0;
-  word_occurrence_t *curr = list;
-  while (curr) {
-    count++;
-    curr = curr->next;
+typedef struct {
+  occurrence_transfer_t *items;
+  int count;
+  int capacity;
+} match_list_t;
+
+static int add_match(match_list_t *m, int doc, int page, long offset) {
+  if (m->count == m->capacity) {
+    int capacity = m->capacity ? m->capacity * 2 : 64;
+    occurrence_transfer_t *temp =
+        realloc(m->items, sizeof(occurrence_transfer_t) * capacity);
+    if (temp == NULL)
+      return -1;
+    m->items = temp;
+    m->capacity = capacity;
+  }
+  m->items[m->count].doc_id = doc;
+  m->items[m->count].page_num = page;
+  m->items[m->count].byte_offset = offset;
+  m->count++;
+  return 0;
+}
+
+/*
+ * Appends the `count` hits of one source (segments are visited in doc
+ * order, so hits stay sorted), taking `hits` over when `m` is empty.
+ */
+static int take_hits(match_list_t *m, occurrence_transfer_t *hits,
+                     int count) {
+  if (hits == NULL || count == 0) {
+    free(hits);
+    return 0;
+  }
+  if (m->count == 0) {
+    free(m->items);
+    m->items = hits;
+    m->count = m->capacity = count;
+    return 0;
+  }
+  if (m->count + count > m->capacity) {
+    int capacity = (m->count + count) * 2;
+    occurrence_transfer_t *temp =
+        realloc(m->items, sizeof(occurrence_transfer_t) * capacity);
+    if (temp == NULL) {
+      free(hits);
+      return -1;
+    }
+    m->items = temp;
+    m->capacity = capacity;
+  }
+  memcpy(m->items + m->count, hits, sizeof(occurrence_transfer_t) * count);
+  m->count += count;
+  free(hits);
+  return 0;
+}
+
+// Hands the hits over, NULL when there are none or `failed`
+static occurrence_transfer_t *finish_hits(match_list_t *m, bool failed,
+                                          int *found_count) {
+  if (failed || m->count == 0) {
+    free(m->items);
+    *found_count = 0;
+    return NULL;
   }
+  *found_count = m->count;
+  return m->items;
+}
+
+int *get_doc_ids_from_search(trie_t *trie, posting_list_t *list,
+                             int *out_count) {
+  trie_read_begin(trie);
+  // The list header already knows how many results we have (at most)
+  int count = list ? (int)posting_list_count(list) : 0;
 
   // Create a flat integer array
   int *ids = calloc(count, sizeof(int));
-  curr = list;
-  for (int i = 0; i < count; i++) {
-    ids[i] = curr->doc_id;
-    curr = curr->next;
+  posting_iter_t it;
+  trie_postings_iter(trie, list, &it);
+  int i = 0;
+  while (ids != NULL && i < count && posting_iter_next(&it)) {
+    ids[i++] = it.current.doc_id;
   }
+  trie_read_end(trie);
 
-  *out_count = count; // tell python how many IDs are there in the array
+  *out_count = i; // tell python how many IDs are there in the array
   return ids;
 }
 
@@ -29,36 +109,1939 @@ int *get_doc_ids_from_search(word_occurrence_t *list, int *out_count) {
 // But python doesn't
 occurrence_transfer_t *get_search_results(search_engine_t *engine,
                                           const char *word, int *found_count) {
-  word_occurrence_t *list = trie_search(engine->index_root, word);
-  if (list == NULL) {
-    *found_count = 0;
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  int sources = segment_view_count(&view);
+  int count = 0;
+  for (int s = 0; s < sources; s++) {
+    posting_list_t *list = trie_search(segment_view_trie(&view, s), word);
+    count += list != NULL ? (int)posting_list_count(list) : 0;
+  }
+
+  // Allocate flat array (space for doc_id, page_num and byte_offset)
+  occurrence_transfer_t *results =
+      count > 0 ? malloc(sizeof(occurrence_transfer_t) * count) : NULL;
+
+  // One sequential pass over the encoded blocks of each segment in doc
+  // order, skipping tombstones
+  int i = 0;
+  for (int s = 0; results != NULL && s < sources; s++) {
+    trie_t *trie = segment_view_trie(&view, s);
+    posting_iter_t it;
+    trie_postings_iter(trie, trie_search(trie, word), &it);
+    while (i < count && posting_iter_next(&it)) {
+      if (engine_doc_deleted(engine, it.current.doc_id))
+        continue;
+      results[i].doc_id = it.current.doc_id;
+      results[i].page_num = it.current.page_num;
+      results[i].byte_offset = it.current.byte_offset;
+      i++;
+    }
+  }
+  segment_view_end(&view);
+
+  *found_count = i;
+  if (i == 0) { // Not found, or every hit was tombstoned
+    free(results);
     return NULL;
   }
+  return results;
+}
 
-  // Count links
-  int count = 0;
-  word_occurrence_t *curr = list;
-  while (curr) {
-    count++;
-    curr = curr->next;
+// One word of a boolean query and its posting list
+typedef struct {
+  const trie_t *trie; // the segment the list is from
+  posting_list_t *list;
+  uint32_t handle; // of the list, keys the impact table
+  uint32_t count;
+  int word; // position of the word in the query
+} query_term_t;
+
+typedef struct {
+  trie_t *trie;
+  query_term_t *terms;
+  int count;
+  int capacity;
+  int words;    // words in the query, found or not
+  bool missing; // some word is not in the index
+  bool failed;
+} term_set_t;
+
+static void add_term(const char *token, size_t len, long byte_offset,
+                     void *user_data) {
+  (void)len;
+  (void)byte_offset;
+  term_set_t *set = user_data;
+  int word = set->words++;
+  uint32_t handle = trie_lookup(set->trie, token);
+  posting_list_t *list =
+      handle != ARENA_NULL ? trie_posting_list(set->trie, handle) : NULL;
+  if (list == NULL || posting_list_count(list) == 0) {
+    set->missing = true;
+    return;
+  }
+  if (set->count == set->capacity) {
+    int capacity = set->capacity ? set->capacity * 2 : 8;
+    query_term_t *temp =
+        realloc(set->terms, sizeof(query_term_t) * capacity);
+    if (temp == NULL) {
+      set->failed = true;
+      return;
+    }
+    set->terms = temp;
+    set->capacity = capacity;
   }
+  set->terms[set->count].trie = set->trie;
+  set->terms[set->count].list = list;
+  set->terms[set->count].handle = handle;
+  set->terms[set->count].count = posting_list_count(list);
+  set->terms[set->count].word = word;
+  set->count++;
+}
 
-  // Allocate flat array (space for doc_id and page_num)
-  occurrence_transfer_t *results =
-      malloc(sizeof(occurrence_transfer_t) * count);
+/*
+ * Runs the query words through the indexing tokenizer, so they are case
+ * folded the same way; a string that splits into several words
+ * contributes each of them. Returns -1 on allocation failure.
+ */
+static int resolve_terms(trie_t *trie, const char *const *words, int count,
+                         term_set_t *set) {
+  memset(set, 0, sizeof(term_set_t));
+  set->trie = trie;
+  for (int i = 0; i < count; i++) {
+    if (words[i] != NULL)
+      tokenize(words[i], strlen(words[i]), add_term, set);
+  }
+  return set->failed ? -1 : 0;
+}
+
+static int compare_terms(const void *a, const void *b) {
+  uint32_t x = ((const query_term_t *)a)->count;
+  uint32_t y = ((const query_term_t *)b)->count;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * Decodes a term into sorted unique keys, leaving out tombstoned
+ * documents. After each key the iterator seeks past the rest of that
+ * document or page, so long runs of hits inside one key skip whole blocks.
+ */
+static size_t term_keys(const search_engine_t *engine, const query_term_t *t,
+                        bool pages, uint64_t *out) {
+  posting_iter_t it;
+  trie_postings_iter(t->trie, t->list, &it);
+  size_t n = 0;
+  bool more = posting_iter_next(&it);
+  while (more) {
+    int doc = it.current.doc_id, page = it.current.page_num;
+    if (!engine_doc_deleted(engine, doc))
+      out[n++] = key_pack(doc, pages ? page : 0);
+    more = pages ? posting_iter_seek(&it, doc, page + 1)
+                 : posting_iter_seek(&it, doc + 1, 0);
+  }
+  return n;
+}
+
+// Whether the term occurs in the key's document (or page)
+static bool probe(posting_iter_t *it, bool *more, uint64_t key, bool pages) {
+  int doc = key_doc(key), page = key_page(key);
+  if (*more)
+    *more = posting_iter_seek(it, doc, page);
+  return *more && it->current.doc_id == doc &&
+         (!pages || it->current.page_num == page);
+}
+
+/*
+ * Keeps the keys at which any term (keep_hits) or no term occurs,
+ * seeking each term's iterator forward instead of decoding its list.
+ */
+static size_t filter_by_seek(const query_term_t *terms, int count,
+                             bool pages, bool keep_hits, uint64_t *keys,
+                             size_t n) {
+  posting_iter_t *its = malloc(sizeof(posting_iter_t) * count);
+  bool *more = malloc(sizeof(bool) * count);
+  if (its == NULL || more == NULL) {
+    free(its);
+    free(more);
+    return (size_t)-1;
+  }
+  for (int t = 0; t < count; t++) {
+    trie_postings_iter(terms[t].trie, terms[t].list, &its[t]);
+    more[t] = true;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < n; i++) {
+    bool hit = false;
+    for (int t = 0; t < count && !hit; t++)
+      hit = probe(&its[t], &more[t], keys[i], pages);
+    if (hit == keep_hits)
+      keys[kept++] = keys[i];
+  }
+  free(its);
+  free(more);
+  return kept;
+}
+
+// Decoded keys of one term, or NULL (with *n 0) on allocation failure
+static uint64_t *load_keys(const search_engine_t *engine,
+                           const query_term_t *t, bool pages, size_t *n) {
+  uint64_t *keys = malloc(sizeof(uint64_t) * t->count);
+  *n = keys ? term_keys(engine, t, pages, keys) : 0;
+  return keys;
+}
+
+// Keys of every should term, merged smallest list first
+static uint64_t *union_terms(const search_engine_t *engine,
+                             const query_term_t *terms, int count,
+                             bool pages, size_t *n) {
+  uint64_t *keys = load_keys(engine, &terms[0], pages, n);
+  for (int t = 1; t < count && keys != NULL; t++) {
+    size_t m;
+    uint64_t *more = load_keys(engine, &terms[t], pages, &m);
+    uint64_t *merged = malloc(sizeof(uint64_t) * (*n + m + 1));
+    if (more == NULL || merged == NULL) {
+      free(more);
+      free(merged);
+      free(keys);
+      return NULL;
+    }
+    *n = key_union(keys, *n, more, m, merged);
+    free(keys);
+    free(more);
+    keys = merged;
+  }
+  return keys;
+}
+
+/*
+ * Candidates for the must terms, rarest first: the rarest list is decoded
+ * and each following term either gets decoded and intersected (galloping
+ * or SIMD merge, see key_intersect) or, when it is much longer than what
+ * is left, probed with seeks that skip most of its blocks.
+ */
+static uint64_t *intersect_terms(const search_engine_t *engine,
+                                 const query_term_t *terms, int count,
+                                 bool pages, size_t *n) {
+  uint64_t *keys = load_keys(engine, &terms[0], pages, n);
+  for (int t = 1; t < count && keys != NULL && *n > 0; t++) {
+    if (terms[t].count > (uint64_t)*n * QUERY_SEEK_RATIO) {
+      size_t kept =
+          filter_by_seek(&terms[t], 1, pages, true, keys, *n);
+      if (kept == (size_t)-1) {
+        free(keys);
+        return NULL;
+      }
+      *n = kept;
+      continue;
+    }
+    size_t m;
+    uint64_t *other = load_keys(engine, &terms[t], pages, &m);
+    uint64_t *both = malloc(sizeof(uint64_t) * (*n + 1));
+    if (other == NULL || both == NULL) {
+      free(other);
+      free(both);
+      free(keys);
+      return NULL;
+    }
+    *n = key_intersect(keys, *n, other, m, both);
+    free(keys);
+    free(other);
+    keys = both;
+  }
+  return keys;
+}
+
+// Drops the keys where any of the excluded terms occurs
+static int exclude_terms(const search_engine_t *engine,
+                         const query_term_t *terms, int count, bool pages,
+                         uint64_t *keys, size_t *n) {
+  for (int t = 0; t < count && *n > 0; t++) {
+    if (terms[t].count > (uint64_t)*n * QUERY_SEEK_RATIO) {
+      size_t kept =
+          filter_by_seek(&terms[t], 1, pages, false, keys, *n);
+      if (kept == (size_t)-1)
+        return -1;
+      *n = kept;
+      continue;
+    }
+    size_t m;
+    uint64_t *other = load_keys(engine, &terms[t], pages, &m);
+    if (other == NULL)
+      return -1;
+    *n = key_difference(keys, *n, other, m, keys);
+    free(other);
+  }
+  return 0;
+}
+
+/*
+ * Turns keys into occurrences: the earliest posting of an anchor term in
+ * each document (or page), so every hit has a position to show a snippet
+ * from.
+ */
+static occurrence_transfer_t *key_occurrences(const query_term_t *anchors,
+                                              int count, bool pages,
+                                              const uint64_t *keys, size_t n) {
+  occurrence_transfer_t *results = malloc(sizeof(occurrence_transfer_t) * n);
+  posting_iter_t *its = malloc(sizeof(posting_iter_t) * count);
+  bool *more = malloc(sizeof(bool) * count);
+  if (results == NULL || its == NULL || more == NULL) {
+    free(results);
+    free(its);
+    free(more);
+    return NULL;
+  }
+  for (int t = 0; t < count; t++) {
+    trie_postings_iter(anchors[t].trie, anchors[t].list, &its[t]);
+    more[t] = true;
+  }
+  for (size_t i = 0; i < n; i++) {
+    const posting_t *best = NULL;
+    for (int t = 0; t < count; t++) {
+      if (probe(&its[t], &more[t], keys[i], pages) &&
+          (best == NULL || posting_compare(&its[t].current, best) < 0))
+        best = &its[t].current;
+    }
+    results[i].doc_id = key_doc(keys[i]);
+    results[i].page_num = best ? best->page_num : key_page(keys[i]);
+    results[i].byte_offset = best ? best->byte_offset : 0;
+  }
+  free(its);
+  free(more);
+  return results;
+}
+
+// search_boolean() over one segment; -1 when the words cannot be resolved
+static int boolean_source(const search_engine_t *engine, trie_t *trie,
+                          const char *const *must, int must_count,
+                          const char *const *should, int should_count,
+                          const char *const *must_not, int not_count,
+                          bool pages, occurrence_transfer_t **out,
+                          int *found_count) {
+  term_set_t all, any, none;
+  occurrence_transfer_t *results = NULL;
+  uint64_t *keys = NULL;
+  size_t n = 0;
+  *found_count = 0;
+
+  int rc = resolve_terms(trie, must, must_count, &all);
+  rc |= resolve_terms(trie, should, should_count, &any);
+  rc |= resolve_terms(trie, must_not, not_count, &none);
+  // A missing must word, or no should word in the index, means no hits
+  if (rc != 0 || all.missing || (should_count > 0 && any.count == 0) ||
+      (all.count == 0 && any.count == 0))
+    goto done;
+
+  if (all.count > 0) {
+    qsort(all.terms, all.count, sizeof(query_term_t), compare_terms);
+    keys = intersect_terms(engine, all.terms, all.count, pages, &n);
+    if (keys != NULL && n > 0 && any.count > 0) {
+      size_t kept =
+          filter_by_seek(any.terms, any.count, pages, true, keys, n);
+      n = kept == (size_t)-1 ? 0 : kept;
+    }
+  } else {
+    qsort(any.terms, any.count, sizeof(query_term_t), compare_terms);
+    keys = union_terms(engine, any.terms, any.count, pages, &n);
+  }
+  if (keys == NULL || n == 0)
+    goto done;
+  if (exclude_terms(engine, none.terms, none.count, pages, keys, &n) != 0 ||
+      n == 0)
+    goto done;
+
+  // Rarest must word, else every should word, marks where the hit is
+  results = all.count > 0
+                ? key_occurrences(all.terms, 1, pages, keys, n)
+                : key_occurrences(any.terms, any.count, pages, keys, n);
+  if (results != NULL)
+    *found_count = (int)n;
+
+done:
+  free(keys);
+  free(all.terms);
+  free(any.terms);
+  free(none.terms);
+  *out = results;
+  return rc != 0 ? -1 : 0;
+}
+
+/*
+ * Boolean search. A hit contains every `must` word, at least one `should`
+ * word when any are given, and none of the `must_not` words, all within
+ * the same document or, with QUERY_SCOPE_PAGE, the same page. Returns one
+ * occurrence per hit in (doc, page) order, pointing at the first anchor
+ * word on it; free with free_results(). NOT on its own matches nothing.
+ */
+occurrence_transfer_t *search_boolean(search_engine_t *engine,
+                                      const char *const *must, int must_count,
+                                      const char *const *should,
+                                      int should_count,
+                                      const char *const *must_not,
+                                      int not_count, int scope,
+                                      int *found_count) {
+  bool pages = scope == QUERY_SCOPE_PAGE;
+  match_list_t hits = {0};
+  bool failed = false;
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  for (int s = 0; s < segment_view_count(&view) && !failed; s++) {
+    occurrence_transfer_t *results;
+    int n;
+    failed = boolean_source(engine, segment_view_trie(&view, s), must,
+                            must_count, should, should_count, must_not,
+                            not_count, pages, &results, &n) != 0 ||
+             take_hits(&hits, results, n) != 0;
+  }
+  segment_view_end(&view);
+  return finish_hits(&hits, failed, found_count);
+}
+
+// Positions of one word on the candidate page being matched
+typedef struct {
+  posting_iter_t it;
+  bool more;
+  int *positions;
+  long *offsets;
+  int count;
+  int capacity;
+} page_cursor_t;
 
-  curr = list;
+// Gathers the word's postings on (doc, page); -1 on allocation failure
+static int cursor_load(page_cursor_t *c, int doc, int page) {
+  c->count = 0;
+  if (c->more)
+    c->more = posting_iter_seek(&c->it, doc, page);
+  while (c->more && c->it.current.doc_id == doc &&
+         c->it.current.page_num == page) {
+    if (c->count == c->capacity) {
+      int capacity = c->capacity ? c->capacity * 2 : 16;
+      int *positions = realloc(c->positions, sizeof(int) * capacity);
+      if (positions == NULL)
+        return -1;
+      c->positions = positions;
+      long *offsets = realloc(c->offsets, sizeof(long) * capacity);
+      if (offsets == NULL)
+        return -1;
+      c->offsets = offsets;
+      c->capacity = capacity;
+    }
+    c->positions[c->count] = c->it.current.position;
+    c->offsets[c->count] = c->it.current.byte_offset;
+    c->count++;
+    c->more = posting_iter_next(&c->it);
+  }
+  return 0;
+}
+
+// Word t sits at position p + t for every t
+static int match_phrase(page_cursor_t *c, int count, int doc, int page,
+                        match_list_t *out) {
+  int *at = calloc(count, sizeof(int));
+  if (at == NULL)
+    return -1;
+  int rc = 0;
+  for (int i = 0; i < c[0].count && rc == 0; i++) {
+    int p = c[0].positions[i];
+    bool ok = true;
+    for (int t = 1; t < count && ok; t++) {
+      while (at[t] < c[t].count && c[t].positions[at[t]] < p + t)
+        at[t]++;
+      ok = at[t] < c[t].count && c[t].positions[at[t]] == p + t;
+    }
+    if (ok)
+      rc = add_match(out, doc, page, c[0].offsets[i]);
+  }
+  free(at);
+  return rc;
+}
+
+/*
+ * Every word within a window with at most `distance` other words in it,
+ * in any order. The window slides by always advancing the word that
+ * starts it; each window start is reported once.
+ */
+static int match_near(page_cursor_t *c, int count, int distance, int doc,
+                      int page, match_list_t *out) {
+  int *at = calloc(count, sizeof(int));
+  if (at == NULL)
+    return -1;
+  int rc = 0;
+  long reported = -1;
+  while (rc == 0) {
+    int first = -1, last = INT_MIN;
+    for (int t = 0; t < count; t++) {
+      if (at[t] == c[t].count) { // Some word has no later occurrence
+        first = -1;
+        break;
+      }
+      int p = c[t].positions[at[t]];
+      if (first < 0 || p < c[first].positions[at[first]])
+        first = t;
+      if (p > last)
+        last = p;
+    }
+    if (first < 0)
+      break;
+    long offset = c[first].offsets[at[first]];
+    int span = last - c[first].positions[at[first]] - (count - 1);
+    if (span <= distance && offset != reported) {
+      rc = add_match(out, doc, page, offset);
+      reported = offset;
+    }
+    at[first]++;
+  }
+  free(at);
+  return rc;
+}
+
+/*
+ * Phrase (distance < 0) and NEAR evaluation: the pages that hold every
+ * word come from the boolean intersection, then the words' positional
+ * postings are merged page by page.
+ */
+static occurrence_transfer_t *positional_search(search_engine_t *engine,
+                                                term_set_t *set,
+                                                int distance,
+                                                int *found_count) {
+  *found_count = 0;
+  if (!set->trie->positional || set->missing || set->count == 0)
+    return NULL;
+
+  int count = set->count;
+  query_term_t *rarest = malloc(sizeof(query_term_t) * count);
+  page_cursor_t *cursors = calloc(count, sizeof(page_cursor_t));
+  match_list_t matches = {0};
+  size_t n = 0;
+  uint64_t *pages = NULL;
+  int rc = -1;
+  if (rarest == NULL || cursors == NULL)
+    goto done;
+  memcpy(rarest, set->terms, sizeof(query_term_t) * count);
+  qsort(rarest, count, sizeof(query_term_t), compare_terms);
+  pages = intersect_terms(engine, rarest, count, true, &n);
+  if (pages == NULL)
+    goto done;
+
+  for (int t = 0; t < count; t++) {
+    trie_postings_iter(set->trie, set->terms[t].list, &cursors[t].it);
+    cursors[t].more = true;
+  }
+  rc = 0;
+  for (size_t i = 0; i < n && rc == 0; i++) {
+    int doc = key_doc(pages[i]), page = key_page(pages[i]);
+    for (int t = 0; t < count && rc == 0; t++)
+      rc = cursor_load(&cursors[t], doc, page);
+    if (rc != 0)
+      break;
+    rc = distance < 0 ? match_phrase(cursors, count, doc, page, &matches)
+                      : match_near(cursors, count, distance, doc, page,
+                                   &matches);
+  }
+
+done:
+  if (cursors != NULL) {
+    for (int t = 0; t < count; t++) {
+      free(cursors[t].positions);
+      free(cursors[t].offsets);
+    }
+  }
+  free(cursors);
+  free(rarest);
+  free(pages);
+  if (rc != 0 || matches.count == 0) {
+    free(matches.items);
+    return NULL;
+  }
+  *found_count = matches.count;
+  return matches.items;
+}
+
+// positional_search() in every segment, hits concatenated in doc order
+static occurrence_transfer_t *search_positions(search_engine_t *engine,
+                                               const char *const *words,
+                                               int count, int distance,
+                                               int *found_count) {
+  match_list_t hits = {0};
+  bool failed = false;
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  for (int s = 0; s < segment_view_count(&view) && !failed; s++) {
+    term_set_t set;
+    int n = 0;
+    occurrence_transfer_t *results = NULL;
+    failed = resolve_terms(segment_view_trie(&view, s), words, count,
+                           &set) != 0;
+    if (!failed)
+      results = positional_search(engine, &set, distance, &n);
+    failed = failed || take_hits(&hits, results, n) != 0;
+    free(set.terms);
+  }
+  segment_view_end(&view);
+  return finish_hits(&hits, failed, found_count);
+}
+
+/*
+ * Every place on a page where the words of `phrase` appear one after the
+ * other, pointing at the first word. Needs an index with token positions
+ * (file version 3); older ones match nothing. Free with free_results().
+ */
+occurrence_transfer_t *search_phrase(search_engine_t *engine,
+                                     const char *phrase, int *found_count) {
+  return search_positions(engine, &phrase, 1, -1, found_count);
+}
+
+/*
+ * NEAR/distance: all `words` on one page, in any order, with at most
+ * `distance` other words between them in total (0 means adjacent).
+ * One hit per window, at its earliest word. Free with free_results().
+ */
+occurrence_transfer_t *search_near(search_engine_t *engine,
+                                   const char *const *words, int count,
+                                   int distance, int *found_count) {
+  if (distance < 0)
+    distance = 0;
+  return search_positions(engine, words, count, distance, found_count);
+}
+
+// One literal run of a prefix/wildcard pattern, folded like indexed text
+typedef struct {
+  char *out;
+  size_t room;
+  size_t len;
+  int words;
+} pattern_run_t;
+
+static void fold_run(const char *token, size_t len, long byte_offset,
+                     void *user_data) {
+  (void)byte_offset;
+  pattern_run_t *run = user_data;
+  if (run->words++ == 0 && len <= run->room) {
+    memcpy(run->out, token, len);
+    run->len = len;
+  } else {
+    run->words++; // Does not fit: refuse it like a second word
+  }
+}
+
+/*
+ * Case folds the literal runs of `pattern` between its '*' and '?'
+ * wildcards into `out`. Returns the folded length, or -1 when some run
+ * holds no word or several (no single indexed word can match it).
+ */
+static long fold_pattern(const char *pattern, char *out) {
+  size_t n = 0;
+  const char *p = pattern;
+  while (*p != '\0') {
+    size_t run = strcspn(p, "*?");
+    if (run > 0) {
+      pattern_run_t folded = {.out = out + n, .room = TRIE_MAX_KEY - 1 - n};
+      tokenize(p, run, fold_run, &folded);
+      if (folded.words != 1)
+        return -1;
+      n += folded.len;
+      p += run;
+    }
+    while ((*p == '*' || *p == '?') && n < TRIE_MAX_KEY - 1)
+      out[n++] = *p++;
+    if (*p == '*' || *p == '?')
+      return -1;
+  }
+  out[n] = '\0';
+  return (long)n;
+}
+
+// Bytes in the UTF-8 character that starts with `c`
+static size_t char_bytes(unsigned char c) {
+  return c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+}
+
+// '*' matches any run of characters, '?' exactly one
+static bool wildcard_match(const char *pattern, size_t plen,
+                           const unsigned char *word, size_t wlen) {
+  size_t p = 0, w = 0, star = SIZE_MAX, mark = 0;
+  while (w < wlen) {
+    if (p < plen && pattern[p] == '*') {
+      star = p++;
+      mark = w;
+    } else if (p < plen && pattern[p] == '?') {
+      p++;
+      w += char_bytes(word[w]);
+    } else if (p < plen && (unsigned char)pattern[p] == word[w]) {
+      p++;
+      w++;
+    } else if (star != SIZE_MAX) {
+      // Let the last '*' swallow one more character and retry
+      p = star + 1;
+      mark += char_bytes(word[mark]);
+      w = mark;
+    } else {
+      return false;
+    }
+  }
+  while (p < plen && pattern[p] == '*')
+    p++;
+  return p == plen && w == wlen;
+}
+
+// The words a pattern expands to, in byte order
+typedef struct {
+  const trie_t *trie;
+  const char *pattern;
+  size_t pattern_len;
+  size_t max_len; // longest word that can match, SIZE_MAX with a '*'
+  bool all;       // "prefix*": every word below the start node matches
+  unsigned char key[TRIE_MAX_KEY];
+  posting_list_t **lists;
+  char **words; // the words of `lists`, kept when segments are combined
+  int count;
+  int limit;
+  bool failed;
+} expansion_t;
+
+static char *key_copy(const unsigned char *key, size_t len) {
+  char *word = malloc(len + 1);
+  if (word != NULL) {
+    memcpy(word, key, len);
+    word[len] = '\0';
+  }
+  return word;
+}
+
+// Depth-first over the subtree of `node`, key[0..depth) spelled so far;
+// stops as soon as `limit` words are collected
+static void expand_node(expansion_t *e, uint32_t node, size_t depth) {
+  trie_node_t *n = trie_node(e->trie, node);
+  uint32_t postings = trie_node_postings(n);
+  if (postings != ARENA_NULL &&
+      (e->all ||
+       wildcard_match(e->pattern, e->pattern_len, e->key, depth))) {
+    posting_list_t *list = trie_posting_list(e->trie, postings);
+    if (e->words != NULL &&
+        (e->lists == NULL || posting_list_count(list) > 0)) {
+      e->words[e->count] = key_copy(e->key, depth);
+      e->failed = e->words[e->count] == NULL;
+    }
+    if (e->failed)
+      return;
+    if (e->lists == NULL) // Only counting
+      e->count++;
+    else if (posting_list_count(list) > 0)
+      e->lists[e->count++] = list;
+  }
+
+  unsigned char keys[ALPHABET_SIZE];
+  uint32_t children[ALPHABET_SIZE];
+  int count = trie_node_children(e->trie, node, keys, children);
+  for (int i = 0; i < count && e->count < e->limit && !e->failed; i++) {
+    trie_node_t *child = trie_node(e->trie, children[i]);
+    size_t end = depth + 1 + child->prefix_len;
+    if (end > e->max_len || end >= TRIE_MAX_KEY)
+      continue;
+    e->key[depth] = keys[i];
+    memcpy(e->key + depth + 1, child->prefix, child->prefix_len);
+    expand_node(e, children[i], end);
+  }
+}
+
+// Min-heap of posting iterators ordered by their current posting
+static bool iter_before(const posting_iter_t *its, int a, int b) {
+  return posting_compare(&its[a].current, &its[b].current) < 0;
+}
+
+static void heap_sift_down(const posting_iter_t *its, int *heap, int size,
+                           int i) {
+  for (;;) {
+    int least = i, l = 2 * i + 1, r = l + 1;
+    if (l < size && iter_before(its, heap[l], heap[least]))
+      least = l;
+    if (r < size && iter_before(its, heap[r], heap[least]))
+      least = r;
+    if (least == i)
+      return;
+    int temp = heap[i];
+    heap[i] = heap[least];
+    heap[least] = temp;
+    i = least;
+  }
+}
+
+/*
+ * k-way merge of the expanded lists into (doc, page, offset) order. Only
+ * the postings that make it into the first `max_results` hits are ever
+ * decoded.
+ */
+static int merge_expansion(const search_engine_t *engine,
+                           const trie_t *trie, posting_list_t **lists,
+                           int count, int max_results, match_list_t *out) {
+  posting_iter_t *its = malloc(sizeof(posting_iter_t) * count);
+  int *heap = malloc(sizeof(int) * count);
+  if (its == NULL || heap == NULL) {
+    free(its);
+    free(heap);
+    return -1;
+  }
+  int size = 0;
+  for (int t = 0; t < count; t++) {
+    trie_postings_iter(trie, lists[t], &its[t]);
+    if (posting_iter_next(&its[t]))
+      heap[size++] = t;
+  }
+  for (int i = size / 2 - 1; i >= 0; i--)
+    heap_sift_down(its, heap, size, i);
+
+  int rc = 0;
+  while (size > 0 && (max_results <= 0 || out->count < max_results)) {
+    const posting_t *p = &its[heap[0]].current;
+    if (!engine_doc_deleted(engine, p->doc_id) &&
+        add_match(out, p->doc_id, p->page_num, p->byte_offset) != 0) {
+      rc = -1;
+      break;
+    }
+    if (!posting_iter_next(&its[heap[0]]))
+      heap[0] = heap[--size];
+    heap_sift_down(its, heap, size, 0);
+  }
+  free(its);
+  free(heap);
+  return rc;
+}
+
+/*
+ * Expands e's pattern below its literal head, `literal` bytes long, into
+ * e->lists (`lists`) or just e->count; `words` keeps every word too.
+ * -1 on allocation failure.
+ */
+static int expand_source(expansion_t *e, const char *folded, size_t literal,
+                         bool lists, bool words) {
+  size_t depth;
+  uint32_t start = trie_find_prefix(e->trie, (const unsigned char *)folded,
+                                    literal, e->key, &depth);
+  if (start == ARENA_NULL || depth > e->max_len)
+    return 0;
+  long terms = trie_subtree_terms(e->trie, start);
+  if (e->all && terms >= 0 && terms < e->limit)
+    e->limit = (int)terms; // Nothing more below: no need to look further
+  size_t slots = e->limit ? e->limit : 1;
+  if (lists && (e->lists = malloc(sizeof(posting_list_t *) * slots)) == NULL)
+    return -1;
+  if (words && e->words == NULL &&
+      (e->words = malloc(sizeof(char *) * slots)) == NULL)
+    return -1;
+  expand_node(e, start, depth);
+  return e->failed ? -1 : 0;
+}
+
+static void free_expansion(expansion_t *e) {
+  for (int i = 0; e->words != NULL && i < e->count; i++)
+    free(e->words[i]);
+  free(e->words);
+  free(e->lists);
+}
+
+static int compare_words(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Distinct words over the expansions of every segment, counted up to
+ * `limit`; *last (when not NULL) gets the last one counted. -1 on
+ * allocation failure.
+ */
+static long distinct_words(const expansion_t *es, int sources, long limit,
+                           const char **last) {
+  int total = 0;
+  for (int s = 0; s < sources; s++)
+    total += es[s].count;
+  char **all = malloc(sizeof(char *) * (total ? total : 1));
+  if (all == NULL)
+    return -1;
+  int n = 0;
+  for (int s = 0; s < sources; s++) {
+    for (int i = 0; i < es[s].count; i++)
+      all[n++] = es[s].words[i];
+  }
+  qsort(all, n, sizeof(char *), compare_words);
+  long distinct = 0;
+  for (int i = 0; i < n && distinct < limit; i++) {
+    if (i > 0 && strcmp(all[i], all[i - 1]) == 0)
+      continue;
+    distinct++;
+    if (last != NULL)
+      *last = all[i];
+  }
+  free(all);
+  return distinct;
+}
+
+/*
+ * Cuts every segment's expansion at the limit-th distinct word overall.
+ * A word within that cut is among the first `limit` of each segment
+ * holding it, so expanding each segment that far was enough.
+ */
+static int cut_expansions(expansion_t *es, int sources, int limit) {
+  const char *cutoff = NULL;
+  if (distinct_words(es, sources, limit, &cutoff) < 0)
+    return -1;
+  if (cutoff == NULL)
+    return 0;
+  for (int s = 0; s < sources; s++) {
+    expansion_t *e = &es[s];
+    while (e->count > 0 && strcmp(e->words[e->count - 1], cutoff) > 0)
+      free(e->words[--e->count]);
+  }
+  return 0;
+}
+
+/*
+ * Prefix and wildcard search: "optim*" expands to every indexed word
+ * starting with "optim", and '?' stands for one character anywhere in
+ * the pattern. The pattern has to start with a literal, which picks the
+ * trie subtree to walk; the first `max_terms` matching words in byte
+ * order (QUERY_MAX_EXPANSIONS when <= 0) are merged into one list of
+ * occurrences in (doc, page, offset) order, cut at `max_results` when
+ * that is > 0. Free with free_results().
+ */
+occurrence_transfer_t *search_prefix(search_engine_t *engine,
+                                     const char *pattern, int max_terms,
+                                     int max_results, int *found_count) {
+  *found_count = 0;
+  size_t len = strlen(pattern);
+  if (len >= TRIE_MAX_KEY)
+    return NULL;
+  char folded[TRIE_MAX_KEY];
+  long folded_len = fold_pattern(pattern, folded);
+  size_t literal = strcspn(folded, "*?");
+  if (folded_len <= 0 || literal == 0)
+    return NULL;
+  int limit = max_terms > 0 ? max_terms : QUERY_MAX_EXPANSIONS;
+
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  int sources = segment_view_count(&view);
+  expansion_t *es = calloc(sources, sizeof(expansion_t));
+  match_list_t matches = {0};
+  bool failed = es == NULL;
+  for (int s = 0; s < sources && !failed; s++) {
+    expansion_t *e = &es[s];
+    e->trie = segment_view_trie(&view, s);
+    e->pattern = folded;
+    e->pattern_len = (size_t)folded_len;
+    e->all = literal + 1 == e->pattern_len && folded[literal] == '*';
+    e->max_len = SIZE_MAX;
+    if (strchr(folded, '*') == NULL) // Each '?' takes at most 4 bytes
+      e->max_len = literal + 4 * (e->pattern_len - literal);
+    e->limit = limit;
+    failed = expand_source(e, folded, literal, true, sources > 1) != 0;
+  }
+  if (!failed && sources > 1)
+    failed = cut_expansions(es, sources, limit) != 0;
+  // Segments hold ascending documents, so their hits simply follow
+  for (int s = 0; s < sources && !failed; s++) {
+    if (max_results > 0 && matches.count >= max_results)
+      break;
+    failed = merge_expansion(engine, es[s].trie, es[s].lists, es[s].count,
+                             max_results, &matches) != 0;
+  }
+  segment_view_end(&view);
+  for (int s = 0; es != NULL && s < sources; s++)
+    free_expansion(&es[s]);
+  free(es);
+  return finish_hits(&matches, failed, found_count);
+}
+
+// Distinct words starting with `prefix` in one segment
+static long prefix_terms(const trie_t *trie, const char *folded,
+                         expansion_t *e) {
+  e->trie = trie;
+  e->all = true;
+  e->max_len = SIZE_MAX;
+  e->limit = TRIE_TERMS_SATURATED;
+  if (e->words == NULL) { // Read from the subtree count when it is kept
+    unsigned char key[TRIE_MAX_KEY];
+    size_t depth;
+    uint32_t start = trie_find_prefix(trie, (const unsigned char *)folded,
+                                      strlen(folded), key, &depth);
+    if (start == ARENA_NULL)
+      return 0;
+    long terms = trie_subtree_terms(trie, start);
+    if (terms >= 0)
+      return terms;
+  }
+  if (expand_source(e, folded, strlen(folded), false, e->words != NULL) != 0)
+    return -1;
+  return e->count;
+}
+
+/*
+ * Indexed words starting with `prefix`, saturating at
+ * TRIE_TERMS_SATURATED. Read from the subtree count kept in the trie;
+ * only indexes mapped from files older than version 4 walk the subtree,
+ * and so does a prefix found in several segments, to count each word
+ * once.
+ */
+long count_prefix_terms(search_engine_t *engine, const char *prefix) {
+  char folded[TRIE_MAX_KEY];
+  if (strlen(prefix) >= TRIE_MAX_KEY || strpbrk(prefix, "*?") != NULL ||
+      fold_pattern(prefix, folded) <= 0)
+    return 0;
+
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  int sources = segment_view_count(&view), holding = 0;
+  long terms = 0;
+  for (int s = 0; s < sources && terms >= 0; s++) {
+    expansion_t e = {0};
+    long n = prefix_terms(segment_view_trie(&view, s), folded, &e);
+    if (n != 0)
+      holding++;
+    terms = n < 0 ? -1 : terms + n;
+  }
+  if (holding > 1) {
+    expansion_t *es = calloc(sources, sizeof(expansion_t));
+    terms = es == NULL ? -1 : 0;
+    for (int s = 0; es != NULL && s < sources && terms >= 0; s++) {
+      es[s].words = malloc(sizeof(char *) * TRIE_TERMS_SATURATED);
+      if (es[s].words == NULL ||
+          prefix_terms(segment_view_trie(&view, s), folded, &es[s]) < 0)
+        terms = -1;
+    }
+    if (terms >= 0)
+      terms = distinct_words(es, sources, INT_MAX, NULL);
+    for (int s = 0; es != NULL && s < sources; s++)
+      free_expansion(&es[s]);
+    free(es);
+  }
+  segment_view_end(&view);
+  return terms > TRIE_TERMS_SATURATED ? TRIE_TERMS_SATURATED : terms;
+}
+
+// A term the fuzzy walk accepted, with the posting list behind it (NULL
+// once the term is combined over segments)
+typedef struct {
+  fuzzy_term_t term;
+  posting_list_t *list;
+} fuzzy_match_t;
+
+typedef struct {
+  const trie_t *trie;
+  lev_automaton_t automaton;
+  unsigned char key[TRIE_MAX_KEY];
+  fuzzy_match_t *matches;
+  int count;
+  int capacity;
+} fuzzy_walk_t;
+
+static int add_fuzzy_match(fuzzy_walk_t *w, posting_list_t *list,
+                           size_t len, int distance) {
+  if (w->count == w->capacity) {
+    int capacity = w->capacity ? w->capacity * 2 : 16;
+    fuzzy_match_t *temp =
+        realloc(w->matches, sizeof(fuzzy_match_t) * capacity);
+    if (temp == NULL)
+      return -1;
+    w->matches = temp;
+    w->capacity = capacity;
+  }
+  char *term = key_copy(w->key, len);
+  if (term == NULL)
+    return -1;
+  fuzzy_match_t *m = &w->matches[w->count++];
+  m->term.term = term;
+  m->term.distance = distance;
+  m->term.count = (int)posting_list_count(list);
+  m->list = list;
+  return 0;
+}
+
+/*
+ * Walks the trie in lockstep with the automaton: `state` has consumed
+ * key[0..depth), and a subtree is dropped as soon as the automaton dies
+ * on the way into it. -1 on allocation failure.
+ */
+static int fuzzy_node(fuzzy_walk_t *w, uint32_t node, size_t depth,
+                      lev_state_t state) {
+  trie_node_t *n = trie_node(w->trie, node);
+  if (depth + n->prefix_len >= TRIE_MAX_KEY)
+    return 0;
+  for (int i = 0; i < n->prefix_len; i++) {
+    w->key[depth++] = n->prefix[i];
+    if (!lev_step(&w->automaton, &state, n->prefix[i]))
+      return 0;
+  }
+  int distance = lev_distance(&w->automaton, &state);
+  uint32_t postings = trie_node_postings(n);
+  if (distance >= 0 && postings != ARENA_NULL) {
+    posting_list_t *list = trie_posting_list(w->trie, postings);
+    if (posting_list_count(list) > 0 &&
+        add_fuzzy_match(w, list, depth, distance) != 0)
+      return -1;
+  }
+
+  unsigned char keys[ALPHABET_SIZE];
+  uint32_t children[ALPHABET_SIZE];
+  int count = trie_node_children(w->trie, node, keys, children);
   for (int i = 0; i < count; i++) {
-    results[i].doc_id = curr->doc_id;
-    results[i].page_num = curr->page_num;
-    results[i].byte_offset = curr->byte_offset;
-    curr = curr->next;
+    lev_state_t next = state;
+    if (!lev_step(&w->automaton, &next, keys[i]))
+      continue;
+    w->key[depth] = keys[i];
+    if (fuzzy_node(w, children[i], depth + 1, next) != 0)
+      return -1;
   }
+  return 0;
+}
 
+// Closest first, then the more frequent term, then byte order
+static int compare_fuzzy(const void *a, const void *b) {
+  const fuzzy_term_t *x = &((const fuzzy_match_t *)a)->term;
+  const fuzzy_term_t *y = &((const fuzzy_match_t *)b)->term;
+  if (x->distance != y->distance)
+    return x->distance - y->distance;
+  if (x->count != y->count)
+    return x->count > y->count ? -1 : 1;
+  return strcmp(x->term, y->term);
+}
+
+static void free_matches(fuzzy_match_t *matches, int from, int count) {
+  for (int i = from; i < count; i++)
+    free(matches[i].term.term);
+}
+
+static int compare_match_terms(const void *a, const void *b) {
+  return strcmp(((const fuzzy_match_t *)a)->term.term,
+                ((const fuzzy_match_t *)b)->term.term);
+}
+
+// One match per term over all segments, with the postings added up
+static int combine_matches(fuzzy_match_t *matches, int count) {
+  qsort(matches, count, sizeof(fuzzy_match_t), compare_match_terms);
+  int n = 0;
+  for (int i = 0; i < count; i++) {
+    if (n > 0 && strcmp(matches[i].term.term, matches[n - 1].term.term) == 0) {
+      matches[n - 1].term.count += matches[i].term.count;
+      free(matches[i].term.term);
+      continue;
+    }
+    matches[n] = matches[i];
+    matches[n++].list = NULL;
+  }
+  return n;
+}
+
+/*
+ * Indexed words within `max_distance` edits (1 or 2) of `word`, ranked
+ * by distance and then frequency, at most `max_terms` of them
+ * (QUERY_MAX_EXPANSIONS when <= 0). The array is NULL with *count 0 when
+ * nothing matched; -1 on allocation failure.
+ */
+static int fuzzy_expand(const segment_view_t *view, const char *word,
+                        int max_distance, int max_terms,
+                        fuzzy_match_t **matches, int *count) {
+  *matches = NULL;
+  *count = 0;
+  char folded[TRIE_MAX_KEY];
+  pattern_run_t run = {.out = folded, .room = sizeof(folded) - 1};
+  tokenize(word, strlen(word), fold_run, &run);
+  fuzzy_walk_t *w = calloc(1, sizeof(fuzzy_walk_t));
+  if (w == NULL)
+    return -1;
+  int sources = segment_view_count(view);
+  int rc = 0;
+  if (run.words == 1 &&
+      lev_init(&w->automaton, folded, run.len, max_distance) == 0) {
+    lev_state_t start;
+    lev_start(&w->automaton, &start);
+    for (int s = 0; s < sources && rc == 0; s++) {
+      w->trie = segment_view_trie(view, s);
+      rc = fuzzy_node(w, trie_root(w->trie), 0, start);
+    }
+  }
+  if (rc == 0 && sources > 1)
+    w->count = combine_matches(w->matches, w->count);
+  if (rc != 0 || w->count == 0) {
+    free_matches(w->matches, 0, w->count);
+    free(w->matches);
+    free(w);
+    return rc;
+  }
+
+  int limit = max_terms > 0 ? max_terms : QUERY_MAX_EXPANSIONS;
+  qsort(w->matches, w->count, sizeof(fuzzy_match_t), compare_fuzzy);
+  if (w->count > limit) {
+    free_matches(w->matches, limit, w->count);
+    w->count = limit;
+  }
+  *matches = w->matches;
+  *count = w->count;
+  free(w);
+  return 0;
+}
+
+/*
+ * Fuzzy term lookup: the indexed words within `max_distance` edits of
+ * `word`, with their distance and posting count, closest first. Typos and
+ * OCR damage usually sit within 1 or 2 edits. Free with
+ * free_fuzzy_terms().
+ */
+fuzzy_term_t *search_fuzzy_terms(search_engine_t *engine, const char *word,
+                                 int max_distance, int max_terms,
+                                 int *found_count) {
+  fuzzy_match_t *matches;
+  int count;
+  *found_count = 0;
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  int rc =
+      fuzzy_expand(&view, word, max_distance, max_terms, &matches, &count);
+  segment_view_end(&view);
+  if (rc != 0 || count == 0)
+    return NULL;
+  fuzzy_term_t *terms = malloc(sizeof(fuzzy_term_t) * count);
+  if (terms == NULL) {
+    free_matches(matches, 0, count);
+    free(matches);
+    return NULL;
+  }
+  for (int i = 0; i < count; i++)
+    terms[i] = matches[i].term;
+  free(matches);
   *found_count = count;
+  return terms;
+}
+
+void free_fuzzy_terms(fuzzy_term_t *terms, int count) {
+  if (terms == NULL)
+    return;
+  for (int i = 0; i < count; i++)
+    free(terms[i].term);
+  free(terms);
+}
+
+/*
+ * Occurrences of every word search_fuzzy_terms() accepts, merged into
+ * (doc, page, offset) order and cut at `max_results` when that is > 0.
+ * Free with free_results().
+ */
+occurrence_transfer_t *search_fuzzy(search_engine_t *engine,
+                                    const char *word, int max_distance,
+                                    int max_terms, int max_results,
+                                    int *found_count) {
+  fuzzy_match_t *matches;
+  int count;
+  *found_count = 0;
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  if (fuzzy_expand(&view, word, max_distance, max_terms, &matches,
+                   &count) != 0 ||
+      count == 0) {
+    segment_view_end(&view);
+    return NULL;
+  }
+  match_list_t hits = {0};
+  posting_list_t **lists = malloc(sizeof(posting_list_t *) * count);
+  bool failed = lists == NULL;
+  for (int s = 0; s < segment_view_count(&view) && !failed; s++) {
+    if (max_results > 0 && hits.count >= max_results)
+      break;
+    trie_t *trie = segment_view_trie(&view, s);
+    // Combined terms are looked up again in each segment
+    for (int i = 0; i < count; i++)
+      lists[i] = matches[i].list ? matches[i].list
+                                 : trie_search(trie, matches[i].term.term);
+    failed = merge_expansion(engine, trie, lists, count, max_results,
+                             &hits) != 0;
+  }
+  segment_view_end(&view);
+  free(lists);
+  free_matches(matches, 0, count);
+  free(matches);
+  return finish_hits(&hits, failed, found_count);
+}
+
+// Average document length, 0 when no document length is known
+double bm25_average_length(const search_engine_t *engine) {
+  int docs = __atomic_load_n(&engine->length_docs, __ATOMIC_RELAXED);
+  uint64_t total = __atomic_load_n(&engine->total_length, __ATOMIC_RELAXED);
+  return docs > 0 ? (double)total / docs : 0.0;
+}
+
+// Robertson-Sparck Jones weight with the +1 that keeps it positive
+static double bm25_idf(const search_engine_t *engine, uint32_t doc_freq) {
+  double n = (double)(engine->doc_count - engine->deleted_count);
+  double df = doc_freq;
+  if (df > n)
+    df = n;
+  return log(1.0 + (n - df + 0.5) / (df + 0.5));
+}
+
+/*
+ * BM25 length factor k1 * (1 - b + b * dl / avgdl). Documents of unknown
+ * length (indexed before lengths were kept) count as average.
+ */
+double bm25_length_norm(const search_engine_t *engine, int doc_id,
+                        double avgdl) {
+  const doc_meta_t *meta = engine_meta_snapshot(engine, doc_id);
+  if (avgdl <= 0.0 || meta == NULL || meta->length == 0)
+    return BM25_K1;
+  double dl = meta->length;
+  return BM25_K1 * (1.0 - BM25_B + BM25_B * dl / avgdl);
+}
+
+/*
+ * Fixed-size min-heap of the best k results; the root is the one to
+ * evict. Lower doc ids win ties so rankings are stable.
+ */
+typedef struct {
+  scored_result_t *items;
+  int count;
+  int k;
+} top_k_t;
+
+static bool ranks_below(const scored_result_t *a, const scored_result_t *b) {
+  return a->score < b->score || (a->score == b->score && a->doc_id > b->doc_id);
+}
+
+static void top_k_push(top_k_t *top, const scored_result_t *r) {
+  scored_result_t *h = top->items;
+  int i;
+  if (top->count < top->k) {
+    // Sift up from the new leaf
+    i = top->count++;
+    while (i > 0 && ranks_below(r, &h[(i - 1) / 2])) {
+      h[i] = h[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    h[i] = *r;
+    return;
+  }
+  if (!ranks_below(&h[0], r))
+    return;
+  // Replace the root and sift down
+  i = 0;
+  for (;;) {
+    int worst = -1, l = 2 * i + 1, rr = l + 1;
+    const scored_result_t *pick = r;
+    if (l < top->count && ranks_below(&h[l], pick)) {
+      worst = l;
+      pick = &h[l];
+    }
+    if (rr < top->count && ranks_below(&h[rr], pick))
+      worst = rr;
+    if (worst < 0)
+      break;
+    h[i] = h[worst];
+    i = worst;
+  }
+  h[i] = *r;
+}
+
+static int compare_ranked(const void *a, const void *b) {
+  const scored_result_t *x = a, *y = b;
+  return ranks_below(x, y) ? 1 : ranks_below(y, x) ? -1 : 0;
+}
+
+// Score a result must beat to get in, -1 while there is still room
+static double top_k_threshold(const top_k_t *top) {
+  return top->count < top->k ? -1.0 : top->items[0].score;
+}
+
+// Best first; hands the heap's array over to the caller
+static scored_result_t *top_k_finish(top_k_t *top, int *found_count) {
+  *found_count = top->count;
+  if (top->count == 0) {
+    free(top->items);
+    return NULL;
+  }
+  qsort(top->items, top->count, sizeof(scored_result_t), compare_ranked);
+  return top->items;
+}
+
+// One query word's postings, read a document at a time
+typedef struct {
+  posting_iter_t it;
+  bool more; // it.current is the first posting of the next document
+  double idf;
+  // Block-max pruning only
+  const impact_block_t *blocks;
+  const posting_skip_t *skips; // where each block starts, NULL if unknown
+  uint32_t block_count;
+  uint32_t block; // first block that may hold the current document
+  double bound;   // idf times the best weight anywhere in the list
+} score_cursor_t;
+
+// Stands in for the blocks of a list the impact table does not cover
+static const impact_block_t whole_list = {UINT32_MAX, BM25_K1 + 1.0};
+
+// Float rounding slack when a bound is compared to the threshold
+#define BOUND_SLACK (1.0 + 1e-9)
+
+static int cursor_doc(const score_cursor_t *c) {
+  return c->more ? c->it.current.doc_id : INT_MAX;
+}
+
+/*
+ * Moves the cursor to its first document at or after `doc_id`. With skip
+ * entries it jumps straight to the impact block holding that document,
+ * so only postings of that block are decoded on the way.
+ */
+static void cursor_seek(score_cursor_t *c, int doc_id) {
+  if (doc_id == INT_MAX) {
+    c->more = false;
+    return;
+  }
+  if (!c->more || c->it.current.doc_id >= doc_id)
+    return;
+  if (c->skips != NULL) {
+    uint32_t b = c->block;
+    while (b < c->block_count && c->blocks[b].last_doc < (uint32_t)doc_id)
+      b++;
+    if (b == c->block_count) {
+      c->more = false;
+      return;
+    }
+    if (b > 0 && (uint32_t)c->it.current.doc_id <= c->blocks[b - 1].last_doc)
+      posting_iter_jump(&c->it, &c->skips[b]);
+    c->block = b;
+  }
+  c->more = posting_iter_seek(&c->it, doc_id, 0);
+}
+
+/*
+ * Shallow move: steps the cursor's block, without decoding anything, to
+ * the one that would hold `doc_id`. Returns the block's score bound and
+ * sets *last to its last document (INT_MAX past the end of the list).
+ */
+static double cursor_block_bound(score_cursor_t *c, int doc_id,
+                                 int64_t *last) {
+  while (c->block < c->block_count &&
+         c->blocks[c->block].last_doc < (uint32_t)doc_id)
+    c->block++;
+  if (c->block == c->block_count) {
+    *last = INT_MAX;
+    return 0.0;
+  }
+  *last = c->blocks[c->block].last_doc;
+  return c->idf * c->blocks[c->block].max_weight;
+}
+
+/*
+ * Consumes the cursor's postings in `doc_id` and returns their number,
+ * the term frequency; *first is set to the first of them.
+ */
+static int cursor_take_doc(score_cursor_t *c, int doc_id, posting_t *first) {
+  int tf = 0;
+  while (c->more && c->it.current.doc_id == doc_id) {
+    if (tf++ == 0)
+      *first = c->it.current;
+    c->more = posting_iter_next(&c->it);
+  }
+  return tf;
+}
+
+/*
+ * Scores one document from every cursor positioned on it, leaving them
+ * on their next document, and offers it to the heap.
+ */
+static void score_document(const search_engine_t *engine,
+                           score_cursor_t *cursors, int count, int doc_id,
+                           double avgdl, top_k_t *top) {
+  double norm = bm25_length_norm(engine, doc_id, avgdl);
+  scored_result_t r = {doc_id, 0, 0, 0.0};
+  posting_t best = {0};
+  bool located = false;
+  for (int t = 0; t < count; t++) {
+    posting_t first;
+    int tf = cursor_take_doc(&cursors[t], doc_id, &first);
+    if (tf == 0)
+      continue;
+    r.score += cursors[t].idf * bm25_weight(tf, norm);
+    if (!located || posting_compare(&first, &best) < 0) {
+      best = first;
+      located = true;
+    }
+  }
+  r.page_num = best.page_num;
+  r.byte_offset = best.byte_offset;
+  if (!engine_doc_deleted(engine, doc_id))
+    top_k_push(top, &r);
+}
+
+// Every document holding a query word is scored
+static void rank_exhaustive(const search_engine_t *engine,
+                            score_cursor_t *cursors, int count, double avgdl,
+                            top_k_t *top) {
+  for (;;) {
+    int doc_id = INT_MAX;
+    for (int t = 0; t < count; t++) {
+      if (cursor_doc(&cursors[t]) < doc_id)
+        doc_id = cursor_doc(&cursors[t]);
+    }
+    if (doc_id == INT_MAX)
+      break;
+    score_document(engine, cursors, count, doc_id, avgdl, top);
+  }
+}
+
+/*
+ * Block-max WAND. With the cursors ordered by document, the pivot is the
+ * first one where the words' list bounds add up to more than the heap's
+ * threshold: no document before it can get in. The block bounds at the
+ * pivot document then either clear it for scoring or let every cursor up
+ * to the pivot jump past the end of the nearest block. Finds exactly the
+ * documents rank_exhaustive() would keep.
+ */
+static int rank_block_max(const search_engine_t *engine,
+                          score_cursor_t *cursors, int count, double avgdl,
+                          top_k_t *top) {
+  int *order = malloc(sizeof(int) * count);
+  if (order == NULL)
+    return -1;
+  int active = 0;
+  for (int t = 0; t < count; t++)
+    order[active++] = t;
+
+  for (;;) {
+    // 1. Order by current document, dropping finished lists
+    int n = 0;
+    for (int i = 0; i < active; i++) {
+      int t = order[i], doc_id = cursor_doc(&cursors[t]), j = n++;
+      if (doc_id == INT_MAX) {
+        n--;
+        continue;
+      }
+      while (j > 0 && cursor_doc(&cursors[order[j - 1]]) > doc_id) {
+        order[j] = order[j - 1];
+        j--;
+      }
+      order[j] = t;
+    }
+    active = n;
+
+    // 2. Pivot, extended over the cursors sharing its document
+    double threshold = top_k_threshold(top);
+    double sum = 0.0;
+    int p = -1;
+    for (int i = 0; i < active; i++) {
+      sum += cursors[order[i]].bound;
+      if (sum * BOUND_SLACK > threshold) {
+        p = i;
+        break;
+      }
+    }
+    if (p < 0)
+      break;
+    int pivot = cursor_doc(&cursors[order[p]]);
+    while (p + 1 < active && cursor_doc(&cursors[order[p + 1]]) == pivot)
+      p++;
+
+    // 3. Tighter bound from the blocks holding the pivot document
+    double block_sum = 0.0;
+    int64_t next = INT_MAX;
+    for (int i = 0; i <= p; i++) {
+      int64_t last;
+      block_sum += cursor_block_bound(&cursors[order[i]], pivot, &last);
+      if (last + 1 < next)
+        next = last + 1;
+    }
+
+    if (block_sum * BOUND_SLACK > threshold) {
+      // 4. Score it once every cursor before the pivot has caught up
+      if (cursor_doc(&cursors[order[0]]) == pivot) {
+        score_document(engine, cursors, count, pivot, avgdl, top);
+      } else {
+        for (int i = 0; i < p; i++)
+          cursor_seek(&cursors[order[i]], pivot);
+      }
+      continue;
+    }
+
+    // 5. Nothing up to the nearest block end or the next word can get in
+    if (p + 1 < active && cursor_doc(&cursors[order[p + 1]]) < next)
+      next = cursor_doc(&cursors[order[p + 1]]);
+    for (int i = 0; i <= p; i++)
+      cursor_seek(&cursors[order[i]], (int)next);
+  }
+  free(order);
+  return 0;
+}
+
+/*
+ * Ranks one segment's postings into `top`, pruning with `impacts` when
+ * given (segment_view_impacts()); `df` holds the documents of each query
+ * word over every segment, so scores match a single index.
+ */
+static int rank_source(const search_engine_t *engine, const term_set_t *set,
+                       const uint32_t *df, const impact_index_t *impacts,
+                       bool prune, double avgdl, top_k_t *top) {
+  prune = prune && impacts != NULL;
+  int count = set->count;
+  if (count == 0)
+    return 0;
+  score_cursor_t *cursors = malloc(sizeof(score_cursor_t) * count);
+  if (cursors == NULL)
+    return -1;
+  for (int t = 0; t < count; t++) {
+    const query_term_t *term = &set->terms[t];
+    score_cursor_t *c = &cursors[t];
+    trie_postings_iter(term->trie, term->list, &c->it);
+    c->more = posting_iter_next(&c->it);
+    c->idf = bm25_idf(engine, df[term->word]);
+    c->block = 0;
+    float max = 0.0f;
+    c->blocks = prune ? impact_list(impacts, term->handle, term->list,
+                                    &c->block_count, &max)
+                      : NULL;
+    c->skips = c->blocks != NULL ? impact_list_skips(impacts, term->handle)
+                                 : NULL;
+    if (c->blocks == NULL) {
+      c->blocks = &whole_list;
+      c->block_count = 1;
+      max = whole_list.max_weight;
+    }
+    c->bound = c->idf * max;
+  }
+  if (!prune || rank_block_max(engine, cursors, count, avgdl, top) != 0)
+    rank_exhaustive(engine, cursors, count, avgdl, top);
+  free(cursors);
+  return 0;
+}
+
+static scored_result_t *rank(search_engine_t *engine,
+                             const segment_view_t *view, const char *query,
+                             int k, bool prune, int *found_count) {
+  int sources = segment_view_count(view);
+  term_set_t *sets = calloc(sources, sizeof(term_set_t));
+  uint32_t *df = NULL;
+  top_k_t top = {0};
+  scored_result_t *results = NULL;
+  *found_count = 0;
+  if (sets == NULL)
+    return NULL;
+
+  // 1. Each segment's lists, and every word's documents over all of them
+  int words = 0, terms = 0;
+  for (int s = 0; s < sources; s++) {
+    if (resolve_terms(segment_view_trie(view, s), &query, 1, &sets[s]) != 0)
+      goto done;
+    words = sets[s].words;
+    terms += sets[s].count;
+  }
+  if (terms == 0)
+    goto done;
+  df = calloc(words, sizeof(uint32_t));
+  top.k = k > 0 ? k : QUERY_DEFAULT_K;
+  top.items = malloc(sizeof(scored_result_t) * top.k);
+  if (df == NULL || top.items == NULL)
+    goto done;
+  for (int s = 0; s < sources; s++) {
+    for (int t = 0; t < sets[s].count; t++)
+      df[sets[s].terms[t].word] += posting_list_docs(sets[s].terms[t].list);
+  }
+
+  // 2. One heap over every segment, so later ones prune against the
+  // scores the earlier ones reached
+  double avgdl = bm25_average_length(engine);
+  for (int s = 0; s < sources; s++) {
+    if (rank_source(engine, &sets[s], df, segment_view_impacts(view, s),
+                    prune, avgdl, &top) != 0)
+      goto done;
+  }
+  results = top_k_finish(&top, found_count);
+  top.items = NULL;
+
+done:
+  for (int s = 0; s < sources; s++)
+    free(sets[s].terms);
+  free(sets);
+  free(df);
+  free(top.items);
   return results;
 }
 
+/*
+ * BM25 over every document holding at least one word of `query`: the
+ * words' postings are walked together a document at a time, term
+ * frequencies counted on the way, and only the best k (QUERY_DEFAULT_K
+ * when <= 0) are kept in a fixed-size heap. Returns them best first,
+ * each pointing at its first query word. Free with free_results().
+ *
+ * With the engine's impact table, documents whose block bounds cannot
+ * beat the k-th score are skipped unread (block-max WAND); the results
+ * are the same.
+ */
+scored_result_t *search_ranked(search_engine_t *engine, const char *query,
+                               int k, int *found_count) {
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  scored_result_t *results = rank(engine, &view, query, k, true, found_count);
+  segment_view_end(&view);
+  return results;
+}
+
+// search_ranked() scoring every candidate, the baseline for the pruning
+scored_result_t *search_ranked_exhaustive(search_engine_t *engine,
+                                          const char *query, int k,
+                                          int *found_count) {
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  scored_result_t *results =
+      rank(engine, &view, query, k, false, found_count);
+  segment_view_end(&view);
+  return results;
+}
+
+// Work shared by the threads of one search_batch() call
+typedef struct {
+  search_engine_t *engine;
+  const char *const *queries;
+  int count;
+  int max_results;
+  occurrence_transfer_t **hits; // per query, until packed
+  int *counts;
+  int next; // first query not claimed yet
+  bool failed;
+} batch_job_t;
+
+/*
+ * A query that folds to one word lists its occurrences, like
+ * get_search_results(); several words are matched as a phrase. At most
+ * max_results hits (0: all) are kept.
+ */
+static occurrence_transfer_t *batch_query(search_engine_t *engine,
+                                          const char *query, int max_results,
+                                          int *found_count, bool *failed) {
+  match_list_t hits = {0};
+  *found_count = 0;
+  if (query == NULL)
+    return NULL;
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  for (int s = 0; s < segment_view_count(&view) && !*failed; s++) {
+    if (max_results > 0 && hits.count >= max_results)
+      break;
+    trie_t *trie = segment_view_trie(&view, s);
+    term_set_t set;
+    if (resolve_terms(trie, &query, 1, &set) != 0) {
+      *failed = true;
+    } else if (set.count > 1 || set.missing) {
+      int n;
+      occurrence_transfer_t *results =
+          positional_search(engine, &set, -1, &n);
+      *failed = take_hits(&hits, results, n) != 0;
+    } else if (set.count == 1) {
+      posting_iter_t it;
+      trie_postings_iter(trie, set.terms[0].list, &it);
+      while ((max_results <= 0 || hits.count < max_results) &&
+             posting_iter_next(&it)) {
+        if (engine_doc_deleted(engine, it.current.doc_id))
+          continue;
+        if (add_match(&hits, it.current.doc_id, it.current.page_num,
+                      it.current.byte_offset) != 0) {
+          *failed = true;
+          break;
+        }
+      }
+    }
+    free(set.terms);
+  }
+  segment_view_end(&view);
+  if (max_results > 0 && hits.count > max_results)
+    hits.count = max_results;
+  *found_count = hits.count;
+  return hits.items;
+}
+
+static void *batch_worker(void *arg) {
+  batch_job_t *job = arg;
+  for (;;) {
+    int first = __atomic_fetch_add(&job->next, QUERY_BATCH_CHUNK,
+                                   __ATOMIC_RELAXED);
+    if (first >= job->count)
+      break;
+    int last = first + QUERY_BATCH_CHUNK < job->count
+                   ? first + QUERY_BATCH_CHUNK
+                   : job->count;
+    bool failed = false;
+    for (int q = first; q < last; q++) {
+      job->hits[q] = batch_query(job->engine, job->queries[q],
+                                 job->max_results, &job->counts[q], &failed);
+    }
+    if (failed)
+      __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+/*
+ * Runs `count` independent queries (see batch_query()) over a pool of
+ * threads and packs the results: the hits of query i are
+ * results[offsets[i] .. offsets[i] + counts[i]), tombstones skipped.
+ * Each query sees the index as published when it starts, so indexing may
+ * go on meanwhile. `workers` <= 0 picks one per online CPU. Free with
+ * free_query_batch(). Returns NULL if out of memory.
+ */
+query_batch_t *search_batch(search_engine_t *engine,
+                            const char *const *queries, int count,
+                            int max_results, int workers) {
+  query_batch_t *batch = calloc(1, sizeof(query_batch_t));
+  if (batch == NULL)
+    return NULL;
+  batch->count = count > 0 ? count : 0;
+  batch->offsets = malloc(sizeof(int64_t) * (batch->count + 1));
+  batch->counts = calloc(batch->count + 1, sizeof(int));
+  batch_job_t job = {0};
+  job.hits = calloc(batch->count + 1, sizeof(occurrence_transfer_t *));
+  if (batch->offsets == NULL || batch->counts == NULL || job.hits == NULL) {
+    free(job.hits);
+    free_query_batch(batch);
+    return NULL;
+  }
+
+  // 1. Evaluate, a chunk of queries per claim
+  job.engine = engine;
+  job.queries = queries;
+  job.count = batch->count;
+  job.max_results = max_results;
+  job.counts = batch->counts;
+  if (workers <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (int)cpus : 1;
+  }
+  int chunks = (batch->count + QUERY_BATCH_CHUNK - 1) / QUERY_BATCH_CHUNK;
+  if (workers > chunks)
+    workers = chunks > 0 ? chunks : 1;
+  pthread_t *threads = calloc(workers, sizeof(pthread_t));
+  int started = 1;
+  while (threads != NULL && started < workers &&
+         pthread_create(&threads[started], NULL, batch_worker, &job) == 0) {
+    started++;
+  }
+  batch_worker(&job);
+  for (int i = 1; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+
+  // 2. Pack them in query order
+  for (int q = 0; q < batch->count; q++) {
+    batch->offsets[q] = batch->total;
+    batch->total += batch->counts[q];
+  }
+  batch->offsets[batch->count] = batch->total;
+  batch->results = job.failed ? NULL
+                              : malloc(sizeof(occurrence_transfer_t) *
+                                       (batch->total > 0 ? batch->total : 1));
+  for (int q = 0; q < batch->count; q++) {
+    if (batch->results != NULL && batch->counts[q] > 0)
+      memcpy(batch->results + batch->offsets[q], job.hits[q],
+             sizeof(occurrence_transfer_t) * batch->counts[q]);
+    free(job.hits[q]);
+  }
+  free(job.hits);
+  if (batch->results == NULL) {
+    free_query_batch(batch);
+    return NULL;
+  }
+  return batch;
+}
+
+// A query's cache key: its folded words, one space apart
+typedef struct {
+  char *text;
+  size_t len;
+  size_t capacity;
+  bool failed;
+} query_key_t;
+
+static void add_key_word(const char *token, size_t len, long byte_offset,
+                         void *user_data) {
+  (void)byte_offset;
+  query_key_t *key = user_data;
+  if (key->len + len + 2 > key->capacity) {
+    size_t capacity = (key->len + len + 2) * 2;
+    char *temp = realloc(key->text, capacity);
+    if (temp == NULL) {
+      key->failed = true;
+      return;
+    }
+    key->text = temp;
+    key->capacity = capacity;
+  }
+  if (key->len > 0)
+    key->text[key->len++] = ' ';
+  memcpy(key->text + key->len, token, len + 1);
+  key->len += len;
+}
+
+/*
+ * Hits of `query` as batch_query() finds them, shared with the engine's
+ * result cache: the same words asked again before the index changes are
+ * answered without touching the postings. The hits are read-only and
+ * stay valid until release_results(), even past engine_free(). NULL when
+ * nothing matched (or out of memory).
+ */
+const occurrence_transfer_t *search_cached(search_engine_t *engine,
+                                           const char *query,
+                                           int *found_count) {
+  *found_count = 0;
+  query_key_t key = {0};
+  if (query != NULL)
+    tokenize(query, strlen(query), add_key_word, &key);
+  if (key.failed || key.len == 0) {
+    free(key.text);
+    return NULL;
+  }
+
+  // 1. Asked before at this generation?
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  uint64_t generation = trie_generation(view.live);
+  segment_view_end(&view);
+  result_buffer_t *buffer =
+      engine->cache != NULL
+          ? result_cache_get(engine->cache, key.text, generation)
+          : NULL;
+
+  // 2. Evaluate it, and keep the hits for next time
+  if (buffer == NULL) {
+    bool failed = false;
+    int count = 0;
+    occurrence_transfer_t *hits =
+        batch_query(engine, key.text, 0, &count, &failed);
+    buffer = failed ? NULL : result_buffer_create(hits, count, key.len);
+    free(hits);
+    if (buffer != NULL && engine->cache != NULL)
+      result_cache_put(engine->cache, key.text, generation, buffer);
+  }
+  free(key.text);
+  if (buffer == NULL)
+    return NULL;
+  if (buffer->count == 0) { // cached all the same, misses repeat too
+    result_buffer_release(buffer);
+    return NULL;
+  }
+  *found_count = buffer->count;
+  return buffer->hits;
+}
+
+void release_results(const occurrence_transfer_t *results) {
+  if (results == NULL)
+    return;
+  result_buffer_release(
+      (result_buffer_t *)((const char *)results -
+                          offsetof(result_buffer_t, hits)));
+}
+
+void free_query_batch(query_batch_t *batch) {
+  if (batch == NULL)
+    return;
+  free(batch->results);
+  free(batch->offsets);
+  free(batch->counts);
+  free(batch);
+}
+
 void free_results(int *results) {
   if (results != NULL) {
     free(results);
@@ -0,0 +1,219 @@
+#include "result_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Buckets a new cache starts with; doubles once it holds twice as many
+#define RESULT_CACHE_BUCKETS 64
+
+// FNV-1a, queries are short
+static uint64_t hash_key(const char *key) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+    h ^= *p;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/*
+ * Copies `count` hits into a buffer with one reference, owned by the
+ * caller. `key_len` is the length of the query it will be cached under,
+ * counted in its size. Returns NULL if out of memory.
+ */
+result_buffer_t *result_buffer_create(const occurrence_transfer_t *hits,
+                                      int count, size_t key_len) {
+  size_t hit_bytes = sizeof(occurrence_transfer_t) * (size_t)count;
+  result_buffer_t *buffer = malloc(sizeof(result_buffer_t) + hit_bytes);
+  if (buffer == NULL)
+    return NULL;
+  buffer->refs = 1;
+  buffer->count = count;
+  buffer->bytes = sizeof(result_buffer_t) + hit_bytes +
+                  sizeof(result_entry_t) + key_len + 1;
+  if (count > 0)
+    memcpy(buffer->hits, hits, hit_bytes);
+  return buffer;
+}
+
+void result_buffer_release(result_buffer_t *buffer) {
+  if (buffer != NULL &&
+      __atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free(buffer);
+}
+
+static void retain(result_buffer_t *buffer) {
+  __atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+result_cache_t *result_cache_create(size_t budget) {
+  result_cache_t *cache = calloc(1, sizeof(result_cache_t));
+  if (cache == NULL)
+    return NULL;
+  cache->buckets = calloc(RESULT_CACHE_BUCKETS, sizeof(result_entry_t *));
+  if (cache->buckets == NULL || pthread_mutex_init(&cache->lock, NULL) != 0) {
+    free(cache->buckets);
+    free(cache);
+    return NULL;
+  }
+  cache->bucket_mask = RESULT_CACHE_BUCKETS - 1;
+  cache->stats.budget = budget;
+  return cache;
+}
+
+static void lru_unlink(result_cache_t *cache, result_entry_t *entry) {
+  if (entry->newer != NULL)
+    entry->newer->older = entry->older;
+  else
+    cache->newest = entry->older;
+  if (entry->older != NULL)
+    entry->older->newer = entry->newer;
+  else
+    cache->oldest = entry->newer;
+}
+
+static void lru_push(result_cache_t *cache, result_entry_t *entry) {
+  entry->newer = NULL;
+  entry->older = cache->newest;
+  if (cache->newest != NULL)
+    cache->newest->newer = entry;
+  else
+    cache->oldest = entry;
+  cache->newest = entry;
+}
+
+// Unhooks an entry and drops the cache's reference to its hits
+static void remove_entry(result_cache_t *cache, result_entry_t *entry) {
+  result_entry_t **link = &cache->buckets[entry->hash & cache->bucket_mask];
+  while (*link != entry)
+    link = &(*link)->next;
+  *link = entry->next;
+  lru_unlink(cache, entry);
+  cache->stats.entries--;
+  cache->stats.bytes -= entry->buffer->bytes;
+  result_buffer_release(entry->buffer);
+  free(entry);
+}
+
+static void evict(result_cache_t *cache) {
+  while (cache->stats.bytes > cache->stats.budget && cache->oldest != NULL) {
+    remove_entry(cache, cache->oldest);
+    cache->stats.evictions++;
+  }
+}
+
+// Doubles the bucket array; chains are short enough that failing is fine
+static void grow_buckets(result_cache_t *cache) {
+  uint32_t count = (cache->bucket_mask + 1) * 2;
+  result_entry_t **buckets = calloc(count, sizeof(result_entry_t *));
+  if (buckets == NULL)
+    return;
+  for (uint32_t b = 0; b <= cache->bucket_mask; b++) {
+    result_entry_t *entry = cache->buckets[b];
+    while (entry != NULL) {
+      result_entry_t *next = entry->next;
+      entry->next = buckets[entry->hash & (count - 1)];
+      buckets[entry->hash & (count - 1)] = entry;
+      entry = next;
+    }
+  }
+  free(cache->buckets);
+  cache->buckets = buckets;
+  cache->bucket_mask = count - 1;
+}
+
+static result_entry_t *find(result_cache_t *cache, const char *key,
+                            uint64_t hash) {
+  result_entry_t *entry = cache->buckets[hash & cache->bucket_mask];
+  while (entry != NULL && (entry->hash != hash || strcmp(entry->key, key)))
+    entry = entry->next;
+  return entry;
+}
+
+/*
+ * Hits cached for `key` at this index generation, with a reference the
+ * caller releases, or NULL. A stale entry for the key is dropped.
+ */
+result_buffer_t *result_cache_get(result_cache_t *cache, const char *key,
+                                  uint64_t generation) {
+  uint64_t hash = hash_key(key);
+  result_buffer_t *buffer = NULL;
+  pthread_mutex_lock(&cache->lock);
+  result_entry_t *entry = find(cache, key, hash);
+  if (entry != NULL && entry->generation != generation) {
+    remove_entry(cache, entry);
+    entry = NULL;
+  }
+  if (entry != NULL) {
+    lru_unlink(cache, entry);
+    lru_push(cache, entry);
+    buffer = entry->buffer;
+    retain(buffer);
+    cache->stats.hits++;
+  } else {
+    cache->stats.misses++;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return buffer;
+}
+
+/*
+ * Caches `buffer` under `key` (taking its own reference), replacing any
+ * entry for the key and evicting the least recently used ones past the
+ * budget. Buffers larger than the whole budget are not kept.
+ */
+void result_cache_put(result_cache_t *cache, const char *key,
+                      uint64_t generation, result_buffer_t *buffer) {
+  size_t key_len = strlen(key);
+  uint64_t hash = hash_key(key);
+  pthread_mutex_lock(&cache->lock);
+  if (buffer->bytes > cache->stats.budget) {
+    pthread_mutex_unlock(&cache->lock);
+    return;
+  }
+  result_entry_t *entry = find(cache, key, hash);
+  if (entry != NULL)
+    remove_entry(cache, entry);
+  entry = malloc(sizeof(result_entry_t) + key_len + 1);
+  if (entry != NULL) {
+    memcpy(entry->key, key, key_len + 1);
+    entry->hash = hash;
+    entry->generation = generation;
+    entry->buffer = buffer;
+    retain(buffer);
+    result_entry_t **bucket = &cache->buckets[hash & cache->bucket_mask];
+    entry->next = *bucket;
+    *bucket = entry;
+    lru_push(cache, entry);
+    cache->stats.entries++;
+    cache->stats.bytes += buffer->bytes;
+    if (cache->stats.entries > 2 * ((uint64_t)cache->bucket_mask + 1))
+      grow_buckets(cache);
+    evict(cache);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// Shrinking the budget evicts right away
+void result_cache_set_budget(result_cache_t *cache, size_t budget) {
+  pthread_mutex_lock(&cache->lock);
+  cache->stats.budget = budget;
+  evict(cache);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void result_cache_stats(result_cache_t *cache, result_cache_stats_t *stats) {
+  pthread_mutex_lock(&cache->lock);
+  *stats = cache->stats;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// Hits still held by callers stay valid until they release them
+void result_cache_free(result_cache_t *cache) {
+  if (cache == NULL)
+    return;
+  while (cache->oldest != NULL)
+    remove_entry(cache, cache->oldest);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->buckets);
+  free(cache);
+}
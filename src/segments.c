@@ -0,0 +1,1089 @@
+#include "segments.h"
+#include "index_file.h"
+#include "query_engine.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// <manifest path>.seg<id>, malloc'd
+static char *segment_path(const char *path, uint64_t id) {
+  size_t len = strlen(path) + sizeof(SEGMENT_SUFFIX) + 20;
+  char *out = malloc(len);
+  if (out != NULL)
+    snprintf(out, len, "%s" SEGMENT_SUFFIX "%llu", path,
+             (unsigned long long)id);
+  return out;
+}
+
+static void unlink_segment(const segment_set_t *set, uint64_t id) {
+  char *path = segment_path(set->path, id);
+  if (path != NULL)
+    unlink(path);
+  free(path);
+}
+
+static void segment_free(segment_t *seg) {
+  if (seg == NULL)
+    return;
+  trie_free(seg->index);
+  impact_free(seg->impacts);
+  doc_table_free(&seg->docs);
+  if (seg->mapping != NULL)
+    munmap(seg->mapping, seg->mapping_size);
+  free(seg);
+}
+
+static segment_list_t *list_create(int capacity) {
+  return calloc(1, sizeof(segment_list_t) +
+                       sizeof(segment_t *) * (capacity > 0 ? capacity : 1));
+}
+
+// epoch_release_fn for a replaced impact table
+static void release_impacts(void *owner, uintptr_t item) {
+  (void)owner;
+  impact_free((impact_index_t *)item);
+}
+
+/*
+ * Pins every source of a query: a monolithic engine's one trie, or the
+ * segment list published at this moment with its live trie. Only the
+ * live trie's published documents are read (see trie_publish()).
+ */
+void segment_view_begin(const search_engine_t *engine, segment_view_t *view) {
+  segment_set_t *set = engine->segments;
+  view->engine = engine;
+  if (set == NULL) {
+    view->list = NULL;
+    view->live = engine->index;
+    view->slot = -1;
+    trie_read_begin(view->live);
+    return;
+  }
+  view->slot = epoch_enter(set->epoch);
+  view->list = __atomic_load_n(&set->list, __ATOMIC_ACQUIRE);
+  view->live = view->list->live;
+  trie_read_snapshot(view->live);
+}
+
+void segment_view_end(segment_view_t *view) {
+  trie_read_end(view->live);
+  if (view->list != NULL)
+    epoch_exit(view->engine->segments->epoch, view->slot);
+}
+
+// Score bounds of one source, NULL when it has none that still hold
+const impact_index_t *segment_view_impacts(const segment_view_t *view,
+                                           int source) {
+  const impact_index_t *impacts;
+  if (view->list != NULL && source < view->list->count) {
+    impacts = __atomic_load_n(&view->list->items[source]->impacts,
+                              __ATOMIC_ACQUIRE);
+    return impact_covers(impacts, view->engine) ? impacts : NULL;
+  }
+  impacts = __atomic_load_n(&view->engine->impacts, __ATOMIC_ACQUIRE);
+  return impacts != NULL && impacts->trie == view->live &&
+                 impact_usable(impacts, view->engine)
+             ? impacts
+             : NULL;
+}
+
+static segment_set_t *create_set(search_engine_t *engine, const char *path) {
+  segment_set_t *set = calloc(1, sizeof(segment_set_t));
+  segment_list_t *list = list_create(0);
+  size_t len = strlen(path) + 1;
+  char *copy = malloc(len);
+  if (set == NULL || list == NULL || copy == NULL) {
+    free(set);
+    free(list);
+    free(copy);
+    return NULL;
+  }
+  memcpy(copy, path, len);
+  list->live = engine->index;
+  set->list = list;
+  set->epoch = engine->index->epoch;
+  set->path = copy;
+  pthread_mutex_init(&set->lock, NULL);
+  pthread_mutex_init(&set->merging, NULL);
+  pthread_cond_init(&set->wake, NULL);
+  return set;
+}
+
+/*
+ * Writes the manifest for `list` to a temporary file renamed over the
+ * old one, then unlinks the files it no longer names. Called with the
+ * lock held; tombstones cannot change meanwhile (see segments.h).
+ */
+static int write_manifest(search_engine_t *engine, segment_set_t *set,
+                          const segment_list_t *list) {
+  segment_manifest_t header = {0};
+  header.magic = SEGMENT_MANIFEST_MAGIC;
+  header.version = SEGMENT_MANIFEST_VERSION;
+  header.segment_count = (uint32_t)list->count;
+  header.doc_count = set->sealed_docs;
+  header.next_id = set->next_id;
+
+  // 1. Tombstones among the sealed documents
+  uint32_t *deleted = NULL;
+  if (engine->deleted_count > 0) {
+    deleted = malloc(sizeof(uint32_t) * engine->deleted_count);
+    if (deleted == NULL)
+      return -1;
+    int slot = epoch_enter(set->epoch);
+    for (int i = 0; i < set->sealed_docs &&
+                    header.deleted_count < (uint64_t)engine->deleted_count;
+         i++) {
+      if (engine_doc_deleted(engine, i))
+        deleted[header.deleted_count++] = (uint32_t)i;
+    }
+    epoch_exit(set->epoch, slot);
+  }
+
+  // 2. Header, segments and tombstones into the temporary file
+  size_t len = strlen(set->path) + sizeof(".tmp");
+  char *temp = malloc(len);
+  FILE *fp = NULL;
+  if (temp != NULL) {
+    snprintf(temp, len, "%s.tmp", set->path);
+    fp = fopen(temp, "wb");
+  }
+  int result = fp != NULL ? 0 : -1;
+  if (fp != NULL && fwrite(&header, sizeof(header), 1, fp) != 1)
+    result = -1;
+  for (int i = 0; result == 0 && i < list->count; i++) {
+    const segment_t *seg = list->items[i];
+    segment_record_t record = {seg->id, seg->bytes, seg->first_doc,
+                               seg->doc_count};
+    if (fwrite(&record, sizeof(record), 1, fp) != 1)
+      result = -1;
+  }
+  if (result == 0 && header.deleted_count > 0 &&
+      fwrite(deleted, sizeof(uint32_t), header.deleted_count, fp) !=
+          header.deleted_count)
+    result = -1;
+  if (result == 0 && (fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+    result = -1;
+  if (fp != NULL && fclose(fp) != 0)
+    result = -1;
+
+  // 3. Swap it in; only then are the old files unused
+  if (result == 0 && rename(temp, set->path) != 0)
+    result = -1;
+  if (result != 0 && temp != NULL) {
+    perror("Error writing the segment manifest");
+    unlink(temp);
+  }
+  if (result == 0) {
+    for (int i = 0; i < set->dead_count; i++)
+      unlink_segment(set, set->dead[i]);
+    set->dead_count = 0;
+  }
+  free(temp);
+  free(deleted);
+  return result;
+}
+
+/*
+ * Writes `seg` to its file through an engine shell over its parts, with
+ * `meta` the fingerprints of its documents.
+ */
+static int write_segment(const segment_set_t *set, segment_t *seg,
+                         const doc_meta_t *meta) {
+  search_engine_t shell = {0};
+  shell.index = seg->index;
+  shell.docs = seg->docs;
+  shell.doc_count = seg->doc_count;
+  shell.doc_meta = (doc_meta_t *)meta;
+  shell.doc_meta_capacity = seg->doc_count;
+  shell.impacts = seg->impacts;
+  for (int i = 0; i < seg->doc_count; i++) {
+    if (meta[i].flags & DOC_DELETED)
+      shell.deleted_count++;
+  }
+
+  // On disk before any manifest names it
+  char *path = segment_path(set->path, seg->id);
+  index_output_t out;
+  if (path == NULL || index_output_open(&out, path) != 0) {
+    free(path);
+    return -1;
+  }
+  int result = index_file_write_segment(&shell, seg->first_doc, out.fp);
+  long size = ftell(out.fp);
+  if (size < 0)
+    result = -1;
+  result = index_output_commit(&out, path, result);
+  seg->bytes = (uint64_t)size;
+  free(path);
+  return result;
+}
+
+static uint64_t take_id(segment_set_t *set) {
+  pthread_mutex_lock(&set->lock);
+  uint64_t id = set->next_id++;
+  pthread_mutex_unlock(&set->lock);
+  return id;
+}
+
+/*
+ * Turns the live trie, documents first..end - 1 of the engine, into a
+ * segment and writes its file. *live gets the trie that takes over: it
+ * shares the epoch, and the old one is frozen once no reader can hold
+ * anything it retired. NULL on error, with the engine untouched.
+ */
+static segment_t *seal_live(search_engine_t *engine, int first, int end,
+                            trie_t **live) {
+  segment_set_t *set = engine->segments;
+  trie_t *old = engine->index;
+  segment_t *seg = calloc(1, sizeof(segment_t));
+  trie_t *fresh = trie_create();
+  if (seg == NULL || fresh == NULL)
+    goto fail;
+  seg->index = old;
+  seg->first_doc = first;
+  seg->doc_count = end - first;
+
+  // 1. Its own paths, looked up block by block from the engine's table
+  char path[DOC_TABLE_MAX_PATH];
+  if (doc_table_reserve(&seg->docs, seg->doc_count) != 0)
+    goto fail;
+  for (int i = first; i < end; i++) {
+    if (doc_table_get(&engine->docs, i, path, sizeof(path)) < 0 ||
+        doc_table_append(&seg->docs, path) != 0)
+      goto fail;
+  }
+
+  // 2. Bounds with headroom, so they outlive a few more flushes
+  seg->impacts = impact_build(
+      engine, old, bm25_average_length(engine) * SEGMENT_IMPACT_HEADROOM);
+  seg->id = take_id(set);
+  if (write_segment(set, seg, engine->doc_meta + first) != 0)
+    goto fail;
+
+  // 3. Hand the epoch over
+  epoch_synchronize(set->epoch);
+  epoch_reclaim(set->epoch);
+  fresh->positional = old->positional;
+  fresh->generation = old->generation + 1;
+  trie_adopt_epoch(fresh, old);
+  *live = fresh;
+  return seg;
+
+fail:
+  if (seg != NULL) {
+    impact_free(seg->impacts);
+    doc_table_free(&seg->docs);
+    free(seg);
+  }
+  trie_free(fresh);
+  return NULL;
+}
+
+static void wake_merger(segment_set_t *set) {
+  pthread_mutex_lock(&set->lock);
+  set->pending = true;
+  pthread_cond_signal(&set->wake);
+  pthread_mutex_unlock(&set->lock);
+}
+
+/*
+ * Publishes `seg`, documents up to end - 1, after the other segments in
+ * `list` with `live` taking over, and writes the manifest. The old list
+ * and the live trie's bounds are retired, since queries may still read
+ * them. Returns the manifest write's result.
+ */
+static int publish_segment(search_engine_t *engine, segment_list_t *list,
+                           segment_t *seg, trie_t *live, int end) {
+  segment_set_t *set = engine->segments;
+  pthread_mutex_lock(&set->lock);
+  segment_list_t *old = set->list;
+  list->live = live;
+  for (int i = 0; i < old->count; i++)
+    list->items[list->count++] = old->items[i];
+  list->items[list->count++] = seg;
+  __atomic_store_n(&set->list, list, __ATOMIC_RELEASE);
+  set->sealed_docs = end;
+  engine->index = live;
+  int result = write_manifest(engine, set, list);
+  pthread_mutex_unlock(&set->lock);
+
+  epoch_retire(set->epoch, epoch_release_memory, NULL, (uintptr_t)old);
+  impact_index_t *impacts = engine->impacts;
+  __atomic_store_n(&engine->impacts, NULL, __ATOMIC_RELEASE);
+  if (impacts != NULL)
+    epoch_retire(set->epoch, release_impacts, NULL, (uintptr_t)impacts);
+  if (set->spill_dir == NULL)
+    wake_merger(set);
+  return result;
+}
+
+// Copies the file at `from` to `to` through a temporary file
+static int copy_file(const char *from, const char *to) {
+  FILE *in = fopen(from, "rb");
+  index_output_t out;
+  if (in == NULL || index_output_open(&out, to) != 0) {
+    if (in != NULL)
+      fclose(in);
+    return -1;
+  }
+  int result = 0;
+  char chunk[1 << 16];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+    if (fwrite(chunk, 1, n, out.fp) != n) {
+      result = -1;
+      break;
+    }
+  }
+  if (ferror(in))
+    result = -1;
+  fclose(in);
+  return index_output_commit(&out, to, result);
+}
+
+/*
+ * Turns the runs a memory budget spilled into the segments of a manifest
+ * at `path`: each run file is linked (or, across file systems, copied)
+ * next to it under the same id, and the temporary directory goes. The
+ * runs stay mapped from where they were. On error the files placed so
+ * far are removed and the runs left where they were.
+ */
+static int adopt_spilled(segment_set_t *set, const char *path) {
+  size_t len = strlen(path) + 1;
+  char *copy = malloc(len);
+  if (copy == NULL)
+    return -1;
+  memcpy(copy, path, len);
+  const segment_list_t *list = set->list; // only the indexer changes it
+  int placed = 0;
+  for (; placed < list->count; placed++) {
+    uint64_t id = list->items[placed]->id;
+    char *from = segment_path(set->path, id);
+    char *to = segment_path(path, id);
+    int result = from != NULL && to != NULL ? 0 : -1;
+    if (result == 0) {
+      unlink(to); // an older index's, overwritten as a flush would
+      if (link(from, to) != 0)
+        result = copy_file(from, to);
+    }
+    free(from);
+    free(to);
+    if (result != 0)
+      break;
+  }
+  if (placed < list->count) {
+    perror("Error moving the spilled runs");
+    for (int i = 0; i < placed; i++) {
+      char *to = segment_path(path, list->items[i]->id);
+      if (to != NULL)
+        unlink(to);
+      free(to);
+    }
+    free(copy);
+    return -1;
+  }
+
+  for (int i = 0; i < list->count; i++)
+    unlink_segment(set, list->items[i]->id);
+  for (int i = 0; i < set->dead_count; i++)
+    unlink_segment(set, set->dead[i]);
+  set->dead_count = 0;
+  unlink(set->path);
+  rmdir(set->spill_dir);
+  free(set->spill_dir);
+  set->spill_dir = NULL;
+  free(set->path);
+  set->path = copy;
+  return 0;
+}
+
+/*
+ * Saves the documents indexed since the last flush as one new segment
+ * file next to the manifest at `path`, and rewrites the manifest (also
+ * for tombstones alone). The first flush turns a monolithic engine into
+ * a segmented one, taking over any runs a memory budget spilled, and
+ * must not run alongside queries; later ones may, but only to the same
+ * path. The page-text store is saved only when the flush covers every
+ * document (the first one, or after compaction). Returns 0 on success,
+ * -1 on error.
+ */
+int engine_flush(search_engine_t *engine, const char *path) {
+  if (engine->mapping != NULL || engine->index->read_only) {
+    fprintf(stderr, "Cannot flush a read-only mapped engine\n");
+    return -1;
+  }
+  if (engine_reserve_meta(engine) != 0)
+    return -1;
+  segment_set_t *set = engine->segments;
+  bool whole = set == NULL || set->spill_dir != NULL;
+  if (set == NULL) {
+    set = create_set(engine, path);
+    if (set == NULL)
+      return -1;
+    engine->segments = set;
+  } else if (set->spill_dir != NULL) {
+    if (adopt_spilled(set, path) != 0)
+      return -1;
+  } else if (strcmp(set->path, path) != 0) {
+    fprintf(stderr, "Segments are flushed to %s only\n", set->path);
+    return -1;
+  }
+
+  // 1. Seal the live trie, if it holds anything
+  int first = set->sealed_docs;
+  segment_t *seg = NULL;
+  segment_list_t *list = NULL;
+  trie_t *live = NULL;
+  if (engine->doc_count > first) {
+    pthread_mutex_lock(&set->lock);
+    list = list_create(set->list->count + 1); // merges only shrink it
+    pthread_mutex_unlock(&set->lock);
+    seg = list != NULL ? seal_live(engine, first, engine->doc_count, &live)
+                       : NULL;
+    if (seg == NULL) {
+      free(list);
+      return -1;
+    }
+  }
+
+  // 2. Publish it with the new live trie, then the manifest
+  int result;
+  if (seg == NULL) {
+    pthread_mutex_lock(&set->lock);
+    result = write_manifest(engine, set, set->list);
+    pthread_mutex_unlock(&set->lock);
+  } else {
+    result = publish_segment(engine, list, seg, live, engine->doc_count);
+  }
+
+  // 3. Page texts, when the segments start over
+  if (result == 0 && (whole || first == 0) && engine->texts != NULL) {
+    size_t len = strlen(path) + sizeof(TEXT_STORE_SUFFIX);
+    char *texts_path = malloc(len);
+    if (texts_path != NULL)
+      snprintf(texts_path, len, "%s" TEXT_STORE_SUFFIX, path);
+    if (texts_path == NULL ||
+        text_store_write(engine->texts, texts_path, engine->doc_count) != 0)
+      result = -1;
+    free(texts_path);
+  }
+  return result;
+}
+
+static int tier_of(uint64_t bytes) {
+  int tier = 0;
+  uint64_t limit = SEGMENT_TIER_BYTES;
+  while (bytes >= limit) {
+    tier++;
+    if (limit > UINT64_MAX / SEGMENT_TIER_FACTOR)
+      break;
+    limit *= SEGMENT_TIER_FACTOR;
+  }
+  return tier;
+}
+
+// First run of SEGMENT_TIER_FACTOR adjacent segments of one tier, -1 if none
+static int pick_merge(const segment_list_t *list) {
+  int run = 0;
+  for (int i = 0; i < list->count; i++) {
+    if (i > 0 &&
+        tier_of(list->items[i]->bytes) == tier_of(list->items[i - 1]->bytes))
+      run++;
+    else
+      run = 1;
+    if (run == SEGMENT_TIER_FACTOR)
+      return i - run + 1;
+  }
+  return -1;
+}
+
+/*
+ * Merges segments from..from+count-1 into one, leaving the postings of
+ * tombstoned documents behind. The inputs are read without the lock:
+ * only merges remove segments, and the caller holds `merging`.
+ */
+static int merge_range(search_engine_t *engine, int from, int count) {
+  segment_set_t *set = engine->segments;
+  segment_t **inputs = malloc(sizeof(segment_t *) * count);
+  if (inputs == NULL)
+    return -1;
+  pthread_mutex_lock(&set->lock);
+  memcpy(inputs, set->list->items + from, sizeof(segment_t *) * count);
+  pthread_mutex_unlock(&set->lock);
+  int first = inputs[0]->first_doc;
+  int end = inputs[count - 1]->first_doc + inputs[count - 1]->doc_count;
+
+  int *remap = malloc(sizeof(int) * end);
+  doc_meta_t *meta = calloc(end - first, sizeof(doc_meta_t));
+  segment_t *seg = calloc(1, sizeof(segment_t));
+  trie_t *trie = trie_create();
+  segment_list_t *list = NULL;
+  int result = -1;
+  if (remap == NULL || meta == NULL || seg == NULL || trie == NULL)
+    goto done;
+  seg->first_doc = first;
+  seg->doc_count = end - first;
+
+  // 1. Fingerprints and tombstones, read pinned: doc_meta may be replaced
+  int slot = epoch_enter(set->epoch);
+  for (int i = first; i < end; i++) {
+    const doc_meta_t *m = engine_meta_snapshot(engine, i);
+    if (m != NULL)
+      meta[i - first] = *m;
+    remap[i] = (meta[i - first].flags & DOC_DELETED) ? -1 : i;
+  }
+  epoch_exit(set->epoch, slot);
+
+  // 2. One trie and one path table, in doc order
+  trie->positional = inputs[0]->index->positional;
+  bool ok = doc_table_reserve(&seg->docs, seg->doc_count) == 0;
+  for (int s = 0; ok && s < count; s++) {
+    ok = trie_merge_remap(trie, inputs[s]->index, remap) == 0;
+    doc_table_iter_t it;
+    doc_table_iter(&inputs[s]->docs, &it);
+    for (int i = 0; ok && i < inputs[s]->doc_count; i++) {
+      const char *path = doc_table_next(&it);
+      ok = path != NULL && doc_table_append(&seg->docs, path) == 0;
+    }
+  }
+  if (!ok)
+    goto done;
+  trie_freeze(trie);
+  seg->index = trie;
+  trie = NULL;
+
+  slot = epoch_enter(set->epoch);
+  seg->impacts = impact_build(
+      engine, seg->index,
+      bm25_average_length(engine) * SEGMENT_IMPACT_HEADROOM);
+  epoch_exit(set->epoch, slot);
+  seg->id = take_id(set);
+  if (write_segment(set, seg, meta) != 0)
+    goto done;
+
+  // 3. Swap it in for the inputs
+  pthread_mutex_lock(&set->lock);
+  segment_list_t *old = set->list;
+  list = list_create(old->count - count + 1);
+  if (list == NULL) {
+    pthread_mutex_unlock(&set->lock);
+    unlink_segment(set, seg->id);
+    goto done;
+  }
+  list->live = old->live;
+  for (int i = 0; i < old->count; i++) {
+    if (i == from)
+      list->items[list->count++] = seg;
+    if (i < from || i >= from + count)
+      list->items[list->count++] = old->items[i];
+  }
+  __atomic_store_n(&set->list, list, __ATOMIC_RELEASE);
+  result = write_manifest(engine, set, list);
+  pthread_mutex_unlock(&set->lock);
+  seg = NULL;
+
+  // 4. Free the inputs once no query can be reading them; their files
+  // stay while the manifest on disk still names them
+  epoch_synchronize(set->epoch);
+  free(old);
+  for (int s = 0; s < count; s++) {
+    if (result == 0)
+      unlink_segment(set, inputs[s]->id);
+    segment_free(inputs[s]);
+  }
+
+done:
+  segment_free(seg);
+  trie_free(trie);
+  free(meta);
+  free(remap);
+  free(inputs);
+  return result;
+}
+
+/*
+ * Rebuilds the score bounds of segments the average document length has
+ * outgrown (or that have none), so pruning keeps working on them.
+ */
+static void refresh_impacts(search_engine_t *engine) {
+  segment_set_t *set = engine->segments;
+  pthread_mutex_lock(&set->lock);
+  int count = set->list->count;
+  segment_t **items = malloc(sizeof(segment_t *) * (count > 0 ? count : 1));
+  if (items != NULL)
+    memcpy(items, set->list->items, sizeof(segment_t *) * count);
+  pthread_mutex_unlock(&set->lock);
+  if (items == NULL)
+    return;
+
+  for (int i = 0; i < count; i++) {
+    segment_t *seg = items[i];
+    if (impact_covers(seg->impacts, engine))
+      continue;
+    int slot = epoch_enter(set->epoch);
+    impact_index_t *fresh = impact_build(
+        engine, seg->index,
+        bm25_average_length(engine) * SEGMENT_IMPACT_HEADROOM);
+    epoch_exit(set->epoch, slot);
+    if (fresh == NULL)
+      continue;
+    impact_index_t *old =
+        __atomic_exchange_n(&seg->impacts, fresh, __ATOMIC_ACQ_REL);
+    epoch_synchronize(set->epoch);
+    impact_free(old);
+  }
+  free(items);
+}
+
+// Merges until no tier holds enough segments; the merges done, -1 on error
+static int run_merges(search_engine_t *engine) {
+  segment_set_t *set = engine->segments;
+  int merges = 0;
+  for (;;) {
+    pthread_mutex_lock(&set->lock);
+    int from = pick_merge(set->list);
+    pthread_mutex_unlock(&set->lock);
+    if (from < 0)
+      break;
+    if (merge_range(engine, from, SEGMENT_TIER_FACTOR) != 0)
+      return -1;
+    merges++;
+  }
+  refresh_impacts(engine);
+  return merges;
+}
+
+static void *merge_worker(void *arg) {
+  search_engine_t *engine = arg;
+  segment_set_t *set = engine->segments;
+  pthread_mutex_lock(&set->lock);
+  while (!set->stop) {
+    if (!set->pending) {
+      pthread_cond_wait(&set->wake, &set->lock);
+      continue;
+    }
+    set->pending = false;
+    pthread_mutex_unlock(&set->lock);
+    pthread_mutex_lock(&set->merging);
+    run_merges(engine);
+    pthread_mutex_unlock(&set->merging);
+    pthread_mutex_lock(&set->lock);
+  }
+  pthread_mutex_unlock(&set->lock);
+  return NULL;
+}
+
+/*
+ * Runs the merge policy on the calling thread: SEGMENT_TIER_FACTOR
+ * adjacent segments of one size tier become one, until no tier has that
+ * many. Returns the merges done (0 for a monolithic engine), -1 on error.
+ */
+int engine_merge_segments(search_engine_t *engine) {
+  segment_set_t *set = engine->segments;
+  if (set == NULL || set->spill_dir != NULL)
+    return 0;
+  pthread_mutex_lock(&set->merging);
+  int merges = run_merges(engine);
+  pthread_mutex_unlock(&set->merging);
+  return merges;
+}
+
+/*
+ * Starts or stops the merge thread, which runs the merge policy after
+ * every flush while queries and indexing go on. Only for a segmented
+ * engine (after engine_flush()); returns -1 otherwise or if the thread
+ * cannot be started. Spilled runs are never merged in memory.
+ */
+int engine_set_background_merge(search_engine_t *engine, bool enabled) {
+  segment_set_t *set = engine->segments;
+  if (set == NULL || set->spill_dir != NULL)
+    return -1;
+  if (enabled == set->running)
+    return 0;
+  if (enabled) {
+    set->stop = false;
+    set->pending = true;
+    if (pthread_create(&set->merger, NULL, merge_worker, engine) != 0)
+      return -1;
+    set->running = true;
+    return 0;
+  }
+  pthread_mutex_lock(&set->lock);
+  set->stop = true;
+  pthread_cond_signal(&set->wake);
+  pthread_mutex_unlock(&set->lock);
+  pthread_join(set->merger, NULL);
+  set->running = false;
+  return 0;
+}
+
+// Sealed segments right now, 0 for a monolithic engine
+int engine_segment_count(search_engine_t *engine) {
+  segment_set_t *set = engine->segments;
+  if (set == NULL)
+    return 0;
+  pthread_mutex_lock(&set->lock);
+  int count = set->list->count;
+  pthread_mutex_unlock(&set->lock);
+  return count;
+}
+
+// Waits out a running merge and keeps the next from starting
+void segments_pause_merges(search_engine_t *engine) {
+  if (engine->segments != NULL)
+    pthread_mutex_lock(&engine->segments->merging);
+}
+
+void segments_resume_merges(search_engine_t *engine) {
+  if (engine->segments != NULL)
+    pthread_mutex_unlock(&engine->segments->merging);
+}
+
+/*
+ * Replaces every segment and the live trie by `trie`, once compaction
+ * renumbered the documents. The old files stay until the next flush
+ * writes the index again from doc 0. Merges must be paused. Returns -1
+ * if out of memory, with nothing changed.
+ */
+int segments_reset(search_engine_t *engine, trie_t *trie) {
+  segment_set_t *set = engine->segments;
+  segment_list_t *list = list_create(0);
+  if (list == NULL)
+    return -1;
+  pthread_mutex_lock(&set->lock);
+  segment_list_t *old = set->list;
+  pthread_mutex_unlock(&set->lock);
+  if (set->dead_count + old->count > set->dead_capacity) {
+    int capacity = (set->dead_count + old->count) * 2;
+    uint64_t *temp = realloc(set->dead, sizeof(uint64_t) * capacity);
+    if (temp == NULL) {
+      free(list);
+      return -1;
+    }
+    set->dead = temp;
+    set->dead_capacity = capacity;
+  }
+
+  // 1. The new trie takes the epoch over from the live one
+  trie_t *live = engine->index;
+  epoch_synchronize(set->epoch);
+  epoch_reclaim(set->epoch);
+  trie->generation = live->generation + 1;
+  trie_adopt_epoch(trie, live);
+
+  // 2. Publish it alone
+  list->live = trie;
+  pthread_mutex_lock(&set->lock);
+  __atomic_store_n(&set->list, list, __ATOMIC_RELEASE);
+  for (int i = 0; i < old->count; i++)
+    set->dead[set->dead_count++] = old->items[i]->id;
+  set->sealed_docs = 0;
+  engine->index = trie;
+  pthread_mutex_unlock(&set->lock);
+
+  // 3. Free the old sources once no query can be reading them
+  epoch_synchronize(set->epoch);
+  for (int i = 0; i < old->count; i++)
+    segment_free(old->items[i]);
+  trie_free(live);
+  free(old);
+  return 0;
+}
+
+/*
+ * Takes over the parts of a segment file opened as an engine shell, its
+ * fingerprints going to `meta` unless NULL. Frees the shell on error.
+ */
+static segment_t *adopt_shell(doc_meta_t *meta, search_engine_t *shell,
+                              bool copy, const segment_record_t *record) {
+  segment_t *seg = calloc(1, sizeof(segment_t));
+  if (seg == NULL) {
+    engine_free(shell);
+    return NULL;
+  }
+  seg->index = shell->index;
+  seg->impacts = shell->impacts;
+  seg->docs = shell->docs;
+  seg->first_doc = record->first_doc;
+  seg->doc_count = record->doc_count;
+  seg->id = record->id;
+  seg->bytes = record->bytes;
+  seg->mapping = shell->mapping;
+  seg->mapping_size = shell->mapping_size;
+  trie_freeze(seg->index);
+  if (meta != NULL && shell->doc_meta != NULL)
+    memcpy(meta, shell->doc_meta, sizeof(doc_meta_t) * record->doc_count);
+  if (copy)
+    free(shell->doc_meta);
+  free(shell);
+  return seg;
+}
+
+// The engine a manifest describes; NULL if any segment is missing or bad
+static search_engine_t *open_segments(const char *path,
+                                      const segment_manifest_t *header,
+                                      const segment_record_t *records,
+                                      const uint32_t *deleted, bool copy) {
+  search_engine_t *engine = calloc(1, sizeof(search_engine_t));
+  if (engine == NULL)
+    return NULL;
+  engine->index = trie_create();
+  if (engine->index == NULL) {
+    free(engine);
+    return NULL;
+  }
+  segment_set_t *set = create_set(engine, path);
+  segment_list_t *list = list_create(header->segment_count);
+  int docs = header->doc_count;
+  engine->doc_meta = calloc(docs > 0 ? docs : 1, sizeof(doc_meta_t));
+  engine->doc_meta_capacity = docs;
+  engine->segments = set;
+  if (set == NULL || list == NULL || engine->doc_meta == NULL ||
+      doc_table_reserve(&engine->docs, docs) != 0)
+    goto fail;
+  list->live = engine->index;
+  free(set->list);
+  set->list = list;
+
+  // 1. Every segment, back to back in doc order
+  for (uint32_t i = 0; i < header->segment_count; i++) {
+    const segment_record_t *record = &records[i];
+    if (record->first_doc != engine->doc_count || record->doc_count <= 0 ||
+        record->doc_count > docs - engine->doc_count)
+      goto fail;
+    char *file = segment_path(path, record->id);
+    search_engine_t *shell =
+        file != NULL
+            ? index_file_open_segment(file, copy, record->first_doc)
+            : NULL;
+    free(file);
+    if (shell == NULL || shell->doc_count != record->doc_count) {
+      engine_free(shell);
+      goto fail;
+    }
+    segment_t *seg =
+        adopt_shell(engine->doc_meta + record->first_doc, shell, copy, record);
+    if (seg == NULL)
+      goto fail;
+    list->items[list->count++] = seg;
+    engine->index->positional = seg->index->positional;
+
+    // 2. Its paths join the engine's table
+    doc_table_iter_t it;
+    doc_table_iter(&seg->docs, &it);
+    const char *doc;
+    while ((doc = doc_table_next(&it)) != NULL) {
+      if (engine_add_document(engine, doc) < 0)
+        goto fail;
+    }
+  }
+  if (engine->doc_count != docs)
+    goto fail;
+
+  // 3. Tombstones since the segments were written, then the statistics
+  for (uint64_t i = 0; i < header->deleted_count; i++) {
+    if (deleted[i] >= (uint32_t)docs)
+      goto fail;
+    engine->doc_meta[deleted[i]].flags |= DOC_DELETED;
+  }
+  for (int i = 0; i < docs; i++) {
+    if (engine->doc_meta[i].flags & DOC_DELETED)
+      engine->deleted_count++;
+  }
+  engine_count_lengths(engine);
+  set->next_id = header->next_id;
+  set->sealed_docs = docs;
+  engine->index->read_only = !copy;
+  return engine;
+
+fail:
+  if (set == NULL || set->list != list)
+    free(list);
+  engine_free(engine);
+  return NULL;
+}
+
+/*
+ * Opens the segments a manifest names. Without copy they are queried
+ * straight from read-only mappings and nothing can be indexed; with copy
+ * new documents go into an empty live trie. NULL if `path` is no
+ * manifest or a segment cannot be opened.
+ */
+search_engine_t *segments_open(const char *path, bool copy) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return NULL;
+  segment_manifest_t header;
+  segment_record_t *records = NULL;
+  uint32_t *deleted = NULL;
+  search_engine_t *engine = NULL;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      header.magic != SEGMENT_MANIFEST_MAGIC ||
+      header.version != SEGMENT_MANIFEST_VERSION || header.doc_count < 0 ||
+      header.segment_count > (uint32_t)header.doc_count ||
+      header.deleted_count > (uint64_t)header.doc_count)
+    goto done;
+  records = malloc(sizeof(segment_record_t) * (header.segment_count + 1));
+  deleted = malloc(sizeof(uint32_t) * (header.deleted_count + 1));
+  if (records == NULL || deleted == NULL ||
+      fread(records, sizeof(segment_record_t), header.segment_count, fp) !=
+          header.segment_count ||
+      fread(deleted, sizeof(uint32_t), header.deleted_count, fp) !=
+          header.deleted_count)
+    goto done;
+  engine = open_segments(path, &header, records, deleted, copy);
+
+done:
+  fclose(fp);
+  free(records);
+  free(deleted);
+  return engine;
+}
+
+// A segment set in a fresh temporary directory, for spilled runs only
+static segment_set_t *create_spill_set(search_engine_t *engine) {
+  const char *parent = engine->temp_dir;
+  if (parent == NULL)
+    parent = getenv("TMPDIR");
+  if (parent == NULL || *parent == '\0')
+    parent = "/tmp";
+  char dir[PATH_MAX - sizeof(SEGMENT_SPILL_MANIFEST)], path[PATH_MAX];
+  if (snprintf(dir, sizeof(dir), "%s/" SEGMENT_SPILL_TEMPLATE, parent) >=
+      (int)sizeof(dir))
+    return NULL;
+  if (mkdtemp(dir) == NULL) {
+    perror("Error creating the spill directory");
+    return NULL;
+  }
+  snprintf(path, sizeof(path), "%s/" SEGMENT_SPILL_MANIFEST, dir);
+  segment_set_t *set = create_set(engine, path);
+  size_t len = strlen(dir) + 1;
+  char *copy = set != NULL ? malloc(len) : NULL;
+  if (copy == NULL) {
+    rmdir(dir);
+    if (set != NULL) {
+      free(set->list);
+      free(set->path);
+      free(set);
+    }
+    return NULL;
+  }
+  memcpy(copy, dir, len);
+  set->spill_dir = copy;
+  return set;
+}
+
+// The file of a just written segment, opened read-only; NULL if it fails
+static segment_t *map_segment(const segment_set_t *set,
+                              const segment_t *seg) {
+  char *file = segment_path(set->path, seg->id);
+  search_engine_t *shell =
+      file != NULL ? index_file_open_segment(file, false, seg->first_doc)
+                   : NULL;
+  free(file);
+  if (shell == NULL || shell->doc_count != seg->doc_count) {
+    engine_free(shell);
+    return NULL;
+  }
+  segment_record_t record = {seg->id, seg->bytes, seg->first_doc,
+                             seg->doc_count};
+  return adopt_shell(NULL, shell, false, &record);
+}
+
+/*
+ * Spills documents sealed_docs..end - 1, the live trie, into a run file
+ * (see engine_set_memory_budget()), next to the manifest of a segmented
+ * engine or else in a temporary directory of its own. Only the file's
+ * read-only mapping is kept, so the trie's memory goes back; the page
+ * cache holds what queries touch. Runs in a temporary directory are
+ * never merged in memory: engine_serialize() streams them into one
+ * index file, or engine_flush() keeps them as segments. Indexer only.
+ * Returns 0 on success, -1 on error.
+ */
+int segments_spill(search_engine_t *engine, int end) {
+  if (engine_reserve_meta(engine) != 0)
+    return -1;
+  segment_set_t *set = engine->segments;
+  if (set == NULL) {
+    set = create_spill_set(engine);
+    if (set == NULL)
+      return -1;
+    engine->segments = set;
+  }
+  int first = set->sealed_docs;
+  if (end <= first)
+    return 0;
+
+  // 1. Seal the documents, then map the file they went to
+  pthread_mutex_lock(&set->lock);
+  segment_list_t *list = list_create(set->list->count + 1);
+  pthread_mutex_unlock(&set->lock);
+  trie_t *live = NULL;
+  segment_t *seg = list != NULL ? seal_live(engine, first, end, &live) : NULL;
+  if (seg == NULL) {
+    free(list);
+    return -1;
+  }
+  segment_t *mapped = map_segment(set, seg);
+
+  // 2. Publish whichever of the two could be had; later documents are
+  // still being indexed
+  trie_hide_from(live, end);
+  int result = publish_segment(engine, list, mapped != NULL ? mapped : seg,
+                               live, end);
+
+  // 3. The in-memory trie goes once no query can be reading it
+  if (mapped != NULL) {
+    epoch_synchronize(set->epoch);
+    segment_free(seg);
+  }
+  return result;
+}
+
+// index_file_verify() on every mapped segment, 0 for a monolithic engine
+int segments_verify(search_engine_t *engine) {
+  segment_set_t *set = engine->segments;
+  if (set == NULL)
+    return 0;
+  int slot = epoch_enter(set->epoch); // merges free what they replace
+  const segment_list_t *list = __atomic_load_n(&set->list, __ATOMIC_ACQUIRE);
+  int result = 0;
+  for (int i = 0; result == 0 && i < list->count; i++) {
+    const segment_t *seg = list->items[i];
+    if (seg->mapping != NULL &&
+        index_file_verify(seg->mapping, seg->mapping_size) != 0)
+      result = -1;
+  }
+  epoch_exit(set->epoch, slot);
+  return result;
+}
+
+// Stops the merge thread and frees every segment; engine_free() only
+void segments_free(search_engine_t *engine) {
+  segment_set_t *set = engine->segments;
+  if (set == NULL)
+    return;
+  engine_set_background_merge(engine, false);
+  if (set->spill_dir != NULL) { // the runs die with the engine
+    for (int i = 0; i < set->list->count; i++)
+      unlink_segment(set, set->list->items[i]->id);
+    for (int i = 0; i < set->dead_count; i++)
+      unlink_segment(set, set->dead[i]);
+    unlink(set->path);
+    rmdir(set->spill_dir);
+    free(set->spill_dir);
+  }
+  for (int i = 0; i < set->list->count; i++)
+    segment_free(set->list->items[i]);
+  free(set->list);
+  free(set->path);
+  free(set->dead);
+  pthread_cond_destroy(&set->wake);
+  pthread_mutex_destroy(&set->merging);
+  pthread_mutex_destroy(&set->lock);
+  free(set);
+  engine->segments = NULL;
+}
@@ -0,0 +1,457 @@
+#include "text_store.h"
+#include "lz.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Compresses one page onto the end of the document's buffer
+int text_doc_add_page(text_doc_t *doc, const char *text, size_t len) {
+  if (len > UINT32_MAX)
+    return -1;
+  if (doc->count == doc->page_capacity) {
+    uint32_t new_capacity = doc->page_capacity ? doc->page_capacity * 2 : 16;
+    text_page_t *temp = realloc(doc->pages, sizeof(text_page_t) * new_capacity);
+    if (temp == NULL)
+      return -1;
+    doc->pages = temp;
+    doc->page_capacity = new_capacity;
+  }
+  size_t bound = lz_bound(len);
+  if (doc->size + bound > doc->capacity) {
+    size_t new_capacity = doc->capacity ? doc->capacity * 2 : 64 * 1024;
+    while (new_capacity < doc->size + bound)
+      new_capacity *= 2;
+    uint8_t *temp = realloc(doc->data, new_capacity);
+    if (temp == NULL)
+      return -1;
+    doc->data = temp;
+    doc->capacity = new_capacity;
+  }
+
+  size_t n = lz_compress((const uint8_t *)text, len, doc->data + doc->size,
+                         doc->capacity - doc->size);
+  text_page_t *page = &doc->pages[doc->count++];
+  page->offset = doc->size;
+  page->compressed = (uint32_t)n;
+  page->raw = (uint32_t)len;
+  doc->size += n;
+  return 0;
+}
+
+void text_doc_release(text_doc_t *doc) {
+  free(doc->data);
+  free(doc->pages);
+  memset(doc, 0, sizeof(text_doc_t));
+}
+
+text_store_t *text_store_create(void) {
+  text_store_t *store = calloc(1, sizeof(text_store_t));
+  if (store == NULL)
+    return NULL;
+  store->spill_fd = -1;
+  pthread_mutex_init(&store->lock, NULL);
+  return store;
+}
+
+static int validate_header(const text_store_header_t *h, size_t size) {
+  if (size < sizeof(text_store_header_t) || h->magic != TEXT_STORE_MAGIC ||
+      h->version != TEXT_STORE_VERSION || h->file_size != size)
+    return -1;
+  uint64_t first_end = sizeof(text_store_header_t) +
+                       sizeof(uint32_t) * ((uint64_t)h->doc_count + 1);
+  uint64_t pages_end =
+      h->pages_offset + sizeof(text_page_t) * (uint64_t)h->page_count;
+  if (h->pages_offset < first_end || h->pages_offset % 8 != 0 ||
+      pages_end > h->data_offset || h->data_offset > size ||
+      h->data_size > size - h->data_offset)
+    return -1;
+  return 0;
+}
+
+/*
+ * Maps a side-car file written by text_store_write(). Only the header is
+ * checked up front; tables and pages are bounds checked as they are read.
+ * Returns NULL if the file is missing or not a text store.
+ */
+text_store_t *text_store_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(text_store_header_t)) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = (size_t)st.st_size;
+  char *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return NULL;
+
+  const text_store_header_t *header = (const text_store_header_t *)base;
+  text_store_t *store = NULL;
+  if (validate_header(header, size) != 0 ||
+      (store = text_store_create()) == NULL) {
+    munmap(base, size);
+    return NULL;
+  }
+  store->mapping = base;
+  store->mapping_size = size;
+  store->header = header;
+  store->base_first = (const uint32_t *)(header + 1);
+  store->base_pages = (const text_page_t *)(base + header->pages_offset);
+  store->base_data = (const uint8_t *)base + header->data_offset;
+  store->doc_count = header->doc_count;
+  return store;
+}
+
+void text_store_free(text_store_t *store) {
+  if (store == NULL)
+    return;
+  if (store->mapping != NULL)
+    munmap(store->mapping, store->mapping_size);
+  if (store->spill_fd >= 0)
+    close(store->spill_fd);
+  free(store->docs);
+  free(store->pages);
+  pthread_mutex_destroy(&store->lock);
+  free(store);
+}
+
+// The document's pages as the base file describes them (count 0 if none)
+static text_doc_ref_t base_ref(const text_store_t *store, uint32_t doc_id) {
+  text_doc_ref_t ref = {0, 0, TEXT_SOURCE_NONE};
+  if (store->header == NULL || doc_id >= store->header->doc_count)
+    return ref;
+  uint32_t first = store->base_first[doc_id];
+  uint32_t last = store->base_first[doc_id + 1];
+  if (first > last || last > store->header->page_count)
+    return ref;
+  ref.first = first;
+  ref.count = last - first;
+  ref.source = TEXT_SOURCE_BASE;
+  return ref;
+}
+
+static text_doc_ref_t doc_ref(const text_store_t *store, uint32_t doc_id) {
+  if (store->docs == NULL)
+    return base_ref(store, doc_id);
+  if (doc_id >= store->doc_count) {
+    text_doc_ref_t none = {0, 0, TEXT_SOURCE_NONE};
+    return none;
+  }
+  return store->docs[doc_id];
+}
+
+// Make sure the overlay exists and covers `docs` documents
+static int reserve_docs(text_store_t *store, uint32_t docs) {
+  if (store->docs == NULL) {
+    // First change: copy the base table into the overlay
+    uint32_t base_docs = store->doc_count;
+    uint32_t capacity = base_docs > 16 ? base_docs : 16;
+    store->docs = calloc(capacity, sizeof(text_doc_ref_t));
+    if (store->docs == NULL)
+      return -1;
+    store->doc_capacity = capacity;
+    for (uint32_t i = 0; i < base_docs; i++) {
+      store->docs[i] = base_ref(store, i);
+    }
+  }
+  if (docs > store->doc_capacity) {
+    uint32_t new_capacity = store->doc_capacity * 2;
+    while (new_capacity < docs)
+      new_capacity *= 2;
+    text_doc_ref_t *temp =
+        realloc(store->docs, sizeof(text_doc_ref_t) * new_capacity);
+    if (temp == NULL)
+      return -1;
+    memset(temp + store->doc_capacity, 0,
+           sizeof(text_doc_ref_t) * (new_capacity - store->doc_capacity));
+    store->docs = temp;
+    store->doc_capacity = new_capacity;
+  }
+  if (docs > store->doc_count)
+    store->doc_count = docs;
+  return 0;
+}
+
+/*
+ * Records the pages of doc_id, replacing any earlier version. The bytes go
+ * to the spill file, so the store's memory only grows by the page table.
+ * Safe to call from several indexing threads at once.
+ */
+int text_store_put(text_store_t *store, int doc_id, const text_doc_t *doc) {
+  if (doc_id < 0)
+    return -1;
+  pthread_mutex_lock(&store->lock);
+  int result = -1;
+
+  // 1. Room in the tables
+  if (reserve_docs(store, (uint32_t)doc_id + 1) != 0)
+    goto out;
+  if (store->page_count + doc->count > store->page_capacity) {
+    uint32_t new_capacity = store->page_capacity ? store->page_capacity : 256;
+    while (new_capacity < store->page_count + doc->count)
+      new_capacity *= 2;
+    text_page_t *temp =
+        realloc(store->pages, sizeof(text_page_t) * new_capacity);
+    if (temp == NULL)
+      goto out;
+    store->pages = temp;
+    store->page_capacity = new_capacity;
+  }
+
+  // 2. Append the compressed bytes to the spill file
+  if (store->spill_fd < 0) {
+    FILE *spill = tmpfile(); // unlinked: gone when the store is freed
+    if (spill == NULL)
+      goto out;
+    store->spill_fd = dup(fileno(spill));
+    fclose(spill);
+    if (store->spill_fd < 0)
+      goto out;
+  }
+  size_t written = 0;
+  while (written < doc->size) {
+    ssize_t n = pwrite(store->spill_fd, doc->data + written,
+                       doc->size - written, store->spill_size + written);
+    if (n <= 0)
+      goto out;
+    written += (size_t)n;
+  }
+
+  // 3. Page entries, rebased onto the spill file
+  text_doc_ref_t *ref = &store->docs[doc_id];
+  ref->first = store->page_count;
+  ref->count = doc->count;
+  ref->source = TEXT_SOURCE_SPILL;
+  for (uint32_t i = 0; i < doc->count; i++) {
+    text_page_t page = doc->pages[i];
+    page.offset += store->spill_size;
+    store->pages[store->page_count++] = page;
+  }
+  store->spill_size += doc->size;
+  result = 0;
+
+out:
+  pthread_mutex_unlock(&store->lock);
+  return result;
+}
+
+bool text_store_has(const text_store_t *store, int doc_id) {
+  return store != NULL && doc_id >= 0 &&
+         doc_ref(store, (uint32_t)doc_id).source != TEXT_SOURCE_NONE;
+}
+
+// Locates a page; returns its entry, NULL if it is not stored
+static const text_page_t *find_page(const text_store_t *store, int doc_id,
+                                    int page, text_doc_ref_t *ref) {
+  if (doc_id < 0 || page < 0)
+    return NULL;
+  *ref = doc_ref(store, (uint32_t)doc_id);
+  if ((uint32_t)page >= ref->count)
+    return NULL;
+  if (ref->source == TEXT_SOURCE_BASE) {
+    const text_page_t *entry = &store->base_pages[ref->first + page];
+    if (entry->offset > store->header->data_size ||
+        entry->compressed > store->header->data_size - entry->offset)
+      return NULL;
+    return entry;
+  }
+  if (ref->source == TEXT_SOURCE_SPILL)
+    return &store->pages[ref->first + page];
+  return NULL;
+}
+
+/*
+ * Decodes one page into a fresh NUL terminated buffer (free() it).
+ * Returns NULL if the page is not stored or does not decode.
+ */
+char *text_store_get_page(const text_store_t *store, int doc_id, int page,
+                          size_t *len) {
+  if (store == NULL)
+    return NULL;
+  text_doc_ref_t ref;
+  const text_page_t *entry = find_page(store, doc_id, page, &ref);
+  if (entry == NULL)
+    return NULL;
+
+  char *text = malloc((size_t)entry->raw + 1);
+  if (text == NULL)
+    return NULL;
+  int result = -1;
+  if (ref.source == TEXT_SOURCE_BASE) {
+    result = lz_decompress(store->base_data + entry->offset,
+                           entry->compressed, (uint8_t *)text, entry->raw);
+  } else {
+    uint8_t *packed = malloc(entry->compressed ? entry->compressed : 1);
+    if (packed != NULL &&
+        pread(store->spill_fd, packed, entry->compressed,
+              (off_t)entry->offset) == (ssize_t)entry->compressed) {
+      result = lz_decompress(packed, entry->compressed, (uint8_t *)text,
+                             entry->raw);
+    }
+    free(packed);
+  }
+  if (result != 0) {
+    free(text);
+    return NULL;
+  }
+  text[entry->raw] = '\0';
+  if (len != NULL)
+    *len = entry->raw;
+  return text;
+}
+
+/*
+ * Renumbers documents after engine_compact(): document i moves to
+ * remap[i], or is dropped if remap[i] is -1.
+ */
+int text_store_remap(text_store_t *store, const int *remap, int old_count) {
+  pthread_mutex_lock(&store->lock);
+  int result = reserve_docs(store, (uint32_t)old_count);
+  if (result == 0) {
+    uint32_t live = 0;
+    for (int i = 0; i < old_count; i++) {
+      if (remap[i] < 0)
+        continue;
+      store->docs[remap[i]] = store->docs[i];
+      live = (uint32_t)remap[i] + 1;
+    }
+    memset(store->docs + live, 0,
+           sizeof(text_doc_ref_t) * (store->doc_capacity - live));
+    store->doc_count = live;
+  }
+  pthread_mutex_unlock(&store->lock);
+  return result;
+}
+
+// Copies one page's compressed bytes from whichever source holds them
+static int copy_page(const text_store_t *store, const text_doc_ref_t *ref,
+                     const text_page_t *entry, FILE *fp, uint8_t *buffer) {
+  if (ref->source == TEXT_SOURCE_BASE) {
+    return fwrite(store->base_data + entry->offset, 1, entry->compressed,
+                  fp) == entry->compressed
+               ? 0
+               : -1;
+  }
+  if (pread(store->spill_fd, buffer, entry->compressed,
+            (off_t)entry->offset) != (ssize_t)entry->compressed)
+    return -1;
+  return fwrite(buffer, 1, entry->compressed, fp) == entry->compressed ? 0
+                                                                        : -1;
+}
+
+static int write_store(const text_store_t *store, FILE *fp, int doc_count) {
+  // 1. Sizes first, so every section lands at a known offset
+  text_store_header_t header = {0};
+  header.magic = TEXT_STORE_MAGIC;
+  header.version = TEXT_STORE_VERSION;
+  header.doc_count = (uint32_t)doc_count;
+  uint32_t max_page = 0;
+  for (int d = 0; d < doc_count; d++) {
+    text_doc_ref_t ref = doc_ref(store, (uint32_t)d);
+    for (uint32_t p = 0; p < ref.count; p++) {
+      text_doc_ref_t unused;
+      const text_page_t *entry = find_page(store, d, (int)p, &unused);
+      header.data_size += entry ? entry->compressed : 0;
+      if (entry && entry->compressed > max_page)
+        max_page = entry->compressed;
+    }
+    header.page_count += ref.count;
+  }
+  uint64_t first_end =
+      sizeof(header) + sizeof(uint32_t) * ((uint64_t)doc_count + 1);
+  header.pages_offset = (first_end + 7) & ~(uint64_t)7;
+  header.data_offset =
+      header.pages_offset + sizeof(text_page_t) * (uint64_t)header.page_count;
+  header.file_size = header.data_offset + header.data_size;
+  if (fwrite(&header, sizeof(header), 1, fp) != 1)
+    return -1;
+
+  // 2. doc_first
+  uint32_t first = 0;
+  for (int d = 0; d <= doc_count; d++) {
+    if (fwrite(&first, sizeof(uint32_t), 1, fp) != 1)
+      return -1;
+    if (d < doc_count)
+      first += doc_ref(store, (uint32_t)d).count;
+  }
+  static const char zeros[8] = {0};
+  size_t pad = (size_t)(header.pages_offset - first_end);
+  if (fwrite(zeros, 1, pad, fp) != pad)
+    return -1;
+
+  // 3. Page table with offsets into the new data section
+  uint64_t offset = 0;
+  for (int d = 0; d < doc_count; d++) {
+    text_doc_ref_t ref = doc_ref(store, (uint32_t)d);
+    for (uint32_t p = 0; p < ref.count; p++) {
+      text_doc_ref_t unused;
+      const text_page_t *entry = find_page(store, d, (int)p, &unused);
+      text_page_t out = {offset, 0, 0};
+      if (entry != NULL) {
+        out.compressed = entry->compressed;
+        out.raw = entry->raw;
+      }
+      if (fwrite(&out, sizeof(out), 1, fp) != 1)
+        return -1;
+      offset += out.compressed;
+    }
+  }
+
+  // 4. The pages themselves
+  uint8_t *buffer = malloc(max_page ? max_page : 1);
+  if (buffer == NULL)
+    return -1;
+  for (int d = 0; d < doc_count; d++) {
+    text_doc_ref_t ref = doc_ref(store, (uint32_t)d);
+    for (uint32_t p = 0; p < ref.count; p++) {
+      text_doc_ref_t unused;
+      const text_page_t *entry = find_page(store, d, (int)p, &unused);
+      if (entry != NULL && copy_page(store, &ref, entry, fp, buffer) != 0) {
+        free(buffer);
+        return -1;
+      }
+    }
+  }
+  free(buffer);
+  return 0;
+}
+
+/*
+ * Writes documents 0..doc_count-1 as a side-car file. The file is built
+ * next to `path` and renamed over it, so a store mapped from the old file
+ * keeps working and a failed write leaves the old file in place.
+ */
+int text_store_write(const text_store_t *store, const char *path,
+                     int doc_count) {
+  size_t len = strlen(path);
+  char *temp_path = malloc(len + 5);
+  if (temp_path == NULL)
+    return -1;
+  memcpy(temp_path, path, len);
+  memcpy(temp_path + len, ".tmp", 5);
+
+  FILE *fp = fopen(temp_path, "wb");
+  if (fp == NULL) {
+    free(temp_path);
+    return -1;
+  }
+  int result = write_store(store, fp, doc_count);
+  if (result == 0 && (fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+    result = -1;
+  if (fclose(fp) != 0)
+    result = -1;
+  if (result == 0 && rename(temp_path, path) != 0)
+    result = -1;
+  if (result != 0)
+    unlink(temp_path);
+  free(temp_path);
+  return result;
+}
@@ -0,0 +1,295 @@
+#include "tokenizer.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Single pass word splitter. A word is a run of ASCII letters and digits
+ * and of non-ASCII letters (any valid UTF-8 code point that is not in one
+ * of the punctuation or space blocks below). ASCII runs are classified and
+ * lowercased a block at a time with SSE2 or AVX2; multi-byte characters
+ * go through a decoder and a simple one-to-one case fold.
+ */
+
+enum { C_SEP = 0, C_WORD = 1, C_HIGH = 2 };
+
+static const uint8_t byte_class[256] = {
+    ['0' ... '9'] = C_WORD, ['A' ... 'Z'] = C_WORD, ['a' ... 'z'] = C_WORD,
+    [0x80 ... 0xFF] = C_HIGH,
+};
+
+static inline uint8_t ascii_lower(uint8_t c) {
+  return (uint8_t)(c + ((uint8_t)(c - 'A') < 26 ? 32 : 0));
+}
+
+/*
+ * The input is classified 64 bytes at a time into two bitmasks: ASCII
+ * letters/digits and non-ASCII bytes. Word boundaries then fall out of
+ * bit scans, and the block is lowercased in the same sweep so ASCII runs
+ * are copied out with memcpy.
+ */
+#define BLOCK 64
+
+typedef struct {
+  const uint8_t *p;
+  size_t len;
+  size_t base;   // Block start; masks cover [base, base + BLOCK)
+  uint64_t word; // ASCII letter or digit
+  uint64_t high; // Non-ASCII byte
+  uint8_t lower[BLOCK + 16]; // Slack for fixed size copies
+} scan_t;
+
+static void scan_load(scan_t *s, size_t base) {
+  s->base = base;
+  size_t n = s->len - base < BLOCK ? s->len - base : BLOCK;
+  uint64_t word = 0, high = 0;
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s->p + base + i));
+    // (x - lo) < range, as a signed compare once shifted by 0x80
+    __m256i digit = _mm256_cmpgt_epi8(
+        _mm256_set1_epi8((char)(0x80 + 10)),
+        _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - '0'))));
+    __m256i upper = _mm256_cmpgt_epi8(
+        _mm256_set1_epi8((char)(0x80 + 26)),
+        _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 'A'))));
+    __m256i lower = _mm256_cmpgt_epi8(
+        _mm256_set1_epi8((char)(0x80 + 26)),
+        _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 'a'))));
+    __m256i w = _mm256_or_si256(digit, _mm256_or_si256(upper, lower));
+    word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(w) << i;
+    high |= (uint64_t)(uint32_t)_mm256_movemask_epi8(v) << i;
+    _mm256_storeu_si256(
+        (__m256i *)(s->lower + i),
+        _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8(32))));
+  }
+#elif defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s->p + base + i));
+    // (x - lo) < range, as a signed compare once shifted by 0x80
+    __m128i digit =
+        _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - '0'))),
+                       _mm_set1_epi8((char)(0x80 + 10)));
+    __m128i upper =
+        _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A'))),
+                       _mm_set1_epi8((char)(0x80 + 26)));
+    __m128i lower =
+        _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'a'))),
+                       _mm_set1_epi8((char)(0x80 + 26)));
+    __m128i w = _mm_or_si128(digit, _mm_or_si128(upper, lower));
+    word |= (uint64_t)(uint16_t)_mm_movemask_epi8(w) << i;
+    high |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << i;
+    _mm_storeu_si128((__m128i *)(s->lower + i),
+                     _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(32))));
+  }
+#endif
+  for (; i < n; i++) {
+    uint8_t c = s->p[base + i];
+    word |= (uint64_t)(byte_class[c] == C_WORD) << i;
+    high |= (uint64_t)(byte_class[c] == C_HIGH) << i;
+    s->lower[i] = ascii_lower(c);
+  }
+  s->word = word;
+  s->high = high;
+}
+
+// First position >= i that may start a word (ASCII alnum or non-ASCII)
+static size_t scan_next_start(scan_t *s, size_t i) {
+  while (i < s->len) {
+    if (i >= s->base + BLOCK)
+      scan_load(s, i);
+    uint64_t m = (s->word | s->high) >> (i - s->base);
+    if (m != 0)
+      return i + (size_t)__builtin_ctzll(m);
+    i = s->base + BLOCK;
+  }
+  return s->len;
+}
+
+/*
+ * Walks the ASCII letter/digit run at i and appends it, lowercased, to
+ * out while it fits in `room` bytes (out needs 16 bytes of slack).
+ * Returns the end of the run; *copied is short of its length when it did
+ * not fit.
+ */
+static size_t scan_ascii_run(scan_t *s, size_t i, uint8_t *out, size_t room,
+                             size_t *copied) {
+  size_t done = 0;
+  while (i < s->len) {
+    if (i >= s->base + BLOCK)
+      scan_load(s, i);
+    size_t k = i - s->base;
+    uint64_t stop = ~s->word >> k;
+    size_t end = stop != 0 ? k + (size_t)__builtin_ctzll(stop) : BLOCK;
+    if (s->base + end > s->len)
+      end = s->len - s->base;
+    size_t take = end - k < room - done ? end - k : room - done;
+    if (take <= 16) // Typical word: one unaligned 16 byte move
+      memcpy(out + done, s->lower + k, 16);
+    else
+      memcpy(out + done, s->lower + k, take);
+    done += take;
+    i = s->base + end;
+    if (end < BLOCK)
+      break;
+  }
+  *copied = done;
+  return i;
+}
+
+/*
+ * Decodes one UTF-8 character. Returns its length, or 0 for an invalid,
+ * overlong or truncated sequence.
+ */
+static size_t utf8_decode(const uint8_t *p, size_t n, unsigned int *cp) {
+  uint8_t b = p[0];
+  size_t len;
+  unsigned int c, min;
+  if (b >= 0xF0 && b <= 0xF4) {
+    len = 4, c = b & 0x07, min = 0x10000;
+  } else if (b >= 0xE0) {
+    len = 3, c = b & 0x0F, min = 0x800;
+  } else if (b >= 0xC2 && b < 0xE0) {
+    len = 2, c = b & 0x1F, min = 0x80;
+  } else {
+    return 0;
+  }
+  if (b > 0xF4 || len > n)
+    return 0;
+  for (size_t i = 1; i < len; i++) {
+    if ((p[i] & 0xC0) != 0x80)
+      return 0;
+    c = (c << 6) | (p[i] & 0x3F);
+  }
+  if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+    return 0;
+  *cp = c;
+  return len;
+}
+
+// Non-ASCII code points that separate words instead of forming them
+static bool is_separator(unsigned int cp) {
+  if (cp < 0x2000) // Latin through Indic: letters but for a few symbols
+    return cp <= 0xBF || cp == 0xD7 || cp == 0xF7;
+  return (cp >= 0x2000 && cp <= 0x206F) || // general punctuation, spaces
+         (cp >= 0x20A0 && cp <= 0x20CF) || // currency
+         (cp >= 0x2190 && cp <= 0x23FF) || // arrows, math operators
+         (cp >= 0x2500 && cp <= 0x27BF) || // box drawing, shapes, dingbats
+         (cp >= 0x3000 && cp <= 0x303F) || // CJK punctuation
+         (cp >= 0xE000 && cp <= 0xF8FF) || // private use (PDF glyph junk)
+         (cp >= 0xFE30 && cp <= 0xFE4F) || // CJK compatibility forms
+         cp == 0xFEFF || cp == 0xFFFD ||   // BOM, replacement character
+         (cp >= 0xFF01 && cp <= 0xFF0F);   // fullwidth punctuation
+}
+
+// One-to-one lowercase mapping for the common European scripts
+static unsigned int fold(unsigned int cp) {
+  if ((cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) || // Latin-1
+      (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) || // Greek
+      (cp >= 0x410 && cp <= 0x42F))                  // Cyrillic
+    return cp + 0x20;
+  if (cp >= 0x400 && cp <= 0x40F)
+    return cp + 0x50;
+  if (cp >= 0x100 && cp <= 0x17F) { // Latin Extended-A pairs
+    if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E))
+      return (cp & 1) ? cp + 1 : cp;
+    if (cp == 0x130 || cp == 0x131 || cp == 0x138 || cp == 0x149 ||
+        cp == 0x17F)
+      return cp;
+    if (cp == 0x178)
+      return 0xFF;
+    return cp | 1;
+  }
+  return cp;
+}
+
+// Writes the folded form of cp as UTF-8; returns the bytes written
+size_t utf8_fold(unsigned int cp, char *out) {
+  cp = fold(cp);
+  uint8_t *o = (uint8_t *)out;
+  if (cp < 0x80) {
+    o[0] = (uint8_t)cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    o[0] = (uint8_t)(0xC0 | (cp >> 6));
+    o[1] = (uint8_t)(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    o[0] = (uint8_t)(0xE0 | (cp >> 12));
+    o[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+    o[2] = (uint8_t)(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  o[0] = (uint8_t)(0xF0 | (cp >> 18));
+  o[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+  o[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+  o[3] = (uint8_t)(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+
+/*
+ * Splits `text` into words and calls `emit` for each one in order.
+ * Runs in one pass over the input. Returns the number of words emitted.
+ */
+size_t tokenize(const char *text, size_t len, token_fn emit, void *user_data) {
+  scan_t s = {.p = (const uint8_t *)text, .len = len};
+  uint8_t word[TOKEN_MAX_BYTES + 16];
+  size_t emitted = 0;
+  size_t i = 0;
+  if (len > 0)
+    scan_load(&s, 0);
+
+  while ((i = scan_next_start(&s, i)) < len) {
+    size_t start = i;
+    size_t w = 0;
+    bool too_long = false;
+    for (;;) {
+      // 1. ASCII letters and digits, straight from the lowered block
+      size_t copied;
+      size_t end =
+          scan_ascii_run(&s, i, word + w, TOKEN_MAX_BYTES - w, &copied);
+      too_long |= copied < end - i;
+      w += copied;
+      i = end;
+      if (i >= len || s.p[i] < 0x80)
+        break;
+
+      // 2. One multi-byte character
+      unsigned int cp;
+      size_t n;
+      uint8_t b = s.p[i];
+      if (b >= 0xC2 && b < 0xE0 && i + 1 < len &&
+          (s.p[i + 1] & 0xC0) == 0x80) {
+        cp = ((b & 0x1Fu) << 6) | (s.p[i + 1] & 0x3Fu); // Common case
+        n = 2;
+      } else {
+        n = utf8_decode(s.p + i, len - i, &cp);
+      }
+      if (n == 0 || is_separator(cp)) {
+        if (i == start)
+          i += n ? n : 1; // Nothing started yet: just step over it
+        break;
+      }
+      if (w + 4 <= TOKEN_MAX_BYTES) {
+        w += utf8_fold(cp, (char *)word + w);
+      } else {
+        too_long = true;
+      }
+      i += n;
+    }
+
+    if (w > 0 && !too_long) {
+      word[w] = '\0';
+      emit((const char *)word, w, (long)start, user_data);
+      emitted++;
+    }
+  }
+  return emitted;
+}
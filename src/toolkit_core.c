@@ -1,26 +1,35 @@
 #include "toolkit_core.h"
+#include "external_merge.h"
+#include "index_file.h"
 #include "index_structure.h"
+#include "indexer.h"
 #include "pdf_processor.h"
+#include "query_engine.h"
+#include "segments.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 
 search_engine_t *engine_create() {
-  search_engine_t *engine = malloc(sizeof(search_engine_t));
+  search_engine_t *engine = calloc(1, sizeof(search_engine_t));
   if (engine == NULL) {
     return NULL;
   }
 
-  engine->index_root = create_node(); // Start the trie
+  engine->index = trie_create(); // Start the trie and its arena
+  if (engine->index == NULL) {
+    free(engine);
+    return NULL;
+  }
   engine->doc_count = 0;
-  engine->doc_capacity = 100; // Start with a space for 100 PDFs
-  char **doc_map = malloc(sizeof(char *) * engine->doc_capacity);
-  if (doc_map == NULL) {
+  engine->texts = text_store_create();
+  if (engine->texts == NULL) {
+    engine_free(engine);
     return NULL;
   }
-  engine->document_map = doc_map;
   return engine;
 }
 
@@ -28,75 +37,159 @@ void engine_free(search_engine_t *engine) {
   if (engine == NULL)
     return;
 
-  trie_free(engine->index_root);
+  // Segments first: they share the live trie's epoch
+  segments_free(engine);
 
-  // Free all strings in the document_map
-  for (int i = 0; i < engine->doc_count; i++) {
-    free(engine->document_map[i]);
-  }
+  // Releases every node and posting slab in one sweep
+  trie_free(engine->index);
+  text_store_free(engine->texts);
+  impact_free(engine->impacts);
+  result_cache_free(engine->cache);
+  free(engine->temp_dir);
 
-  // Free the array of pointers
-  free(engine->document_map);
+  // The path arena and block index (nothing when mapped)
+  doc_table_free(&engine->docs);
+
+  // A mapped engine borrowed everything above from the file
+  if (engine->mapping != NULL) {
+    munmap(engine->mapping, engine->mapping_size);
+  } else {
+    free(engine->doc_meta);
+  }
 
   // Free the engine shell
   free(engine);
 }
 
+static void print_progress(int done, int total, const char *path,
+                           void *user_data) {
+  (void)user_data;
+  printf("Indexing [%d/%d]: %s\n", done, total, path);
+}
+
+// Single-threaded indexing with the classic console progress
 void engine_index_all(search_engine_t *engine) {
-  for (int i = 0; i < engine->doc_count; i++) {
-    const char *path = engine->document_map[i];
-    // call the indexing function here for each path!
-    printf("Indexing [%d/%d]: %s\n", i + 1, engine->doc_count, path);
-    index_pdf_content(engine, i, path);
-  }
+  engine_index_parallel(engine, 1, print_progress, NULL);
 }
 
-int engine_serialize(search_engine_t *engine, char *filepath) {
-  // 1. Open the file for writing in binary mode
-  FILE *fp;
-  fp = fopen(filepath, "wb");
+// <index path> + TEXT_STORE_SUFFIX, malloc'd
+static char *text_store_path(const char *filepath) {
+  size_t len = strlen(filepath);
+  char *path = malloc(len + sizeof(TEXT_STORE_SUFFIX));
+  if (path != NULL) {
+    memcpy(path, filepath, len);
+    memcpy(path + len, TEXT_STORE_SUFFIX, sizeof(TEXT_STORE_SUFFIX));
+  }
+  return path;
+}
 
-  if (fp == NULL) {
-    perror("Error opening file");
-    return -1;
+/*
+ * Gives a freshly loaded engine the page-text store saved next to its
+ * file, or an empty one (snippets then fall back to Poppler). A store
+ * that knows more documents than the index belongs to another file.
+ */
+static search_engine_t *attach_text_store(search_engine_t *engine,
+                                          const char *filepath) {
+  if (engine == NULL)
+    return NULL;
+  char *path = text_store_path(filepath);
+  engine->texts = path ? text_store_open(path) : NULL;
+  free(path);
+  if (engine->texts != NULL &&
+      engine->texts->doc_count > (uint32_t)engine->doc_count) {
+    text_store_free(engine->texts);
+    engine->texts = NULL;
+  }
+  if (engine->texts == NULL)
+    engine->texts = text_store_create();
+  if (engine->texts == NULL) {
+    engine_free(engine);
+    return NULL;
   }
+  return engine;
+}
 
-  // 2. Write header info for the root node
-  uint32_t MAGIC = 0xD0C0C0DE;
-  fwrite(&MAGIC, sizeof(uint32_t), 1, fp);
+/*
+ * Always writes the version 2 (flat, mmap-able) layout, checksummed and
+ * replacing the old file only once complete, plus the page-text
+ * store as <filepath>.text. A segmented engine is flushed instead; the
+ * runs a memory budget spilled are merged into the one file.
+ */
+int engine_serialize(search_engine_t *engine, char *filepath) {
+  if (engine->segments != NULL && engine->segments->spill_dir == NULL)
+    return engine_flush(engine, filepath);
 
-  // 3. Write the version number
-  uint16_t VERSION = 1;
-  fwrite(&VERSION, sizeof(uint16_t), 1, fp);
-  fwrite(&engine->doc_count, sizeof(int), 1, fp);
+  int result;
+  if (engine->segments != NULL) {
+    // 1-2. Every run and the live trie, streamed through an external merge
+    result = external_merge_write(engine, filepath);
+  } else {
+    // 1. Open a temporary file next to it, renamed over it once complete
+    index_output_t out;
+    if (index_output_open(&out, filepath) != 0)
+      return -1;
 
-  // 4. Write document paths
-  for (int i = 0; i < engine->doc_count; i++) {
-    char *file_path = engine->document_map[i];
-    int len = strlen(file_path);
-    fwrite(&len, sizeof(int), 1, fp);
-    fwrite(file_path, sizeof(char), len, fp);
+    // 2. Header, document map, dictionary and postings sections
+    result = index_output_commit(&out, filepath,
+                                 index_file_write(engine, out.fp));
   }
 
-  // 5. Write ROOT metadata (but not using trie_node_serialize)
-  trie_node_t *root = engine->index_root;
-  fwrite(&root->isEndOfWord, sizeof(bool), 1, fp);
-  int root_children_num = trie_children_count(root);
-  fwrite(&root_children_num, sizeof(int), 1, fp);
+  // 3. Page texts for snippets
+  char *texts_path = text_store_path(filepath);
+  if (result == 0 && engine->texts != NULL &&
+      (texts_path == NULL ||
+       text_store_write(engine->texts, texts_path, engine->doc_count) != 0)) {
+    result = -1;
+  }
+  free(texts_path);
+  return result;
+}
 
-  // 6. Serialize all children recursively
+/*
+ * Version 1 body: document count, length-prefixed paths, then the trie
+ * as one record per character
+ */
+static search_engine_t *deserialize_tree(FILE *fp) {
+  // 1. Allocate a new search_engine_t
+  search_engine_t *engine = calloc(1, sizeof(search_engine_t));
+  if (engine == NULL) {
+    return NULL;
+  }
 
-  for (int i = 0; i < ALPHABET_SIZE; i++) {
-    if (root->children[i] != NULL) {
-      trie_node_serialize(root->children[i], i, fp);
+  // 2. Read the document count
+  int doc_count;
+  if (fread(&doc_count, sizeof(int), 1, fp) != 1 || doc_count < 0) {
+    free(engine);
+    return NULL;
+  }
+
+  // 3. Rebuild the document table
+  char file_path[DOC_TABLE_MAX_PATH];
+  for (int i = 0; i < doc_count; i++) {
+    int len;
+    if (fread(&len, sizeof(int), 1, fp) != 1 || len < 0 ||
+        len >= DOC_TABLE_MAX_PATH ||
+        fread(file_path, sizeof(char), len, fp) != (size_t)len) {
+      engine_free(engine);
+      return NULL;
+    }
+    file_path[len] = '\0';
+    if (engine_add_document(engine, file_path) < 0) {
+      engine_free(engine);
+      return NULL;
     }
   }
 
-  fclose(fp);
-  return 0;
+  // 4. Rebuild the trie from the root metadata and its subtrees
+  engine->index = trie_deserialize(fp);
+  if (engine->index == NULL) {
+    engine_free(engine);
+    return NULL;
+  }
+  return engine;
 }
 
-// Deserialize and read from the file
+// Deserialize and read from the file into an engine that can keep indexing
 search_engine_t *engine_deserialize(char *filepath) {
   // 1. Open the file for reading in binary mode
   FILE *fp;
@@ -108,62 +201,283 @@ search_engine_t *engine_deserialize(char *filepath) {
 
   // 2. Read and verify the magic number
   uint32_t MAGIC;
-  fread(&MAGIC, sizeof(uint32_t), 1, fp);
-  if (MAGIC != 0xD0C0C0DE) { // Check if this is the right file format
+  if (fread(&MAGIC, sizeof(uint32_t), 1, fp) != 1 ||
+      (MAGIC != INDEX_MAGIC && MAGIC != SEGMENT_MANIFEST_MAGIC)) {
     fclose(fp);
     return NULL; // Return, this is wrong or corrupt file
   }
+  if (MAGIC == SEGMENT_MANIFEST_MAGIC) { // A segmented index
+    fclose(fp);
+    return attach_text_store(segments_open(filepath, true), filepath);
+  }
 
-  // 3. Read the VERSION number
+  // 3. The VERSION number selects the layout
   uint16_t VERSION;
-  fread(&VERSION, sizeof(uint16_t), 1, fp);
+  if (fread(&VERSION, sizeof(uint16_t), 1, fp) != 1) {
+    fclose(fp);
+    return NULL;
+  }
+
+  search_engine_t *engine = NULL;
+  if (VERSION == INDEX_VERSION_TREE) {
+    engine = deserialize_tree(fp);
+  } else if (VERSION >= INDEX_VERSION_FLAT &&
+             VERSION <= INDEX_VERSION_CHECKSUMS) {
+    engine = index_file_open(filepath, true);
+  }
+
+  fclose(fp);
+  return attach_text_store(engine, filepath);
+}
 
-  // 4. Allocate a new search_engine_t
-  search_engine_t *engine = malloc(sizeof(search_engine_t));
+/*
+ * Opens an index for searching only. Version 2 files and the segments of
+ * a manifest are mapped read-only and queried in place, with only their
+ * headers, paths and fingerprints checksummed (engine_verify() checks
+ * the rest); older files fall back to engine_deserialize().
+ */
+search_engine_t *engine_open_mapped(char *filepath) {
+  search_engine_t *engine = index_file_open(filepath, false);
+  if (engine == NULL)
+    engine = segments_open(filepath, false);
   if (engine == NULL) {
-    fclose(fp);
+    return engine_deserialize(filepath);
+  }
+  return attach_text_store(engine, filepath);
+}
+
+/*
+ * Checks the checksums engine_open_mapped() leaves unchecked: every
+ * section of the files a mapped engine reads in place, not only the
+ * header, paths and fingerprints. Reads the whole index once. Returns 0
+ * if all match, as for an engine copied in (checked whole on open), -1
+ * if not.
+ */
+int engine_verify(search_engine_t *engine) {
+  if (engine->mapping != NULL &&
+      index_file_verify(engine->mapping, engine->mapping_size) != 0)
+    return -1;
+  return segments_verify(engine);
+}
+
+/*
+ * Appends `path` to the document table and returns its new doc id, -1 if
+ * out of memory, too long or the engine is mapped read-only.
+ */
+int engine_add_document(search_engine_t *engine, const char *path) {
+  if (engine->mapping != NULL ||
+      (engine->index != NULL && engine->index->read_only) ||
+      engine->docs.count != engine->doc_count ||
+      doc_table_append(&engine->docs, path) != 0) {
+    return -1;
+  }
+  return engine->doc_count++;
+}
+
+/*
+ * Make room for `extra` more documents (capacity doubles, so appends are
+ * amortized). Returns 0 on success, -1 if out of memory or the engine is
+ * mapped read-only.
+ */
+int engine_reserve_documents(search_engine_t *engine, int extra) {
+  if (engine->mapping != NULL) {
+    return -1;
+  }
+  return doc_table_reserve(&engine->docs, extra);
+}
+
+// NULL for ids the engine has no fingerprint slot for
+doc_meta_t *engine_doc_meta(search_engine_t *engine, int doc_id) {
+  if (doc_id < 0 || doc_id >= engine->doc_meta_capacity) {
     return NULL;
   }
+  return &engine->doc_meta[doc_id];
+}
 
-  // 5. Read the document count
-  int doc_count;
-  fread(&doc_count, sizeof(int), 1, fp);
-  engine->doc_count = doc_count;
+/*
+ * Grow doc_meta to cover every document in the table. New slots are
+ * zeroed, i.e. unknown and live. Queries may still read the old array,
+ * so it is retired through the index's epoch rather than reallocated.
+ * Returns 0 on success, -1 if out of memory or the engine is mapped
+ * read-only.
+ */
+int engine_reserve_meta(search_engine_t *engine) {
+  if (engine->doc_meta_capacity >= engine->doc_count) {
+    return 0;
+  }
+  if (engine->mapping != NULL) {
+    return -1;
+  }
+  int new_capacity = engine->doc_meta_capacity * 2 > engine->doc_count
+                         ? engine->doc_meta_capacity * 2
+                         : engine->doc_count;
+  doc_meta_t *temp = calloc(new_capacity, sizeof(doc_meta_t));
+  if (temp == NULL) {
+    return -1;
+  }
+  doc_meta_t *old = engine->doc_meta;
+  if (engine->doc_meta_capacity > 0)
+    memcpy(temp, old, sizeof(doc_meta_t) * engine->doc_meta_capacity);
+  __atomic_store_n(&engine->doc_meta, temp, __ATOMIC_RELEASE);
+  __atomic_store_n(&engine->doc_meta_capacity, new_capacity,
+                   __ATOMIC_RELEASE);
+  if (old != NULL)
+    epoch_retire(engine->index->epoch, epoch_release_memory, NULL,
+                 (uintptr_t)old);
+  return 0;
+}
 
-  // 6. Rebuild the document_map array
-  char **document_map = malloc(sizeof(char *) * doc_count);
-  for (int i = 0; i < engine->doc_count; i++) {
-    int len;
-    fread(&len, sizeof(int), 1, fp);
-    char *file_path = malloc(len + 1);
-    fread(file_path, sizeof(char), len, fp);
-    file_path[len] = '\0';
-    document_map[i] = file_path;
+/*
+ * Recomputes total_length and length_docs from doc_meta. Called whenever
+ * documents are indexed or dropped; tombstoned documents do not count.
+ */
+void engine_count_lengths(search_engine_t *engine) {
+  int known = engine->doc_meta_capacity < engine->doc_count
+                  ? engine->doc_meta_capacity
+                  : engine->doc_count;
+  uint64_t total = 0;
+  int docs = 0;
+  for (int i = 0; i < known; i++) {
+    const doc_meta_t *meta = &engine->doc_meta[i];
+    if (meta->length == 0 || (meta->flags & DOC_DELETED))
+      continue;
+    total += meta->length;
+    docs++;
   }
+  // Queries may be reading them (see bm25_average_length())
+  __atomic_store_n(&engine->total_length, total, __ATOMIC_RELAXED);
+  __atomic_store_n(&engine->length_docs, docs, __ATOMIC_RELAXED);
+}
+
+// epoch_release_fn for a replaced impact table
+static void release_impacts(void *owner, uintptr_t item) {
+  (void)owner;
+  impact_free((impact_index_t *)item);
+}
 
-  engine->document_map = document_map;
-  engine->doc_capacity = doc_count;
+/*
+ * Brings the ranking statistics in line with the index: document lengths,
+ * then the block bounds computed from them. Without bounds (out of memory)
+ * ranked search just scores exhaustively. The old table is retired, since
+ * queries may still hold it.
+ */
+void engine_update_ranking(search_engine_t *engine) {
+  engine_count_lengths(engine);
+  impact_index_t *old = engine->impacts;
+  impact_index_t *fresh =
+      impact_build(engine, engine->index, bm25_average_length(engine));
+  __atomic_store_n(&engine->impacts, fresh, __ATOMIC_RELEASE);
+  if (old != NULL)
+    epoch_retire(engine->index->epoch, release_impacts, NULL,
+                 (uintptr_t)old);
+}
 
-  // 7. Create and read the root node metadata
-  trie_node_t *root = create_node();
-  bool isEndOfWord;
-  fread(&isEndOfWord, sizeof(bool), 1, fp);
-  int root_children_num;
-  fread(&root_children_num, sizeof(int), 1, fp);
+/*
+ * Caches the hits of search_cached() within `bytes` (0 turns the cache
+ * off). Not to be called while other threads search. Returns -1 if out of
+ * memory.
+ */
+int engine_set_cache_budget(search_engine_t *engine, size_t bytes) {
+  if (bytes == 0) {
+    result_cache_free(engine->cache);
+    engine->cache = NULL;
+    return 0;
+  }
+  if (engine->cache == NULL) {
+    engine->cache = result_cache_create(bytes);
+    return engine->cache != NULL ? 0 : -1;
+  }
+  result_cache_set_budget(engine->cache, bytes);
+  return 0;
+}
 
-  // 8. Deserialize all of root children
-  for (int i = 0; i < root_children_num; i++) {
-    trie_node_t *child = trie_node_deserialize(fp);
-    if (child != NULL) {
-      root->children[child->char_index] = child;
-    }
+// All zero while the cache is off
+void engine_cache_stats(search_engine_t *engine, result_cache_stats_t *stats) {
+  if (engine->cache == NULL) {
+    memset(stats, 0, sizeof(result_cache_stats_t));
+    return;
   }
-  engine->index_root = root;
+  result_cache_stats(engine->cache, stats);
+}
 
-  fclose(fp);
-  return engine;
+/*
+ * Snippet for one hit. Served from the page-text store when the document
+ * is in it (one page decoded, no PDF access), else from the PDF itself.
+ */
+char *engine_get_snippet(search_engine_t *engine, int doc_id, int page_num,
+                         long byte_offset) {
+  size_t len;
+  char *page_text = text_store_get_page(engine->texts, doc_id, page_num, &len);
+  if (page_text == NULL) {
+    const char *path = engine_get_document_path(engine, doc_id);
+    return path ? get_snippet(path, page_num, byte_offset) : NULL;
+  }
+  char *snippet = snippet_from_text(page_text, len, byte_offset);
+  free(page_text);
+  return snippet;
 }
 
+/*
+ * Path of `doc_id`, NULL if there is none. It is decoded into a buffer of
+ * the calling thread, valid until that thread's next call.
+ */
 const char *engine_get_document_path(search_engine_t *engine, int doc_id) {
-  return engine->document_map[doc_id];
+  static __thread char path[DOC_TABLE_MAX_PATH];
+  if (doc_id < 0 || doc_id >= engine->doc_count) {
+    return NULL;
+  }
+  return doc_table_get(&engine->docs, doc_id, path, sizeof(path)) >= 0 ? path
+                                                                       : NULL;
+}
+
+/*
+ * Copies the whole document map out in two allocations, so a binding can
+ * take every path in one call instead of one call per result.
+ */
+doc_path_table_t *engine_export_paths(search_engine_t *engine) {
+  doc_path_table_t *table = calloc(1, sizeof(doc_path_table_t));
+  if (table == NULL)
+    return NULL;
+  table->count = engine->doc_count;
+  table->offsets = malloc(sizeof(uint64_t) * ((size_t)table->count + 1));
+  size_t capacity = 4096;
+  table->paths = malloc(capacity);
+  if (table->offsets == NULL || table->paths == NULL) {
+    free_doc_path_table(table);
+    return NULL;
+  }
+
+  // One sequential pass over the front-coded blocks
+  doc_table_iter_t it;
+  doc_table_iter(&engine->docs, &it);
+  uint64_t size = 0;
+  for (int i = 0; i < table->count; i++) {
+    const char *path = doc_table_next(&it);
+    size_t len = path != NULL ? it.len + 1 : 0;
+    table->offsets[i] = size;
+    if (size + len > capacity) {
+      while (size + len > capacity)
+        capacity *= 2;
+      char *temp = realloc(table->paths, capacity);
+      if (temp == NULL) {
+        free_doc_path_table(table);
+        return NULL;
+      }
+      table->paths = temp;
+    }
+    if (len > 0)
+      memcpy(table->paths + size, path, len);
+    size += len;
+  }
+  table->offsets[table->count] = size;
+  table->paths_size = size;
+  return table;
+}
+
+void free_doc_path_table(doc_path_table_t *table) {
+  if (table == NULL)
+    return;
+  free(table->paths);
+  free(table->offsets);
+  free(table);
 }
@@ -0,0 +1,362 @@
+#include "updater.h"
+#include "segments.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*
+ * Incremental updates. A re-crawl is diffed against the fingerprints
+ * recorded at index time: size and mtime decide most files without reading
+ * them, the content hash settles the rest (a touched but identical file).
+ * Posting lists cannot drop a document in place, so a changed file is
+ * tombstoned under its old id and indexed again under a new one; queries
+ * skip tombstones until engine_compact() rewrites the index without them.
+ */
+
+#define FINGERPRINT_CHUNK (64 * 1024)
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// Final avalanche (murmur3 fmix64)
+static inline uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// One multiply per 8 bytes; `h` carries over between chunks
+static uint64_t hash_bytes(uint64_t h, const uint8_t *data, size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    h = rotl64(h ^ (word * 0x87c37b91114253d5ULL), 31) * 0x9E3779B97F4A7C15ULL;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, data + i, len - i);
+  if (len > i)
+    h = rotl64(h ^ (tail * 0x87c37b91114253d5ULL), 31) * 0x9E3779B97F4A7C15ULL;
+  return h;
+}
+
+static uint64_t hash_string(const char *s) {
+  size_t len = strlen(s);
+  return mix64(hash_bytes(len, (const uint8_t *)s, len));
+}
+
+/*
+ * Records size, mtime and a content hash of `path` in `meta`, keeping the
+ * flags other than DOC_META_KNOWN. Returns 0 on success, -1 if the file
+ * cannot be read (meta is then marked unknown).
+ */
+int doc_fingerprint(const char *path, doc_meta_t *meta) {
+  meta->flags &= ~DOC_META_KNOWN;
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return -1;
+
+  struct stat st;
+  uint8_t *buffer = malloc(FINGERPRINT_CHUNK);
+  if (buffer == NULL || fstat(fileno(fp), &st) != 0) {
+    free(buffer);
+    fclose(fp);
+    return -1;
+  }
+
+  // fread only comes up short at the end, so every chunk but the last is
+  // a multiple of 8 bytes and chunking does not change the hash
+  uint64_t h = 0;
+  uint64_t total = 0;
+  size_t n;
+  while ((n = fread(buffer, 1, FINGERPRINT_CHUNK, fp)) > 0) {
+    h = hash_bytes(h, buffer, n);
+    total += n;
+  }
+  int result = ferror(fp) ? -1 : 0;
+  free(buffer);
+  fclose(fp);
+  if (result != 0)
+    return -1;
+
+  meta->size = total;
+  meta->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL +
+                   st.st_mtim.tv_nsec;
+  meta->hash = mix64(h ^ total);
+  meta->flags |= DOC_META_KNOWN;
+  return 0;
+}
+
+// Open addressing over the live documents, keyed by path
+typedef struct {
+  int *slots; // doc id + 1, 0 = empty
+  size_t mask;
+} path_table_t;
+
+static int path_table_build(path_table_t *table, search_engine_t *engine) {
+  size_t size = 16;
+  while (size < (size_t)engine->doc_count * 2)
+    size *= 2;
+  table->slots = calloc(size, sizeof(int));
+  table->mask = size - 1;
+  if (table->slots == NULL)
+    return -1;
+  doc_table_iter_t it;
+  doc_table_iter(&engine->docs, &it);
+  for (int i = 0; i < engine->doc_count; i++) {
+    const char *path = doc_table_next(&it);
+    if (path == NULL) {
+      free(table->slots);
+      return -1;
+    }
+    if (engine->doc_meta[i].flags & DOC_DELETED)
+      continue;
+    size_t slot = hash_string(path) & table->mask;
+    while (table->slots[slot] != 0)
+      slot = (slot + 1) & table->mask;
+    table->slots[slot] = i + 1;
+  }
+  return 0;
+}
+
+static int path_table_find(const path_table_t *table,
+                           search_engine_t *engine, const char *path) {
+  char known[DOC_TABLE_MAX_PATH];
+  size_t slot = hash_string(path) & table->mask;
+  while (table->slots[slot] != 0) {
+    int doc_id = table->slots[slot] - 1;
+    if (doc_table_get(&engine->docs, doc_id, known, sizeof(known)) >= 0 &&
+        strcmp(known, path) == 0)
+      return doc_id;
+    slot = (slot + 1) & table->mask;
+  }
+  return -1;
+}
+
+static void tombstone(search_engine_t *engine, int doc_id) {
+  engine->doc_meta[doc_id].flags |= DOC_DELETED;
+  engine->deleted_count++;
+  trie_touch(engine->index); // cached results may hold the document
+}
+
+// Decides whether a file at a known id still matches its fingerprint
+static bool unchanged(doc_meta_t *meta, const char *path) {
+  struct stat st;
+  if (!(meta->flags & DOC_META_KNOWN) || stat(path, &st) != 0 ||
+      (uint64_t)st.st_size != meta->size)
+    return false;
+  int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL +
+                  st.st_mtim.tv_nsec;
+  if (mtime == meta->mtime_ns)
+    return true;
+
+  // Touched or rewritten: only the content can tell
+  doc_meta_t now = *meta;
+  if (doc_fingerprint(path, &now) != 0 || now.hash != meta->hash)
+    return false;
+  meta->mtime_ns = now.mtime_ns;
+  return true;
+}
+
+// engine_update_directory() once merges are paused
+static int update_directory(search_engine_t *engine, const char *path,
+                            const crawl_options_t *options,
+                            index_progress_fn progress, void *user_data,
+                            update_stats_t *stats) {
+  update_stats_t counts = {0};
+
+  // 1. Crawl into a bare engine shell, only its document table is used
+  crawl_options_t crawl = {0};
+  if (options != NULL)
+    crawl = *options;
+  crawl.on_batch = NULL;
+  search_engine_t *found = calloc(1, sizeof(search_engine_t));
+  if (found == NULL)
+    return -1;
+  if (crawl_directory_parallel(path, found, &crawl) != 0) {
+    engine_free(found);
+    return -1;
+  }
+
+  path_table_t table;
+  bool *seen = calloc(engine->doc_count > 0 ? engine->doc_count : 1,
+                      sizeof(bool));
+  if (seen == NULL || path_table_build(&table, engine) != 0 ||
+      engine_reserve_documents(engine, found->doc_count) != 0) {
+    free(seen);
+    engine_free(found);
+    return -1;
+  }
+
+  // 2. Diff the crawl against the fingerprints
+  int first_new = engine->doc_count;
+  bool failed = false;
+  doc_table_iter_t it;
+  doc_table_iter(&found->docs, &it);
+  const char *file;
+  while ((file = doc_table_next(&it)) != NULL) {
+    int doc_id = path_table_find(&table, engine, file);
+    if (doc_id >= 0) {
+      seen[doc_id] = true;
+      if (unchanged(&engine->doc_meta[doc_id], file)) {
+        counts.unchanged++;
+        continue;
+      }
+      tombstone(engine, doc_id);
+      counts.modified++;
+    } else {
+      counts.added++;
+    }
+    if (engine_add_document(engine, file) < 0) {
+      failed = true;
+      break;
+    }
+  }
+
+  // 3. Live documents under `path` that the crawl did not see are gone
+  // (unless the diff stopped early and did not see everything)
+  size_t root_len = strlen(path);
+  while (root_len > 0 && path[root_len - 1] == '/')
+    root_len--;
+  doc_table_iter(&engine->docs, &it);
+  for (int i = 0; !failed && i < first_new; i++) {
+    const char *doc = doc_table_next(&it);
+    if (doc == NULL || seen[i] || (engine->doc_meta[i].flags & DOC_DELETED) ||
+        strncmp(doc, path, root_len) != 0 || doc[root_len] != '/')
+      continue;
+    tombstone(engine, i);
+    counts.deleted++;
+  }
+  free(table.slots);
+  free(seen);
+  engine_free(found);
+
+  // 4. Extract only what is new
+  int result = engine_index_from(engine, first_new, crawl.workers, progress,
+                                 user_data);
+  if (stats != NULL)
+    *stats = counts;
+  return failed ? -1 : result;
+}
+
+/*
+ * Brings the engine up to date with the files under `path`: new files are
+ * appended and indexed, changed files are tombstoned and indexed again,
+ * and documents under `path` that are no longer found are tombstoned.
+ * Documents outside `path` are left alone. `options` configures the crawl
+ * (its on_batch is not called); `options->workers` also sets the indexing
+ * threads. Segment merges wait meanwhile, since they read tombstones.
+ * Returns 0 on success, -1 on error (the engine stays usable).
+ */
+int engine_update_directory(search_engine_t *engine, const char *path,
+                            const crawl_options_t *options,
+                            index_progress_fn progress, void *user_data,
+                            update_stats_t *stats) {
+  if (engine->mapping != NULL || engine->index->read_only ||
+      engine_reserve_meta(engine) != 0) {
+    fprintf(stderr, "Cannot update a read-only mapped engine\n");
+    return -1;
+  }
+  segments_pause_merges(engine);
+  int result = update_directory(engine, path, options, progress, user_data,
+                                stats);
+  segments_resume_merges(engine);
+  return result;
+}
+
+// engine_compact() once merges are paused
+static int compact(search_engine_t *engine) {
+  if (engine->deleted_count == 0)
+    return 0;
+  if (engine_reserve_meta(engine) != 0)
+    return -1;
+
+  // 1. Old id -> new id, -1 for tombstones
+  int *remap = malloc(sizeof(int) * engine->doc_count);
+  if (remap == NULL)
+    return -1;
+  int live = 0;
+  for (int i = 0; i < engine->doc_count; i++) {
+    remap[i] = engine_doc_deleted(engine, i) ? -1 : live++;
+  }
+
+  // 2. The surviving paths, front-coded afresh
+  doc_table_t docs = {0};
+  doc_table_iter_t it;
+  doc_table_iter(&engine->docs, &it);
+  bool ok = doc_table_reserve(&docs, live) == 0;
+  for (int i = 0; ok && i < engine->doc_count; i++) {
+    const char *path = doc_table_next(&it);
+    ok = path != NULL && (remap[i] < 0 || doc_table_append(&docs, path) == 0);
+  }
+
+  // 3. Rebuild the dictionary and postings, segment by segment
+  trie_t *trie = ok ? trie_create() : NULL;
+  if (trie != NULL)
+    trie->positional = engine->index->positional;
+  segment_view_t view;
+  segment_view_begin(engine, &view);
+  for (int s = 0; trie != NULL && s < segment_view_count(&view); s++) {
+    if (trie_merge_remap(trie, segment_view_trie(&view, s), remap) != 0) {
+      trie_free(trie);
+      trie = NULL;
+    }
+  }
+  segment_view_end(&view);
+  if (trie == NULL ||
+      (engine->segments != NULL && segments_reset(engine, trie) != 0)) {
+    trie_free(trie);
+    doc_table_free(&docs);
+    free(remap);
+    return -1;
+  }
+  if (engine->segments == NULL) {
+    trie->generation = engine->index->generation + 1;
+    trie_free(engine->index);
+    engine->index = trie;
+  }
+  doc_table_free(&engine->docs);
+  engine->docs = docs;
+
+  // Page texts follow; without room for that they are dropped, and
+  // snippets come from the PDFs again
+  if (engine->texts != NULL &&
+      text_store_remap(engine->texts, remap, engine->doc_count) != 0) {
+    text_store_free(engine->texts);
+    engine->texts = text_store_create();
+  }
+
+  // 4. Squeeze the fingerprints
+  for (int i = 0; i < engine->doc_count; i++) {
+    if (remap[i] >= 0)
+      engine->doc_meta[remap[i]] = engine->doc_meta[i];
+  }
+  memset(engine->doc_meta + live, 0,
+         sizeof(doc_meta_t) * (engine->doc_meta_capacity - live));
+  engine->doc_count = live;
+  engine->deleted_count = 0;
+  engine_update_ranking(engine);
+  free(remap);
+  return 0;
+}
+
+/*
+ * Drops tombstoned documents for good: the trie is rebuilt without their
+ * postings and the surviving documents are renumbered densely in their old
+ * order. Segments are all folded into the live trie, and the next flush
+ * writes the index again. Returns 0 on success, -1 on error (the engine
+ * is left untouched).
+ */
+int engine_compact(search_engine_t *engine) {
+  if (engine->mapping != NULL || engine->index->read_only)
+    return -1;
+  segments_pause_merges(engine);
+  int result = compact(engine);
+  segments_resume_merges(engine);
+  return result;
+}
@@ -0,0 +1,279 @@
+#include "bench.h"
+#include "query_engine.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// Micro-benchmark suite on a synthetic corpus, no PDFs needed. Prints a
+// summary and writes every result as a JSON line so runs can be diffed.
+// Usage: bench_suite [--docs N] [--mib N] [--k N] [--seed N]
+//                    [--out FILE] [--scratch DIR] [benchmark ...]
+
+double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+uint64_t bench_random(uint64_t *state) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return *state >> 11;
+}
+
+int bench_zipf_rank(const bench_corpus_t *corpus, uint64_t *state) {
+  double u = (double)bench_random(state) / (double)(1ULL << 53) *
+             corpus->cumulative[corpus->vocab - 1];
+  int lo = 0, hi = corpus->vocab - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (corpus->cumulative[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Consonant-vowel syllables spelling the rank in base 80
+static void make_word(int rank, char *out) {
+  static const char consonants[] = "bcdfghklmnprstvz";
+  static const char vowels[] = "aeiou";
+  size_t len = 0;
+  unsigned r = (unsigned)rank;
+  do {
+    out[len++] = consonants[r % 16];
+    r /= 16;
+    out[len++] = vowels[r % 5];
+    r /= 5;
+  } while (r > 0 && len + 2 < BENCH_WORD_MAX);
+  out[len] = '\0';
+}
+
+static int corpus_init(bench_corpus_t *corpus, int docs, uint64_t seed) {
+  memset(corpus, 0, sizeof(*corpus));
+  corpus->docs = docs;
+  corpus->vocab = BENCH_VOCAB;
+  corpus->words = malloc(sizeof(*corpus->words) * corpus->vocab);
+  corpus->cumulative = malloc(sizeof(double) * corpus->vocab);
+  corpus->first = malloc(sizeof(size_t) * (docs + 1));
+  if (corpus->words == NULL || corpus->cumulative == NULL ||
+      corpus->first == NULL)
+    return -1;
+  for (int r = 0; r < corpus->vocab; r++) {
+    make_word(r, corpus->words[r]);
+    corpus->cumulative[r] =
+        (r ? corpus->cumulative[r - 1] : 0.0) + 1.0 / (r + 1);
+  }
+
+  // Lengths first, so the ranks take one allocation
+  uint64_t state = seed;
+  corpus->first[0] = 0;
+  for (int d = 0; d < docs; d++)
+    corpus->first[d + 1] = corpus->first[d] + 50 + bench_random(&state) % 500;
+  corpus->ranks = malloc(sizeof(int32_t) * (corpus->first[docs] + 1));
+  if (corpus->ranks == NULL)
+    return -1;
+  for (size_t i = 0; i < corpus->first[docs]; i++)
+    corpus->ranks[i] = bench_zipf_rank(corpus, &state);
+  return 0;
+}
+
+static void corpus_free(bench_corpus_t *corpus) {
+  free(corpus->words);
+  free(corpus->cumulative);
+  free(corpus->ranks);
+  free(corpus->first);
+}
+
+/*
+ * Document `doc` as page text: its words separated by spaces, with a
+ * comma or a full stop and newline now and then. Returns the length,
+ * truncated to cap - 1.
+ */
+size_t bench_text(const bench_corpus_t *corpus, int doc, char *out,
+                  size_t cap) {
+  size_t len = 0;
+  for (size_t i = corpus->first[doc]; i < corpus->first[doc + 1]; i++) {
+    const char *word = corpus->words[corpus->ranks[i]];
+    size_t n = strlen(word);
+    if (len + n + 3 > cap)
+      break;
+    memcpy(out + len, word, n);
+    len += n;
+    if (i % 17 == 16) {
+      out[len++] = '.';
+      out[len++] = '\n';
+    } else if (i % 7 == 6) {
+      out[len++] = ',';
+      out[len++] = ' ';
+    } else {
+      out[len++] = ' ';
+    }
+  }
+  out[len] = '\0';
+  return len;
+}
+
+/*
+ * An engine holding the corpus, as the indexer would leave it: 300
+ * words to a page, byte offsets 6 apart, document lengths set.
+ */
+search_engine_t *bench_index(const bench_corpus_t *corpus) {
+  search_engine_t *engine = engine_create();
+  if (engine == NULL || engine_reserve_documents(engine, corpus->docs) != 0)
+    return NULL;
+  for (int d = 0; d < corpus->docs; d++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/bench/doc%d.pdf", d);
+    engine_add_document(engine, path);
+  }
+  if (engine_reserve_meta(engine) != 0)
+    return NULL;
+  for (int d = 0; d < corpus->docs; d++) {
+    size_t first = corpus->first[d], end = corpus->first[d + 1];
+    for (size_t i = first; i < end; i++) {
+      int position = (int)(i - first);
+      trie_insert_at(engine->index, corpus->words[corpus->ranks[i]], d,
+                     position / 300, position * 6L, position % 300);
+    }
+    engine->doc_meta[d].length = (uint32_t)(end - first);
+  }
+  engine_count_lengths(engine);
+  return engine;
+}
+
+// The corpus indexed once and shared by the benchmarks that only read it
+search_engine_t *bench_engine(bench_t *bench) {
+  if (bench->engine == NULL)
+    bench->engine = bench_index(&bench->corpus);
+  return bench->engine;
+}
+
+long bench_peak_rss_kb(void) {
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+}
+
+void bench_report(bench_t *bench, const char *name, const char *metric,
+                  double value, const char *unit) {
+  printf("  %-20s %-16s %12.3f %s\n", name, metric, value, unit);
+  if (bench->out != NULL)
+    fprintf(bench->out,
+            "{\"bench\":\"%s\",\"metric\":\"%s\",\"value\":%.6g,"
+            "\"unit\":\"%s\",\"docs\":%d,\"seed\":%llu}\n",
+            name, metric, value, unit, bench->docs,
+            (unsigned long long)bench->seed);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Percentiles of `samples` (seconds, sorted in place) in microseconds
+void bench_report_latency(bench_t *bench, const char *name, double *samples,
+                          int count) {
+  if (count <= 0)
+    return;
+  qsort(samples, count, sizeof(double), compare_doubles);
+  static const struct {
+    const char *metric;
+    double rank;
+  } points[] = {{"p50", 0.50}, {"p90", 0.90}, {"p99", 0.99}, {"max", 1.0}};
+  char metric[64];
+  for (size_t p = 0; p < sizeof(points) / sizeof(points[0]); p++) {
+    int i = (int)(points[p].rank * (count - 1) + 0.5);
+    snprintf(metric, sizeof(metric), "latency_%s", points[p].metric);
+    bench_report(bench, name, metric, samples[i] * 1e6, "us");
+  }
+}
+
+static const struct {
+  const char *name;
+  void (*run)(bench_t *bench);
+} benchmarks[] = {
+    {"tokenizer", bench_tokenizer}, {"insert", bench_insert},
+    {"search", bench_search},       {"serialize", bench_serialize},
+    {"ranking", bench_ranking},
+};
+#define BENCHMARK_COUNT (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static int usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--docs N] [--mib N] [--k N] [--seed N] [--out FILE]\n"
+          "          [--scratch DIR] [benchmark ...]\n"
+          "Benchmarks:",
+          program);
+  for (int b = 0; b < BENCHMARK_COUNT; b++)
+    fprintf(stderr, " %s", benchmarks[b].name);
+  fprintf(stderr, " (default: all)\n");
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  bench_t bench = {0};
+  bench.docs = BENCH_DOCS;
+  bench.mib = BENCH_MIB;
+  bench.k = QUERY_DEFAULT_K;
+  bench.seed = BENCH_SEED;
+  bench.scratch = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+  const char *out = "bench.json";
+  bool selected[BENCHMARK_COUNT] = {false};
+  bool any = false;
+
+  // 1. Options, then the benchmarks to run
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strncmp(arg, "--", 2) == 0 && value == NULL)
+      return usage(argv[0]);
+    if (strcmp(arg, "--docs") == 0)
+      bench.docs = atoi(argv[++i]);
+    else if (strcmp(arg, "--mib") == 0)
+      bench.mib = atoi(argv[++i]);
+    else if (strcmp(arg, "--k") == 0)
+      bench.k = atoi(argv[++i]);
+    else if (strcmp(arg, "--seed") == 0)
+      bench.seed = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(arg, "--out") == 0)
+      out = argv[++i];
+    else if (strcmp(arg, "--scratch") == 0)
+      bench.scratch = argv[++i];
+    else {
+      int b = 0;
+      while (b < BENCHMARK_COUNT && strcmp(arg, benchmarks[b].name) != 0)
+        b++;
+      if (b == BENCHMARK_COUNT)
+        return usage(argv[0]);
+      selected[b] = any = true;
+    }
+  }
+  if (bench.docs <= 0 || bench.mib <= 0 || bench.k <= 0)
+    return usage(argv[0]);
+
+  // 2. The corpus, then each benchmark in turn
+  bench.out = fopen(out, "w");
+  if (bench.out == NULL) {
+    perror(out);
+    return 1;
+  }
+  if (corpus_init(&bench.corpus, bench.docs, bench.seed) != 0) {
+    perror("corpus");
+    return 1;
+  }
+  printf("%d documents, %zu words, seed %llu\n", bench.docs,
+         bench.corpus.first[bench.docs], (unsigned long long)bench.seed);
+  for (int b = 0; b < BENCHMARK_COUNT; b++) {
+    if (any && !selected[b])
+      continue;
+    printf("%s\n", benchmarks[b].name);
+    benchmarks[b].run(&bench);
+  }
+
+  engine_free(bench.engine);
+  corpus_free(&bench.corpus);
+  fclose(bench.out);
+  printf("Results written to %s\n", out);
+  return 0;
+}
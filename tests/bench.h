@@ -0,0 +1,65 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "toolkit_core.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Defaults of the suite; see bench_suite --help
+#define BENCH_DOCS 10000
+#define BENCH_VOCAB 50000
+#define BENCH_MIB 16
+#define BENCH_SEED 42
+
+// Longest synthetic word, NUL included
+#define BENCH_WORD_MAX 16
+
+/*
+ * Deterministic synthetic corpus: documents of 50 to 549 words drawn
+ * from a Zipfian vocabulary (rank r has probability ~ 1 / (r + 1)), as
+ * word ranks. The same seed always gives the same corpus, so runs on
+ * different builds index exactly the same postings.
+ */
+typedef struct {
+  int docs;
+  int vocab;
+  char (*words)[BENCH_WORD_MAX]; // [vocab], pronounceable, short when frequent
+  double *cumulative;            // [vocab], Zipf weights summed by rank
+  int32_t *ranks;                // every document's words back to back
+  size_t *first;                 // [docs + 1], document d is ranks[first[d]..)
+} bench_corpus_t;
+
+// What every benchmark gets: the corpus and where results go
+typedef struct {
+  int docs;
+  int mib;
+  int k;
+  uint64_t seed;
+  const char *scratch; // directory for the files a benchmark writes
+  FILE *out;           // JSON lines, one per result
+  bench_corpus_t corpus;
+  search_engine_t *engine; // the corpus indexed, see bench_engine()
+} bench_t;
+
+double bench_now(void);
+uint64_t bench_random(uint64_t *state);
+int bench_zipf_rank(const bench_corpus_t *corpus, uint64_t *state);
+size_t bench_text(const bench_corpus_t *corpus, int doc, char *out,
+                  size_t cap);
+search_engine_t *bench_index(const bench_corpus_t *corpus);
+search_engine_t *bench_engine(bench_t *bench);
+long bench_peak_rss_kb(void);
+
+void bench_report(bench_t *bench, const char *name, const char *metric,
+                  double value, const char *unit);
+void bench_report_latency(bench_t *bench, const char *name, double *samples,
+                          int count);
+
+void bench_tokenizer(bench_t *bench);
+void bench_insert(bench_t *bench);
+void bench_search(bench_t *bench);
+void bench_serialize(bench_t *bench);
+void bench_ranking(bench_t *bench);
+
+#endif // !BENCH_H
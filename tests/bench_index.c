@@ -0,0 +1,146 @@
+#include "bench.h"
+#include "query_engine.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Lookups timed one by one for the latency percentiles
+#define SEARCH_SAMPLES 20000
+
+/*
+ * trie_insert_at() throughput over the whole corpus, and what the index
+ * costs once built: bytes per posting and per distinct word, and the
+ * process's peak RSS so far.
+ */
+void bench_insert(bench_t *bench) {
+  const bench_corpus_t *corpus = &bench->corpus;
+  size_t postings = corpus->first[corpus->docs];
+  trie_t *trie = trie_create();
+  if (trie == NULL) {
+    perror("trie");
+    return;
+  }
+
+  double t0 = bench_now();
+  for (int d = 0; d < corpus->docs; d++) {
+    size_t first = corpus->first[d], end = corpus->first[d + 1];
+    for (size_t i = first; i < end; i++) {
+      int position = (int)(i - first);
+      trie_insert_at(trie, corpus->words[corpus->ranks[i]], d,
+                     position / 300, position * 6L, position % 300);
+    }
+  }
+  double t = bench_now() - t0;
+
+  // Distinct words: every rank the corpus drew at least once
+  char *seen = calloc(corpus->vocab, 1);
+  long terms = 0;
+  for (size_t i = 0; seen != NULL && i < postings; i++) {
+    terms += !seen[corpus->ranks[i]];
+    seen[corpus->ranks[i]] = 1;
+  }
+  free(seen);
+
+  size_t bytes = trie_memory_bytes(trie);
+  bench_report(bench, "insert", "throughput", postings / t / 1e6,
+               "Mpostings/s");
+  bench_report(bench, "insert", "index_bytes", bytes / 1048576.0, "MiB");
+  bench_report(bench, "insert", "bytes_per_posting", (double)bytes / postings,
+               "B");
+  if (terms > 0)
+    bench_report(bench, "insert", "bytes_per_term", (double)bytes / terms,
+                 "B");
+  bench_report(bench, "insert", "peak_rss", bench_peak_rss_kb() / 1024.0,
+               "MiB");
+  trie_free(trie);
+}
+
+/*
+ * Single-word lookups on the indexed corpus, words drawn by frequency
+ * as a query log would: trie_search() alone (the dictionary walk), then
+ * get_search_results() (the walk plus decoding every occurrence).
+ */
+void bench_search(bench_t *bench) {
+  search_engine_t *engine = bench_engine(bench);
+  double *samples = malloc(sizeof(double) * SEARCH_SAMPLES);
+  int32_t *ranks = malloc(sizeof(int32_t) * SEARCH_SAMPLES);
+  if (engine == NULL || samples == NULL || ranks == NULL) {
+    perror("search");
+    free(samples);
+    free(ranks);
+    return;
+  }
+  uint64_t state = bench->seed + 1;
+  for (int s = 0; s < SEARCH_SAMPLES; s++)
+    ranks[s] = bench_zipf_rank(&bench->corpus, &state);
+
+  volatile uint32_t sink = 0; // keeps the lookups from being dropped
+  for (int s = 0; s < SEARCH_SAMPLES; s++) {
+    const char *word = bench->corpus.words[ranks[s]];
+    double t0 = bench_now();
+    posting_list_t *list = trie_search(engine->index, word);
+    samples[s] = bench_now() - t0;
+    sink += list != NULL ? posting_list_count(list) : 0;
+  }
+  bench_report_latency(bench, "trie_search", samples, SEARCH_SAMPLES);
+
+  long hits = 0;
+  for (int s = 0; s < SEARCH_SAMPLES; s++) {
+    const char *word = bench->corpus.words[ranks[s]];
+    int found = 0;
+    double t0 = bench_now();
+    occurrence_transfer_t *results =
+        get_search_results(engine, word, &found);
+    samples[s] = bench_now() - t0;
+    free(results);
+    hits += found;
+  }
+  bench_report_latency(bench, "results", samples, SEARCH_SAMPLES);
+  bench_report(bench, "results", "hits_per_query",
+               (double)hits / SEARCH_SAMPLES, "hits");
+  (void)sink;
+  free(samples);
+  free(ranks);
+}
+
+/*
+ * Saving and loading the indexed corpus in the scratch directory:
+ * engine_serialize() and engine_deserialize() in MB/s of index file,
+ * and engine_open_mapped(), which only maps and verifies it.
+ */
+void bench_serialize(bench_t *bench) {
+  search_engine_t *engine = bench_engine(bench);
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/bench_suite.%d.db", bench->scratch,
+           (int)getpid());
+  struct stat st;
+
+  double t0 = bench_now();
+  if (engine == NULL || engine_serialize(engine, path) != 0 ||
+      stat(path, &st) != 0) {
+    perror(path);
+    unlink(path);
+    return;
+  }
+  double save = bench_now() - t0;
+  double mb = st.st_size / 1e6;
+
+  t0 = bench_now();
+  search_engine_t *loaded = engine_deserialize(path);
+  double load = bench_now() - t0;
+  t0 = bench_now();
+  search_engine_t *mapped = engine_open_mapped(path);
+  double map = bench_now() - t0;
+
+  bench_report(bench, "serialize", "file_size", mb, "MB");
+  bench_report(bench, "serialize", "save", mb / save, "MB/s");
+  if (loaded != NULL)
+    bench_report(bench, "serialize", "load", mb / load, "MB/s");
+  if (mapped != NULL)
+    bench_report(bench, "serialize", "open_mapped", map * 1e3, "ms");
+  if (loaded == NULL || mapped == NULL)
+    fprintf(stderr, "Could not read back %s\n", path);
+  engine_free(loaded);
+  engine_free(mapped);
+  unlink(path);
+}
@@ -0,0 +1,89 @@
+#include "bench.h"
+#include "query_engine.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Top-k BM25 latency with block-max WAND against exhaustive scoring, on
+// the synthetic corpus
+
+#define QUERIES 200
+
+typedef scored_result_t *(*rank_fn)(search_engine_t *, const char *, int,
+                                    int *);
+
+// Times each query into `samples`; the scores are summed into `checksum`
+static void run(rank_fn fn, search_engine_t *engine, char **queries, int k,
+                double *samples, double *checksum) {
+  *checksum = 0.0;
+  for (int q = 0; q < QUERIES; q++) {
+    int found;
+    double t0 = bench_now();
+    scored_result_t *r = fn(engine, queries[q], k, &found);
+    samples[q] = bench_now() - t0;
+    for (int i = 0; i < found; i++)
+      *checksum += r[i].score;
+    free(r);
+  }
+}
+
+static double mean(const double *samples) {
+  double sum = 0.0;
+  for (int q = 0; q < QUERIES; q++)
+    sum += samples[q];
+  return sum / QUERIES;
+}
+
+void bench_ranking(bench_t *bench) {
+  search_engine_t *engine = bench_engine(bench);
+  if (engine == NULL) {
+    perror("corpus");
+    return;
+  }
+  double t0 = bench_now();
+  engine_update_ranking(engine);
+  bench_report(bench, "ranking", "impacts_build", (bench_now() - t0) * 1e3,
+               "ms");
+
+  // Two to four words each, drawn from the same distribution as the text
+  struct {
+    const char *name;
+    int lo, hi; // word ranks
+  } mixes[] = {
+      {"frequent", 0, 50},
+      {"mixed", 0, 5000},
+      {"rare", 1000, 20000},
+  };
+  uint64_t state = 7;
+  char name[64];
+  for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+    char *queries[QUERIES];
+    for (int q = 0; q < QUERIES; q++) {
+      char buffer[128];
+      size_t len = 0;
+      int words = 2 + (int)(bench_random(&state) % 3);
+      for (int w = 0; w < words; w++) {
+        int rank = mixes[m].lo +
+                   (int)(bench_random(&state) % (mixes[m].hi - mixes[m].lo));
+        len += snprintf(buffer + len, sizeof(buffer) - len, "%s ",
+                        bench->corpus.words[rank]);
+      }
+      queries[q] = strdup(buffer);
+    }
+    double exhaustive[QUERIES], pruned[QUERIES];
+    double exhaustive_sum, pruned_sum;
+    run(search_ranked_exhaustive, engine, queries, bench->k, exhaustive,
+        &exhaustive_sum);
+    run(search_ranked, engine, queries, bench->k, pruned, &pruned_sum);
+    double speedup = mean(exhaustive) / mean(pruned);
+    if (exhaustive_sum != pruned_sum)
+      fprintf(stderr, "%s: block-max results differ!\n", mixes[m].name);
+
+    snprintf(name, sizeof(name), "exhaustive_%s", mixes[m].name);
+    bench_report_latency(bench, name, exhaustive, QUERIES);
+    snprintf(name, sizeof(name), "blockmax_%s", mixes[m].name);
+    bench_report_latency(bench, name, pruned, QUERIES);
+    bench_report(bench, name, "speedup", speedup, "x");
+    for (int q = 0; q < QUERIES; q++)
+      free(queries[q]);
+  }
+}
@@ -0,0 +1,137 @@
+#include "bench.h"
+#include "tokenizer.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tokenizer throughput on synthetic page text, against the old per-byte
+// isalnum/tolower loop for reference
+
+// English-like prose with PDF-ish punctuation and the odd long identifier
+static const char *ascii_words[] = {
+    "the",       "search",   "Engine", "indexes",   "PDF",
+    "documents", "quickly,", "and",    "(returns)", "42",
+    "x86_64",    "B-tree",   "cafe",   "1998-2024", "Optimization.",
+    "configuration_parameter_value",
+};
+
+// The same with accented and Cyrillic words and typographic punctuation
+static const char *mixed_words[] = {
+    "the",       "search",   "Engine", "indexes",   "PDF",
+    "documents", "quickly,", "and",    "(returns)", "42",
+    "x86_64",    "B-tree",   "caf\xC3\xA9", "1998-2024", "Optimization.",
+    "configuration_parameter_value",   "na\xC3\xAFve",
+    "\xD0\x9C\xD0\xB8\xD1\x80",  "\xE2\x80\x94",
+    "\xE2\x80\x9Cquoted\xE2\x80\x9D",
+};
+
+static char *make_text(size_t size, const char **words, size_t nwords) {
+  char *text = malloc(size + 1);
+  if (text == NULL)
+    return NULL;
+  uint32_t state = 2463534242u;
+  size_t len = 0;
+  while (len < size) {
+    state ^= state << 13, state ^= state >> 17, state ^= state << 5;
+    const char *w = words[state % nwords];
+    size_t wl = strlen(w);
+    if (len + wl + 1 > size)
+      break;
+    memcpy(text + len, w, wl);
+    len += wl;
+    text[len++] = (state >> 8) % 11 == 0 ? '\n' : ' ';
+  }
+  memset(text + len, ' ', size - len);
+  text[size] = '\0';
+  return text;
+}
+
+static void count_token(const char *token, size_t len, long byte_offset,
+                        void *user_data) {
+  (void)token;
+  (void)byte_offset;
+  *(size_t *)user_data += len;
+}
+
+// The tokenizer loop index_pdf_into used before tokenize()
+static size_t baseline(const char *text, size_t len, token_fn emit,
+                       void *user_data) {
+  char word[100];
+  int w = 0;
+  size_t count = 0;
+  for (size_t j = 0; j < len; j++) {
+    char c = text[j];
+    if (isalnum(c)) {
+      if (w < 99)
+        word[w++] = tolower(c);
+    } else if (w > 0) {
+      word[w] = '\0';
+      emit(word, w, (long)j, user_data);
+      count++;
+      w = 0;
+    }
+  }
+  return count;
+}
+
+static double best_of(size_t (*run)(const char *, size_t, token_fn, void *),
+                      const char *text, size_t size, size_t *tokens,
+                      size_t *bytes) {
+  double best = 1e9;
+  for (int r = 0; r < 5; r++) {
+    *bytes = 0;
+    double t0 = bench_now();
+    *tokens = run(text, size, count_token, bytes);
+    double t = bench_now() - t0;
+    if (t < best)
+      best = t;
+  }
+  return best;
+}
+
+// The corpus documents back to back, repeated until `size` bytes
+static char *corpus_text(const bench_corpus_t *corpus, size_t size) {
+  char *text = malloc(size + 1);
+  if (text == NULL)
+    return NULL;
+  size_t len = 0, added = 1;
+  for (int d = 0; len < size && added > 0; d = (d + 1) % corpus->docs) {
+    added = bench_text(corpus, d, text + len, size + 1 - len);
+    len += added;
+  }
+  memset(text + len, ' ', size - len);
+  text[size] = '\0';
+  return text;
+}
+
+void bench_tokenizer(bench_t *bench) {
+  size_t size = (size_t)bench->mib << 20;
+  struct {
+    const char *name;
+    const char **words;
+    size_t count;
+  } inputs[] = {
+      {"ascii", ascii_words, sizeof(ascii_words) / sizeof(ascii_words[0])},
+      {"mixed", mixed_words, sizeof(mixed_words) / sizeof(mixed_words[0])},
+      {"zipf", NULL, 0},
+  };
+
+  char metric[64];
+  for (size_t k = 0; k < sizeof(inputs) / sizeof(inputs[0]); k++) {
+    char *text = inputs[k].words != NULL
+                     ? make_text(size, inputs[k].words, inputs[k].count)
+                     : corpus_text(&bench->corpus, size);
+    if (text == NULL) {
+      perror("malloc");
+      return;
+    }
+    size_t tokens, bytes;
+    double t = best_of(tokenize, text, size, &tokens, &bytes);
+    snprintf(metric, sizeof(metric), "%s_tokenize", inputs[k].name);
+    bench_report(bench, "tokenizer", metric, bench->mib / t, "MiB/s");
+    t = best_of(baseline, text, size, &tokens, &bytes);
+    snprintf(metric, sizeof(metric), "%s_baseline", inputs[k].name);
+    bench_report(bench, "tokenizer", metric, bench->mib / t, "MiB/s");
+    free(text);
+  }
+}
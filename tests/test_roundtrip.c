@@ -1,26 +1,61 @@
+#include "crawler.h"
+#include "crc32c.h"
+#include "index_file.h"
 #include "index_structure.h"
+#include "indexer.h"
+#include "key_set.h"
+#include "levenshtein.h"
+#include "lz.h"
+#include "pdf_processor.h"
 #include "query_engine.h"
+#include "segments.h"
+#include "tokenizer.h"
+#include "updater.h"
 #include "toolkit_core.h"
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+// First posting of a word, or doc_id -1 if the word is missing
+static posting_t first_posting(trie_t *trie, const char *word) {
+  posting_t none = {-1, -1, -1, -1};
+  posting_list_t *list = trie_search(trie, word);
+  if (list == NULL)
+    return none;
+  posting_iter_t it;
+  trie_postings_iter(trie, list, &it);
+  return posting_iter_next(&it) ? it.current : none;
+}
 
 void test_trie_basic_logic() {
   printf("Running: test_trie_basic_logic... ");
-  trie_node_t *root = create_node();
+  trie_t *root = trie_create();
 
-  // Test prepending logic: Page 10 should come BEFORE Page 5
-  trie_insert(root, "intelligence", 1, 5, 100);
+  // Test ordering logic: postings come back sorted, so page 5 comes
+  // BEFORE page 10 whatever the insertion order
   trie_insert(root, "intelligence", 1, 10, 200);
+  trie_insert(root, "intelligence", 1, 5, 100);
+  trie_insert(root, "intelligence", 1, 5, 100); // duplicate is skipped
 
-  word_occurrence_t *occ = trie_search(root, "intelligence");
-  assert(occ != NULL);
-  assert(occ->page_num == 10);
-  assert(occ->byte_offset == 200);
-  assert(occ->next->page_num == 5);
-  assert(occ->next->byte_offset == 100);
+  posting_list_t *list = trie_search(root, "intelligence");
+  assert(list != NULL);
+  assert(list->count == 2);
+  posting_iter_t it;
+  trie_postings_iter(root, list, &it);
+  assert(posting_iter_next(&it));
+  assert(it.current.page_num == 5);
+  assert(it.current.byte_offset == 100);
+  assert(posting_iter_next(&it));
+  assert(it.current.page_num == 10);
+  assert(it.current.byte_offset == 200);
+  assert(!posting_iter_next(&it));
 
   trie_free(root);
   printf("PASSED!\n");
@@ -34,15 +69,14 @@ void test_serialization_roundtrip() {
   assert(engine1 != NULL);
 
   // Add dummy documents
-  engine1->doc_count = 2;
-  engine1->document_map[0] = strdup("/test/doc1.pdf");
-  engine1->document_map[1] = strdup("/test/doc2.pdf");
+  engine_add_document(engine1, "/test/doc1.pdf");
+  engine_add_document(engine1, "/test/doc2.pdf");
 
   // Insert words (sam as the original test style)
-  trie_insert(engine1->index_root, "intelligence", 1, 5, 100);
-  trie_insert(engine1->index_root, "intelligence", 1, 10, 200);
-  trie_insert(engine1->index_root, "toolkit", 0, 3, 150);
-  trie_insert(engine1->index_root, "algorithm", 0, 7, 500);
+  trie_insert(engine1->index, "intelligence", 1, 5, 100);
+  trie_insert(engine1->index, "intelligence", 1, 10, 200);
+  trie_insert(engine1->index, "toolkit", 0, 3, 150);
+  trie_insert(engine1->index, "algorithm", 0, 7, 500);
 
   // 2. Serialize
   const char *test_file = "tests/test_data/text_index.db";
@@ -55,16 +89,19 @@ void test_serialization_roundtrip() {
 
   // 4. Verify document map
   assert(engine2->doc_count == 2);
-  assert(strcmp(engine2->document_map[0], "/test/doc1.pdf") == 0);
+  assert(strcmp(engine_get_document_path(engine2, 0), "/test/doc1.pdf") == 0);
 
   // 5. Search and verify data
-  word_occurrence_t *intel = trie_search(engine2->index_root, "intelligence");
+  posting_list_t *intel = trie_search(engine2->index, "intelligence");
   assert(intel != NULL);
-  assert(intel->page_num == 5);
-  assert(intel->byte_offset == 100);
-  assert(intel->next != NULL);
-  assert(intel->next->page_num == 10);
-  assert(intel->next->byte_offset == 200);
+  posting_iter_t it;
+  trie_postings_iter(engine2->index, intel, &it);
+  assert(posting_iter_next(&it));
+  assert(it.current.page_num == 5);
+  assert(it.current.byte_offset == 100);
+  assert(posting_iter_next(&it));
+  assert(it.current.page_num == 10);
+  assert(it.current.byte_offset == 200);
 
   // 6. Cleanup
   engine_free(engine1);
@@ -90,6 +127,73 @@ void test_corrupted_files() {
   search_engine_t *engine = engine_deserialize((char *)bad_file);
   assert(engine == NULL);
 
+  // CRC32C check values
+  assert(crc32c(0, "123456789", 9) == 0xE3069283u);
+  assert(crc32c(crc32c(0, "1234", 4), "56789", 5) == 0xE3069283u);
+
+  // A saved index replaces the old file whole and carries checksums
+  engine = engine_create();
+  engine_add_document(engine, "/test/doc0.pdf");
+  trie_insert_at(engine->index, "checksum", 0, 1, 40, 7);
+  assert(engine_serialize(engine, (char *)bad_file) == 0);
+  engine_free(engine);
+  assert(access("tests/test_data/bad_index.db.tmp", F_OK) != 0);
+  fp = fopen(bad_file, "r+b");
+  assert(fp != NULL);
+  index_file_header_t header;
+  assert(fread(&header, sizeof(header), 1, fp) == 1);
+  assert(header.version == INDEX_VERSION_DOC_TABLE);
+  assert(header.section_count > INDEX_SECTION_CHECKSUMS);
+  engine = engine_open_mapped((char *)bad_file);
+  assert(engine != NULL && trie_search(engine->index, "checksum") != NULL);
+  assert(engine_verify(engine) == 0);
+  engine_free(engine);
+
+  // One flipped bit anywhere in a section, or in the header, is refused.
+  // A mapped open leaves the postings to engine_verify()
+  long flips[] = {(long)header.sections[INDEX_SECTION_POSTINGS].offset,
+                  (long)header.sections[INDEX_SECTION_DOCMETA].offset + 8,
+                  offsetof(index_file_header_t, root)};
+  for (int i = 0; i < 3; i++) {
+    unsigned char byte;
+    assert(fseek(fp, flips[i], SEEK_SET) == 0 && fread(&byte, 1, 1, fp) == 1);
+    byte ^= 0x10;
+    assert(fseek(fp, flips[i], SEEK_SET) == 0 && fwrite(&byte, 1, 1, fp) == 1);
+    fflush(fp);
+    engine = engine_open_mapped((char *)bad_file);
+    assert(i == 0 ? engine != NULL && engine_verify(engine) != 0
+                  : engine == NULL);
+    engine_free(engine);
+    assert(engine_deserialize((char *)bad_file) == NULL);
+    byte ^= 0x10;
+    assert(fseek(fp, flips[i], SEEK_SET) == 0 && fwrite(&byte, 1, 1, fp) == 1);
+    fflush(fp);
+  }
+  fclose(fp);
+  engine = engine_deserialize((char *)bad_file);
+  assert(engine != NULL);
+  engine_free(engine);
+
+  // Older layouts, still written for tries without positions, are
+  // checksummed just the same
+  engine = engine_create();
+  engine->index->positional = false;
+  engine_add_document(engine, "/test/doc0.pdf");
+  trie_insert(engine->index, "checksum", 0, 1, 40);
+  assert(engine_serialize(engine, (char *)bad_file) == 0);
+  engine_free(engine);
+  fp = fopen(bad_file, "r+b");
+  assert(fp != NULL && fread(&header, sizeof(header), 1, fp) == 1);
+  assert(header.version == INDEX_VERSION_FLAT);
+  assert(header.section_count > INDEX_SECTION_CHECKSUMS);
+  long postings = (long)header.sections[INDEX_SECTION_POSTINGS].offset;
+  unsigned char byte;
+  assert(fseek(fp, postings, SEEK_SET) == 0 && fread(&byte, 1, 1, fp) == 1);
+  byte ^= 0x10;
+  assert(fseek(fp, postings, SEEK_SET) == 0 && fwrite(&byte, 1, 1, fp) == 1);
+  fclose(fp);
+  assert(engine_deserialize((char *)bad_file) == NULL);
+
   printf("PASSED!\n");
 }
 
@@ -108,7 +212,7 @@ void test_empty_engine() {
   assert(engine2 != NULL);
   assert(engine2->doc_count == 0);
 
-  word_occurrence_t *none = trie_search(engine2->index_root, "anything");
+  posting_list_t *none = trie_search(engine2->index, "anything");
   assert(none == NULL);
 
   engine_free(engine1);
@@ -121,10 +225,10 @@ void test_query_engine_array_packing() {
   printf("Running: test_query_engine_array_packing... ");
 
   // Create a dummy engine for this test
-  search_engine_t engine;
-  engine.index_root = create_node();
+  search_engine_t engine = {0};
+  engine.index = trie_create();
 
-  trie_insert(engine.index_root, "toolkit", 1, 1, 15);
+  trie_insert(engine.index, "toolkit", 1, 1, 15);
 
   int count = 0;
   occurrence_transfer_t *results =
@@ -139,7 +243,1970 @@ void test_query_engine_array_packing() {
   assert(results[0].byte_offset == 15); // byte_offset
 
   free(results);
-  trie_free(engine.index_root);
+  trie_free(engine.index);
+  printf("PASSED!\n");
+}
+
+void test_arena_handles() {
+  printf("Running: test_arena_handles... ");
+
+  trie_t *trie = trie_create();
+  assert(trie != NULL);
+  assert(trie->root != ARENA_NULL);
+
+  // Enough distinct words to spill over into several node slabs
+  char word[16];
+  for (int i = 0; i < 20000; i++) {
+    snprintf(word, sizeof(word), "w%d", i);
+    trie_insert(trie, word, i, i % 7, i * 3);
+  }
+  assert(trie->lists.next_handle == 20001);
+
+  for (int i = 0; i < 20000; i += 997) {
+    snprintf(word, sizeof(word), "w%d", i);
+    posting_list_t *list = trie_search(trie, word);
+    assert(list != NULL && list->count == 1);
+    posting_t p = first_posting(trie, word);
+    assert(p.doc_id == i);
+    assert(p.page_num == i % 7);
+    assert(p.byte_offset == i * 3);
+  }
+
+  trie_free(trie);
+  printf("PASSED!\n");
+}
+
+void test_adaptive_nodes() {
+  printf("Running: test_adaptive_nodes... ");
+
+  trie_t *trie = trie_create();
+
+  // Words that are prefixes of each other and split compressed paths
+  trie_insert(trie, "international", 0, 1, 10);
+  trie_insert(trie, "internationalization", 0, 1, 20);
+  trie_insert(trie, "internet", 0, 2, 30);
+  trie_insert(trie, "in", 0, 3, 40);
+  assert(first_posting(trie, "international").byte_offset == 10);
+  assert(first_posting(trie, "internationalization").byte_offset == 20);
+  assert(first_posting(trie, "internet").byte_offset == 30);
+  assert(first_posting(trie, "in").byte_offset == 40);
+  assert(trie_search(trie, "inter") == NULL);
+  assert(trie_search(trie, "internationalize") == NULL);
+  assert(trie_search(trie, "i") == NULL);
+
+  // Fan out one node through Node4 -> Node16 -> Node48 -> Node256,
+  // including bytes outside the ASCII range
+  char word[3] = {'x', 0, 0};
+  for (int c = 1; c < 256; c++) {
+    word[1] = (char)c;
+    trie_insert(trie, word, c, 0, c);
+  }
+  for (int c = 1; c < 256; c++) {
+    word[1] = (char)c;
+    assert(first_posting(trie, word).doc_id == c);
+  }
+  uint32_t x = trie_find_child(trie, trie->root, 'x');
+  assert(trie_node_type(x) == TRIE_NODE256);
+
+  // Far smaller than the 1 KB per character of the old layout
+  assert(trie_memory_bytes(trie) < 4 * 1024 * 1024);
+
+  trie_free(trie);
+  printf("PASSED!\n");
+}
+
+void test_compressed_postings() {
+  printf("Running: test_compressed_postings... ");
+
+  trie_t *trie = trie_create();
+
+  // Enough postings to span several blocks, with offsets past 32 bits
+  for (int doc = 0; doc < 50; doc++) {
+    for (int page = 0; page < 20; page++) {
+      for (long off = 0; off < 5; off++) {
+        trie_insert(trie, "the", doc, page, off * 1000 + ((long)doc << 33));
+      }
+    }
+  }
+  posting_list_t *list = trie_search(trie, "the");
+  assert(list->count == 50 * 20 * 5);
+  assert(list->doc_count == 50);
+  assert(list->head != list->tail);
+
+  posting_iter_t it;
+  trie_postings_iter(trie, list, &it);
+  uint32_t n = 0;
+  while (posting_iter_next(&it)) {
+    int doc = n / 100, page = (n / 5) % 20;
+    long off = (n % 5) * 1000 + ((long)doc << 33);
+    assert(it.current.doc_id == doc);
+    assert(it.current.page_num == page);
+    assert(it.current.byte_offset == off);
+    n++;
+  }
+  assert(n == list->count);
+
+  // Roughly 2 bytes per posting instead of a 24-byte linked node
+  assert(trie->postings.next_unit * BYTE_ARENA_UNIT < list->count * 6);
+
+  trie_free(trie);
+  printf("PASSED!\n");
+}
+
+void test_mapped_index() {
+  printf("Running: test_mapped_index... ");
+
+  search_engine_t *engine1 = engine_create();
+  engine_add_document(engine1, "/test/doc1.pdf");
+  engine_add_document(engine1, "/test/doc2.pdf");
+  trie_insert(engine1->index, "intelligence", 1, 5, 100);
+  trie_insert(engine1->index, "intelligence", 1, 10, 200);
+  trie_insert(engine1->index, "toolkit", 0, 3, 150);
+
+  const char *test_file = "tests/test_data/mapped_index.db";
+  assert(engine_serialize(engine1, (char *)test_file) == 0);
+
+  // Served straight from the mapping, no trie rebuild
+  search_engine_t *engine2 = engine_open_mapped((char *)test_file);
+  assert(engine2 != NULL);
+  assert(engine2->mapping != NULL);
+  assert(engine2->doc_count == 2);
+  assert(strcmp(engine_get_document_path(engine2, 1), "/test/doc2.pdf") == 0);
+  assert(engine_get_document_path(engine2, 2) == NULL);
+
+  int count = 0;
+  occurrence_transfer_t *results =
+      get_search_results(engine2, "intelligence", &count);
+  assert(count == 2);
+  assert(results[0].doc_id == 1 && results[0].page_num == 5);
+  assert(results[1].page_num == 10 && results[1].byte_offset == 200);
+  free(results);
+
+  // The mapping is read-only, inserts are refused instead of faulting
+  trie_insert(engine2->index, "newword", 0, 0, 0);
+  assert(trie_search(engine2->index, "newword") == NULL);
+
+  engine_free(engine1);
+  engine_free(engine2);
+  printf("PASSED!\n");
+}
+
+void test_legacy_tree_file() {
+  printf("Running: test_legacy_tree_file... ");
+
+  // Hand-written version 1 file: one doc and the word "ab" stored newest
+  // first, the way the old prepend-based writer did it
+  const char *old_file = "tests/test_data/legacy_index.db";
+  FILE *fp = fopen(old_file, "wb");
+  assert(fp != NULL);
+  uint32_t magic = 0xD0C0C0DE;
+  uint16_t version = 1;
+  int doc_count = 1, len = 4;
+  fwrite(&magic, sizeof(uint32_t), 1, fp);
+  fwrite(&version, sizeof(uint16_t), 1, fp);
+  fwrite(&doc_count, sizeof(int), 1, fp);
+  fwrite(&len, sizeof(int), 1, fp);
+  fwrite("/old", 1, 4, fp);
+
+  bool no = false, yes = true;
+  int one = 1, zero = 0, two = 2;
+  fwrite(&no, sizeof(bool), 1, fp); // root
+  fwrite(&one, sizeof(int), 1, fp);
+  int a = 'a', b = 'b';
+  fwrite(&a, sizeof(int), 1, fp); // 'a': no word, one child
+  fwrite(&no, sizeof(bool), 1, fp);
+  fwrite(&one, sizeof(int), 1, fp);
+  fwrite(&zero, sizeof(int), 1, fp);
+  fwrite(&b, sizeof(int), 1, fp); // 'b': ends "ab", two occurrences
+  fwrite(&yes, sizeof(bool), 1, fp);
+  fwrite(&zero, sizeof(int), 1, fp);
+  fwrite(&two, sizeof(int), 1, fp);
+  int page = 9;
+  long offset = 90;
+  fwrite(&zero, sizeof(int), 1, fp);
+  fwrite(&page, sizeof(int), 1, fp);
+  fwrite(&offset, sizeof(long), 1, fp);
+  page = 1;
+  offset = 10;
+  fwrite(&zero, sizeof(int), 1, fp);
+  fwrite(&page, sizeof(int), 1, fp);
+  fwrite(&offset, sizeof(long), 1, fp);
+  fclose(fp);
+
+  // engine_open_mapped falls back to the tree loader for old files
+  search_engine_t *engine = engine_open_mapped((char *)old_file);
+  assert(engine != NULL);
+  assert(engine->mapping == NULL);
+  assert(strcmp(engine_get_document_path(engine, 0), "/old") == 0);
+
+  int count = 0;
+  occurrence_transfer_t *results = get_search_results(engine, "ab", &count);
+  assert(count == 2);
+  assert(results[0].page_num == 1 && results[1].page_num == 9);
+  free(results);
+
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+static void count_progress(int done, int total, const char *path,
+                           void *user_data) {
+  int *seen = user_data;
+  assert(done == *seen + 1 && total == 24 && path != NULL);
+  *seen = done;
+}
+
+void test_parallel_indexing() {
+  printf("Running: test_parallel_indexing... ");
+
+  // 1. Merging appends the source postings after the target's
+  trie_t *dst = trie_create();
+  trie_t *src = trie_create();
+  trie_insert(dst, "alpha", 0, 1, 10);
+  trie_insert(src, "alpha", 1, 0, 5);
+  trie_insert(src, "alphabet", 1, 2, 7);
+  assert(trie_merge(dst, src) == 0);
+  assert(trie_search(dst, "alpha")->count == 2);
+  assert(first_posting(dst, "alphabet").page_num == 2);
+
+  // A reset trie is empty but can be filled again
+  assert(trie_reset(src) == 0);
+  assert(trie_search(src, "alpha") == NULL);
+  trie_insert(src, "beta", 2, 0, 0);
+  assert(first_posting(src, "beta").doc_id == 2);
+  trie_free(dst);
+  trie_free(src);
+
+  // 2. Same documents indexed with one and with four workers
+  const char *files[] = {"tests/test_data/sample.pdf",
+                         "tests/test_data/Application Resume.pdf"};
+  search_engine_t *serial = engine_create();
+  search_engine_t *parallel = engine_create();
+  for (int i = 0; i < 24; i++) {
+    engine_add_document(serial, files[i % 2]);
+    engine_add_document(parallel, files[i % 2]);
+  }
+
+  int seen = 0;
+  assert(engine_index_parallel(serial, 1, NULL, NULL) == 0);
+  assert(engine_index_parallel(parallel, 4, count_progress, &seen) == 0);
+  assert(seen == 24);
+
+  // 3. Doc ids and posting order do not depend on the worker count
+  assert(serial->index->lists.next_handle ==
+         parallel->index->lists.next_handle);
+  const char *words[] = {"sam", "the", "a", "pdf"};
+  for (int w = 0; w < 4; w++) {
+    int n1 = 0, n2 = 0;
+    occurrence_transfer_t *r1 = get_search_results(serial, words[w], &n1);
+    occurrence_transfer_t *r2 = get_search_results(parallel, words[w], &n2);
+    assert(n1 == n2);
+    for (int i = 0; i < n1; i++) {
+      assert(r1[i].doc_id == r2[i].doc_id && r1[i].page_num == r2[i].page_num &&
+             r1[i].byte_offset == r2[i].byte_offset);
+    }
+    free(r1);
+    free(r2);
+  }
+
+  engine_free(serial);
+  engine_free(parallel);
+  printf("PASSED!\n");
+}
+
+static void touch(const char *path) {
+  FILE *fp = fopen(path, "w");
+  assert(fp != NULL);
+  fclose(fp);
+}
+
+static void count_batch(const char *const *paths, int count, int first_doc_id,
+                        void *user_data) {
+  int *seen = user_data;
+  assert(first_doc_id == *seen && count <= 3);
+  for (int i = 0; i < count; i++) {
+    assert(strstr(paths[i], "tests/test_data/crawl/") == paths[i]);
+  }
+  *seen += count;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+void test_parallel_crawl() {
+  printf("Running: test_parallel_crawl... ");
+
+  // 1. A small tree: nested folders, mixed case, filtered and bare names
+  system("rm -rf tests/test_data/crawl");
+  system("mkdir -p tests/test_data/crawl/a/b/c tests/test_data/crawl/d");
+  touch("tests/test_data/crawl/one.pdf");
+  touch("tests/test_data/crawl/notes.txt");
+  touch("tests/test_data/crawl/.pdf");
+  touch("tests/test_data/crawl/README");
+  touch("tests/test_data/crawl/a/two.PDF");
+  touch("tests/test_data/crawl/a/b/three.pdf");
+  touch("tests/test_data/crawl/a/b/c/four.pdf");
+  touch("tests/test_data/crawl/a/b/c/draft.md");
+  touch("tests/test_data/crawl/d/five.pdf");
+  touch("tests/test_data/crawl/d/six.pdf");
+
+  // 2. Four workers, batches of three
+  search_engine_t *engine = engine_create();
+  int seen = 0;
+  crawl_options_t options = {0};
+  options.workers = 4;
+  options.batch_size = 3;
+  options.on_batch = count_batch;
+  options.user_data = &seen;
+  assert(crawl_directory_parallel("tests/test_data/crawl/", engine,
+                                  &options) == 0);
+  assert(engine->doc_count == 6 && seen == 6);
+
+  // Workers finish in any order, so compare the sorted paths
+  char *paths[6];
+  for (int i = 0; i < 6; i++)
+    paths[i] = strdup(engine_get_document_path(engine, i));
+  qsort(paths, 6, sizeof(char *), compare_paths);
+  assert(strcmp(paths[0], "tests/test_data/crawl/a/b/c/four.pdf") == 0);
+  assert(strcmp(paths[4], "tests/test_data/crawl/d/six.pdf") == 0);
+  assert(strcmp(paths[5], "tests/test_data/crawl/one.pdf") == 0);
+  for (int i = 0; i < 6; i++)
+    free(paths[i]);
+  engine_free(engine);
+
+  // 3. Extension filters: the exclude list wins over the include list
+  const char *include[] = {"txt", "md", "pdf", NULL};
+  const char *exclude[] = {"pdf", NULL};
+  engine = engine_create();
+  crawl_options_t text_only = {0};
+  text_only.workers = 2;
+  text_only.include_ext = include;
+  text_only.exclude_ext = exclude;
+  assert(crawl_directory_parallel("tests/test_data/crawl", engine,
+                                  &text_only) == 0);
+  assert(engine->doc_count == 2);
+  engine_free(engine);
+
+  // 4. A missing root fails cleanly
+  engine = engine_create();
+  assert(crawl_directory_parallel("tests/test_data/crawl/missing", engine,
+                                  NULL) == -1);
+  assert(engine->doc_count == 0);
+  engine_free(engine);
+
+  system("rm -rf tests/test_data/crawl");
+  printf("PASSED!\n");
+}
+
+// Every hit of `word` belongs to `doc_id`; returns the hit count
+static int hits_only_in(search_engine_t *engine, const char *word, int doc_id) {
+  int count = 0;
+  occurrence_transfer_t *results = get_search_results(engine, word, &count);
+  for (int i = 0; i < count; i++) {
+    assert(results[i].doc_id == doc_id);
+  }
+  free(results);
+  return count;
+}
+
+void test_incremental_update() {
+  printf("Running: test_incremental_update... ");
+
+  system("rm -rf tests/test_data/update && mkdir -p tests/test_data/update");
+  system("cp tests/test_data/sample.pdf tests/test_data/update/a.pdf");
+  system("cp 'tests/test_data/Application Resume.pdf' "
+         "tests/test_data/update/b.pdf");
+
+  // 1. First run indexes everything and records fingerprints
+  search_engine_t *engine = engine_create();
+  update_stats_t stats;
+  assert(engine_update_directory(engine, "tests/test_data/update", NULL, NULL,
+                                 NULL, &stats) == 0);
+  assert(stats.added == 2 && stats.unchanged == 0 && engine->doc_count == 2);
+  assert(engine->doc_meta[0].flags & DOC_META_KNOWN);
+  assert(engine->doc_meta[1].size > 0);
+  assert(engine->doc_meta[0].length > 0 && engine->length_docs == 2);
+
+  // 2. Nothing changed, then only the mtime changed
+  assert(engine_update_directory(engine, "tests/test_data/update", NULL, NULL,
+                                 NULL, &stats) == 0);
+  assert(stats.unchanged == 2 && stats.added == 0 && stats.modified == 0);
+  system("touch -d '2001-01-01' tests/test_data/update/a.pdf");
+  assert(engine_update_directory(engine, "tests/test_data/update/", NULL,
+                                 NULL, NULL, &stats) == 0);
+  assert(stats.unchanged == 2 && engine->doc_count == 2);
+
+  // 3. b.pdf gets a's content, a.pdf disappears
+  system("cp tests/test_data/sample.pdf tests/test_data/update/b.pdf");
+  system("rm tests/test_data/update/a.pdf");
+  assert(engine_update_directory(engine, "tests/test_data/update", NULL, NULL,
+                                 NULL, &stats) == 0);
+  assert(stats.modified == 1 && stats.deleted == 1 && stats.added == 0);
+  assert(engine->doc_count == 3 && engine->deleted_count == 2);
+  assert(engine_doc_deleted(engine, 0) && engine_doc_deleted(engine, 1));
+  assert(engine->length_docs == 1 &&
+         engine->total_length == engine->doc_meta[2].length);
+  const char *words[] = {"sam", "the", "a", "pdf"};
+  int before[4];
+  for (int w = 0; w < 4; w++) {
+    before[w] = hits_only_in(engine, words[w], 2);
+  }
+
+  // 4. Tombstones and fingerprints survive a save and a mapped open
+  const char *test_file = "tests/test_data/update_index.db";
+  assert(engine_serialize(engine, (char *)test_file) == 0);
+  search_engine_t *mapped = engine_open_mapped((char *)test_file);
+  assert(mapped != NULL && mapped->deleted_count == 2);
+  assert(engine_doc_deleted(mapped, 1) && !engine_doc_deleted(mapped, 2));
+  assert(mapped->doc_meta[2].hash == engine->doc_meta[2].hash);
+  assert(mapped->total_length == engine->total_length &&
+         mapped->length_docs == 1);
+  assert(hits_only_in(mapped, words[0], 2) == before[0]);
+  engine_free(mapped);
+
+  // 5. Compaction drops the tombstones and renumbers what is left
+  assert(engine_compact(engine) == 0);
+  assert(engine->doc_count == 1 && engine->deleted_count == 0);
+  assert(strcmp(engine_get_document_path(engine, 0),
+                "tests/test_data/update/b.pdf") == 0);
+  assert(engine->length_docs == 1 &&
+         engine->total_length == engine->doc_meta[0].length);
+  for (int w = 0; w < 4; w++) {
+    assert(hits_only_in(engine, words[w], 0) == before[w]);
+  }
+
+  engine_free(engine);
+  system("rm -rf tests/test_data/update");
+  printf("PASSED!\n");
+}
+
+void test_snippet_batch() {
+  printf("Running: test_snippet_batch... ");
+
+  search_engine_t *engine = engine_create();
+  engine_add_document(engine, "tests/test_data/sample.pdf");
+  engine_add_document(engine, "tests/test_data/Application Resume.pdf");
+  engine_add_document(engine, "tests/test_data/missing.pdf");
+  assert(engine_index_parallel(engine, 1, NULL, NULL) == 0);
+
+  // Hits from both documents plus one that cannot be opened
+  int count = 0;
+  occurrence_transfer_t *found = get_search_results(engine, "the", &count);
+  occurrence_transfer_t *hits =
+      malloc(sizeof(occurrence_transfer_t) * (count + 1));
+  for (int i = 0; i < count; i++) {
+    hits[i] = found[count - 1 - i]; // any order works
+  }
+  hits[count].doc_id = 2;
+  hits[count].page_num = 0;
+  hits[count].byte_offset = 0;
+  free(found);
+
+  snippet_batch_t *batch = get_snippets(engine, hits, count + 1, 4);
+  assert(batch != NULL && batch->count == count + 1);
+  assert(batch->offsets[count] == -1);
+  for (int i = 0; i < count; i++) {
+    const char *path = engine_get_document_path(engine, hits[i].doc_id);
+    char *single = get_snippet(path, hits[i].page_num, hits[i].byte_offset);
+    assert(single != NULL && batch->offsets[i] >= 0);
+    assert((size_t)batch->offsets[i] < batch->text_size);
+    assert(strcmp(batch->text + batch->offsets[i], single) == 0);
+    free_snippet(single);
+  }
+  free_snippet_batch(batch);
+
+  // An empty request still hands back a batch
+  batch = get_snippets(engine, NULL, 0, 0);
+  assert(batch != NULL && batch->count == 0);
+  free_snippet_batch(batch);
+
+  free(hits);
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+void test_lz_codec() {
+  printf("Running: test_lz_codec... ");
+
+  // Text-like input with plenty of repeats, plus a pseudo random tail
+  size_t n = 200000;
+  uint8_t *src = malloc(n);
+  const char *phrase = "the quick brown fox jumps over the lazy dog. ";
+  size_t phrase_len = strlen(phrase);
+  uint32_t state = 12345;
+  for (size_t i = 0; i < n; i++) {
+    state = state * 1103515245 + 12345;
+    src[i] = i < n / 2 ? (uint8_t)phrase[i % phrase_len]
+                       : (uint8_t)(state >> 16);
+  }
+  uint8_t *packed = malloc(lz_bound(n));
+  uint8_t *out = malloc(n);
+  size_t packed_len = lz_compress(src, n, packed, lz_bound(n));
+  assert(packed_len > 0 && packed_len < n * 6 / 10);
+  assert(lz_decompress(packed, packed_len, out, n) == 0);
+  assert(memcmp(src, out, n) == 0);
+
+  // Empty and tiny inputs
+  for (size_t len = 0; len < 10; len++) {
+    size_t m = lz_compress(src, len, packed, lz_bound(len));
+    assert(lz_decompress(packed, m, out, len) == 0);
+    assert(memcmp(src, out, len) == 0);
+  }
+
+  // Truncated blocks and wrong sizes are rejected, not overrun
+  assert(lz_decompress(packed, packed_len / 2, out, n) != 0);
+  packed_len = lz_compress(src, 1000, packed, lz_bound(1000));
+  assert(lz_decompress(packed, packed_len, out, 999) != 0);
+  assert(lz_compress(src, n, packed, n / 2) == 0);
+
+  free(src);
+  free(packed);
+  free(out);
+  printf("PASSED!\n");
+}
+
+void test_text_store() {
+  printf("Running: test_text_store... ");
+
+  // 1. Index a copy of a PDF, then lose the PDF after saving
+  system("rm -rf tests/test_data/texts && mkdir -p tests/test_data/texts");
+  system("cp tests/test_data/sample.pdf tests/test_data/texts/gone.pdf");
+  search_engine_t *engine = engine_create();
+  engine_add_document(engine, "tests/test_data/texts/gone.pdf");
+  engine_add_document(engine, "tests/test_data/sample.pdf");
+  assert(engine_index_parallel(engine, 2, NULL, NULL) == 0);
+  assert(text_store_has(engine->texts, 0) && text_store_has(engine->texts, 1));
+
+  int count = 0;
+  occurrence_transfer_t *hits = get_search_results(engine, "the", &count);
+  char **expected = malloc(sizeof(char *) * (count + 1));
+  for (int i = 0; i < count; i++) {
+    expected[i] = get_snippet(engine_get_document_path(engine, hits[i].doc_id),
+                              hits[i].page_num, hits[i].byte_offset);
+    char *stored = engine_get_snippet(engine, hits[i].doc_id, hits[i].page_num,
+                                      hits[i].byte_offset);
+    assert(expected[i] != NULL && strcmp(stored, expected[i]) == 0);
+    free_snippet(stored);
+  }
+
+  const char *test_file = "tests/test_data/texts/index.db";
+  assert(engine_serialize(engine, (char *)test_file) == 0);
+  engine_free(engine);
+  system("rm tests/test_data/texts/gone.pdf");
+
+  // 2. Snippets come from the mapped side-car, no PDF needed
+  engine = engine_open_mapped((char *)test_file);
+  assert(engine != NULL && engine->texts->mapping != NULL);
+  for (int i = 0; i < count; i++) {
+    char *stored = engine_get_snippet(engine, hits[i].doc_id, hits[i].page_num,
+                                      hits[i].byte_offset);
+    assert(stored != NULL && strcmp(stored, expected[i]) == 0);
+    free_snippet(stored);
+  }
+  assert(text_store_get_page(engine->texts, 0, 100000, NULL) == NULL);
+  assert(text_store_get_page(engine->texts, 7, 0, NULL) == NULL);
+  engine_free(engine);
+
+  // 3. A writable reload keeps the old pages when it is saved again
+  engine = engine_deserialize((char *)test_file);
+  assert(engine != NULL && text_store_has(engine->texts, 0));
+  assert(engine_serialize(engine, (char *)test_file) == 0);
+  engine_free(engine);
+  engine = engine_open_mapped((char *)test_file);
+  if (count > 0) {
+    char *stored = engine_get_snippet(engine, hits[0].doc_id, hits[0].page_num,
+                                      hits[0].byte_offset);
+    assert(stored != NULL && strcmp(stored, expected[0]) == 0);
+    free_snippet(stored);
+  }
+  engine_free(engine);
+
+  for (int i = 0; i < count; i++) {
+    free_snippet(expected[i]);
+  }
+  free(expected);
+  free(hits);
+  system("rm -rf tests/test_data/texts");
+  printf("PASSED!\n");
+}
+
+typedef struct {
+  char words[16][TOKEN_MAX_BYTES + 1];
+  long offsets[16];
+  int count;
+} token_log_t;
+
+static void log_token(const char *token, size_t len, long byte_offset,
+                      void *user_data) {
+  token_log_t *log = user_data;
+  assert(strlen(token) == len);
+  if (log->count < 16) {
+    memcpy(log->words[log->count], token, len + 1);
+    log->offsets[log->count] = byte_offset;
+  }
+  log->count++;
+}
+
+void test_tokenizer() {
+  printf("Running: test_tokenizer... ");
+
+  // ASCII words are lowercased and keep their starting byte offsets
+  token_log_t log = {0};
+  const char *text = "Hello, WORLD! x86_64 -- End";
+  assert(tokenize(text, strlen(text), log_token, &log) == 5);
+  assert(strcmp(log.words[0], "hello") == 0 && log.offsets[0] == 0);
+  assert(strcmp(log.words[1], "world") == 0 && log.offsets[1] == 7);
+  assert(strcmp(log.words[2], "x86") == 0 && log.offsets[2] == 14);
+  assert(strcmp(log.words[3], "64") == 0 && log.offsets[3] == 18);
+  assert(strcmp(log.words[4], "end") == 0 && log.offsets[4] == 24);
+
+  // UTF-8 letters stay inside words and are case folded; typographic
+  // punctuation and invalid bytes split words
+  memset(&log, 0, sizeof(log));
+  text = "Caf\xC3\x89 \xC3\x9C"
+         "ber\xE2\x80\x94"
+         "NA\xC3\x8FVE \xCE\xA3\xCE\xA9 \xD0\x9C\xD0\x98\xD0\xA0 ab\xFF"
+         "cd";
+  assert(tokenize(text, strlen(text), log_token, &log) == 7);
+  assert(strcmp(log.words[0], "caf\xC3\xA9") == 0);
+  assert(strcmp(log.words[1], "\xC3\xBC" "ber") == 0 && log.offsets[1] == 6);
+  assert(strcmp(log.words[2], "na\xC3\xAFve") == 0 && log.offsets[2] == 14);
+  assert(strcmp(log.words[3], "\xCF\x83\xCF\x89") == 0);
+  assert(strcmp(log.words[4], "\xD0\xBC\xD0\xB8\xD1\x80") == 0);
+  assert(strcmp(log.words[5], "ab") == 0 && strcmp(log.words[6], "cd") == 0);
+
+  // Long runs are dropped whole; words either side survive. Lengths cross
+  // the vector widths so the bulk and tail paths both run.
+  char buf[1024];
+  for (size_t n = 1; n < 300; n += 7) {
+    memset(&log, 0, sizeof(log));
+    size_t len = 0;
+    buf[len++] = 'a';
+    buf[len++] = ' ';
+    for (size_t k = 0; k < n; k++)
+      buf[len++] = (char)('A' + k % 26);
+    memcpy(buf + len, " zz", 3);
+    len += 3;
+    int expected = n <= TOKEN_MAX_BYTES ? 3 : 2;
+    assert(tokenize(buf, len, log_token, &log) == (size_t)expected);
+    assert(strcmp(log.words[expected - 1], "zz") == 0);
+    assert(log.offsets[expected - 1] == (long)(len - 2));
+    if (expected == 3)
+      assert(strlen(log.words[1]) == n && log.words[1][0] == 'a');
+  }
+
+  // Separators and stray continuation bytes only
+  memset(&log, 0, sizeof(log));
+  assert(tokenize(" \t\n.,;\x80\xBF\xC3", 9, log_token, &log) == 0);
+  assert(tokenize("", 0, log_token, &log) == 0);
+
+  printf("PASSED!\n");
+}
+
+void test_key_sets() {
+  printf("Running: test_key_sets... ");
+
+  // Random sets at several density ratios, checked against a bitmap so
+  // the merge (SIMD), galloping and scalar tail paths are all covered
+  enum { UNIVERSE = 4096 };
+  static uint64_t a[UNIVERSE], b[UNIVERSE], out[2 * UNIVERSE];
+  uint32_t state = 7;
+  int densities[][2] = {{50, 50}, {2, 90}, {90, 2}, {100, 30}, {1, 1}};
+  for (int d = 0; d < 5; d++) {
+    for (int round = 0; round < 20; round++) {
+      bool in_a[UNIVERSE], in_b[UNIVERSE];
+      size_t na = 0, nb = 0;
+      for (int k = 0; k < UNIVERSE; k++) {
+        state = state * 1103515245 + 12345;
+        in_a[k] = (int)((state >> 8) % 100) < densities[d][0];
+        state = state * 1103515245 + 12345;
+        in_b[k] = (int)((state >> 8) % 100) < densities[d][1];
+        if (in_a[k])
+          a[na++] = key_pack(k / 8, k % 8);
+        if (in_b[k])
+          b[nb++] = key_pack(k / 8, k % 8);
+      }
+      size_t n = key_intersect(a, na, b, nb, out), expect = 0;
+      for (int k = 0; k < UNIVERSE; k++) {
+        if (in_a[k] && in_b[k])
+          assert(out[expect++] == key_pack(k / 8, k % 8));
+      }
+      assert(n == expect);
+
+      n = key_union(a, na, b, nb, out), expect = 0;
+      for (int k = 0; k < UNIVERSE; k++) {
+        if (in_a[k] || in_b[k])
+          assert(out[expect++] == key_pack(k / 8, k % 8));
+      }
+      assert(n == expect);
+
+      n = key_difference(a, na, b, nb, out), expect = 0;
+      for (int k = 0; k < UNIVERSE; k++) {
+        if (in_a[k] && !in_b[k])
+          assert(out[expect++] == key_pack(k / 8, k % 8));
+      }
+      assert(n == expect);
+    }
+  }
+
+  for (size_t i = 0; i < 100; i++)
+    a[i] = i * 3;
+  assert(key_gallop(a, 100, 0, 0) == 0);
+  assert(key_gallop(a, 100, 0, 151) == 51);
+  assert(key_gallop(a, 100, 60, 151) == 60);
+  assert(key_gallop(a, 100, 0, 1000) == 100);
+  printf("PASSED!\n");
+}
+
+void test_posting_seek() {
+  printf("Running: test_posting_seek... ");
+  trie_t *trie = trie_create();
+  // Enough postings for a long chain of blocks
+  for (int doc = 0; doc < 2000; doc++) {
+    for (int page = 0; page < 3; page++)
+      trie_insert(trie, "dense", doc * 2, page, 10 + page);
+  }
+  posting_list_t *list = trie_search(trie, "dense");
+  posting_iter_t it;
+  trie_postings_iter(trie, list, &it);
+  assert(posting_iter_seek(&it, 0, 0) && it.current.doc_id == 0);
+  assert(posting_iter_seek(&it, 0, 0) && it.current.page_num == 0);
+  assert(posting_iter_seek(&it, 7, 0) && it.current.doc_id == 8);
+  assert(posting_iter_seek(&it, 1500, 2) && it.current.doc_id == 1500 &&
+         it.current.page_num == 2 && it.current.byte_offset == 12);
+  assert(posting_iter_seek(&it, 1500, 3) && it.current.doc_id == 1502);
+  assert(posting_iter_next(&it) && it.current.page_num == 1);
+  assert(posting_iter_seek(&it, 3998, 2) && it.current.doc_id == 3998);
+  assert(posting_iter_seek(&it, 10, 0) && it.current.doc_id == 3998);
+  assert(!posting_iter_seek(&it, 3999, 0));
+  // Exhausted: the last posting decoded is no longer a hit
+  assert(!posting_iter_seek(&it, 10, 0));
+  assert(!posting_iter_seek(&it, 3998, 2));
+  assert(!posting_iter_next(&it));
+
+  // Stopped at the document limit, the same
+  trie_postings_iter(trie, list, &it);
+  it.doc_limit = 100;
+  assert(posting_iter_seek(&it, 98, 1) && it.current.doc_id == 98);
+  assert(!posting_iter_seek(&it, 99, 0));
+  assert(!posting_iter_seek(&it, 0, 0));
+  trie_free(trie);
+  printf("PASSED!\n");
+}
+
+void test_boolean_query() {
+  printf("Running: test_boolean_query... ");
+  search_engine_t *engine = engine_create();
+  for (int i = 0; i < 4; i++)
+    engine_add_document(engine, "/test/doc.pdf");
+
+  // doc 0: neural (p0) network (p1)     doc 1: neural network (p2)
+  // doc 2: network graph (p0)           doc 3: neural graph (p4)
+  trie_insert(engine->index, "neural", 0, 0, 5);
+  trie_insert(engine->index, "network", 0, 1, 9);
+  trie_insert(engine->index, "neural", 1, 2, 40);
+  trie_insert(engine->index, "network", 1, 2, 47);
+  trie_insert(engine->index, "network", 2, 0, 3);
+  trie_insert(engine->index, "graph", 2, 0, 11);
+  trie_insert(engine->index, "neural", 3, 4, 0);
+  trie_insert(engine->index, "graph", 3, 4, 7);
+  // A common word on every page, long enough to be probed by seeking
+  for (int d = 0; d < 4; d++) {
+    for (int p = 0; p < 400; p++)
+      trie_insert(engine->index, "the", d, p, 1);
+  }
+
+  int found;
+  const char *nn[] = {"Neural", "NETWORK"};
+  occurrence_transfer_t *r =
+      search_boolean(engine, nn, 2, NULL, 0, NULL, 0, QUERY_SCOPE_DOCUMENT,
+                     &found);
+  assert(found == 2 && r[0].doc_id == 0 && r[1].doc_id == 1);
+  // Anchored on the rarer word's first occurrence
+  assert(r[1].page_num == 2);
+  free(r);
+
+  r = search_boolean(engine, nn, 2, NULL, 0, NULL, 0, QUERY_SCOPE_PAGE,
+                     &found);
+  assert(found == 1 && r[0].doc_id == 1 && r[0].page_num == 2);
+  free(r);
+
+  // OR: union in order, each pointing at its earliest matching word
+  const char *ng[] = {"network", "graph"};
+  r = search_boolean(engine, NULL, 0, ng, 2, NULL, 0, QUERY_SCOPE_DOCUMENT,
+                     &found);
+  assert(found == 4 && r[2].doc_id == 2 && r[2].byte_offset == 3);
+  free(r);
+
+  // AND + OR + NOT with the dense word in play
+  const char *the[] = {"the"}, *neural[] = {"neural"};
+  r = search_boolean(engine, the, 1, ng, 2, neural, 1, QUERY_SCOPE_DOCUMENT,
+                     &found);
+  assert(found == 1 && r[0].doc_id == 2);
+  free(r);
+  const char *neural_the[] = {"the", "neural"};
+  r = search_boolean(engine, neural_the, 2, NULL, 0, NULL, 0,
+                     QUERY_SCOPE_PAGE, &found);
+  assert(found == 3 && r[2].doc_id == 3 && r[2].page_num == 4);
+  free(r);
+  r = search_boolean(engine, neural, 1, NULL, 0, the, 1, QUERY_SCOPE_PAGE,
+                     &found);
+  assert(found == 0 && r == NULL);
+
+  // Missing must words and NOT-only queries match nothing
+  const char *missing[] = {"neural", "zebra"};
+  assert(search_boolean(engine, missing, 2, NULL, 0, NULL, 0,
+                        QUERY_SCOPE_DOCUMENT, &found) == NULL &&
+         found == 0);
+  assert(search_boolean(engine, NULL, 0, NULL, 0, neural, 1,
+                        QUERY_SCOPE_DOCUMENT, &found) == NULL);
+
+  // Tombstoned documents drop out
+  engine_reserve_meta(engine);
+  engine->doc_meta[1].flags |= DOC_DELETED;
+  engine->deleted_count = 1;
+  r = search_boolean(engine, nn, 2, NULL, 0, NULL, 0, QUERY_SCOPE_DOCUMENT,
+                     &found);
+  assert(found == 1 && r[0].doc_id == 0);
+  free(r);
+
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+void test_phrase_query() {
+  printf("Running: test_phrase_query... ");
+  search_engine_t *engine = engine_create();
+  engine_add_document(engine, "/test/doc1.pdf");
+  engine_add_document(engine, "/test/doc2.pdf");
+
+  // doc 0 page 0: "deep neural network training"
+  const char *p0[] = {"deep", "neural", "network", "training"};
+  for (int i = 0; i < 4; i++)
+    trie_insert_at(engine->index, p0[i], 0, 0, i * 10, i);
+  // doc 0 page 1: "network neural"
+  trie_insert_at(engine->index, "network", 0, 1, 0, 0);
+  trie_insert_at(engine->index, "neural", 0, 1, 8, 1);
+  // doc 1 page 3: "neural nets and a network"
+  const char *p1[] = {"neural", "nets", "and", "a", "network"};
+  for (int i = 0; i < 5; i++)
+    trie_insert_at(engine->index, p1[i], 1, 3, i * 10, i);
+
+  posting_t first = first_posting(engine->index, "network");
+  assert(first.position == 2 && first.byte_offset == 20);
+
+  int found;
+  occurrence_transfer_t *r =
+      search_phrase(engine, "Neural Network", &found);
+  assert(found == 1 && r[0].doc_id == 0 && r[0].page_num == 0 &&
+         r[0].byte_offset == 10);
+  free(r);
+  r = search_phrase(engine, "deep neural network training", &found);
+  assert(found == 1);
+  free(r);
+  assert(search_phrase(engine, "network training deep", &found) == NULL &&
+         found == 0);
+
+  const char *words[] = {"neural", "network"};
+  r = search_near(engine, words, 2, 0, &found);
+  assert(found == 2 && r[1].page_num == 1 && r[1].byte_offset == 0);
+  free(r);
+  r = search_near(engine, words, 2, 3, &found);
+  assert(found == 3 && r[2].doc_id == 1 && r[2].byte_offset == 0);
+  free(r);
+  r = search_near(engine, words, 2, 2, &found);
+  assert(found == 2);
+  free(r);
+
+  // Positions survive the version 3 file, mapped or copied
+  const char *file = "tests/test_data/phrase_index.db";
+  assert(engine_serialize(engine, (char *)file) == 0);
+  search_engine_t *mapped = engine_open_mapped((char *)file);
+  assert(mapped != NULL && mapped->index->positional);
+  r = search_phrase(mapped, "neural network", &found);
+  assert(found == 1 && r[0].byte_offset == 10);
+  free(r);
+  engine_free(mapped);
+
+  // An index without positions still answers word queries, phrases
+  // match nothing
+  search_engine_t *legacy = engine_create();
+  legacy->index->positional = false;
+  engine_add_document(legacy, "/test/doc1.pdf");
+  for (int i = 0; i < 4; i++)
+    trie_insert_at(legacy->index, p0[i], 0, 0, ((long)i << 34) + i, i);
+  assert(engine_serialize(legacy, (char *)file) == 0);
+  engine_free(legacy);
+  legacy = engine_deserialize((char *)file);
+  assert(legacy != NULL && !legacy->index->positional);
+  first = first_posting(legacy->index, "training");
+  assert(first.byte_offset == (3L << 34) + 3 && first.position == -1);
+  assert(search_phrase(legacy, "neural network", &found) == NULL);
+  engine_free(legacy);
+
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+void test_prefix_query() {
+  printf("Running: test_prefix_query... ");
+  search_engine_t *engine = engine_create();
+  engine_add_document(engine, "/test/doc1.pdf");
+  engine_add_document(engine, "/test/doc2.pdf");
+
+  // Inserted so the compressed paths get split and extended
+  const char *words[] = {"optimizer", "optimal", "opt",   "optimize",
+                         "optimum",   "option",  "colour", "color"};
+  for (int i = 0; i < 8; i++) {
+    trie_insert(engine->index, words[i], i % 2, 8 - i, i);
+    trie_insert(engine->index, words[i], 1, 0, 100 + i);
+  }
+  assert(count_prefix_terms(engine, "optim") == 4);
+  assert(count_prefix_terms(engine, "OPT") == 6);
+  assert(count_prefix_terms(engine, "optimi") == 2);
+  assert(count_prefix_terms(engine, "c") == 2);
+  assert(count_prefix_terms(engine, "optx") == 0);
+
+  // Merged in (doc, page, offset) order across the expanded words
+  int found;
+  occurrence_transfer_t *r = search_prefix(engine, "Optim*", 0, 0, &found);
+  assert(found == 8);
+  for (int i = 1; i < found; i++) {
+    assert(r[i - 1].doc_id < r[i].doc_id ||
+           (r[i - 1].doc_id == r[i].doc_id &&
+            r[i - 1].page_num <= r[i].page_num));
+  }
+  assert(r[0].doc_id == 0 && r[0].page_num == 4 && r[0].byte_offset == 4);
+  free(r);
+
+  // Term cap (byte order: optimal, optimize) and result limit
+  r = search_prefix(engine, "optim*", 2, 0, &found);
+  assert(found == 4 && r[0].byte_offset == 101 && r[2].byte_offset == 3);
+  free(r);
+  r = search_prefix(engine, "opt*", 0, 3, &found);
+  assert(found == 3 && r[2].doc_id == 0 && r[2].byte_offset == 0);
+  free(r);
+
+  // Wildcards inside the word
+  r = search_prefix(engine, "colo?r", 0, 0, &found);
+  assert(found == 2 && r[0].byte_offset == 6);
+  free(r);
+  r = search_prefix(engine, "col*r", 0, 0, &found);
+  assert(found == 4);
+  free(r);
+  r = search_prefix(engine, "opti?n", 0, 0, &found);
+  assert(found == 2 && r[0].byte_offset == 105);
+  free(r);
+  assert(search_prefix(engine, "*tion", 0, 0, &found) == NULL && found == 0);
+  assert(search_prefix(engine, "zeta*", 0, 0, &found) == NULL);
+
+  // Counts are stored from version 4 on; older files count on demand
+  const char *file = "tests/test_data/prefix_index.db";
+  assert(engine_serialize(engine, (char *)file) == 0);
+  search_engine_t *mapped = engine_open_mapped((char *)file);
+  assert(mapped != NULL && mapped->index->term_counts);
+  assert(count_prefix_terms(mapped, "optim") == 4);
+  engine_free(mapped);
+  engine->index->term_counts = false;
+  assert(engine_serialize(engine, (char *)file) == 0);
+  mapped = engine_open_mapped((char *)file);
+  assert(mapped != NULL && !mapped->index->term_counts);
+  assert(count_prefix_terms(mapped, "opt") == 6);
+  r = search_prefix(mapped, "optim*", 0, 0, &found);
+  assert(found == 8);
+  free(r);
+  engine_free(mapped);
+  search_engine_t *copied = engine_deserialize((char *)file);
+  assert(copied != NULL && copied->index->term_counts);
+  assert(count_prefix_terms(copied, "optim") == 4);
+  trie_insert(copied->index, "optics", 0, 0, 0);
+  assert(count_prefix_terms(copied, "opt") == 7);
+  engine_free(copied);
+
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+// Reference edit distance over code points (the test words are ASCII
+// apart from 'é', which both count as one character)
+static int edit_distance(const char *a, const char *b) {
+  int la = (int)strlen(a), lb = (int)strlen(b);
+  int row[64], prev[64];
+  for (int j = 0; j <= lb; j++)
+    prev[j] = j;
+  for (int i = 1; i <= la; i++) {
+    row[0] = i;
+    for (int j = 1; j <= lb; j++) {
+      int best = prev[j - 1] + (a[i - 1] != b[j - 1]);
+      if (prev[j] + 1 < best)
+        best = prev[j] + 1;
+      if (row[j - 1] + 1 < best)
+        best = row[j - 1] + 1;
+      row[j] = best;
+    }
+    memcpy(prev, row, sizeof(int) * (lb + 1));
+  }
+  return prev[lb];
+}
+
+void test_levenshtein() {
+  printf("Running: test_levenshtein... ");
+  // The automaton agrees with the dynamic programming distance
+  srand(42);
+  for (int round = 0; round < 2000; round++) {
+    char a[12], b[12];
+    int la = 1 + rand() % 8, lb = rand() % 10;
+    for (int i = 0; i < la; i++)
+      a[i] = "abc"[rand() % 3];
+    for (int i = 0; i < lb; i++)
+      b[i] = "abc"[rand() % 3];
+    a[la] = b[lb] = '\0';
+    lev_automaton_t lev;
+    assert(lev_init(&lev, a, la, 2) == 0);
+    lev_state_t state;
+    lev_start(&lev, &state);
+    bool alive = true;
+    for (int i = 0; i < lb && alive; i++)
+      alive = lev_step(&lev, &state, (unsigned char)b[i]);
+    int expected = edit_distance(a, b);
+    int got = alive ? lev_distance(&lev, &state) : -1;
+    assert(got == (expected <= 2 ? expected : -1));
+  }
+
+  // A two-byte character is one edit, not two
+  lev_automaton_t lev;
+  lev_state_t state;
+  assert(lev_init(&lev, "caf\xc3\xa9", 5, 1) == 0 && lev.length == 4);
+  lev_start(&lev, &state);
+  const char *typo = "cafe";
+  for (int i = 0; typo[i]; i++)
+    lev_step(&lev, &state, (unsigned char)typo[i]);
+  assert(lev_distance(&lev, &state) == 1);
+  char *longest = malloc(LEV_MAX_CHARS + 2);
+  memset(longest, 'a', LEV_MAX_CHARS + 1);
+  assert(lev_init(&lev, longest, LEV_MAX_CHARS, 2) == 0);
+  assert(lev_init(&lev, longest, LEV_MAX_CHARS + 1, 2) == -1);
+  free(longest);
+  printf("PASSED!\n");
+}
+
+void test_fuzzy_query() {
+  printf("Running: test_fuzzy_query... ");
+  search_engine_t *engine = engine_create();
+  engine_add_document(engine, "/test/doc1.pdf");
+  engine_add_document(engine, "/test/doc2.pdf");
+  const char *words[] = {"network", "netwrok", "networks", "neural",
+                         "nctwork", "network", "artwork", "net"};
+  for (int i = 0; i < 8; i++)
+    trie_insert(engine->index, words[i], i % 2, 0, i * 10);
+
+  int found;
+  fuzzy_term_t *terms = search_fuzzy_terms(engine, "Network", 1, 0, &found);
+  assert(found == 3);
+  assert(strcmp(terms[0].term, "network") == 0 && terms[0].distance == 0 &&
+         terms[0].count == 2);
+  assert(strcmp(terms[1].term, "nctwork") == 0 && terms[1].distance == 1);
+  assert(strcmp(terms[2].term, "networks") == 0 && terms[2].distance == 1);
+  free_fuzzy_terms(terms, found);
+
+  // A transposition costs two edits, like two substitutions
+  terms = search_fuzzy_terms(engine, "network", 2, 0, &found);
+  assert(found == 5 && strcmp(terms[3].term, "artwork") == 0 &&
+         strcmp(terms[4].term, "netwrok") == 0 && terms[4].distance == 2);
+  free_fuzzy_terms(terms, found);
+  terms = search_fuzzy_terms(engine, "network", 2, 2, &found);
+  assert(found == 2);
+  free_fuzzy_terms(terms, found);
+  assert(search_fuzzy_terms(engine, "zzzzzz", 2, 0, &found) == NULL &&
+         found == 0);
+
+  occurrence_transfer_t *r = search_fuzzy(engine, "netwerk", 1, 0, 0, &found);
+  assert(found == 2 && r[0].doc_id == 0 && r[0].byte_offset == 0 &&
+         r[1].doc_id == 1 && r[1].byte_offset == 50);
+  free(r);
+  r = search_fuzzy(engine, "network", 2, 0, 3, &found);
+  assert(found == 3 && r[0].byte_offset == 0 && r[1].byte_offset == 20);
+  free(r);
+
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+void test_ranked_query() {
+  printf("Running: test_ranked_query... ");
+  search_engine_t *engine = engine_create();
+  for (int d = 0; d < 4; d++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/test/doc%d.pdf", d);
+    engine_add_document(engine, path);
+  }
+  assert(engine_reserve_meta(engine) == 0);
+
+  // doc 0: short, "neural" three times; doc 1: long, "neural" once;
+  // doc 2: "neural network"; doc 3: "network" only
+  uint32_t lengths[] = {10, 100, 20, 30};
+  for (int d = 0; d < 4; d++)
+    engine->doc_meta[d].length = lengths[d];
+  engine_count_lengths(engine);
+  assert(engine->total_length == 160 && engine->length_docs == 4);
+  for (int i = 0; i < 3; i++)
+    trie_insert(engine->index, "neural", 0, i, 5);
+  trie_insert(engine->index, "neural", 1, 7, 40);
+  trie_insert(engine->index, "neural", 2, 0, 0);
+  trie_insert(engine->index, "network", 2, 0, 7);
+  trie_insert(engine->index, "network", 3, 1, 3);
+
+  int found;
+  scored_result_t *r = search_ranked(engine, "Neural", 0, &found);
+  assert(found == 3 && r[0].doc_id == 0 && r[1].doc_id == 2 &&
+         r[2].doc_id == 1);
+  assert(r[0].page_num == 0 && r[2].page_num == 7 && r[2].byte_offset == 40);
+  // idf = ln(1 + (4 - 3 + 0.5) / (3 + 0.5)), avgdl = 40
+  double idf = log(1.0 + 1.5 / 3.5);
+  double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * 10.0 / 40.0);
+  double expected = idf * 3 * (BM25_K1 + 1.0) / (3 + norm);
+  assert(fabs(r[0].score - expected) < 1e-9);
+  free(r);
+
+  // Both words beat either alone; k keeps only the best
+  r = search_ranked(engine, "neural network", 2, &found);
+  assert(found == 2 && r[0].doc_id == 2 && r[0].byte_offset == 0 &&
+         r[0].score > r[1].score);
+  free(r);
+  assert(search_ranked(engine, "absent", 5, &found) == NULL && found == 0);
+
+  // Tombstoned documents are scored past, never returned
+  engine->doc_meta[0].flags |= DOC_DELETED;
+  engine->deleted_count = 1;
+  r = search_ranked(engine, "neural", 10, &found);
+  assert(found == 2 && r[0].doc_id == 2);
+  free(r);
+
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+// Deterministic Zipf-distributed word ranks for synthetic corpora
+static int zipf_rank(const double *cumulative, int n, uint64_t *state) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  double u = (double)(*state >> 11) / (double)(1ULL << 53) *
+             cumulative[n - 1];
+  int lo = 0, hi = n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cumulative[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void assert_same_ranking(search_engine_t *engine, const char *query,
+                                int k) {
+  int found, expected;
+  scored_result_t *r = search_ranked(engine, query, k, &found);
+  scored_result_t *e = search_ranked_exhaustive(engine, query, k, &expected);
+  assert(found == expected);
+  for (int i = 0; i < found; i++) {
+    assert(r[i].doc_id == e[i].doc_id && r[i].score == e[i].score);
+    assert(r[i].page_num == e[i].page_num);
+  }
+  free(r);
+  free(e);
+}
+
+void test_block_max_wand() {
+  printf("Running: test_block_max_wand... ");
+  enum { DOCS = 3000, VOCAB = 300 };
+  search_engine_t *engine = engine_create();
+  assert(engine_reserve_documents(engine, DOCS) == 0);
+  for (int d = 0; d < DOCS; d++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/test/doc%d.pdf", d);
+    engine_add_document(engine, path);
+  }
+  assert(engine_reserve_meta(engine) == 0);
+
+  double cumulative[VOCAB];
+  for (int r = 0; r < VOCAB; r++)
+    cumulative[r] = (r ? cumulative[r - 1] : 0.0) + 1.0 / (r + 1);
+  uint64_t state = 42;
+  for (int d = 0; d < DOCS; d++) {
+    int length = 20 + (int)(state % 180);
+    for (int i = 0; i < length; i++) {
+      char word[16];
+      snprintf(word, sizeof(word), "w%d",
+               zipf_rank(cumulative, VOCAB, &state));
+      trie_insert(engine->index, word, d, i / 40, i);
+    }
+    engine->doc_meta[d].length = (uint32_t)length;
+  }
+  assert(engine->impacts == NULL);
+  engine_update_ranking(engine);
+  assert(impact_usable(engine->impacts, engine));
+
+  // Each block's skip entry lands on its first document, nothing before
+  // it decoded
+  const char *skipped[] = {"w0", "w7", "w120"};
+  for (size_t w = 0; w < sizeof(skipped) / sizeof(skipped[0]); w++) {
+    uint32_t handle = trie_lookup(engine->index, skipped[w]);
+    posting_list_t *list = trie_search(engine->index, skipped[w]);
+    uint32_t count;
+    float bound;
+    const impact_block_t *blocks =
+        impact_list(engine->impacts, handle, list, &count, &bound);
+    const posting_skip_t *skips = impact_list_skips(engine->impacts, handle);
+    assert(blocks != NULL && skips != NULL && count > 1);
+    for (uint32_t b = 0; b < count; b++) {
+      posting_iter_t it, seek;
+      trie_postings_iter(engine->index, list, &it);
+      posting_iter_jump(&it, &skips[b]);
+      assert(posting_iter_next(&it) &&
+             it.current.doc_id <= (int)blocks[b].last_doc &&
+             (b == 0 || it.current.doc_id > (int)blocks[b - 1].last_doc));
+      trie_postings_iter(engine->index, list, &seek);
+      assert(posting_iter_seek(&seek, it.current.doc_id, 0) &&
+             posting_compare(&seek.current, &it.current) == 0);
+    }
+  }
+
+  // A section written before the skip entries still has its bounds, and
+  // ranking with them gives the same results
+  FILE *fp = tmpfile();
+  assert(fp != NULL && impact_write(engine->impacts, fp) == 0);
+  long length = ftell(fp);
+  char *image = malloc(length);
+  rewind(fp);
+  assert(image != NULL && fread(image, 1, length, fp) == (size_t)length);
+  fclose(fp);
+  uint64_t block_count = engine->impacts->header.block_count;
+  impact_index_t *current = impact_open(image, length, true);
+  impact_index_t *older =
+      impact_open(image, length - sizeof(posting_skip_t) * block_count, true);
+  assert(current != NULL && current->skips != NULL);
+  assert(older != NULL && older->skips == NULL &&
+         memcmp(older->blocks, engine->impacts->blocks,
+                sizeof(impact_block_t) * block_count) == 0);
+  impact_index_t *built = engine->impacts;
+  older->trie = engine->index;
+  engine->impacts = older;
+  assert_same_ranking(engine, "w0 w1 w2", 10);
+  assert_same_ranking(engine, "w5 w17 w299", 3);
+  engine->impacts = built;
+  impact_free(current);
+  impact_free(older);
+  free(image);
+
+  // Frequent, rare and mixed words, with k below and above the matches
+  const char *queries[] = {"w0 w1",      "w0 w1 w2 w3", "w0 w250",
+                           "w5 w17 w299", "w42",        "w3 w3 w120"};
+  int ks[] = {1, 10, 100, 5000};
+  for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+    for (size_t k = 0; k < sizeof(ks) / sizeof(ks[0]); k++)
+      assert_same_ranking(engine, queries[q], ks[k]);
+  }
+
+  // Tombstones are pruned past like any other low scorer
+  for (int d = 0; d < DOCS; d += 7)
+    engine->doc_meta[d].flags |= DOC_DELETED;
+  engine->deleted_count = (DOCS + 6) / 7;
+  assert_same_ranking(engine, "w0 w1 w2", 10);
+
+  // The bounds travel with the file and are used from the mapping
+  const char *test_file = "tests/test_data/block_max.db";
+  assert(engine_serialize(engine, (char *)test_file) == 0);
+  search_engine_t *mapped = engine_open_mapped((char *)test_file);
+  assert(mapped != NULL && impact_usable(mapped->impacts, mapped));
+  assert_same_ranking(mapped, "w0 w250", 10);
+  assert_same_ranking(mapped, "w5 w17 w299", 3);
+  engine_free(mapped);
+
+  // A list grown since is scored without its stale blocks
+  posting_list_t *w1 = trie_search(engine->index, "w1");
+  uint32_t blocks;
+  float max;
+  for (int i = 0; i < 40; i++)
+    trie_insert(engine->index, "w1", DOCS - 1, 9, 1000 + i);
+  assert(impact_list(engine->impacts, trie_lookup(engine->index, "w1"), w1,
+                     &blocks, &max) == NULL);
+  assert_same_ranking(engine, "w1 w2", 1);
+
+  // Different document lengths invalidate every bound
+  engine->doc_meta[1].length += 500;
+  engine_count_lengths(engine);
+  assert(!impact_usable(engine->impacts, engine));
+  assert_same_ranking(engine, "w0 w1", 10);
+
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+static void assert_same_hits(const occurrence_transfer_t *a, int a_count,
+                             const occurrence_transfer_t *b, int b_count) {
+  assert(a_count == b_count);
+  for (int i = 0; i < a_count; i++) {
+    assert(a[i].doc_id == b[i].doc_id && a[i].page_num == b[i].page_num);
+    assert(a[i].byte_offset == b[i].byte_offset);
+  }
+}
+
+/*
+ * Every kind of query gives `seg` the answers of the monolithic `mono`;
+ * with `stats`, also the same posting counts and so the same scores.
+ */
+static void assert_same_answers(search_engine_t *mono, search_engine_t *seg,
+                                bool stats) {
+  const char *must[] = {"w2"}, *must_not[] = {"w5"};
+  const char *near[] = {"w1", "w4"};
+  occurrence_transfer_t *a, *b;
+  int n, m;
+  for (int q = 0; q < 7; q++) {
+    switch (q) {
+    case 0:
+      a = get_search_results(mono, "w3", &n);
+      b = get_search_results(seg, "w3", &m);
+      break;
+    case 1:
+      a = search_phrase(mono, "w0 w1", &n);
+      b = search_phrase(seg, "w0 w1", &m);
+      break;
+    case 2:
+      a = search_boolean(mono, must, 1, NULL, 0, must_not, 1,
+                         QUERY_SCOPE_PAGE, &n);
+      b = search_boolean(seg, must, 1, NULL, 0, must_not, 1, QUERY_SCOPE_PAGE,
+                         &m);
+      break;
+    case 3:
+      a = search_near(mono, near, 2, 3, &n);
+      b = search_near(seg, near, 2, 3, &m);
+      break;
+    case 4:
+      a = search_prefix(mono, "w1*", 5, 0, &n);
+      b = search_prefix(seg, "w1*", 5, 0, &m);
+      break;
+    case 5:
+      a = search_prefix(mono, "w?", 0, 100, &n);
+      b = search_prefix(seg, "w?", 0, 100, &m);
+      break;
+    default:
+      a = search_fuzzy(mono, "w12", 1, 4, 0, &n);
+      b = search_fuzzy(seg, "w12", 1, 4, 0, &m);
+      break;
+    }
+    assert(n > 0);
+    assert_same_hits(a, n, b, m);
+    free(a);
+    free(b);
+  }
+  assert(count_prefix_terms(mono, "w1") == count_prefix_terms(seg, "w1"));
+
+  fuzzy_term_t *x = search_fuzzy_terms(mono, "w7", 1, 0, &n);
+  fuzzy_term_t *y = search_fuzzy_terms(seg, "w7", 1, 0, &m);
+  assert(n == m);
+  for (int i = 0; stats && i < n; i++)
+    assert(strcmp(x[i].term, y[i].term) == 0 && x[i].count == y[i].count);
+  free_fuzzy_terms(x, n);
+  free_fuzzy_terms(y, m);
+
+  const occurrence_transfer_t *c = search_cached(mono, "w0 w1", &n);
+  const occurrence_transfer_t *d = search_cached(seg, "w0 w1", &m);
+  assert_same_hits(c, n, d, m);
+  release_results(c);
+  release_results(d);
+
+  if (!stats)
+    return;
+  scored_result_t *r = search_ranked(mono, "w0 w7 w33", 10, &n);
+  scored_result_t *e = search_ranked(seg, "w0 w7 w33", 10, &m);
+  assert(n == m && n == 10);
+  for (int i = 0; i < n; i++)
+    assert(r[i].doc_id == e[i].doc_id && r[i].score == e[i].score);
+  free(r);
+  free(e);
+  assert_same_ranking(seg, "w0 w7 w33", 10);
+  assert_same_ranking(seg, "w1 w40", 3);
+}
+
+// Documents first..first + count of synthetic text, into both engines
+static void add_documents(search_engine_t **engines, int first, int count,
+                          uint64_t *state) {
+  enum { VOCAB = 60 };
+  double cumulative[VOCAB];
+  for (int r = 0; r < VOCAB; r++)
+    cumulative[r] = (r ? cumulative[r - 1] : 0.0) + 1.0 / (r + 1);
+  for (int e = 0; e < 2; e++) {
+    for (int d = first; d < first + count; d++) {
+      char path[32];
+      snprintf(path, sizeof(path), "/test/doc%d.pdf", d);
+      engine_add_document(engines[e], path);
+    }
+    assert(engine_reserve_meta(engines[e]) == 0);
+  }
+  for (int d = first; d < first + count; d++) {
+    int length = 20 + (int)(*state % 80);
+    for (int i = 0; i < length; i++) {
+      char word[16];
+      snprintf(word, sizeof(word), "w%d",
+               zipf_rank(cumulative, VOCAB, state));
+      for (int e = 0; e < 2; e++)
+        trie_insert_at(engines[e]->index, word, d, i / 30, i * 4, i % 30);
+    }
+    for (int e = 0; e < 2; e++)
+      engines[e]->doc_meta[d].length = (uint32_t)length;
+  }
+  for (int e = 0; e < 2; e++)
+    engine_count_lengths(engines[e]);
+}
+
+void test_segmented_index() {
+  printf("Running: test_segmented_index... ");
+  const char *path = "tests/test_data/segmented.db";
+  system("rm -f tests/test_data/segmented.db*");
+  search_engine_t *mono = engine_create();
+  search_engine_t *seg = engine_create();
+  search_engine_t *engines[] = {mono, seg};
+  uint64_t state = 7;
+
+  // 1. Every flush seals what was added since into one more segment
+  for (int b = 0; b < SEGMENT_TIER_FACTOR; b++) {
+    add_documents(engines, b * 50, 50, &state);
+    assert(engine_flush(seg, path) == 0);
+    assert(engine_segment_count(seg) == b + 1);
+  }
+  add_documents(engines, 200, 30, &state); // Left in the live trie
+  assert(engine_flush(seg, "tests/test_data/other.db") != 0);
+  engine_update_ranking(mono);
+  assert_same_answers(mono, seg, true);
+
+  // 2. Tombstones: document frequencies stay those of the postings until
+  // a merge drops the deleted documents, so ranking is compared first
+  for (int d = 3; d < 230; d += 11) {
+    for (int e = 0; e < 2; e++) {
+      engines[e]->doc_meta[d].flags |= DOC_DELETED;
+      engines[e]->deleted_count++;
+      trie_touch(engines[e]->index);
+      engine_count_lengths(engines[e]);
+    }
+  }
+  engine_update_ranking(mono);
+  assert_same_answers(mono, seg, true);
+
+  // 3. Four small segments become one, and the live trie a fifth
+  assert(engine_merge_segments(seg) == 1);
+  assert(engine_segment_count(seg) == 1);
+  assert(engine_flush(seg, path) == 0);
+  assert(engine_segment_count(seg) == 2);
+  assert_same_answers(mono, seg, false);
+  assert_same_ranking(seg, "w0 w1 w2", 10);
+
+  // 4. The manifest brings the segments and the tombstones back
+  search_engine_t *mapped = engine_open_mapped((char *)path);
+  assert(mapped != NULL && mapped->segments != NULL);
+  assert(mapped->doc_count == 230 && mapped->deleted_count == 21);
+  assert(engine_doc_deleted(mapped, 14) && !engine_doc_deleted(mapped, 15));
+  assert(strcmp(engine_get_document_path(mapped, 229), "/test/doc229.pdf") ==
+         0);
+  assert(engine_add_document(mapped, "/test/new.pdf") < 0);
+  assert_same_answers(mono, mapped, false);
+  assert(engine_verify(mapped) == 0);
+
+  // Damaged postings in a segment are left to engine_verify()
+  char file[PATH_MAX];
+  snprintf(file, sizeof(file), "%s" SEGMENT_SUFFIX "%llu", path,
+           (unsigned long long)mapped->segments->list->items[1]->id);
+  engine_free(mapped);
+  FILE *fp = fopen(file, "r+b");
+  index_file_header_t header;
+  assert(fp != NULL && fread(&header, sizeof(header), 1, fp) == 1);
+  long at = (long)header.sections[INDEX_SECTION_POSTINGS].offset + 8;
+  unsigned char byte;
+  assert(fseek(fp, at, SEEK_SET) == 0 && fread(&byte, 1, 1, fp) == 1);
+  byte ^= 0x01;
+  assert(fseek(fp, at, SEEK_SET) == 0 && fwrite(&byte, 1, 1, fp) == 1);
+  fflush(fp);
+  mapped = engine_open_mapped((char *)path);
+  assert(mapped != NULL && engine_verify(mapped) != 0);
+  engine_free(mapped);
+  assert(engine_deserialize((char *)path) == NULL);
+  byte ^= 0x01;
+  assert(fseek(fp, at, SEEK_SET) == 0 && fwrite(&byte, 1, 1, fp) == 1);
+  fclose(fp);
+  mapped = engine_open_mapped((char *)path);
+  assert(mapped != NULL && engine_verify(mapped) == 0);
+  engine_free(mapped);
+  search_engine_t *copy = engine_deserialize((char *)path);
+  assert(copy != NULL && engine_segment_count(copy) == 2);
+  assert_same_answers(mono, copy, false);
+  engine_free(copy);
+
+  // 5. Compaction leaves one segment's worth of live documents
+  assert(engine_compact(mono) == 0 && engine_compact(seg) == 0);
+  assert(engine_segment_count(seg) == 0 && seg->doc_count == 209);
+  engine_update_ranking(mono);
+  assert_same_answers(mono, seg, true);
+  assert(engine_flush(seg, path) == 0);
+  copy = engine_deserialize((char *)path);
+  assert(copy != NULL && copy->doc_count == 209 && copy->deleted_count == 0);
+  assert_same_answers(mono, copy, false);
+  engine_free(copy);
+
+  // 6. The merge thread works while documents are added and queried
+  assert(engine_set_background_merge(seg, true) == 0);
+  for (int b = 0; b < SEGMENT_TIER_FACTOR - 1; b++) {
+    add_documents(engines, 209 + b * 40, 40, &state);
+    assert(engine_flush(seg, path) == 0);
+    assert_same_answers(mono, seg, false);
+  }
+  assert(engine_set_background_merge(seg, false) == 0);
+  assert(engine_merge_segments(seg) >= 0 && engine_segment_count(seg) == 1);
+  assert_same_answers(mono, seg, false);
+
+  engine_free(mono);
+  engine_free(seg);
+  system("rm -f tests/test_data/segmented.db*");
+  printf("PASSED!\n");
+}
+
+void test_memory_budget() {
+  printf("Running: test_memory_budget... ");
+  const char *path = "tests/test_data/budget.db";
+  const char *manifest = "tests/test_data/budget.db.manifest";
+  search_engine_t *mono = engine_create();
+  search_engine_t *spill = engine_create();
+  search_engine_t *engines[] = {mono, spill};
+  uint64_t state = 11;
+
+  // 1. Each spill leaves a run file behind and the live trie empty
+  assert(engine_set_memory_budget(spill, 1, "tests/test_data") == 0);
+  for (int b = 0; b < 4; b++) {
+    add_documents(engines, b * 60, 60, &state);
+    trie_publish(spill->index, INT_MAX);
+    size_t full = trie_memory_bytes(spill->index);
+    assert(segments_spill(spill, spill->doc_count) == 0);
+    assert(trie_memory_bytes(spill->index) < full);
+    assert(engine_segment_count(spill) == b + 1);
+  }
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", spill->segments->spill_dir);
+  assert(strncmp(dir, "tests/test_data/pdfsearch-", 26) == 0);
+  add_documents(engines, 240, 25, &state); // Left in the live trie
+  trie_publish(spill->index, INT_MAX);
+  engine_update_ranking(mono);
+  engine_update_ranking(spill);
+  assert_same_answers(mono, spill, true);
+
+  // Runs are merged once, into the final file only
+  assert(engine_merge_segments(spill) == 0);
+  assert(engine_set_background_merge(spill, true) != 0);
+
+  // 2. The external merge writes what a build without a budget would
+  assert(engine_serialize(spill, (char *)path) == 0);
+  search_engine_t *merged = engine_open_mapped((char *)path);
+  assert(merged != NULL && merged->segments == NULL);
+  assert(merged->doc_count == 265 && impact_usable(merged->impacts, merged));
+  assert_same_answers(mono, merged, true);
+  engine_free(merged);
+
+  // A segmented save takes the runs over instead, the live trie after them
+  assert(engine_flush(spill, manifest) == 0);
+  assert(spill->segments->spill_dir == NULL && access(dir, F_OK) != 0);
+  assert(engine_segment_count(spill) == 5);
+  merged = engine_open_mapped((char *)manifest);
+  assert(merged != NULL && engine_segment_count(merged) == 5);
+  assert_same_answers(mono, merged, true);
+  engine_free(merged);
+
+  // Its lists take appends like any other
+  search_engine_t *copy = engine_deserialize((char *)path);
+  assert(copy != NULL);
+  search_engine_t *grown[] = {mono, copy};
+  add_documents(grown, 265, 20, &state);
+  engine_update_ranking(mono);
+  engine_update_ranking(copy);
+  assert_same_answers(mono, copy, true);
+  engine_free(copy);
+
+  engine_free(spill);
+  engine_free(mono);
+
+  // 3. The indexer spills on its own, sequential or parallel
+  const char *files[] = {"tests/test_data/sample.pdf",
+                         "tests/test_data/Application Resume.pdf"};
+  search_engine_t *serial = engine_create();
+  search_engine_t *budgeted[2] = {engine_create(), engine_create()};
+  for (int i = 0; i < 24; i++) {
+    engine_add_document(serial, files[i % 2]);
+    for (int e = 0; e < 2; e++)
+      engine_add_document(budgeted[e], files[i % 2]);
+  }
+  assert(engine_index_parallel(serial, 1, NULL, NULL) == 0);
+  for (int e = 0; e < 2; e++) {
+    assert(engine_set_memory_budget(budgeted[e], 1, NULL) == 0);
+    assert(engine_index_parallel(budgeted[e], e == 0 ? 1 : 4, NULL, NULL) ==
+           0);
+    assert(engine_segment_count(budgeted[e]) > 1);
+    snprintf(dir, sizeof(dir), "%s", budgeted[e]->segments->spill_dir);
+
+    // One merged file, or every run kept as a segment
+    const char *saved = e == 0 ? path : manifest;
+    assert((e == 0 ? engine_serialize(budgeted[e], (char *)path)
+                   : engine_flush(budgeted[e], manifest)) == 0);
+    merged = engine_open_mapped((char *)saved);
+    assert(merged != NULL);
+    const char *words[] = {"sam", "the", "a", "pdf"};
+    for (int w = 0; w < 4; w++) {
+      int n1, n2, n3;
+      occurrence_transfer_t *r1 = get_search_results(serial, words[w], &n1);
+      occurrence_transfer_t *r2 =
+          get_search_results(budgeted[e], words[w], &n2);
+      occurrence_transfer_t *r3 = get_search_results(merged, words[w], &n3);
+      assert_same_hits(r1, n1, r2, n2);
+      assert_same_hits(r1, n1, r3, n3);
+      free(r1);
+      free(r2);
+      free(r3);
+    }
+    engine_free(merged);
+    engine_free(budgeted[e]);
+    assert(access(dir, F_OK) != 0); // the runs go with the engine
+  }
+
+  engine_free(serial);
+  system("rm -f tests/test_data/budget.db*");
+  printf("PASSED!\n");
+}
+
+void test_export_paths() {
+  printf("Running: test_export_paths... ");
+  search_engine_t *engine = engine_create();
+  engine_add_document(engine, "/test/a.pdf");
+  engine_add_document(engine, "/test/b\xC3\xA9.pdf");
+  engine_add_document(engine, "/c.pdf");
+
+  doc_path_table_t *table = engine_export_paths(engine);
+  assert(table != NULL && table->count == 3);
+  assert(table->offsets[0] == 0 && table->offsets[3] == table->paths_size);
+  for (int i = 0; i < 3; i++) {
+    assert(strcmp(table->paths + table->offsets[i],
+                  engine_get_document_path(engine, i)) == 0);
+    assert(table->offsets[i + 1] - table->offsets[i] ==
+           strlen(engine_get_document_path(engine, i)) + 1);
+  }
+  free_doc_path_table(table);
+
+  // Same table from a mapped file, and from an engine with no documents
+  const char *test_file = "tests/test_data/export_paths.db";
+  assert(engine_serialize(engine, (char *)test_file) == 0);
+  search_engine_t *mapped = engine_open_mapped((char *)test_file);
+  assert(mapped != NULL);
+  table = engine_export_paths(mapped);
+  assert(table != NULL && table->count == 3 &&
+         strcmp(table->paths + table->offsets[2], "/c.pdf") == 0);
+  free_doc_path_table(table);
+  engine_free(mapped);
+  engine_free(engine);
+
+  engine = engine_create();
+  table = engine_export_paths(engine);
+  assert(table != NULL && table->count == 0 && table->paths_size == 0 &&
+         table->offsets[0] == 0);
+  free_doc_path_table(table);
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+void test_doc_table() {
+  printf("Running: test_doc_table... ");
+  enum { DOCS = 100 };
+  search_engine_t *engine = engine_create();
+  assert(engine_reserve_documents(engine, DOCS) == 0);
+  char path[64], out[64];
+  for (int d = 0; d < DOCS; d++) {
+    snprintf(path, sizeof(path), "/library/shelf%d/book%03d.pdf", d / 40, d);
+    assert(engine_add_document(engine, path) == d);
+  }
+  assert(engine->docs.count == DOCS);
+  assert(engine->docs.size < (uint64_t)DOCS * strlen(path) / 2);
+
+  // 1. Random access across block boundaries, and in order
+  for (int d = DOCS - 1; d >= 0; d -= 3) {
+    snprintf(path, sizeof(path), "/library/shelf%d/book%03d.pdf", d / 40, d);
+    assert(strcmp(engine_get_document_path(engine, d), path) == 0);
+  }
+  assert(engine_get_document_path(engine, DOCS) == NULL);
+  assert(doc_table_get(&engine->docs, 0, out, 8) < 0);
+  doc_table_iter_t it;
+  doc_table_iter(&engine->docs, &it);
+  for (int d = 0; d < DOCS; d++) {
+    snprintf(path, sizeof(path), "/library/shelf%d/book%03d.pdf", d / 40, d);
+    assert(strcmp(doc_table_next(&it), path) == 0 && it.len == strlen(path));
+  }
+  assert(doc_table_next(&it) == NULL);
+
+  // 2. Over-long paths are refused rather than truncated
+  char *long_path = malloc(DOC_TABLE_MAX_PATH + 1);
+  memset(long_path, 'a', DOC_TABLE_MAX_PATH);
+  long_path[DOC_TABLE_MAX_PATH] = '\0';
+  assert(engine_add_document(engine, long_path) == -1);
+  assert(engine->doc_count == DOCS);
+  free(long_path);
+
+  // 3. Mapped files decode in place; copies keep taking appends
+  const char *test_file = "tests/test_data/doc_table.db";
+  assert(engine_serialize(engine, (char *)test_file) == 0);
+  search_engine_t *mapped = engine_open_mapped((char *)test_file);
+  assert(mapped != NULL && mapped->docs.mapped);
+  assert(strcmp(engine_get_document_path(mapped, 57),
+                "/library/shelf1/book057.pdf") == 0);
+  assert(engine_add_document(mapped, "/x.pdf") == -1);
+  engine_free(mapped);
+
+  search_engine_t *copied = engine_deserialize((char *)test_file);
+  assert(copied != NULL && copied->doc_count == DOCS);
+  assert(engine_add_document(copied, "/library/shelf2/book100.pdf") == DOCS);
+  assert(strcmp(engine_get_document_path(copied, DOCS - 1),
+                "/library/shelf2/book099.pdf") == 0);
+  assert(strcmp(engine_get_document_path(copied, DOCS),
+                "/library/shelf2/book100.pdf") == 0);
+  engine_free(copied);
+
+  // 4. Compaction rebuilds the table from the survivors
+  assert(engine_reserve_meta(engine) == 0);
+  for (int d = 0; d < DOCS; d += 2)
+    engine->doc_meta[d].flags |= DOC_DELETED;
+  engine->deleted_count = DOCS / 2;
+  assert(engine_compact(engine) == 0);
+  assert(engine->doc_count == DOCS / 2 && engine->docs.count == DOCS / 2);
+  for (int d = 0; d < DOCS / 2; d++) {
+    int old = 2 * d + 1;
+    snprintf(path, sizeof(path), "/library/shelf%d/book%03d.pdf", old / 40,
+             old);
+    assert(strcmp(engine_get_document_path(engine, d), path) == 0);
+  }
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+void test_result_cache() {
+  printf("Running: test_result_cache... ");
+  search_engine_t *engine = engine_create();
+  for (int d = 0; d < 3; d++)
+    engine_add_document(engine, "/test/doc.pdf");
+  const char *words[] = {"deep", "neural", "network"};
+  for (int d = 0; d < 3; d++) {
+    for (int i = 0; i < 3 + d; i++)
+      trie_insert_at(engine->index, words[i < 3 ? i : 0], d, d, i * 5, i);
+  }
+  assert(engine_set_cache_budget(engine, RESULT_CACHE_DEFAULT_BYTES) == 0);
+
+  // 1. The same words, however they are spelled, share one buffer
+  int found, again;
+  const occurrence_transfer_t *deep = search_cached(engine, "deep", &found);
+  const occurrence_transfer_t *same = search_cached(engine, " DEEP ", &again);
+  assert(found == 6 && again == 6 && same == deep);
+  int plain;
+  occurrence_transfer_t *expected = get_search_results(engine, "deep", &plain);
+  assert(plain == 6 &&
+         memcmp(deep, expected, sizeof(occurrence_transfer_t) * 6) == 0);
+  free_results((int *)expected);
+  release_results(same);
+
+  const occurrence_transfer_t *phrase =
+      search_cached(engine, "Neural  network", &found);
+  assert(found == 3 && phrase[0].byte_offset == 5);
+  release_results(phrase);
+  assert(search_cached(engine, "absent", &found) == NULL && found == 0);
+  assert(search_cached(engine, "absent", &found) == NULL && found == 0);
+  assert(search_cached(engine, "", &found) == NULL && found == 0);
+
+  result_cache_stats_t stats;
+  engine_cache_stats(engine, &stats);
+  assert(stats.hits == 2 && stats.misses == 3 && stats.entries == 3);
+
+  // 2. A change to the index, once published, makes every entry stale;
+  // buffers already handed out keep their hits
+  trie_insert_at(engine->index, "deep", 2, 3, 0, 0);
+  trie_publish(engine->index, INT_MAX);
+  const occurrence_transfer_t *fresh = search_cached(engine, "deep", &found);
+  assert(found == 7 && fresh != deep && deep[5].doc_id == 2);
+  release_results(deep);
+  release_results(fresh);
+  engine_cache_stats(engine, &stats);
+  assert(stats.hits == 2 && stats.misses == 4);
+
+  // 3. Past the budget the least recently used entries go
+  assert(engine_set_cache_budget(engine, stats.bytes) == 0);
+  release_results(search_cached(engine, "neural", &found));
+  engine_cache_stats(engine, &stats);
+  assert(stats.evictions > 0 && stats.bytes <= stats.budget);
+  release_results(search_cached(engine, "neural", &found));
+  engine_cache_stats(engine, &stats);
+  assert(stats.hits == 3);
+
+  // 4. Hits outlive the engine; with the cache off nothing is kept
+  const occurrence_transfer_t *held = search_cached(engine, "network", &found);
+  assert(engine_set_cache_budget(engine, 0) == 0);
+  engine_cache_stats(engine, &stats);
+  assert(stats.entries == 0 && stats.budget == 0);
+  const occurrence_transfer_t *uncached =
+      search_cached(engine, "network", &again);
+  assert(again == found && uncached != held);
+  release_results(uncached);
+  engine_free(engine);
+  assert(found == 3 && held[2].doc_id == 2);
+  release_results(held);
+  printf("PASSED!\n");
+}
+
+void test_search_batch() {
+  printf("Running: test_search_batch... ");
+  search_engine_t *engine = engine_create();
+  for (int d = 0; d < 3; d++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/test/doc%d.pdf", d);
+    engine_add_document(engine, path);
+  }
+  // Page d of document d: "deep neural network", then "deep" d more times
+  const char *words[] = {"deep", "neural", "network"};
+  for (int d = 0; d < 3; d++) {
+    for (int i = 0; i < 3 + d; i++)
+      trie_insert_at(engine->index, words[i < 3 ? i : 0], d, d, i * 5, i);
+  }
+
+  // Plain words, folded case, a phrase, misses, and enough repeats to
+  // spread over several chunks
+  enum { QUERIES = 1000 };
+  const char *queries[QUERIES];
+  const char *kinds[] = {"deep", "NEURAL", "neural network", "absent",
+                         "",     NULL,     "network neural"};
+  int expected[] = {6, 3, 3, 0, 0, 0, 0};
+  for (int q = 0; q < QUERIES; q++)
+    queries[q] = kinds[q % 7];
+
+  for (int workers = 1; workers <= 4; workers += 3) {
+    query_batch_t *batch = search_batch(engine, queries, QUERIES, 0, workers);
+    assert(batch != NULL && batch->count == QUERIES);
+    int64_t total = 0;
+    for (int q = 0; q < QUERIES; q++) {
+      assert(batch->counts[q] == expected[q % 7]);
+      assert(batch->offsets[q] == total);
+      total += batch->counts[q];
+    }
+    assert(batch->total == total && batch->offsets[QUERIES] == total);
+
+    // Same hits, in the same order, as the one-query calls
+    int found;
+    occurrence_transfer_t *one = get_search_results(engine, "deep", &found);
+    assert(memcmp(one, batch->results + batch->offsets[7],
+                  sizeof(occurrence_transfer_t) * found) == 0);
+    free(one);
+    one = search_phrase(engine, "neural network", &found);
+    const occurrence_transfer_t *hit = batch->results + batch->offsets[2];
+    assert(found == 3 && hit[2].doc_id == 2 && hit[2].byte_offset == 5 &&
+           memcmp(one, hit, sizeof(occurrence_transfer_t) * found) == 0);
+    free(one);
+    free_query_batch(batch);
+  }
+
+  // Capped per query; tombstones are skipped before the cap
+  assert(engine_reserve_meta(engine) == 0);
+  engine->doc_meta[0].flags |= DOC_DELETED;
+  engine->deleted_count = 1;
+  query_batch_t *batch = search_batch(engine, queries, 3, 2, 0);
+  assert(batch->counts[0] == 2 && batch->counts[1] == 2 &&
+         batch->counts[2] == 2 && batch->total == 6);
+  assert(batch->results[0].doc_id == 1 && batch->results[2].doc_id == 1);
+  free_query_batch(batch);
+
+  batch = search_batch(engine, NULL, 0, 0, 0);
+  assert(batch != NULL && batch->count == 0 && batch->total == 0);
+  free_query_batch(batch);
+  engine_free(engine);
+  printf("PASSED!\n");
+}
+
+// Writer side of test_concurrent_search(): one document at a time
+typedef struct {
+  search_engine_t *engine;
+  int docs;
+  int done;
+} concurrent_job_t;
+
+static void *concurrent_writer(void *arg) {
+  concurrent_job_t *job = arg;
+  trie_t *trie = job->engine->index;
+  trie_hide_from(trie, 0);
+  for (int d = 0; d < job->docs; d++) {
+    char word[16];
+    snprintf(word, sizeof(word), "t%d", d); // grows and splits nodes
+    trie_insert_at(trie, word, d, 0, 0, 0);
+    trie_insert_at(trie, "common", d, 0, 8, 1);
+    trie_insert_at(trie, "common", d, 1, 0, 0);
+    trie_insert_at(trie, "late", d, 2, 0, 0);
+    trie_insert_at(trie, "late", d, 1, 0, 0); // out of order: list copied
+    trie_publish(trie, d + 1);
+  }
+  trie_publish(trie, INT_MAX);
+  __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// Every query sees whole documents 0..k-1 and nothing else
+static void *concurrent_reader(void *arg) {
+  concurrent_job_t *job = arg;
+  trie_t *trie = job->engine->index;
+  while (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+    int found;
+    occurrence_transfer_t *hits =
+        get_search_results(job->engine, "common", &found);
+    assert(found % 2 == 0);
+    for (int i = 0; i < found; i++)
+      assert(hits[i].doc_id == i / 2 && hits[i].page_num == i % 2);
+    free(hits);
+
+    hits = search_phrase(job->engine, "late", &found);
+    for (int i = 0; i < found; i++)
+      assert(hits[i].doc_id == i / 2 && hits[i].page_num == 1 + i % 2);
+    free(hits);
+
+    // One pin: the newest document's own word is there too
+    trie_read_begin(trie);
+    posting_iter_t it;
+    trie_postings_iter(trie, trie_search(trie, "common"), &it);
+    int last = -1;
+    while (posting_iter_next(&it))
+      last = it.current.doc_id;
+    if (last >= 0) {
+      char word[16];
+      snprintf(word, sizeof(word), "t%d", last);
+      assert(trie_lookup(trie, word) != ARENA_NULL);
+    }
+    trie_read_end(trie);
+  }
+  return NULL;
+}
+
+void test_concurrent_search() {
+  printf("Running: test_concurrent_search... ");
+  search_engine_t *engine = engine_create();
+  concurrent_job_t job = {engine, 2000, 0};
+  pthread_t writer, readers[3];
+  for (int i = 0; i < 3; i++)
+    pthread_create(&readers[i], NULL, concurrent_reader, &job);
+  pthread_create(&writer, NULL, concurrent_writer, &job);
+  pthread_join(writer, NULL);
+  for (int i = 0; i < 3; i++)
+    pthread_join(readers[i], NULL);
+
+  // Everything is visible once the writer is done
+  int found;
+  occurrence_transfer_t *hits = get_search_results(engine, "late", &found);
+  assert(found == 2 * job.docs && hits[found - 1].doc_id == job.docs - 1);
+  free(hits);
+  assert(count_prefix_terms(engine, "t") == job.docs);
+  engine_free(engine);
   printf("PASSED!\n");
 }
 
@@ -159,6 +2226,34 @@ int main() {
   test_corrupted_files();
   test_empty_engine();
   test_query_engine_array_packing();
+  test_arena_handles();
+  test_adaptive_nodes();
+  test_compressed_postings();
+  test_mapped_index();
+  test_legacy_tree_file();
+  test_parallel_indexing();
+  test_parallel_crawl();
+  test_incremental_update();
+  test_snippet_batch();
+  test_lz_codec();
+  test_text_store();
+  test_tokenizer();
+  test_key_sets();
+  test_posting_seek();
+  test_boolean_query();
+  test_phrase_query();
+  test_prefix_query();
+  test_levenshtein();
+  test_fuzzy_query();
+  test_ranked_query();
+  test_block_max_wand();
+  test_segmented_index();
+  test_memory_budget();
+  test_export_paths();
+  test_search_batch();
+  test_doc_table();
+  test_result_cache();
+  test_concurrent_search();
   printf("\n");
   printf("╔════════════════════════════════════════════╗\n");
   printf("║         ALL TESTS PASSED! ✅               ║\n");